@@ -9,6 +9,7 @@ enum
     EMUMODE_NOTIMERS = 0x02,
     EMUMODE_NOPLAYBUFFERS = 0x04,
     EMUMODE_VIRTUALDIRECTSOUND = 0x08,
+    EMUMODE_HIGHQUALITYRESAMPLE = 0x10,
 };
 
 enum
@@ -19,6 +20,7 @@ enum
     FFMODE_RAMSKIP = 0x08,
     FFMODE_SLEEPSKIP = 0x10,
     FFMODE_WAITSKIP = 0x20,
+    FFMODE_LAZYMIX = 0x40,
 };
 
 enum class DebugPrintModeMask
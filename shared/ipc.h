@@ -26,6 +26,7 @@ enum class CAPTUREINFO
     TYPE_NONE_SUBSEQUENT, // nothing sent and it's the same frame/time as last time
     TYPE_PREV, // reuse previous frame's image (new sleep frame)
     TYPE_DDSD, // locked directdraw surface description
+    TYPE_SHARED, // frame in the shared frame ring (see sharedframes.h), the info is its sequence number
 };
 
 struct LastFrameSoundInfo
@@ -0,0 +1,228 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <cstring>
+#include <string>
+
+#include "sharedframes.h"
+
+namespace
+{
+    const unsigned int MAGIC = 0x46475748; /* "HWGF" */
+    const unsigned int VERSION = 1;
+    const unsigned int ALIGNMENT = 64;
+
+    unsigned int Align(unsigned int size)
+    {
+        return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+#if defined(_MSC_VER)
+    /*
+     * With MSVC, volatile reads acquire and volatile writes release (/volatile:ms, the default
+     * on x86), and the two processes are on the same machine.
+     */
+    unsigned int LoadAcquire(const volatile unsigned int* value)
+    {
+        return *value;
+    }
+
+    void StoreRelease(volatile unsigned int* value, unsigned int new_value)
+    {
+        *value = new_value;
+    }
+#else
+    unsigned int LoadAcquire(const volatile unsigned int* value)
+    {
+        return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+    }
+
+    void StoreRelease(volatile unsigned int* value, unsigned int new_value)
+    {
+        __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+/*
+ * At the start of the memory, followed by slot_count slots of slot_stride bytes, each one a
+ * SharedFrameInfo followed by slot_size bytes of pixels.
+ */
+struct SharedFrameRing::Header
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slot_count;
+    unsigned int slot_size;
+    unsigned int slot_stride;
+    /*
+     * Only changed by the reader.
+     */
+    volatile unsigned int enabled;
+    volatile unsigned int read;
+    /*
+     * Only changed by the writer.
+     */
+    volatile unsigned int written;
+};
+
+SharedFrameRing::SharedFrameRing() :
+    m_header(nullptr),
+    m_slots(nullptr),
+    m_slot_count(0),
+    m_slot_size(0),
+    m_slot_stride(0),
+    m_reading(0)
+{
+}
+
+std::string SharedFrameRing::GetName(unsigned int process_id)
+{
+    std::string digits;
+    do
+    {
+        digits.insert(digits.begin(), static_cast<char>('0' + process_id % 10));
+        process_id /= 10;
+    } while (process_id != 0);
+    return "Hourglass-SharedFrames-" + digits;
+}
+
+unsigned int SharedFrameRing::GetMemorySize(unsigned int slot_count, unsigned int slot_size)
+{
+    return Align(sizeof(Header)) + slot_count * Align(sizeof(SharedFrameInfo) + slot_size);
+}
+
+bool SharedFrameRing::Create(void* memory, unsigned int memory_size, unsigned int slot_count, unsigned int slot_size)
+{
+    if (slot_count == 0 || memory_size < GetMemorySize(slot_count, slot_size))
+    {
+        return false;
+    }
+    m_header = static_cast<Header*>(memory);
+    m_slots = static_cast<unsigned char*>(memory) + Align(sizeof(Header));
+    m_header->version = VERSION;
+    m_header->slot_count = slot_count;
+    m_header->slot_size = slot_size;
+    m_header->slot_stride = Align(sizeof(SharedFrameInfo) + slot_size);
+    m_header->enabled = 0;
+    m_header->read = 0;
+    m_header->written = 0;
+    m_slot_count = slot_count;
+    m_slot_size = slot_size;
+    m_slot_stride = m_header->slot_stride;
+    m_reading = 0;
+    /*
+     * Last, so that a writer that looks early doesn't take a half set up ring.
+     */
+    StoreRelease(&m_header->magic, MAGIC);
+    return true;
+}
+
+bool SharedFrameRing::Attach(void* memory, unsigned int memory_size)
+{
+    Detach();
+    if (memory_size < Align(sizeof(Header)))
+    {
+        return false;
+    }
+    Header* header = static_cast<Header*>(memory);
+    if (LoadAcquire(&header->magic) != MAGIC || header->version != VERSION)
+    {
+        return false;
+    }
+    unsigned int slot_count = header->slot_count;
+    unsigned int slot_size = header->slot_size;
+    unsigned int slot_stride = header->slot_stride;
+    if (slot_count == 0 || slot_size > slot_stride || slot_stride - slot_size < sizeof(SharedFrameInfo)
+        || slot_stride > (memory_size - Align(sizeof(Header))) / slot_count)
+    {
+        return false;
+    }
+    m_header = header;
+    m_slots = static_cast<unsigned char*>(memory) + Align(sizeof(Header));
+    m_slot_count = slot_count;
+    m_slot_size = slot_size;
+    m_slot_stride = slot_stride;
+    return true;
+}
+
+void SharedFrameRing::Detach()
+{
+    m_header = nullptr;
+    m_slots = nullptr;
+}
+
+bool SharedFrameRing::IsAttached() const
+{
+    return m_header != nullptr;
+}
+
+unsigned int SharedFrameRing::GetSlotSize() const
+{
+    return m_slot_size;
+}
+
+SharedFrameInfo* SharedFrameRing::BeginWrite(unsigned int size, unsigned char** pixels)
+{
+    if (m_header == nullptr || LoadAcquire(&m_header->enabled) == 0 || size > m_slot_size)
+    {
+        return nullptr;
+    }
+    unsigned int written = m_header->written;
+    if (written - LoadAcquire(&m_header->read) >= m_slot_count)
+    {
+        return nullptr;
+    }
+    unsigned char* slot = GetSlot(written);
+    *pixels = slot + sizeof(SharedFrameInfo);
+    return reinterpret_cast<SharedFrameInfo*>(slot);
+}
+
+unsigned int SharedFrameRing::EndWrite()
+{
+    unsigned int sequence = m_header->written;
+    StoreRelease(&m_header->written, sequence + 1);
+    return sequence;
+}
+
+void SharedFrameRing::SetEnabled(bool enabled)
+{
+    StoreRelease(&m_header->enabled, enabled ? 1 : 0);
+}
+
+const SharedFrameInfo* SharedFrameRing::BeginRead(unsigned int sequence, const unsigned char** pixels)
+{
+    unsigned int written = LoadAcquire(&m_header->written);
+    unsigned int read = m_header->read;
+    /*
+     * The sequence number comes from the other process, so it's only trusted if it's one of
+     * the frames in the ring.
+     */
+    if (sequence - read >= written - read)
+    {
+        return nullptr;
+    }
+    if (sequence != read)
+    {
+        StoreRelease(&m_header->read, sequence);
+    }
+    m_reading = sequence;
+    const unsigned char* slot = GetSlot(sequence);
+    *pixels = slot + sizeof(SharedFrameInfo);
+    return reinterpret_cast<const SharedFrameInfo*>(slot);
+}
+
+void SharedFrameRing::EndRead()
+{
+    StoreRelease(&m_header->read, m_reading + 1);
+}
+
+void SharedFrameRing::DropFrames()
+{
+    StoreRelease(&m_header->read, LoadAcquire(&m_header->written));
+}
+
+unsigned char* SharedFrameRing::GetSlot(unsigned int sequence) const
+{
+    return m_slots + (sequence % m_slot_count) * m_slot_stride;
+}
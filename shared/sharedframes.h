@@ -0,0 +1,103 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+/*
+ * A ring of video frames in memory that the game and Hourglass share. At a frame boundary the
+ * game copies the frame into the ring and sends its sequence number in the FRAME message, so
+ * that Hourglass can take the frame from there instead of reading it out of the game's memory
+ * with ReadProcessMemory.
+ *
+ * Only the layout and the protocol are here, the C++ standard library is all it needs. The
+ * memory itself is a file mapping named by GetName, which Hourglass creates and the game opens.
+ *
+ * There is one writer, the game, and one reader, Hourglass. Each side only ever changes its own
+ * counter, and publishes it with release semantics after it's done with the slot, so the other
+ * side sees the slot's contents when it sees the counter. The writer never waits: when the ring
+ * is full or disabled, or the frame doesn't fit in a slot, BeginWrite fails and the game hands
+ * the frame over the old way instead. Frames that were written but never announced, or
+ * announced while Hourglass wasn't capturing, are skipped by the next BeginRead.
+ */
+
+#include <string>
+
+struct SharedFrameInfo
+{
+    int width;
+    int height;
+    /*
+     * Bytes from one row to the next. The rows are in the order the game gave them, so the
+     * first one is row 0 of the frame.
+     */
+    int pitch;
+    int bpp;
+    unsigned int rmask;
+    unsigned int gmask;
+    unsigned int bmask;
+    /*
+     * For 8-bit frames, the palette as 256 PALETTEENTRY.
+     */
+    unsigned char palette[256 * 4];
+};
+
+class SharedFrameRing
+{
+public:
+    SharedFrameRing();
+
+    static std::string GetName(unsigned int process_id);
+    static unsigned int GetMemorySize(unsigned int slot_count, unsigned int slot_size);
+
+    /*
+     * Reader side: sets up an empty, disabled ring in memory of memory_size bytes, which must
+     * be at least GetMemorySize. Returns false if it doesn't fit.
+     */
+    bool Create(void* memory, unsigned int memory_size, unsigned int slot_count, unsigned int slot_size);
+    /*
+     * Writer side: uses the ring the reader set up in memory. Returns false if there isn't a
+     * ring of this version there.
+     */
+    bool Attach(void* memory, unsigned int memory_size);
+    void Detach();
+    bool IsAttached() const;
+    /*
+     * The most bytes of pixels a frame can have.
+     */
+    unsigned int GetSlotSize() const;
+
+    /*
+     * Writer side. BeginWrite returns the slot's info to fill in and where size bytes of
+     * pixels go, or nullptr. EndWrite hands the slot to the reader and returns the frame's
+     * sequence number.
+     */
+    SharedFrameInfo* BeginWrite(unsigned int size, unsigned char** pixels);
+    unsigned int EndWrite();
+
+    /*
+     * Reader side. BeginRead drops every frame before sequence and returns that frame, or
+     * nullptr if it isn't in the ring. EndRead gives the slot back to the writer.
+     */
+    void SetEnabled(bool enabled);
+    const SharedFrameInfo* BeginRead(unsigned int sequence, const unsigned char** pixels);
+    void EndRead();
+    /*
+     * Drops every frame that has been written so far.
+     */
+    void DropFrames();
+
+private:
+    struct Header;
+
+    unsigned char* GetSlot(unsigned int sequence) const;
+
+    Header* m_header;
+    unsigned char* m_slots;
+    /*
+     * Copies of the header's layout, which the other process could change under us.
+     */
+    unsigned int m_slot_count;
+    unsigned int m_slot_size;
+    unsigned int m_slot_stride;
+    unsigned int m_reading;
+};
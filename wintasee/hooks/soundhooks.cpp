@@ -41,6 +41,12 @@ static DWORD contiguousMixOutBufSize = 0;
 static DWORD contiguousMixOutBufAllocated = 0;
 static DWORD contiguousMixOutBufOffset = 0;
 static LPWAVEFORMATEX contiguousMixOutBufFormat = nullptr;
+// every buffer is mixed into this first, one int per sample of contiguousMixOutBuf, see soundmixing.cpp
+static int* contiguousMixBus = nullptr;
+static DWORD contiguousMixBusSize = 0;
+static DWORD contiguousMixBusAllocated = 0;
+// what each playing buffer needs mixed this frame, all mixed together at the end of AdvanceTimeAndMixAll
+static std::vector<SoundMixJob> pendingMixJobs;
 
 LastFrameSoundInfo lastFrameSoundInfo;
 
@@ -50,9 +56,146 @@ static CRITICAL_SECTION s_soundBufferListCS;
 static BOOL noDirectSoundOutputAvailable = FALSE;
 static bool usingVirtualDirectSound = false;
 
-void MixFromToInternal(DWORD pos1, DWORD pos2, DWORD outPos1, DWORD outPos2, bool pos2IsLastSample,
-    DWORD outSamplesPerSec, WORD myBitsPerSample, WORD outBitsPerSample, WORD myChannels, WORD outChannels, WORD myBlockSize, WORD outBlockSize,
-    unsigned char* buffer, unsigned char* contiguousMixOutBuf, CachedVolumeAndPan& volumes);
+// lazy mixing: while fast-forwarding, the emulated buffers still advance their play and write cursors
+// and fire their notifications every frame, exactly as usual, so the game can't tell the difference,
+// but none of their sound gets mixed (or played) until fast-forward ends.
+// it's never lazy while audio is being captured, since the capture needs every sample.
+static bool IsMixingLazy()
+{
+    return tasflags.fastForward && (tasflags.fastForwardFlags & FFMODE_LAZYMIX) && !(tasflags.aviMode & 2);
+}
+
+void MixAllInternal(SoundMixJob* jobs, int numJobs, int* mixBus, DWORD busSamples);
+void MixBusToOutput(const int* mixBus, unsigned char* outbuf, DWORD outSize, WORD outBitsPerSample);
+
+
+// SOUND MEMORY POOLS:
+//   games that create and release short sound effects all the time would otherwise have the emulated buffers
+//   allocating and freeing their sample data, lock buffers, formats and notifications constantly,
+//   so freed blocks are kept in pools by size (4 sizes per power of 2) and handed out again.
+//   every block also has a reference count, which lets duplicated sound buffers share their sample data.
+//   nothing writes to a block while it's shared, whoever wants to write to it gets a copy of their own first.
+
+struct SoundBlockHeader
+{
+    int sizeClass; // -1 if it was too big for the pools
+    volatile LONG refcount;
+    DWORD size;
+    SoundBlockHeader* nextFree;
+};
+
+enum { soundPoolNumClasses = 80, soundPoolMaxCachedBytes = 32*1024*1024 };
+
+static CRITICAL_SECTION s_soundPoolCS;
+static SoundBlockHeader* soundPoolFree [soundPoolNumClasses];
+static DWORD soundPoolCachedBytes = 0;
+
+// class c holds blocks of (5,6,7,8) << (c/4+3) bytes, so from 40 bytes up to 32 MB
+static DWORD SoundPoolClassSize(int sizeClass)
+{
+    return (DWORD)(sizeClass % 4 + 5) << (sizeClass / 4 + 3);
+}
+static int SoundPoolClass(DWORD size)
+{
+    if(size <= 40)
+        return 0;
+    DWORD n = size - 1;
+    int shift = 3;
+    while((n >> shift) >= 8)
+        shift++;
+    int sizeClass = (shift - 3) * 4 + (int)(n >> shift) - 4;
+    return (sizeClass < soundPoolNumClasses) ? sizeClass : -1;
+}
+
+static void* SoundAlloc(DWORD size)
+{
+    int sizeClass = SoundPoolClass(size);
+    SoundBlockHeader* block = nullptr;
+    if(sizeClass >= 0)
+    {
+        EnterCriticalSection(&s_soundPoolCS);
+        block = soundPoolFree[sizeClass];
+        if(block)
+        {
+            soundPoolFree[sizeClass] = block->nextFree;
+            soundPoolCachedBytes -= SoundPoolClassSize(sizeClass);
+        }
+        LeaveCriticalSection(&s_soundPoolCS);
+    }
+    if(!block)
+    {
+        block = (SoundBlockHeader*)malloc(sizeof(SoundBlockHeader) + ((sizeClass >= 0) ? SoundPoolClassSize(sizeClass) : size));
+        if(!block)
+            return nullptr;
+    }
+    block->sizeClass = sizeClass;
+    block->refcount = 1;
+    block->size = size;
+    block->nextFree = nullptr;
+    return block + 1;
+}
+
+// releases a reference to the block, it goes back to its pool once there are none left.
+static void SoundFree(void* ptr)
+{
+    if(!ptr)
+        return;
+    SoundBlockHeader* block = (SoundBlockHeader*)ptr - 1;
+    if(InterlockedDecrement(&block->refcount) != 0)
+        return;
+    int sizeClass = block->sizeClass;
+    if(sizeClass >= 0)
+    {
+        EnterCriticalSection(&s_soundPoolCS);
+        bool keep = (soundPoolCachedBytes + SoundPoolClassSize(sizeClass) <= soundPoolMaxCachedBytes);
+        if(keep)
+        {
+            block->nextFree = soundPoolFree[sizeClass];
+            soundPoolFree[sizeClass] = block;
+            soundPoolCachedBytes += SoundPoolClassSize(sizeClass);
+        }
+        LeaveCriticalSection(&s_soundPoolCS);
+        if(keep)
+            return;
+    }
+    free(block);
+}
+
+// adds a reference to the block, which then must not be written to until SoundUnshare or SoundRealloc gives back a copy.
+static void* SoundShare(void* ptr)
+{
+    if(ptr)
+        InterlockedIncrement(&((SoundBlockHeader*)ptr - 1)->refcount);
+    return ptr;
+}
+
+// like realloc, but the block it returns is never shared, even if the one it was given was.
+static void* SoundRealloc(void* ptr, DWORD size)
+{
+    if(!ptr)
+        return SoundAlloc(size);
+    SoundBlockHeader* block = (SoundBlockHeader*)ptr - 1;
+    DWORD capacity = (block->sizeClass >= 0) ? SoundPoolClassSize(block->sizeClass) : block->size;
+    if(block->refcount == 1 && size <= capacity && SoundPoolClass(size) == block->sizeClass)
+    {
+        block->size = size;
+        return ptr;
+    }
+    void* copy = SoundAlloc(size);
+    if(!copy)
+        return nullptr; // like realloc, the old block is left alone
+    memcpy(copy, ptr, min(size, block->size));
+    SoundFree(ptr);
+    return copy;
+}
+
+// returns the block or a copy of it that nobody else is using, so it can be written to.
+static void* SoundUnshare(void* ptr)
+{
+    if(ptr && ((SoundBlockHeader*)ptr - 1)->refcount > 1)
+        return SoundRealloc(ptr, ((SoundBlockHeader*)ptr - 1)->size);
+    return ptr;
+}
 
 
 #include <map>
@@ -115,10 +258,10 @@ public:
             soundBuffers.erase(found);
         LeaveCriticalSection(&s_soundBufferListCS);
         debuglog(LCF_DSOUND, "%d sound buffers\n", soundBuffers.size());
-        free(buffer);
-        free(lockBuf);
-        free(waveformat);
-        free(notifies);
+        SoundFree(buffer);
+        SoundFree(lockBuf);
+        SoundFree(waveformat);
+        SoundFree(notifies);
         DeleteCriticalSection(&m_bufferCS);
         DeleteCriticalSection(&m_lockBufferCS);
     }
@@ -128,8 +271,8 @@ public:
         EmulatedDirectSoundBuffer* copy = new EmulatedDirectSoundBuffer();
         copy->bufferSize = original->bufferSize;
         copy->allocated = original->allocated;
-        copy->buffer = (unsigned char*)malloc(copy->allocated);
-        memcpy(copy->buffer, original->buffer, original->allocated);
+        // the sample data isn't copied, both buffers use the same data until one of them writes to it
+        copy->buffer = (unsigned char*)SoundShare(original->buffer);
         copy->frequency = original->frequency;
         copy->pan = original->pan;
         copy->volume = original->volume;
@@ -141,7 +284,7 @@ public:
         int wfxsize = sizeof(WAVEFORMATEX);
         if(original->waveformat->wFormatTag != WAVE_FORMAT_PCM)
             wfxsize += original->waveformat->cbSize;
-        copy->waveformat = (WAVEFORMATEX*)malloc(wfxsize);
+        copy->waveformat = (WAVEFORMATEX*)SoundAlloc(wfxsize);
         memcpy(copy->waveformat, original->waveformat, wfxsize);
 
         return copy;
@@ -314,7 +457,7 @@ public:
         EnterCriticalSection(&m_bufferCS);
         bufferSize = min(max(bufferSize, DSBSIZE_MIN), DSBSIZE_MAX);
         allocated = bufferSize;
-        buffer = (unsigned char*)realloc(buffer, allocated);
+        buffer = (unsigned char*)SoundRealloc(buffer, allocated);
         memset(buffer, (waveformat->wBitsPerSample <= 8) ? 0x80 : 0, allocated);
         LeaveCriticalSection(&m_bufferCS);
 
@@ -332,7 +475,7 @@ public:
         int wfxsize = sizeof(WAVEFORMATEX);
         if(pFormat->wFormatTag != WAVE_FORMAT_PCM)
             wfxsize += pFormat->cbSize;
-        waveformat = (WAVEFORMATEX*)realloc(waveformat, wfxsize);
+        waveformat = (WAVEFORMATEX*)SoundRealloc(waveformat, wfxsize);
         memcpy(waveformat, pFormat, wfxsize);
         if(pFormat->wFormatTag == WAVE_FORMAT_PCM)
             waveformat->cbSize = 0;
@@ -348,7 +491,7 @@ public:
         EnterCriticalSection(&m_lockBufferCS);
 
         if(!lockBuf)
-            lockBuf = (unsigned char*)realloc(lockBuf, bufferSize);
+            lockBuf = (unsigned char*)SoundRealloc(lockBuf, bufferSize);
         memcpy(lockBuf, buffer, bufferSize);
 
         if(dwFlags & DSBLOCK_FROMWRITECURSOR)
@@ -471,6 +614,7 @@ public:
         if(!lockBuf)
             return DSERR_INVALIDCALL;
         EnterCriticalSection(&m_bufferCS);
+        buffer = (unsigned char*)SoundUnshare(buffer);
         if(pvAudioPtr1 && pvAudioPtr1 == lockPtr1)
         {
             if(dwAudioBytes1 > lockBytes1)
@@ -488,7 +632,7 @@ public:
         if(numRemainingUnlocksBeforeLeavingLockBufResident)
         {
             numRemainingUnlocksBeforeLeavingLockBufResident--;
-            free(lockBuf);
+            SoundFree(lockBuf);
             lockBuf = nullptr;
         }
         ReplicateBufferIntoExtraAllocated();
@@ -535,9 +679,9 @@ public:
         if (dwPositionNotifies > DSBNOTIFICATIONS_MAX || pcPositionNotifies == nullptr)
             return DSERR_INVALIDPARAM;
 
-        free(notifies);
+        SoundFree(notifies);
         numNotifies = 0;
-        notifies = (DSBPOSITIONNOTIFY*)malloc(dwPositionNotifies * sizeof(DSBPOSITIONNOTIFY));
+        notifies = (DSBPOSITIONNOTIFY*)SoundAlloc(dwPositionNotifies * sizeof(DSBPOSITIONNOTIFY));
         if(!notifies)
             return DSERR_OUTOFMEMORY;
         
@@ -622,6 +766,8 @@ public:
         if((tasflags.emuMode & EMUMODE_NOPLAYBUFFERS) || noDirectSoundOutputAvailable)
             if(!(tasflags.aviMode & 2))
                 doMix = false; // if muted and not capturing audio, there's no need to mix it
+        if(IsMixingLazy())
+            doMix = false;
 
         if(doMix)
         {
@@ -651,19 +797,37 @@ public:
                 contiguousMixOutBufAllocated = contiguousMixOutBufSize+16;
                 contiguousMixOutBuf = (unsigned char*)realloc(contiguousMixOutBuf, contiguousMixOutBufAllocated);
             }
-            if(contiguousMixOutBufSize)
-                memset(contiguousMixOutBuf, (format.wBitsPerSample <= 8) ? 0x80 : 0, contiguousMixOutBufSize);
+            contiguousMixBusSize = contiguousMixOutBufSize / ((format.wBitsPerSample <= 8) ? 1 : 2) + 16;
+            if(contiguousMixBusAllocated < contiguousMixBusSize)
+            {
+                contiguousMixBusAllocated = contiguousMixBusSize;
+                contiguousMixBus = (int*)realloc(contiguousMixBus, contiguousMixBusAllocated * sizeof(int));
+            }
+            memset(contiguousMixBus, 0, contiguousMixBusSize * sizeof(int));
 
             lastFrameSoundInfo.buffer = contiguousMixOutBuf;
             lastFrameSoundInfo.size = contiguousMixOutBufSize;
             lastFrameSoundInfo.format = contiguousMixOutBufFormat;
         }
 
+        // the cursors and notifications are all updated first, one buffer after another in the same order as always,
+        // and then everything they need mixed is mixed at once (on more than one thread if there's a lot of it).
+        // that has to happen before leaving s_soundBufferListCS, so none of the buffers can be released while they're being mixed.
+        // each job also holds a reference to the sample data it mixes (see MixFromTo), which is given back here.
         EnterCriticalSection(&s_soundBufferListCS);
+        pendingMixJobs.clear();
         for(MyBufferList::iterator iter = soundBuffers.begin(); iter != soundBuffers.end(); iter++)
             (*iter)->AdvanceTimeAndMix(ticks, doMix);
+        if(doMix && !pendingMixJobs.empty())
+            MixAllInternal(&pendingMixJobs[0], (int)pendingMixJobs.size(), contiguousMixBus, contiguousMixBusSize);
+        for(size_t i = 0; i < pendingMixJobs.size(); i++)
+            SoundFree(pendingMixJobs[i].buffer);
+        pendingMixJobs.clear();
         LeaveCriticalSection(&s_soundBufferListCS);
 
+        if(doMix && contiguousMixOutBufSize)
+            MixBusToOutput(contiguousMixBus, contiguousMixOutBuf, contiguousMixOutBufSize, contiguousMixOutBufFormat->wBitsPerSample);
+
         if(doMix && s_myMixingOutputBuffer)
         {
             void* ptr1 = nullptr; DWORD size1 = 0;
@@ -819,8 +983,8 @@ public:
                         {
                             EnterCriticalSection(&m_bufferCS);
                             allocated = unwrappedPlayCursor + waveformat->nBlockAlign;
-                            buffer = (unsigned char*)realloc(buffer, allocated);
-                            if(!buffer) { buffer = (unsigned char*)realloc(buffer, allocated); }
+                            buffer = (unsigned char*)SoundRealloc(buffer, allocated);
+                            if(!buffer) { buffer = (unsigned char*)SoundRealloc(buffer, allocated); }
                             if(!buffer) { debuglog(LCF_ERROR, "FAILED TO ALLOCATE LOOP BUFFER\n"); }
                             ReplicateBufferIntoExtraAllocated();
                             LeaveCriticalSection(&m_bufferCS);
@@ -871,21 +1035,35 @@ public:
             memcpy(buffer + copied, buffer, min(bufferSize, allocated - copied));
     }
 
+    // doesn't mix anything yet, only adds it to the mixing AdvanceTimeAndMixAll does once every buffer has advanced.
+    // the job shares the sample data until then, so a SetFormat or Unlock from the game meanwhile
+    // gets a block of its own instead of freeing or changing the one being mixed.
     void MixFromTo(DWORD pos1, DWORD pos2, DWORD outPos1, DWORD outPos2, bool pos2IsLastSample)
     {
+        SoundMixJob job;
+        job.pos1 = pos1;
+        job.pos2 = pos2;
+        job.outPos1 = outPos1;
+        job.outPos2 = outPos2;
+        job.pos2IsLastSample = pos2IsLastSample;
+
         //DWORD mySamplesPerSec = waveformat->nSamplesPerSec;
-        DWORD outSamplesPerSec = contiguousMixOutBufFormat->nSamplesPerSec;
-        WORD myBitsPerSample = waveformat->wBitsPerSample;
-        WORD outBitsPerSample = contiguousMixOutBufFormat->wBitsPerSample;
-        WORD myChannels = (waveformat->nChannels >= 2) ? 2 : 1;
-        WORD outChannels = (contiguousMixOutBufFormat->nChannels >= 2) ? 2 : 1;
+        job.outSamplesPerSec = contiguousMixOutBufFormat->nSamplesPerSec;
+        job.myBitsPerSample = waveformat->wBitsPerSample;
+        job.outBitsPerSample = contiguousMixOutBufFormat->wBitsPerSample;
+        job.myChannels = (waveformat->nChannels >= 2) ? 2 : 1;
+        job.outChannels = (contiguousMixOutBufFormat->nChannels >= 2) ? 2 : 1;
 
-        WORD myBlockSize = waveformat->nBlockAlign;
-        WORD outBlockSize = contiguousMixOutBufFormat->nBlockAlign;
+        job.myBlockSize = waveformat->nBlockAlign;
+        job.outBlockSize = contiguousMixOutBufFormat->nBlockAlign;
 
-        MixFromToInternal(pos1, pos2, outPos1, outPos2, pos2IsLastSample,
-            outSamplesPerSec, myBitsPerSample, outBitsPerSample, myChannels, outChannels, myBlockSize, outBlockSize,
-            buffer, contiguousMixOutBuf, volumes);
+        EnterCriticalSection(&m_bufferCS);
+        job.buffer = (unsigned char*)SoundShare(buffer);
+        job.bufferBytes = allocated;
+        LeaveCriticalSection(&m_bufferCS);
+        job.highQuality = (tasflags.emuMode & EMUMODE_HIGHQUALITYRESAMPLE) != 0;
+        job.volumes = volumes; // as it is now, in case the game changes it from another thread before the mixing
+        pendingMixJobs.push_back(job);
     }
 
     void CalcVolumeScales()
@@ -2905,8 +3083,10 @@ void DoFrameBoundarySoundChecks()
         pauseHandlerSuspendedSound = false;
     }
 
+    // nothing new gets written to the mixing output buffer while lazily mixing either,
+    // so it's stopped instead of being left to loop the last bit of sound
     static bool noPlayBuffersOn = false;
-    bool noPlayBuffersOnNow = (tasflags.emuMode & EMUMODE_NOPLAYBUFFERS) != 0;
+    bool noPlayBuffersOnNow = (tasflags.emuMode & EMUMODE_NOPLAYBUFFERS) != 0 || IsMixingLazy();
     if(noPlayBuffersOn != noPlayBuffersOnNow)
     {
         noPlayBuffersOn = noPlayBuffersOnNow;
@@ -2931,6 +3111,7 @@ void SoundDllMainInit()
 {
     InitializeCriticalSection(&s_soundBufferListCS);
     InitializeCriticalSection(&s_myMixingOutputBufferCS);
+    InitializeCriticalSection(&s_soundPoolCS);
 }
 
 bool TrySoundCoCreateInstance(REFIID riid, LPVOID *ppv)
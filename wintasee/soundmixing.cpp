@@ -1,13 +1,45 @@
 /*  Copyright (C) 2011 nitsuja and contributors
     Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
 
+#ifdef SOUNDMIXING_STANDALONE
+// built on its own by wintaser/tools/Makefile, which has a stand-in for global.h in tools/soundmixstub
+#include <global.h>
+#else
 #include "global.h"
+#endif
+
+#include <math.h>
+#include <vector>
+#include <intrin.h>
+#include <emmintrin.h>
+
+// the AVX2 intrinsics need VS2012 or later (built on its own, the compiler has to be told to use AVX2)
+#if _MSC_VER >= 1700 || (defined(SOUNDMIXING_STANDALONE) && defined(__AVX2__))
+#define MIX_HAS_AVX2 1
+#include <immintrin.h>
+#else
+#define MIX_HAS_AVX2 0
+#endif
 
 // this is used mainly for clamping from -32678 to 32767
 //#define clamptofullsignedrange(x,lo,hi) ((x)>=(lo)?((x)<=(hi)?(x):(hi)):(lo))
 // but, this version is faster for the no-need-to-clamp case:
 #define clamptofullsignedrange(x,lo,hi) (((unsigned int)((x)-(lo))<=(unsigned int)((hi)-(lo)))?(x):(((x)<0)?(lo):(hi)))
-// TODO: maybe _mm_adds_pi16 or _mm_adds_pi8 would be even faster? especially if vectorized.
+
+
+// this file is only the mixing itself: everything in here works on the buffers it's given and nothing else,
+// without any threads, hooks or Windows calls (besides the types, the CPU feature check and one interlocked exchange),
+// so that it can be built on its own to check and time the mixing outside of a game (see wintaser/tools/soundmixtest.cpp).
+// the worker threads that do the mixing for the sound buffers are in soundmixthreads.cpp.
+
+// THE MIXING BUS:
+//   the sound buffers aren't mixed straight into the output buffer.
+//   instead each of them is added into a bus of ints, one per sample of the output buffer,
+//   in the range of the output bitrate but without any clamping,
+//   and only the total is clamped and converted to the output format, by MixBusToOutput.
+//   that way the output only gets clipped once, no matter how many buffers are playing or in which order,
+//   and the output buffer doesn't have to be read back and clamped again for every buffer.
+//   the bus is all integer math, so it comes out exactly the same on every machine.
 
 
 // this is the mixing uber-function that does all the hard work.
@@ -21,6 +53,7 @@
 //   this handles all possible combinations of bitrate conversions between the following types:
 //   (8-bit signed, 8-bit unsigned, 16-bit signed, and 16-bit unsigned)
 //   as determined by the types you specify for fromtype and totype.
+//   (totype is the type of the output buffer the bus will end up in, which decides the range of the values added to the bus)
 //   in practice, only the following 4 combinations are useful:
 //   (8-bit unsigned to 8-bit unsigned, 16-bit signed to 16-bit signed,
 //    8-bit unsigned to 16-bit signed, and 16-bit signed to 8-bit unsigned)
@@ -34,16 +67,14 @@
 //   the cached volume levels given are applied to the source audio when mixing.
 //   this automatically includes panning, which applies for every case except (mono to mono) conversion.
 // CLIPPING:
-//   values exceeding the bounds of the destination bitrate will be clamped to within the valid range.
+//   none here, the values are added to the bus as they are. MixBusToOutput does the clamping.
 // INTERPOLATION:
 //   this performs linear interpolation of samples.
 //   some games would sound very noticeably wrong otherwise.
 template<typename fromtype, typename totype, int fromchannels, int tochannels>
-static void Mix(const unsigned char*__restrict buf, unsigned char*__restrict outbuf, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, CachedVolumeAndPan& volumes)
+static void Mix(const unsigned char*__restrict buf, int*__restrict bus, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, CachedVolumeAndPan& volumes)
 {
     enum { fromshift = (2+sizeof(fromtype)-sizeof(totype))<<3 }; // 16 when both buffers have the same bit/sample... this is for combining differing bitrates
-    enum { maxto = (1<<(8*sizeof(totype)-1))-1 }; // clamping magnitude (127 or 32767)
-    enum { tosignoffset = (totype(-1)<0)?0:-(1<<(8*sizeof(totype)-1)) }; // add this to make numbers in the "to" buffer signed
     enum { fromsignoffset = (fromtype(-1)<0)?0:-(1<<(8*sizeof(fromtype)-1)) }; // add this to make numbers in the "from" buffer signed
     enum { toincrement = sizeof(totype) * tochannels };
     enum { fromincrement = sizeof(fromtype) * fromchannels };
@@ -57,7 +88,7 @@ static void Mix(const unsigned char*__restrict buf, unsigned char*__restrict out
 
     DWORD offsetRemainder = 0;
     DWORD inOffset = 0;
-    for(DWORD i = 0; i < outSize; outbuf += toincrement, i += toincrement)
+    for(DWORD i = 0; i < outSize; bus += tochannels, i += toincrement)
     {
         DWORD offset = inOffset;
         offset -= offset % fromincrement; // prevent starting from the wrong speaker (compiler should be smart enough not to do a modulo op here)
@@ -70,23 +101,20 @@ static void Mix(const unsigned char*__restrict buf, unsigned char*__restrict out
         int myR = (int)((fromtype*)inbuf)[fromchannels-1] + fromsignoffset;
         int myL2 = (int)((fromtype*)inbuf2)[0] + fromsignoffset;
         int myR2 = (int)((fromtype*)inbuf2)[fromchannels-1] + fromsignoffset;
-        int otherL = (int)((totype*)outbuf)[0] + tosignoffset;
-        int otherR = (int)((totype*)outbuf)[tochannels-1] + tosignoffset;
         int lvas = volumes.leftVolumeAsScale;
         int rvas = volumes.rightVolumeAsScale;
-        int mixedL = (otherL + ((int)(((myL * (int)lvas) >> fromshift) * (1024-frac) + ((myL2 * (int)lvas) >> fromshift) * frac) >> 10));
-        int mixedR = (otherR + ((int)(((myR * (int)rvas) >> fromshift) * (1024-frac) + ((myR2 * (int)rvas) >> fromshift) * frac) >> 10));
+        int mixedL = ((int)(((myL * (int)lvas) >> fromshift) * (1024-frac) + ((myL2 * (int)lvas) >> fromshift) * frac) >> 10);
+        int mixedR = ((int)(((myR * (int)rvas) >> fromshift) * (1024-frac) + ((myR2 * (int)rvas) >> fromshift) * frac) >> 10);
         if(tochannels != 1)
         {
             // stereo output
-            ((totype*)outbuf)[0] = (clamptofullsignedrange(mixedL,-maxto-1,maxto))-tosignoffset;
-            ((totype*)outbuf)[1] = (clamptofullsignedrange(mixedR,-maxto-1,maxto))-tosignoffset;
+            bus[0] += mixedL;
+            bus[1] += mixedR;
         }
         else
         {
             // monaural output
-            int mixed = (mixedL + mixedR) >> 1;
-            ((totype*)outbuf)[0] = clamptofullsignedrange(mixed,-maxto-1,maxto)-tosignoffset;
+            bus[0] += (mixedL + mixedR) >> 1;
         }
 
         // I'm going to lots of trouble to avoid using integer division or modulus
@@ -111,42 +139,575 @@ static void Mix(const unsigned char*__restrict buf, unsigned char*__restrict out
     }
 }
 
+// SIMD versions of Mix.
+// these give exactly the same output as the Mix above, bit for bit, since movies have to play back the same
+// no matter which CPU they're played on (and AVI dumps would otherwise differ between machines).
+// the input positions and interpolation fractions are stepped through the same way Mix does it,
+// a batch of output frames at a time, and then the volume scaling, interpolation and adding to the bus
+// of the whole batch is done in SIMD registers:
+//   (my * vas) >> fromshift never needs more than 16 bits, so it's worked out exactly from 16-bit multiplies,
+//   and _mm_madd_epi16 then does "a * (1024-frac) + b * frac" for both channels of 2 frames at once.
+// the volume scales can't go above 65536 for that to be exact, anything louder is left to Mix.
+
+enum MixLevel { MIX_SCALAR, MIX_SSE2, MIX_AVX2 };
+
+static MixLevel DetectMixLevel()
+{
+    int regs[4];
+    __cpuid(regs, 0);
+    int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    if(!(regs[3] & (1 << 26))) // EDX[26]
+        return MIX_SCALAR;
+#if MIX_HAS_AVX2
+    // AVX2 needs AVX (ECX[28]) and the OS saving the YMM registers (ECX[27] OSXSAVE, then XCR0[2:1])
+    if(maxLeaf >= 7 && (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(regs, 7, 0);
+        if(regs[1] & (1 << 5)) // EBX[5]
+            return MIX_AVX2;
+    }
+#else
+    (void)maxLeaf;
+#endif
+    return MIX_SSE2;
+}
+
+static MixLevel GetMixLevel()
+{
+    static int level = -1; // racing threads would all store the same value
+    if(level < 0)
+        level = DetectMixLevel();
+    return (MixLevel)level;
+}
+
+// output frames per batch, enough to fill 4 SSE registers or 2 AVX registers with interleaved samples
+enum { mixBatchFrames = 8 };
+
+// one batch of input for the SIMD kernels.
+// per output frame there are the left sample, the next left sample, the right sample and the next right sample,
+// already made signed, with their interpolation weights (1024-frac, frac, 1024-frac, frac) next to them in weights.
+struct MixBatch
+{
+    short samples [mixBatchFrames*4];
+    short weights [mixBatchFrames*4];
+};
+
+// (x * vas) >> fromshift for 16-bit x, where vas is given as its low 16 bits and a mask of the lanes where it's 32768 or more.
+// _mm_mulhi_epi16 takes vas as signed, which makes the high half come out x too small when vas >= 32768.
+template<int fromshift>
+static inline __m128i ScaleSSE2(__m128i x, __m128i vasLow, __m128i vasHigh)
+{
+    __m128i lo = _mm_mullo_epi16(x, vasLow);
+    __m128i hi = _mm_add_epi16(_mm_mulhi_epi16(x, vasLow), _mm_and_si128(x, vasHigh));
+    if(fromshift == 16)
+        return hi;
+    if(fromshift == 8)
+        return _mm_or_si128(_mm_slli_epi16(hi, 8), _mm_srli_epi16(lo, 8));
+    return _mm_srai_epi16(hi, fromshift - 16);
+}
+
+// the outputs of 2 frames (4 int32s) at a time to mono: (L + R) >> 1 for the 4 frames of a and b
+static inline __m128i DownmixSSE2(__m128i a, __m128i b)
+{
+    __m128i left = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2,0,2,0)));
+    __m128i right = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3,1,3,1)));
+    return _mm_srai_epi32(_mm_add_epi32(left, right), 1);
+}
+
+template<typename fromtype, typename totype, int tochannels>
+static void MixBatchSSE2(const MixBatch& batch, int* bus, __m128i vasLow, __m128i vasHigh)
+{
+    enum { fromshift = (2+sizeof(fromtype)-sizeof(totype))<<3 };
+
+    __m128i m [4]; // int32 [L,R,L,R] of 2 frames each
+    for(int r = 0; r < 4; r++)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(batch.samples + r*8));
+        __m128i w = _mm_loadu_si128((const __m128i*)(batch.weights + r*8));
+        m[r] = _mm_srai_epi32(_mm_madd_epi16(ScaleSSE2<fromshift>(x, vasLow, vasHigh), w), 10);
+    }
+
+    __m128i* out = (__m128i*)bus;
+    if(tochannels != 1)
+    {
+        for(int r = 0; r < 4; r++)
+            _mm_storeu_si128(out + r, _mm_add_epi32(_mm_loadu_si128(out + r), m[r]));
+    }
+    else
+    {
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), DownmixSSE2(m[0], m[1])));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), DownmixSSE2(m[2], m[3])));
+    }
+}
+
+#if MIX_HAS_AVX2
+template<int fromshift>
+static inline __m256i ScaleAVX2(__m256i x, __m256i vasLow, __m256i vasHigh)
+{
+    __m256i lo = _mm256_mullo_epi16(x, vasLow);
+    __m256i hi = _mm256_add_epi16(_mm256_mulhi_epi16(x, vasLow), _mm256_and_si256(x, vasHigh));
+    if(fromshift == 16)
+        return hi;
+    if(fromshift == 8)
+        return _mm256_or_si256(_mm256_slli_epi16(hi, 8), _mm256_srli_epi16(lo, 8));
+    return _mm256_srai_epi16(hi, fromshift - 16);
+}
+
+// the shuffles and packs only work within 128-bit lanes, this puts the 64-bit quarters back in order after them
+static inline __m256i FixLanesAVX2(__m256i x)
+{
+    return _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3,1,2,0));
+}
+
+static inline __m256i DownmixAVX2(__m256i a, __m256i b)
+{
+    __m256i left = FixLanesAVX2(_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2,0,2,0))));
+    __m256i right = FixLanesAVX2(_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(3,1,3,1))));
+    return _mm256_srai_epi32(_mm256_add_epi32(left, right), 1);
+}
+
+template<typename fromtype, typename totype, int tochannels>
+static void MixBatchAVX2(const MixBatch& batch, int* bus, __m256i vasLow, __m256i vasHigh)
+{
+    enum { fromshift = (2+sizeof(fromtype)-sizeof(totype))<<3 };
+
+    __m256i m [2]; // int32 [L,R,L,R,L,R,L,R] of 4 frames each
+    for(int r = 0; r < 2; r++)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(batch.samples + r*16));
+        __m256i w = _mm256_loadu_si256((const __m256i*)(batch.weights + r*16));
+        m[r] = _mm256_srai_epi32(_mm256_madd_epi16(ScaleAVX2<fromshift>(x, vasLow, vasHigh), w), 10);
+    }
+
+    __m256i* out = (__m256i*)bus;
+    if(tochannels != 1)
+    {
+        for(int r = 0; r < 2; r++)
+            _mm256_storeu_si256(out + r, _mm256_add_epi32(_mm256_loadu_si256(out + r), m[r]));
+    }
+    else
+    {
+        _mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), DownmixAVX2(m[0], m[1])));
+    }
+}
+#endif
+
+// same as Mix, but with the arithmetic done by MixBatchSSE2 or MixBatchAVX2
+template<typename fromtype, typename totype, int fromchannels, int tochannels, MixLevel level>
+static void MixBatched(const unsigned char*__restrict buf, int*__restrict bus, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, CachedVolumeAndPan& volumes)
+{
+    enum { fromsignoffset = (fromtype(-1)<0)?0:-(1<<(8*sizeof(fromtype)-1)) };
+    enum { toincrement = sizeof(totype) * tochannels };
+    enum { fromincrement = sizeof(fromtype) * fromchannels };
+
+    // per lane of the samples: L, L2, R, R2
+    DWORD lvas = volumes.leftVolumeAsScale;
+    DWORD rvas = volumes.rightVolumeAsScale;
+    short lLow = (short)(lvas & 0xFFFF), rLow = (short)(rvas & 0xFFFF);
+    short lHigh = (lvas >= 32768) ? -1 : 0, rHigh = (rvas >= 32768) ? -1 : 0;
+    __m128i vasLow = _mm_setr_epi16(lLow, lLow, rLow, rLow, lLow, lLow, rLow, rLow);
+    __m128i vasHigh = _mm_setr_epi16(lHigh, lHigh, rHigh, rHigh, lHigh, lHigh, rHigh, rHigh);
+#if MIX_HAS_AVX2
+    __m256i vasLow256 = _mm256_broadcastsi128_si256(vasLow);
+    __m256i vasHigh256 = _mm256_broadcastsi128_si256(vasHigh);
+#endif
+
+    MixBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    int last [mixBatchFrames*tochannels]; // the destination of a batch that would go past the end of the bus
+
+    DWORD frac = 0;
+    DWORD fracnumer = (size*(toincrement<<10));
+    DWORD fracincrement = fracnumer / outSize;
+    DWORD fracErrorIncrement = fracnumer % outSize;
+    DWORD fracError = 0;
+
+    // the while loop of Mix, done with one division up front
+    DWORD offsetIncrement = (size*toincrement) / outSize;
+    DWORD offsetRemainderIncrement = (size*toincrement) % outSize;
+    DWORD offsetRemainder = 0;
+    DWORD inOffset = 0;
+    for(DWORD i = 0; i < outSize; )
+    {
+        int frames = 0;
+        for(; frames < mixBatchFrames && i < outSize; frames++, i += toincrement)
+        {
+            DWORD offset = inOffset;
+            offset -= offset % fromincrement;
+            const unsigned char* inbuf = buf + offset;
+            offset += fromincrement;
+            if(sizeReachesBufferEnd && (offset > (size - fromincrement)))
+                offset = size - fromincrement;
+            const unsigned char* inbuf2 = buf + offset;
+            short* samples = batch.samples + frames*4;
+            short* weights = batch.weights + frames*4;
+            samples[0] = (short)((int)((fromtype*)inbuf)[0] + fromsignoffset);
+            samples[1] = (short)((int)((fromtype*)inbuf2)[0] + fromsignoffset);
+            samples[2] = (short)((int)((fromtype*)inbuf)[fromchannels-1] + fromsignoffset);
+            samples[3] = (short)((int)((fromtype*)inbuf2)[fromchannels-1] + fromsignoffset);
+            weights[0] = weights[2] = (short)(1024-frac);
+            weights[1] = weights[3] = (short)frac;
+
+            inOffset += offsetIncrement;
+            offsetRemainder += offsetRemainderIncrement;
+            if(offsetRemainder >= outSize)
+            {
+                offsetRemainder -= outSize;
+                inOffset++;
+            }
+
+            fracError += fracErrorIncrement;
+            if(fracError >= outSize)
+            {
+                fracError -= outSize;
+                frac++;
+            }
+            frac = (frac + fracincrement) & 0x3FF;
+        }
+
+        int* dest = bus;
+        if(frames < mixBatchFrames)
+        {
+            memset(last, 0, sizeof(last));
+            memcpy(last, bus, frames*tochannels*sizeof(int));
+            dest = last;
+        }
+#if MIX_HAS_AVX2
+        if(level == MIX_AVX2)
+            MixBatchAVX2<fromtype,totype,tochannels>(batch, dest, vasLow256, vasHigh256);
+        else
+#endif
+            MixBatchSSE2<fromtype,totype,tochannels>(batch, dest, vasLow, vasHigh);
+        if(frames < mixBatchFrames)
+            memcpy(bus, last, frames*tochannels*sizeof(int));
+        bus += frames*tochannels;
+    }
+#if MIX_HAS_AVX2
+    if(level == MIX_AVX2)
+        _mm256_zeroupper();
+#endif
+}
+
+// picks the fastest version of Mix that gives the same results
+template<typename fromtype, typename totype, int fromchannels, int tochannels>
+static void MixAny(const unsigned char* buf, int* bus, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, CachedVolumeAndPan& volumes)
+{
+    MixLevel level = GetMixLevel();
+    if(volumes.leftVolumeAsScale > 65536 || volumes.rightVolumeAsScale > 65536)
+        level = MIX_SCALAR;
+#if MIX_HAS_AVX2
+    if(level == MIX_AVX2)
+        MixBatched<fromtype,totype,fromchannels,tochannels,MIX_AVX2>(buf, bus, size, outSize, sizeReachesBufferEnd, volumes);
+    else
+#endif
+    if(level != MIX_SCALAR)
+        MixBatched<fromtype,totype,fromchannels,tochannels,MIX_SSE2>(buf, bus, size, outSize, sizeReachesBufferEnd, volumes);
+    else
+        Mix<fromtype,totype,fromchannels,tochannels>(buf, bus, size, outSize, sizeReachesBufferEnd, volumes);
+}
+
+// HIGH QUALITY RESAMPLING:
+//   linear interpolation lets a lot of aliasing through when a sound is played back at a much different rate,
+//   like an 11025 Hz sample into a 44100 Hz buffer, so MixSinc can be used instead when the user asks for it.
+//   it's a polyphase windowed-sinc filter: sincTaps input frames around the position
+//   are weighted with one of sincPhases precomputed rows of coefficients,
+//   so the cost per output sample is the same no matter what the rates are.
+//   the cutoff of the filter is the lower of the two Nyquist frequencies (a little below it, to leave room for the transition),
+//   in steps of 1/sincCutoffSteps, and there's a table of coefficients for each cutoff that gets used.
+//   the tables are worked out without the CRT's sin and cos and the filter is all integer math,
+//   so the output is the same on every machine, with or without SSE2.
+
+enum { sincTaps = 16, sincPhases = 256, sincCutoffSteps = 32, sincMaxCutoff = 30, sincScaleBits = 14 };
+
+struct SincTable
+{
+    // for the position frac/sincPhases between frames n and n+1, coefs[frac] weights frames n-7 through n+8
+    short coefs [sincPhases][sincTaps];
+};
+
+static SincTable* volatile sincTables [sincMaxCutoff+1];
+
+static const double sincPi = 3.14159265358979323846;
+
+// sin by its Taylor series, which comes out the same everywhere unlike the CRT's sin
+static double SincSine(double x)
+{
+    x -= 2*sincPi * floor(x / (2*sincPi) + 0.5);
+    double term = x, sum = x;
+    for(int n = 1; n < 12; n++)
+    {
+        term *= -x*x / ((2*n) * (2*n+1));
+        sum += term;
+    }
+    return sum;
+}
+
+static const SincTable& GetSincTable(int cutoffStep)
+{
+    if(sincTables[cutoffStep])
+        return *sincTables[cutoffStep];
+    SincTable* table = new SincTable;
+
+    double cutoff = (double)cutoffStep / sincCutoffSteps; // as a fraction of the input's Nyquist frequency
+    for(int phase = 0; phase < sincPhases; phase++)
+    {
+        double weights [sincTaps];
+        double total = 0;
+        for(int tap = 0; tap < sincTaps; tap++)
+        {
+            double x = tap - (sincTaps/2-1) - (double)phase / sincPhases; // distance from the position, in frames
+            double sinc = (x == 0) ? cutoff : SincSine(sincPi * cutoff * x) / (sincPi * x);
+            // blackman window over [-sincTaps/2, sincTaps/2]
+            double window = 0.42 + 0.5 * SincSine(sincPi * x / (sincTaps/2) + sincPi/2) + 0.08 * SincSine(2*sincPi * x / (sincTaps/2) + sincPi/2);
+            weights[tap] = sinc * window;
+            total += weights[tap];
+        }
+        // normalized so that each row adds up to exactly 1, or a constant signal would come out a little louder or quieter
+        int sum = 0;
+        for(int tap = 0; tap < sincTaps; tap++)
+        {
+            table->coefs[phase][tap] = (short)floor(weights[tap] / total * (1 << sincScaleBits) + 0.5);
+            sum += table->coefs[phase][tap];
+        }
+        int nearest = (sincTaps/2-1) + ((phase >= sincPhases/2) ? 1 : 0);
+        table->coefs[phase][nearest] += (short)((1 << sincScaleBits) - sum);
+    }
+    // mixing threads racing to make the same table would all make the same one, so whichever one gets there first is kept
+    if(InterlockedCompareExchangePointer((PVOID volatile*)&sincTables[cutoffStep], table, nullptr))
+        delete table;
+    return *sincTables[cutoffStep];
+}
+
+static inline int SincDot(const short* samples, const short* coefs, bool sse2)
+{
+    int sum;
+    if(sse2)
+    {
+        __m128i a = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)samples), _mm_loadu_si128((const __m128i*)coefs));
+        __m128i b = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(samples + 8)), _mm_loadu_si128((const __m128i*)(coefs + 8)));
+        __m128i s = _mm_add_epi32(a, b);
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+        sum = _mm_cvtsi128_si32(s);
+    }
+    else
+    {
+        sum = 0;
+        for(int tap = 0; tap < sincTaps; tap++)
+            sum += samples[tap] * coefs[tap];
+    }
+    return (sum + (1 << (sincScaleBits-1))) >> sincScaleBits;
+}
+
+// the frames MixSinc may read, relative to the start of the range being mixed.
+// the filter needs frames from before and after the range, which are clamped to these.
+struct MixSincRange
+{
+    int firstFrame; // 0 or less
+    int lastFrame;
+};
+
+// the same as Mix (and adds to the bus the same way), but resamples with the windowed-sinc filter
+template<typename fromtype, typename totype, int fromchannels, int tochannels>
+static void MixSinc(const unsigned char* buf, int* bus, DWORD size, DWORD outSize, const MixSincRange& range, CachedVolumeAndPan& volumes, std::vector<short>& inputs)
+{
+    enum { fromshift = (2+sizeof(fromtype)-sizeof(totype))<<3 };
+    enum { maxfrom = (1<<(8*sizeof(fromtype)-1))-1 };
+    enum { fromsignoffset = (fromtype(-1)<0)?0:-(1<<(8*sizeof(fromtype)-1)) };
+    enum { toincrement = sizeof(totype) * tochannels };
+    enum { fromincrement = sizeof(fromtype) * fromchannels };
+
+    if(range.lastFrame < range.firstFrame)
+        return;
+
+    // the position of each output frame is counted in 1/sincPhases of an input frame,
+    // with the same ratio between the sizes that Mix uses
+    DWORD outFrames = (outSize + toincrement - 1) / toincrement;
+    unsigned long long posStep = (unsigned long long)size * toincrement * sincPhases;
+    DWORD posDenominator = outSize * fromincrement;
+    DWORD posIncrement = (DWORD)(posStep / posDenominator);
+    DWORD posRemainderIncrement = (DWORD)(posStep % posDenominator);
+    DWORD lastPos = (DWORD)((outFrames - 1) * posStep / posDenominator);
+
+    int cutoffStep = sincMaxCutoff;
+    if(posIncrement > sincPhases) // fewer output frames than input frames
+        cutoffStep = max(1, (int)((unsigned long long)sincPhases * sincMaxCutoff / posIncrement));
+    const SincTable& table = GetSincTable(cutoffStep);
+
+    // the input converted to signed 16-bit and split into channels,
+    // from sincTaps/2-1 frames before the range to sincTaps/2 frames after the last position.
+    // inputs belongs to the thread doing the mixing, and keeps its size from one call to the next
+    int firstInput = -(sincTaps/2-1);
+    int numInputs = (int)(lastPos / sincPhases) + sincTaps;
+    inputs.resize(numInputs * fromchannels);
+    short* left = &inputs[0];
+    short* right = (fromchannels == 1) ? left : left + numInputs;
+    for(int i = 0; i < numInputs; i++)
+    {
+        int frame = min(max(firstInput + i, range.firstFrame), range.lastFrame);
+        const fromtype* in = (const fromtype*)(buf + frame * fromincrement);
+        left[i] = (short)((int)in[0] + fromsignoffset);
+        if(fromchannels != 1)
+            right[i] = (short)((int)in[1] + fromsignoffset);
+    }
+
+    bool sse2 = (GetMixLevel() != MIX_SCALAR);
+    int lvas = volumes.leftVolumeAsScale;
+    int rvas = volumes.rightVolumeAsScale;
+    DWORD pos = 0;
+    DWORD posRemainder = 0;
+    for(DWORD i = 0; i < outFrames; i++, bus += tochannels)
+    {
+        int index = pos / sincPhases;
+        const short* coefs = table.coefs[pos % sincPhases];
+        int myL = SincDot(left + index, coefs, sse2);
+        int myR = (fromchannels == 1) ? myL : SincDot(right + index, coefs, sse2);
+        // the filter can overshoot a little next to sudden changes
+        myL = min(max(myL, -maxfrom-1), maxfrom);
+        myR = min(max(myR, -maxfrom-1), maxfrom);
+        int mixedL = (myL * lvas) >> fromshift;
+        int mixedR = (myR * rvas) >> fromshift;
+        if(tochannels != 1)
+        {
+            bus[0] += mixedL;
+            bus[1] += mixedR;
+        }
+        else
+        {
+            bus[0] += (mixedL + mixedR) >> 1;
+        }
+
+        pos += posIncrement;
+        posRemainder += posRemainderIncrement;
+        if(posRemainder >= posDenominator)
+        {
+            posRemainder -= posDenominator;
+            pos++;
+        }
+    }
+}
+
+template<typename fromtype, typename totype, int fromchannels, int tochannels>
+static void MixWith(const unsigned char* buf, int* bus, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, const MixSincRange* sincRange, CachedVolumeAndPan& volumes, std::vector<short>& sincInputs)
+{
+    if(sincRange)
+        MixSinc<fromtype,totype,fromchannels,tochannels>(buf, bus, size, outSize, *sincRange, volumes, sincInputs);
+    else
+        MixAny<fromtype,totype,fromchannels,tochannels>(buf, bus, size, outSize, sizeReachesBufferEnd, volumes);
+}
+
 template<int fromchannels, int tochannels>
-static void Mix(const unsigned char* buf, unsigned char* outbuf, int myBitsPerSample, int outBitsPerSample, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, CachedVolumeAndPan& volumes)
+static void Mix(const unsigned char* buf, int* bus, int myBitsPerSample, int outBitsPerSample, DWORD size, DWORD outSize, bool sizeReachesBufferEnd, const MixSincRange* sincRange, CachedVolumeAndPan& volumes, std::vector<short>& sincInputs)
 {
     // note: WAV uses unsigned for 8-bit and signed for 16-bit (it makes a big difference!)
     if(myBitsPerSample <= 8 && outBitsPerSample <= 8)
-        Mix<unsigned char,unsigned char,fromchannels,tochannels>(buf, outbuf, size, outSize, sizeReachesBufferEnd, volumes);
+        MixWith<unsigned char,unsigned char,fromchannels,tochannels>(buf, bus, size, outSize, sizeReachesBufferEnd, sincRange, volumes, sincInputs);
     else if(myBitsPerSample > 8 && outBitsPerSample > 8)
-        Mix<signed short,signed short,fromchannels,tochannels>(buf, outbuf, size, outSize, sizeReachesBufferEnd, volumes);
+        MixWith<signed short,signed short,fromchannels,tochannels>(buf, bus, size, outSize, sizeReachesBufferEnd, sincRange, volumes, sincInputs);
     else if(outBitsPerSample > 8)
-        Mix<unsigned char,signed short,fromchannels,tochannels>(buf, outbuf, size, outSize, sizeReachesBufferEnd, volumes);
+        MixWith<unsigned char,signed short,fromchannels,tochannels>(buf, bus, size, outSize, sizeReachesBufferEnd, sincRange, volumes, sincInputs);
     else
-        Mix<signed short,unsigned char,fromchannels,tochannels>(buf, outbuf, size, outSize, sizeReachesBufferEnd, volumes);
+        MixWith<signed short,unsigned char,fromchannels,tochannels>(buf, bus, size, outSize, sizeReachesBufferEnd, sincRange, volumes, sincInputs);
 }
 
-void MixFromToInternal(DWORD pos1, DWORD pos2, DWORD outPos1, DWORD outPos2, bool pos2IsLastSample,
-    DWORD outSamplesPerSec, WORD myBitsPerSample, WORD outBitsPerSample, WORD myChannels, WORD outChannels, WORD myBlockSize, WORD outBlockSize,
-    unsigned char* buffer, unsigned char* contiguousMixOutBuf, CachedVolumeAndPan& volumes)
+// mixes one sound buffer into the bus.
+// sincInputs is scratch space for the sinc resampler, each thread that mixes needs its own.
+void MixFromToInternal(SoundMixJob& job, int* mixBus, std::vector<short>& sincInputs)
 {
+    DWORD pos1 = job.pos1, pos2 = job.pos2, outPos1 = job.outPos1, outPos2 = job.outPos2;
+    bool pos2IsLastSample = job.pos2IsLastSample;
+    WORD myBitsPerSample = job.myBitsPerSample, outBitsPerSample = job.outBitsPerSample;
+    WORD myChannels = job.myChannels, outChannels = job.outChannels;
+    CachedVolumeAndPan& volumes = job.volumes;
+
     if(pos2 <= pos1 || outPos2 <= outPos1)
         return; // not allowed
 
-    unsigned char* buf = buffer + pos1;
+    unsigned char* buf = job.buffer + pos1;
     const DWORD size = pos2 - pos1;
     
-    unsigned char* outbuf = contiguousMixOutBuf + outPos1;
+    // the out positions are in bytes of the output buffer, the bus has one int for each of its samples
+    int* bus = mixBus + outPos1 / ((outBitsPerSample > 8) ? 2 : 1);
     const DWORD outSize = outPos2 - outPos1;
 
 //		debugprintf("size=%d, outsize=%d\n", size, outSize);
     //debugprintf("blocksize=%d, outblock=%d\n", myBlockSize, outBlockSize);
 
+    // the sinc filter reads past the ends of the range, from anywhere in the buffer
+    // (except past the last sample when that's where the sound ends)
+    MixSincRange sincRange;
+    if(job.highQuality)
+    {
+        DWORD frameSize = ((myBitsPerSample > 8) ? 2 : 1) * myChannels;
+        sincRange.firstFrame = -(int)(pos1 / frameSize);
+        sincRange.lastFrame = (int)((pos2IsLastSample ? size : (job.bufferBytes - pos1)) / frameSize) - 1;
+    }
+    const MixSincRange* sinc = job.highQuality ? &sincRange : nullptr;
+
     if(myChannels == 1 && outChannels == 1)
-        Mix<1,1>(buf, outbuf, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, volumes);
+        Mix<1,1>(buf, bus, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, sinc, volumes, sincInputs);
     else if(myChannels == 1 && outChannels == 2)
-        Mix<1,2>(buf, outbuf, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, volumes);
+        Mix<1,2>(buf, bus, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, sinc, volumes, sincInputs);
     else if(myChannels == 2 && outChannels == 1)
-        Mix<2,1>(buf, outbuf, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, volumes);
+        Mix<2,1>(buf, bus, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, sinc, volumes, sincInputs);
     else if(myChannels == 2 && outChannels == 2)
-        Mix<2,2>(buf, outbuf, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, volumes);
+        Mix<2,2>(buf, bus, myBitsPerSample, outBitsPerSample, size, outSize, pos2IsLastSample, sinc, volumes, sincInputs);
+}
+
+// clamps the sum of everything that was mixed into the bus to the range of the output buffer,
+// and converts it to the output format (unsigned 8-bit or signed 16-bit).
+// outSize is in bytes of the output buffer.
+void MixBusToOutput(const int* mixBus, unsigned char* outbuf, DWORD outSize, WORD outBitsPerSample)
+{
+    bool sse2 = (GetMixLevel() != MIX_SCALAR);
+    DWORD i = 0;
+    if(outBitsPerSample > 8)
+    {
+        DWORD count = outSize / 2;
+        short* out = (short*)outbuf;
+        if(sse2)
+        {
+            for(; i + 8 <= count; i += 8)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(mixBus + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(mixBus + i + 4));
+                _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(a, b));
+            }
+        }
+        for(; i < count; i++)
+            out[i] = clamptofullsignedrange(mixBus[i],-32768,32767);
+    }
+    else
+    {
+        if(sse2)
+        {
+            const __m128i flip = _mm_set1_epi8((char)0x80);
+            for(; i + 16 <= outSize; i += 16)
+            {
+                const __m128i* in = (const __m128i*)(mixBus + i);
+                __m128i lo = _mm_packs_epi32(_mm_loadu_si128(in), _mm_loadu_si128(in + 1));
+                __m128i hi = _mm_packs_epi32(_mm_loadu_si128(in + 2), _mm_loadu_si128(in + 3));
+                _mm_storeu_si128((__m128i*)(outbuf + i), _mm_xor_si128(_mm_packs_epi16(lo, hi), flip));
+            }
+        }
+        for(; i < outSize; i++)
+            outbuf[i] = clamptofullsignedrange(mixBus[i],-128,127)+128;
+    }
+}
+
+// adds one bus into another, for combining buses that were mixed separately.
+void AddMixBus(int* mixBus, const int* bus, DWORD busSamples)
+{
+    DWORD i = 0;
+    if(GetMixLevel() != MIX_SCALAR)
+    {
+        for(; i + 4 <= busSamples; i += 4)
+        {
+            __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(mixBus + i)), _mm_loadu_si128((const __m128i*)(bus + i)));
+            _mm_storeu_si128((__m128i*)(mixBus + i), sum);
+        }
+    }
+    for(; i < busSamples; i++)
+        mixBus[i] += bus[i];
 }
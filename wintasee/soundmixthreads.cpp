@@ -0,0 +1,129 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#ifdef SOUNDMIXING_STANDALONE
+// built on its own by wintaser/tools/Makefile, like soundmixing.cpp
+#include <global.h>
+#else
+#include "global.h"
+#endif
+
+#include <vector>
+
+// PARALLEL MIXING:
+//   every sound buffer is mixed into the bus without looking at what the others put there,
+//   so when there are enough of them playing, they get split up between a few threads.
+//   each thread mixes its own fixed run of the jobs, in order, into a bus of its own,
+//   and those buses are added into the real one afterward, always in the same order.
+//   since the bus is integer math, the total comes out exactly the same as mixing one buffer after another,
+//   no matter how many threads there are or which of them finishes first.
+//   with only a few buffers playing, waking up the threads would take longer than the mixing does,
+//   so below mixParallelMinJobs everything is mixed on the calling thread like before.
+
+enum { mixMaxWorkers = 3, mixParallelMinJobs = 16 };
+
+struct MixWorker
+{
+    HANDLE thread;
+    HANDLE startEvent;
+    HANDLE doneEvent;
+    SoundMixJob* jobs;
+    int numJobs;
+    int* bus;
+    DWORD busSamples;
+    DWORD busAllocated;
+    std::vector<short> sincInputs;
+};
+
+static MixWorker mixWorkers [mixMaxWorkers];
+static int numMixWorkers = -1; // until the threads are needed for the first time
+
+void MixFromToInternal(SoundMixJob& job, int* mixBus, std::vector<short>& sincInputs);
+void AddMixBus(int* mixBus, const int* bus, DWORD busSamples);
+void SetThreadName(DWORD dwThreadID, char* threadName);
+
+static DWORD WINAPI MixWorkerThread(LPVOID lpParam)
+{
+    MixWorker& worker = *(MixWorker*)lpParam;
+    while(true)
+    {
+        WaitForSingleObject(worker.startEvent, INFINITE);
+        memset(worker.bus, 0, worker.busSamples * sizeof(int));
+        for(int i = 0; i < worker.numJobs; i++)
+            MixFromToInternal(worker.jobs[i], worker.bus, worker.sincInputs);
+        SetEvent(worker.doneEvent);
+    }
+}
+
+// starts the worker threads the first time it's called.
+// they're never stopped, they just wait for more jobs until the game exits.
+static int GetNumMixWorkers()
+{
+    if(numMixWorkers >= 0)
+        return numMixWorkers;
+    numMixWorkers = 0;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int wanted = min((int)info.dwNumberOfProcessors - 1, (int)mixMaxWorkers);
+    for(int i = 0; i < wanted; i++)
+    {
+        MixWorker& worker = mixWorkers[numMixWorkers];
+        worker.startEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        worker.doneEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        DWORD threadId = 0;
+        worker.thread = (worker.startEvent && worker.doneEvent) ? CreateThread(nullptr, 0, MixWorkerThread, &worker, 0, &threadId) : nullptr;
+        if(!worker.thread)
+        {
+            if(worker.startEvent)
+                CloseHandle(worker.startEvent);
+            if(worker.doneEvent)
+                CloseHandle(worker.doneEvent);
+            break;
+        }
+        // the mixing thread waits for them, so they shouldn't have to wait for anything less important
+        SetThreadPriority(worker.thread, GetThreadPriority(GetCurrentThread()));
+        SetThreadName(threadId, "SoundMix");
+        numMixWorkers++;
+    }
+    return numMixWorkers;
+}
+
+// mixes every job into mixBus, which has busSamples ints in it (already cleared or with something to mix over).
+// the jobs must stay valid until this returns. their sound buffers can't go away or change meanwhile
+// because each job holds a reference to its block of sample data (see MixFromTo in hooks/soundhooks.cpp),
+// and whoever writes to a shared block gets a copy of it first.
+void MixAllInternal(SoundMixJob* jobs, int numJobs, int* mixBus, DWORD busSamples)
+{
+    static std::vector<short> sincInputs;
+
+    int numWorkers = (numJobs >= mixParallelMinJobs) ? GetNumMixWorkers() : 0;
+    int numRuns = numWorkers + 1;
+
+    // run 0 is mixed by this thread straight into mixBus, run n by worker n-1
+    for(int n = 1; n < numRuns; n++)
+    {
+        MixWorker& worker = mixWorkers[n-1];
+        int first = numJobs * n / numRuns;
+        worker.jobs = jobs + first;
+        worker.numJobs = numJobs * (n+1) / numRuns - first;
+        if(worker.busAllocated < busSamples)
+        {
+            worker.busAllocated = busSamples;
+            worker.bus = (int*)realloc(worker.bus, worker.busAllocated * sizeof(int));
+        }
+        worker.busSamples = busSamples;
+        SetEvent(worker.startEvent);
+    }
+
+    int numOwnJobs = numJobs / numRuns;
+    for(int i = 0; i < numOwnJobs; i++)
+        MixFromToInternal(jobs[i], mixBus, sincInputs);
+
+    for(int n = 1; n < numRuns; n++)
+    {
+        MixWorker& worker = mixWorkers[n-1];
+        WaitForSingleObject(worker.doneEvent, INFINITE);
+        AddMixBus(mixBus, worker.bus, busSamples);
+    }
+}
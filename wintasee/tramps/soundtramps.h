@@ -53,3 +53,17 @@ struct CachedVolumeAndPan
     DWORD leftVolumeAsScale; // out of 65536
     DWORD rightVolumeAsScale; // out of 65536
 };
+
+// one sound buffer's worth of mixing for a frame, as worked out by the sound buffer,
+// so that MixAllInternal can do the mixing of every buffer together afterward
+struct SoundMixJob
+{
+    DWORD pos1, pos2, outPos1, outPos2;
+    bool pos2IsLastSample;
+    DWORD outSamplesPerSec;
+    WORD myBitsPerSample, outBitsPerSample, myChannels, outChannels, myBlockSize, outBlockSize;
+    unsigned char* buffer;
+    DWORD bufferBytes;
+    bool highQuality;
+    CachedVolumeAndPan volumes;
+};
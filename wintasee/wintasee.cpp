@@ -239,6 +239,7 @@ static InfoForDebugger infoForDebugger = {};
 static TrustedRangeInfos trustedRangeInfos = {};
 
 #include <shared/Score/DllLoadInfos_SHARED.h>
+#include <shared/sharedframes.h>
 
 PALETTEENTRY activePalette [256];
 
@@ -869,6 +870,57 @@ DWORD threadCounter = 0;
 static int lastSentFPS = 0;
 static int s_skipFreq = 8;
 
+// the frame ring that wintaser shares with us while capturing video, opened on the first captured frame
+static SharedFrameRing s_sharedFrames;
+static bool s_triedSharedFrames = false;
+
+// copies a DDSD capture into the shared frame ring, so that wintaser doesn't have to read it out of our memory.
+// returns false if the frame has to be sent the old way.
+static bool CopyFrameToSharedMemory(const DDSURFACEDESC& desc, unsigned int* sequence)
+{
+    if(!s_sharedFrames.IsAttached())
+    {
+        if(s_triedSharedFrames)
+            return false;
+        s_triedSharedFrames = true;
+        HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, SharedFrameRing::GetName(GetCurrentProcessId()).c_str());
+        if(!mapping)
+            return false;
+        void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        CloseHandle(mapping); // the view keeps it open
+        if(!memory)
+            return false;
+        MEMORY_BASIC_INFORMATION info;
+        if(!VirtualQuery(memory, &info, sizeof(info)) || !s_sharedFrames.Attach(memory, info.RegionSize))
+        {
+            UnmapViewOfFile(memory);
+            return false;
+        }
+        debuglog(LCF_FRAME, "capturing frames through shared memory.\n");
+    }
+
+    int bytesPerPixel = desc.ddpfPixelFormat.dwRGBBitCount >> 3;
+    int rowSize = desc.dwWidth * bytesPerPixel;
+    unsigned char* pixels;
+    SharedFrameInfo* info = s_sharedFrames.BeginWrite(rowSize * desc.dwHeight, &pixels);
+    if(!info)
+        return false;
+    // rows go in the order the surface has them, so a negative pitch ends up positive
+    for(DWORD row = 0; row < desc.dwHeight; row++)
+        memcpy(pixels + row * rowSize, (const char*)desc.lpSurface + (int)row * desc.lPitch, rowSize);
+    info->width = desc.dwWidth;
+    info->height = desc.dwHeight;
+    info->pitch = rowSize;
+    info->bpp = desc.ddpfPixelFormat.dwRGBBitCount;
+    info->rmask = desc.ddpfPixelFormat.dwRBitMask;
+    info->gmask = desc.ddpfPixelFormat.dwGBitMask;
+    info->bmask = desc.ddpfPixelFormat.dwBBitMask;
+    if(bytesPerPixel == 1)
+        memcpy(info->palette, activePalette, sizeof(info->palette));
+    *sequence = s_sharedFrames.EndWrite();
+    return true;
+}
+
 void FrameBoundary(void* captureInfo, CAPTUREINFO captureInfoType)
 {
     int localFrameCount = framecount;
@@ -1008,6 +1060,21 @@ void FrameBoundary(void* captureInfo, CAPTUREINFO captureInfoType)
     previnput = curinput;
 
     g_videoFramesPrepared++;
+
+    if(captureInfoType == CAPTUREINFO::TYPE_DDSD && captureInfo && (tasflags.aviMode & 1))
+    {
+        unsigned int sequence;
+        if(CopyFrameToSharedMemory(*(DDSURFACEDESC*)captureInfo, &sequence))
+        {
+            captureInfo = (void*)(size_t)sequence;
+            captureInfoType = CAPTUREINFO::TYPE_SHARED;
+        }
+    }
+    else if(!(tasflags.aviMode & 1))
+    {
+        // try opening the ring again next time video capture starts
+        s_triedSharedFrames = false;
+    }
     //debugprintf(__FUNCTION__ ": g_soundMixedTicks=%d, g_videoFramesPrepared=%d, ratio=%g\n", g_soundMixedTicks, g_videoFramesPrepared, (float)g_soundMixedTicks/g_videoFramesPrepared);
     bool ranCommand;
     do
@@ -3,9 +3,11 @@
 #include "AVIDumper.h"
 #include "logging.h"
 #include "CustomDLGs.h"
+#include "Movie.h"
 
 #include <malloc.h>
 #include <stdio.h>
+#include <string>
 
 //#include "Resource.h"
 #include <external/ddraw.h>
@@ -17,7 +19,17 @@
 #pragma comment(lib, "msacm32.lib")
 
 #include <shared/ipc.h>
+#include <shared/sharedframes.h>
+#include "CPUinfo.h"
 #include "Config.h"
+#include "encoderprocess.h"
+#include "framering.h"
+#include "imagesequence.h"
+#include "losslesscodec.h"
+#include "pcmconvert.h"
+#include "pixelconvert.h"
+#include "rawstreams.h"
+#include "workerpool.h"
 
 //extern TasFlags localTASflags;
 extern bool tasFlagsDirty;
@@ -33,8 +45,18 @@ bool g_gammaRampEnabled = false;
 
 static HANDLE captureProcess = nullptr;
 
+// the ring the game copies its frames into (see sharedframes.h), for the capture process
+static HANDLE sharedFramesMapping = nullptr;
+static void* sharedFramesMemory = nullptr;
+static DWORD sharedFramesProcessId = 0;
+static SharedFrameRing sharedFrames;
+// the game waits for each frame to be taken before it goes on, so two slots are plenty
+static const unsigned int sharedFrameSlots = 2;
+
 char avifilename [MAX_PATH+1];
 
+extern Movie movie;
+
 #define avidebugprintf verbosedebugprintf
 
 #ifdef _DEBUG
@@ -43,9 +65,6 @@ char avifilename [MAX_PATH+1];
 
 #if defined(_AVIDEBUG) || 0 //1
     #define verbosedebugprintf debugprintf
-
-    #include "Movie.h"
-    extern Movie movie;
 #else
     #define verbosedebugprintf(...) ((void)0)
 #endif
@@ -84,12 +103,25 @@ private:
     }
 };
 
+// PCM formats that PcmConverter handles, which covers everything the game can play
+static bool IsNativePCM(const WAVEFORMATEX* format)
+{
+    if(format->wFormatTag != WAVE_FORMAT_PCM)
+        return false;
+    PcmFormat pcm = {format->nChannels, (int)format->nSamplesPerSec, format->wBitsPerSample};
+    return PcmConverter::IsSupported(pcm);
+}
+static PcmFormat ToPcmFormat(const WAVEFORMATEX* format)
+{
+    PcmFormat pcm = {format->nChannels, (int)format->nSamplesPerSec, format->wBitsPerSample};
+    return pcm;
+}
 
 class AudioConverterStream
 {
 public:
     AudioConverterStream(WaveFormat sourceFormat, WaveFormat destFormat, WaveFormat** prevSourceFormats = nullptr, int numPrevSourceFormats = 0)
-        : outBuffer(nullptr), outSize(0), outBufferAllocated(0), stream(nullptr), isProxy(false), failed(false), subConverter(nullptr), startOffset(0)
+        : outBuffer(nullptr), outSize(0), outBufferAllocated(0), stream(nullptr), isProxy(false), failed(false), subConverter(nullptr), pcmConverter(nullptr), startOffset(0)
     {
         if(sourceFormat.GetSize() == destFormat.GetSize() && !memcmp((LPWAVEFORMATEX)sourceFormat, (LPWAVEFORMATEX)destFormat, sourceFormat.GetSize()))
         {
@@ -98,6 +130,37 @@ public:
             return;
         }
 
+        // PCM to PCM doesn't need ACM at all. doing it ourselves is faster,
+        // and the result doesn't depend on which codecs are installed.
+        if(IsNativePCM(sourceFormat) && IsNativePCM(destFormat))
+        {
+            pcmConverter = new PcmConverter(ToPcmFormat(sourceFormat), ToPcmFormat(destFormat), CPUHasSSE2());
+            return;
+        }
+
+        // for a compressed format, change the channels and rate ourselves and leave only the encoding to ACM
+        if(IsNativePCM(sourceFormat) && destFormat.m_format->wFormatTag != WAVE_FORMAT_PCM)
+        {
+            LPWAVEFORMATEX dest = destFormat;
+            WAVEFORMATEX intermediateFormat = {WAVE_FORMAT_PCM, dest->nChannels, dest->nSamplesPerSec, dest->nSamplesPerSec * dest->nChannels * 2, (WORD)(dest->nChannels * 2), 16, 0};
+            if((sourceFormat.m_format->nChannels != intermediateFormat.nChannels
+             || sourceFormat.m_format->nSamplesPerSec != intermediateFormat.nSamplesPerSec
+             || sourceFormat.m_format->wBitsPerSample != intermediateFormat.wBitsPerSample)
+            && IsNativePCM(&intermediateFormat)
+            && acmStreamOpen(nullptr, nullptr, &intermediateFormat, destFormat, nullptr, 0, 0, ACM_STREAMOPENF_QUERY | ACM_STREAMOPENF_NONREALTIME) == MMSYSERR_NOERROR)
+            {
+                subConverter = new AudioConverterStream(intermediateFormat, destFormat);
+                if(!subConverter->failed)
+                {
+                    pcmConverter = new PcmConverter(ToPcmFormat(sourceFormat), ToPcmFormat(&intermediateFormat), CPUHasSSE2());
+                    return;
+                }
+                // fall back to letting ACM do all of it
+                delete subConverter;
+                subConverter = nullptr;
+            }
+        }
+
         MMRESULT mm = acmStreamOpen(&stream, nullptr, sourceFormat, destFormat, nullptr, 0, 0, ACM_STREAMOPENF_NONREALTIME);
         if(mm != MMSYSERR_NOERROR)
         {
@@ -228,8 +291,12 @@ tryMoreSuggestions:
         if(isProxy)
             return;
         delete subConverter;
-        acmStreamUnprepareHeader(stream, &header, 0);
-        acmStreamClose(stream, 0);
+        delete pcmConverter;
+        if(stream)
+        {
+            acmStreamUnprepareHeader(stream, &header, 0);
+            acmStreamClose(stream, 0);
+        }
         free(outBuffer);
     }
     struct ConvertOutput
@@ -246,6 +313,16 @@ tryMoreSuggestions:
             return rv;
         }
 
+        if(pcmConverter)
+        {
+            unsigned int convertedSize = 0;
+            BYTE* converted = (BYTE*)pcmConverter->Convert(inBuffer, inSize, &convertedSize);
+            if(subConverter)
+                return subConverter->Convert(converted, convertedSize);
+            ConvertOutput rv = {converted, (int)convertedSize};
+            return rv;
+        }
+
         outSize = 0;
         int prevSrcLength = header.cbSrcLength;
         int usedInSize = 0;
@@ -304,6 +381,7 @@ private:
     HACMSTREAM stream;
     bool isProxy;
     AudioConverterStream* subConverter;
+    PcmConverter* pcmConverter; // used instead of stream for PCM, then subConverter encodes if the output is compressed
     void ReserveOutBuffer(int size)
     {
         if(outBufferAllocated < size)
@@ -321,54 +399,6 @@ AudioConverterStream* audioConverterStream = nullptr;
 //};
 
 
-class WaitableBool
-{
-public:
-    WaitableBool(bool initialState = false) : m_value(initialState)
-    {
-        m_event = CreateEvent(nullptr, TRUE, initialState, nullptr);
-        m_eventInverse = CreateEvent(nullptr, TRUE, !initialState, nullptr);
-    }
-    ~WaitableBool()
-    {
-        CloseHandle(m_event);
-        CloseHandle(m_eventInverse);
-    }
-    void WaitUntilTrue() const
-    {
-        if(!m_value)
-            WaitForSingleObject(m_event, INFINITE);
-    }
-    void WaitUntilFalse() const
-    {
-        if(m_value)
-            WaitForSingleObject(m_eventInverse, INFINITE);
-    }
-    void operator= (bool set)
-    {
-        m_value = set;
-        if(set)
-        {
-            SetEvent(m_event);
-            ResetEvent(m_eventInverse);
-        }
-        else
-        {
-            ResetEvent(m_event);
-            SetEvent(m_eventInverse);
-        }
-    }
-    operator bool () const
-    {
-        return m_value;
-    }
-private:
-    HANDLE m_event;
-    HANDLE m_eventInverse;
-    bool m_value;
-};
-
-
 HRESULT SafeAVIStreamWrite(PAVISTREAM pavi, LONG lStart, LONG lSamples, LPVOID lpBuffer, LONG cbBuffer, DWORD dwFlags, LONG FAR *plSampWritten, LONG FAR *plBytesWritten)
 {
     HRESULT hr;
@@ -380,27 +410,32 @@ HRESULT SafeAVIStreamWrite(PAVISTREAM pavi, LONG lStart, LONG lSamples, LPVOID l
     return hr;
 }
 
-//0x1FE -> -1
-// 0xFF -> 0
-// 0x7F -> 1
-// 0x3F -> 2
-static int leftShiftFromMask(unsigned int mask)
+// 64-bit hash of a converted frame, to spot frames that are the same as the one before them.
+// four lanes are hashed independently so that their multiplies can overlap.
+static unsigned long long HashFrame(const unsigned char* pixels, int size)
 {
-    int shift = 0;
-    if(mask)
+    const unsigned long long multiplier = 0x9E3779B97F4A7C15ull;
+    unsigned long long lanes [4] = {1, 2, 3, 4};
+    int pos = 0;
+    for(; pos + 32 <= size; pos += 32)
     {
-        if(mask < 0xFF)
+        for(int i = 0; i < 4; i++)
         {
-            while((mask << shift) < 128)
-                shift++;
-        }
-        else
-        {
-            while((mask >> -shift) > 255)
-                shift--;
+            unsigned long long word;
+            memcpy(&word, pixels + pos + i * 8, 8);
+            lanes[i] = (lanes[i] ^ word) * multiplier;
+            lanes[i] = (lanes[i] << 31) | (lanes[i] >> 33);
         }
     }
-    return shift;
+    unsigned long long hash = (unsigned long long)size;
+    for(; pos < size; pos++)
+        hash = (hash ^ pixels[pos]) * multiplier;
+    for(int i = 0; i < 4; i++)
+    {
+        hash = (hash ^ lanes[i]) * multiplier;
+        hash ^= hash >> 29;
+    }
+    return hash;
 }
 
 template<typename T>
@@ -415,7 +450,11 @@ static void ReserveBuffer(T*& buffer, int& bufferAllocated, int size)
 
 // warning: gamma ramp is (unlike everything else) stored in a way that doesn't properly reset when loading a savestate.
 // this is probably fine since it's currently only used for AVI capture.
+// temp? processing the pixels in the game without causing too much slowdown
+// was getting to be a pain, so for now gamma ramp effects only shows up in AVIs.
+// the ramp is turned into lookup tables here, which the pixel conversion applies as it goes.
 DDGAMMARAMP g_gammaRamp;
+static PixelConverter pixelConverter;
 void SetGammaRamp(void* gammaRampPointer, HANDLE process)
 {
     if(gammaRampPointer)
@@ -424,26 +463,138 @@ void SetGammaRamp(void* gammaRampPointer, HANDLE process)
         if(ReadProcessMemory(process, gammaRampPointer, &g_gammaRamp, sizeof(DDGAMMARAMP), &bytesRead))
         {
             g_gammaRampEnabled = true;
+            pixelConverter.SetGammaRamp(g_gammaRamp.red, g_gammaRamp.green, g_gammaRamp.blue);
         }
     }
     else
     {
         g_gammaRampEnabled = false;
+        pixelConverter.ClearGammaRamp();
+    }
+}
+
+static bool aviLibraryOpened = false;
+static PAVIFILE aviFile = nullptr;
+static PAVISTREAM aviStream = nullptr;
+static PAVISTREAM aviSoundStream = nullptr;
+static PAVISTREAM aviCompressedStream = nullptr;
+//static PAVISTREAM aviCompressedSoundStream = nullptr;
+static int curAviWidth=0, curAviHeight=0, curAviFps=0;
+// row pitch of the game's last frame, the video queue keeps those pixels too until they're converted
+static int curAviInputPitch=0;
+int aviFrameCount = 0, aviEmptyFrameCount = 0;
+static int aviRepeatFrameCount = 0;
+// hash and copy of the last frame that went to the encoder, see OutputVideoFrame
+static unsigned long long aviPrevFrameHash = 0;
+static bool aviHasPrevFrameHash = false;
+static unsigned char* aviPrevFramePixels = nullptr;
+static int aviPrevFramePixelsAllocated = 0;
+// whether repeated frames can be written as empty frames (or the output's own kind of repeat), see OutputRepeatedFrame.
+// only set when a file is opened, and a split reopens the same kind of output, so the capture thread can read it.
+static bool aviEmptyFramesAllowed = false;
+static bool oldIsBasicallyEmpty = false;
+static int aviSoundSampleCount = 0;
+int aviSoundFrameCount = 0;
+static double aviSoundSecondsCount = 0;
+static int aviFilesize = 0;
+static CRITICAL_SECTION s_aviCS;
+static CRITICAL_SECTION s_fqaCS;
+static CRITICAL_SECTION s_fqvCS;
+
+// when the config has an encoder command, captures are piped to that process instead of written to an AVI file.
+// the encoder threads write to these streams without holding s_aviCS, since a pipe write can block
+// until the encoder gets around to reading, which it may only do after reading from the other stream.
+static EncoderProcess* encoderProcess = nullptr;
+static Y4MStream* encoderVideo = nullptr;
+static WavStream* encoderAudio = nullptr;
+static volatile LONG encoderFailed = 0;
+
+// when the file name has an image extension, every video frame goes to an image file of its own instead,
+// and the audio goes through encoderAudio to a WAV file next to them.
+static ImageSequence* imageSequence = nullptr;
+static bool imageSequenceVideo = false;
+
+// converts video frames in horizontal strips, so that all the cores can work on them.
+// it's made for the first frame and kept from then on, like the frame queue.
+static WorkerPool* conversionPool = nullptr;
+static const int maxConversionStrips = 64;
+
+// with the built-in codec, the encoder thread compresses frames itself and writes them straight to aviStream.
+// the tiles of a frame are spread over conversionPool, each task takes every numTasks-th tile.
+static LosslessEncoder* losslessEncoder = nullptr;
+static const int losslessKeyframeSeconds = 10;
+static volatile LONG losslessTasksLeft = 0;
+static HANDLE losslessTilesDone = nullptr;
+struct LosslessTileTask : WorkerPool::Task
+{
+    int firstTile, numTasks;
+    virtual void Run()
+    {
+        for(int tile = firstTile; tile < losslessEncoder->GetTileCount(); tile += numTasks)
+            losslessEncoder->EncodeTile(tile);
+        if(InterlockedDecrement(&losslessTasksLeft) == 0)
+            SetEvent(losslessTilesDone);
+    }
+};
+static const unsigned char* EncodeLosslessFrame(const unsigned char* pixels, unsigned int* size, bool* keyframe)
+{
+    static LosslessTileTask tasks [maxConversionStrips];
+    losslessEncoder->BeginFrame(pixels);
+    int numTasks = min(losslessEncoder->GetTileCount(), min(maxConversionStrips, (int)conversionPool->GetThreadCount() * 2));
+    losslessTasksLeft = numTasks;
+    for(int i = 0; i < numTasks; i++)
+    {
+        tasks[i].firstTile = i;
+        tasks[i].numTasks = numTasks;
+        conversionPool->Submit(&tasks[i]);
+    }
+    WaitForSingleObject(losslessTilesDone, INFINITE);
+    return losslessEncoder->FinishFrame(size, keyframe);
+}
+
+// whether an AVI file or an encoder is open, and with which streams
+static bool IsCaptureOpen() { return aviFile || encoderProcess || imageSequence; }
+static bool IsVideoStreamOpen() { return aviCompressedStream || losslessEncoder || encoderVideo || imageSequenceVideo; }
+static bool IsAudioStreamOpen() { return aviSoundStream || (encoderAudio && encoderAudio->HasFormat()); }
+
+// the encoder exited or stopped reading, or an image file couldn't be written. this stops the capture
+// but leaves the cleanup to the next CloseAVI, which can't be called from the encoder threads.
+static void EncoderWriteFailed()
+{
+    if(InterlockedExchange(&encoderFailed, 1))
+        return;
+    Config::localTASflags.aviMode = 0;
+    tasFlagsDirty = true;
+    if(imageSequence)
+    {
+        debugprintf("Writing the image files failed!\n");
+        NormalMessageBox("Writing the image files failed!\nThe disk may be full.\n", "Error", MB_OK|MB_ICONERROR);
+        return;
     }
+    debugprintf("Writing to the encoder failed!\n");
+    NormalMessageBox("Writing to the encoder failed!\nIt may have exited, its output is in the .log file next to the capture file.\n", "Error", MB_OK|MB_ICONERROR);
 }
 
-template<int numSlots>
+// frames go from the capture (producer) side to the encoder threads (consumers) through two rings,
+// one for video and one for audio, so a slow codec write only holds up the game once a ring is full.
+// the depth and memory limit of the rings come from the config.
 struct AviFrameQueue
 {
-    AviFrameQueue() : m_nextWrite(0), m_nextRead(0), m_nextWriteAudio(0), m_nextReadAudio(0)
+    // videoSlotSize is what one video slot holds (see VideoSlotSize) if it's known already,
+    // so that the video ring gets no more slots than fit in the memory limit.
+    AviFrameQueue(int videoSlotSize = 0)
+        : m_videoRing(VideoDepth(videoSlotSize), MaxQueueBytes()), m_audioRing(QueueDepth(), MaxQueueBytes()), m_prevVideoSlot(-1)
     {
         m_disableFills = true;
-        for(int i = 0; i < numSlots; i++)
-            m_slots[i].slotNum = i;
-        threadDone = false;
-        thread = CreateThread(nullptr, 0, AviFrameQueue<numSlots>::OutputVideoThreadFunc, (void*)this, CREATE_SUSPENDED, nullptr);
+        m_videoSlots = new Slot [m_videoRing.GetDepth()];
+        m_audioSlots = new Slot [m_audioRing.GetDepth()];
+        for(unsigned int i = 0; i < m_videoRing.GetDepth(); i++)
+            m_videoSlots[i].slotNum = i;
+        for(unsigned int i = 0; i < m_audioRing.GetDepth(); i++)
+            m_audioSlots[i].slotNum = i;
+        thread = CreateThread(nullptr, 0, AviFrameQueue::OutputVideoThreadFunc, (void*)this, CREATE_SUSPENDED, nullptr);
         SetThreadPriority(thread, THREAD_PRIORITY_HIGHEST);
-        threadAudio = CreateThread(nullptr, 0, AviFrameQueue<numSlots>::OutputAudioThreadFunc, (void*)this, CREATE_SUSPENDED, nullptr);
+        threadAudio = CreateThread(nullptr, 0, AviFrameQueue::OutputAudioThreadFunc, (void*)this, CREATE_SUSPENDED, nullptr);
         SetThreadPriority(threadAudio, THREAD_PRIORITY_ABOVE_NORMAL);
         m_disableFills = false;
         ResumeThread(thread);
@@ -452,12 +603,9 @@ struct AviFrameQueue
     ~AviFrameQueue()
     {
         m_disableFills = true;
-        threadDone = true;
-        for(int i = 0; i < numSlots; i++)
-        {
-            m_slots[i].hasProcessedVideo = true; // wake up thread to stop it
-            m_slots[i].hasProcessedAudio = true;
-        }
+        // wake up the threads to stop them
+        m_videoRing.Close();
+        m_audioRing.Close();
         DWORD exitCode = STILL_ACTIVE;
         for(int i = 0; exitCode == STILL_ACTIVE && i < 500; i++)
             if(!GetExitCodeThread(thread, &exitCode))
@@ -490,43 +638,54 @@ struct AviFrameQueue
             TerminateThread(threadAudio, -1);
         }
         CloseHandle(threadAudio);
+        delete[] m_videoSlots;
+        delete[] m_audioSlots;
     }
 
     void Flush()
     {
-        for(int i = 0; i < numSlots; i++)
-        {
-            m_slots[i].hasProcessedVideo.WaitUntilFalse();
-            m_slots[i].hasProcessedAudio.WaitUntilFalse();
-        }
+        m_videoRing.WaitUntilEmpty();
+        m_audioRing.WaitUntilEmpty();
+    }
+
+    void GetStats(FrameRingStats* video, FrameRingStats* audio) const
+    {
+        m_videoRing.GetStats(video);
+        m_audioRing.GetStats(audio);
     }
 
-    // send a new frame to AVI
+    // send a new frame to AVI.
+    // if localPixels is set, the frame has already been copied out of the game (with a positive pitch),
+    // and so has its palette if it has one.
     void FillFrame(void* remotePixels, int width, int height, int pitch, int bpp,
-                   int rmask, int gmask, int bmask)
+                   int rmask, int gmask, int bmask,
+                   const unsigned char* localPixels = nullptr, const PALETTEENTRY* localPalette = nullptr)
     {
         AutoCritSect cs(&s_fqvCS);
         if(m_disableFills)
             return;
 
-        Slot& slot = m_slots[m_nextWrite];
-        avidebugprintf("FillFrame: slot %d, movie frame %d\n", m_nextWrite, movie.currentFrame);
-        m_nextWrite++;
-        m_nextWrite %= numSlots;
-
+        const int aviPixelsSize = width * height * (24 / 8) + 8;
         const int remotePixelsSize = (pitch > 0 ? pitch : -pitch) * height;
+        int slotNum = m_videoRing.BeginWrite(VideoSlotSize(width, height, pitch));
+        if(slotNum < 0)
+            return;
+        Slot& slot = m_videoSlots[slotNum];
+        avidebugprintf("FillFrame: slot %d, movie frame %d\n", slotNum, movie.currentFrame);
 
-        slot.hasProcessedVideo.WaitUntilFalse();
-
-        static unsigned char* inPixels = nullptr;
-        static int inPixelsAllocated = 0;
-        ReserveBuffer(inPixels, inPixelsAllocated, remotePixelsSize);
+        ReserveBuffer(slot.inPixels, slot.inPixelsAllocated, remotePixelsSize);
+        unsigned char* inPixels = slot.inPixels;
 #ifdef _DEBUG
         DWORD time1 = timeGetTime();
 #endif
 
         unsigned char* curInPixels;
-        if(pitch >= 0)
+        if(localPixels)
+        {
+            memcpy(inPixels, localPixels, remotePixelsSize);
+            curInPixels = inPixels;
+        }
+        else if(pitch >= 0)
         {
             // we got a pointer to the start of the first row of pixel data
             ReadProcessMemory(captureProcess, remotePixels, inPixels, remotePixelsSize, nullptr);
@@ -543,96 +702,34 @@ struct AviFrameQueue
         DWORD time2 = timeGetTime();
         debugprintf("AVI: reading pixel data took %d ticks\n", (int)(time2-time1));
 #endif
-#ifdef _AVIDEBUG
         slot.framecount = movie.currentFrame;
-#endif
 
-        const int aviPixelsSize = width * height * (24 / 8) + 8;
         ReserveBuffer(slot.aviPixels, slot.aviPixelsAllocated, aviPixelsSize);
 
-        unsigned char* aviPix = slot.aviPixels;
-
-        const int bytesPerInPixel = bpp >> 3;
-        const int bytesPerAVIPixel = 24 >> 3;
-
-        int rShiftLeft = leftShiftFromMask(rmask);
-        int gShiftLeft = leftShiftFromMask(gmask);
-        int bShiftLeft = leftShiftFromMask(bmask);
-        const int rShiftRight = max(0, -rShiftLeft);
-        const int gShiftRight = max(0, -gShiftLeft);
-        const int bShiftRight = max(0, -bShiftLeft);
-        rShiftLeft = max(0, rShiftLeft);
-        gShiftLeft = max(0, gShiftLeft);
-        bShiftLeft = max(0, bShiftLeft);
-
-        if(bytesPerInPixel == 4 && rmask == 0x00FF0000 && gmask == 0x0000FF00 && bmask == 0x000000FF)
-        {
-            // "fast" case
-            // TODO: use the MMX-optimized blit32to24loop from kkapture for this case
-            for(int yDst = height-1; yDst >= 0; yDst--)
-            {
-                unsigned char* inPix = curInPixels + (yDst * pitch);
-                for(int xRem = width+1; --xRem; inPix += 4, aviPix += bytesPerAVIPixel)
-                    *(unsigned int*)aviPix = *(unsigned int*)inPix;
-            }
-        }
-        else if(bytesPerInPixel == 1 && !rmask && !gmask && !bmask)
+        pixelConverter.SetFormat(bpp, rmask, gmask, bmask);
+        if((bpp >> 3) == 1 && !rmask && !gmask && !bmask)
         {
             // palettized case
             static PALETTEENTRY activePalette [256];
-            ReadProcessMemory(captureProcess, paletteEntriesPointer, &activePalette, sizeof(activePalette), nullptr);
-            for(int yDst = height-1; yDst >= 0; yDst--)
-            {
-                unsigned char* inPix = curInPixels + (yDst * pitch);
-                for(int xDst = 0; xDst < width; xDst++, inPix++, aviPix += bytesPerAVIPixel)
-                {
-                    PALETTEENTRY entry = activePalette[*(unsigned char*)inPix];
-                    aviPix[0] = entry.peBlue;
-                    aviPix[1] = entry.peGreen;
-                    aviPix[2] = entry.peRed;
-                }
-            }
-        }
-        else
-        {
-            // general case
-            for(int yDst = height-1; yDst >= 0; yDst--)
-            {
-                unsigned char* inPix = curInPixels + (yDst * pitch);
-                for(int xDst = 0; xDst < width; xDst++, inPix += bytesPerInPixel, aviPix += bytesPerAVIPixel)
-                {
-                    int pixel = *(int*)inPix;
-                    unsigned char r = (pixel & rmask) << rShiftLeft >> rShiftRight;
-                    unsigned char g = (pixel & gmask) << gShiftLeft >> gShiftRight;
-                    unsigned char b = (pixel & bmask) << bShiftLeft >> bShiftRight;
-                    aviPix[0] = b;
-                    aviPix[1] = g;
-                    aviPix[2] = r;
-                }
-            }
-        }
-
-
-        // apply gamma ramp
-        // temp? processing the pixels in the game without causing too much slowdown
-        // was getting to be a pain, so for now gamma ramp effects only shows up in AVIs.
-        if(g_gammaRampEnabled)
-        {
-            aviPix = slot.aviPixels;
-            for(int count = aviPixelsSize/bytesPerAVIPixel+1; --count; aviPix += bytesPerAVIPixel)
-            {
-                unsigned char b = aviPix[0];
-                unsigned char g = aviPix[1];
-                unsigned char r = aviPix[2];
-                aviPix[0] = g_gammaRamp.blue[b] >> 8;
-                aviPix[1] = g_gammaRamp.green[g] >> 8;
-                aviPix[2] = g_gammaRamp.red[r] >> 8;
-            }
+            if(localPalette)
+                memcpy(activePalette, localPalette, sizeof(activePalette));
+            else
+                ReadProcessMemory(captureProcess, paletteEntriesPointer, &activePalette, sizeof(activePalette), nullptr);
+            pixelConverter.SetPalette(activePalette);
         }
 
-
-        slot.hasProcessedVideo = true;
-
+        // the conversion happens on the worker threads, with the format, palette and gamma as they are now.
+        // the encoder thread waits for it when it gets to the slot, so frames still come out in order.
+        slot.converter = pixelConverter;
+        slot.firstInRow = curInPixels;
+        slot.width = width;
+        slot.height = height;
+        slot.pitch = pitch;
+        slot.repeatsPrevious = false;
+        StartConversion(slot);
+
+        m_prevVideoSlot = slotNum;
+        m_videoRing.EndWrite();
     }
 
     // output the last frame again to AVI
@@ -642,31 +739,45 @@ struct AviFrameQueue
         if(m_disableFills)
             return;
 
-        Slot& prevSlot = m_slots[(numSlots+m_nextWrite-1)%numSlots];
-        Slot& slot = m_slots[m_nextWrite];
-        avidebugprintf("RefillFrame: slot %d, movie frame %d\n", m_nextWrite, movie.currentFrame);
-        m_nextWrite++;
-        m_nextWrite %= numSlots;
+        if(Config::aviSkipDuplicateFrames && aviEmptyFramesAllowed && m_prevVideoSlot >= 0)
+        {
+            // nothing to copy or encode, the slot only tells the encoder thread to repeat the previous frame
+            int slotNum = m_videoRing.BeginWrite(0);
+            if(slotNum < 0)
+                return;
+            avidebugprintf("RefillFrame: slot %d, movie frame %d (repeat)\n", slotNum, movie.currentFrame);
+            m_videoSlots[slotNum].framecount = movie.currentFrame;
+            m_videoSlots[slotNum].repeatsPrevious = true;
+            m_videoRing.EndWrite();
+            return;
+        }
 
-        slot.hasProcessedVideo.WaitUntilFalse();
+        // the previous frame's slot keeps its pixels after the encoder is done with it.
+        // repeat slots don't become the previous frame, so after enough of them in a row
+        // the ring wraps around and we get that same slot here, already holding the pixels.
+        Slot* prevSlot = (m_prevVideoSlot >= 0) ? &m_videoSlots[m_prevVideoSlot] : nullptr;
+        int aviPixelsSize = (prevSlot && prevSlot->aviPixels) ? prevSlot->aviPixelsAllocated : curAviWidth * curAviHeight * (24 / 8) + 8;
+        int slotNum = m_videoRing.BeginWrite(aviPixelsSize);
+        if(slotNum < 0)
+            return;
+        Slot& slot = m_videoSlots[slotNum];
+        avidebugprintf("RefillFrame: slot %d, movie frame %d\n", slotNum, movie.currentFrame);
 
-#ifdef _AVIDEBUG
         slot.framecount = movie.currentFrame;
-#endif
 
-        const int aviPixelsSize = prevSlot.aviPixelsAllocated;
         ReserveBuffer(slot.aviPixels, slot.aviPixelsAllocated, aviPixelsSize);
-        if(!slot.aviPixels)
+        if(prevSlot && prevSlot->aviPixels)
         {
-            const int aviPixelsSize = curAviWidth * curAviHeight * (24 / 8) + 8;
-            ReserveBuffer(slot.aviPixels, slot.aviPixelsAllocated, aviPixelsSize);
+            prevSlot->WaitUntilConverted();
+            if(prevSlot != &slot) // the same slot if the ring wrapped around to it, see above
+                memcpy(slot.aviPixels, prevSlot->aviPixels, aviPixelsSize);
         }
-        if(prevSlot.aviPixels)
-            memcpy(slot.aviPixels, prevSlot.aviPixels, aviPixelsSize);
         else
             memset(slot.aviPixels, 0, aviPixelsSize);
 
-        slot.hasProcessedVideo = true;
+        slot.repeatsPrevious = false;
+        m_prevVideoSlot = slotNum;
+        m_videoRing.EndWrite();
     }
 
     void FillAudioFrame()
@@ -687,12 +798,11 @@ struct AviFrameQueue
             return;
 
 
-        Slot& slot = m_slots[m_nextWriteAudio];
-        avidebugprintf("FillAudioFrame: slot %d, movie frame %d\n", m_nextWriteAudio, movie.currentFrame);
-        m_nextWriteAudio++;
-        m_nextWriteAudio %= numSlots;
-
-        slot.hasProcessedAudio.WaitUntilFalse();
+        int slotNum = m_audioRing.BeginWrite(soundInfo.size);
+        if(slotNum < 0)
+            return;
+        Slot& slot = m_audioSlots[slotNum];
+        avidebugprintf("FillAudioFrame: slot %d, movie frame %d\n", slotNum, movie.currentFrame);
 
         slot.audioFrameSamples = soundInfo.size / format.nBlockAlign;
 
@@ -702,7 +812,7 @@ struct AviFrameQueue
 
         slot.inAudioSeconds = (double)soundInfo.size / format.nAvgBytesPerSec;
 
-        slot.hasProcessedAudio = true;
+        m_audioRing.EndWrite();
     }
 
     void FillEmptyAudioFrame()
@@ -722,12 +832,11 @@ struct AviFrameQueue
         if (!ReadProcessMemory(captureProcess, soundInfo.format, &format, sizeof(WAVEFORMATEX), nullptr))
             return;
 
-        Slot& slot = m_slots[m_nextWriteAudio];
-        avidebugprintf("FillEmptyAudioFrame: slot %d, movie frame %d\n", m_nextWriteAudio, movie.currentFrame);
-        m_nextWriteAudio++;
-        m_nextWriteAudio %= numSlots;
-
-        slot.hasProcessedAudio.WaitUntilFalse();
+        int slotNum = m_audioRing.BeginWrite(soundInfo.size);
+        if(slotNum < 0)
+            return;
+        Slot& slot = m_audioSlots[slotNum];
+        avidebugprintf("FillEmptyAudioFrame: slot %d, movie frame %d\n", slotNum, movie.currentFrame);
 
         slot.audioFrameSamples = soundInfo.size / format.nBlockAlign;
 
@@ -739,7 +848,7 @@ struct AviFrameQueue
         slot.inAudioSize = soundInfo.size;
         slot.inAudioSeconds = (double)soundInfo.size / format.nAvgBytesPerSec;
 
-        slot.hasProcessedAudio = true;
+        m_audioRing.EndWrite();
     }
 
     //void ReclaimMemory()
@@ -750,43 +859,107 @@ struct AviFrameQueue
     //	m_disableFills = false;
     //}
 
+    struct Slot;
+
+    // one horizontal strip of a video frame, for conversionPool
+    struct ConversionStrip : WorkerPool::Task
+    {
+        Slot* slot;
+        int firstRow, numRows;
+        virtual void Run()
+        {
+            slot->ConvertRows(firstRow, numRows);
+        }
+    };
+
+    // splits the slot's frame into strips and hands them to the worker threads
+    static void StartConversion(Slot& slot)
+    {
+        if(!conversionPool)
+            conversionPool = new WorkerPool(Config::aviConversionThreads);
+        // a few more strips than threads, so that a thread that gets held up doesn't hold up the whole frame
+        int numStrips = min(slot.height, min(maxConversionStrips, (int)conversionPool->GetThreadCount() * 2));
+        if(numStrips <= 0)
+            return;
+        ResetEvent(slot.convertedEvent);
+        slot.stripsLeft = numStrips;
+        for(int i = 0; i < numStrips; i++)
+        {
+            ConversionStrip& strip = slot.strips[i];
+            strip.slot = &slot;
+            strip.firstRow = slot.height * i / numStrips;
+            strip.numRows = slot.height * (i + 1) / numStrips - strip.firstRow;
+            conversionPool->Submit(&strip);
+        }
+    }
+
     struct Slot
     {
-        WaitableBool hasProcessedVideo;
-        WaitableBool hasProcessedAudio;
-//		unsigned char* inPixels;
-//		int inPixelsAllocated;
+        unsigned char* inPixels;
+        int inPixelsAllocated;
         unsigned char* aviPixels;
         int aviPixelsAllocated;
         unsigned char* audioBuffer;
         int audioBufferAllocated;
         int inAudioSize, audioFrameSamples;
         double inAudioSeconds; // hack
-        int framecount; int slotNum; // for debugging
-        Slot() : hasProcessedVideo(false), hasProcessedAudio(false),
+        bool repeatsPrevious; // a video slot without pixels of its own, see RefillFrame
+        // what the worker threads need to convert inPixels into aviPixels, see StartConversion.
+        // firstInRow is the game's top row, the others are pitch bytes apart from there.
+        PixelConverter converter;
+        const unsigned char* firstInRow;
+        int width, height, pitch;
+        ConversionStrip strips [maxConversionStrips];
+        volatile LONG stripsLeft;
+        HANDLE convertedEvent; // set while stripsLeft is 0
+        int framecount; // the movie frame it was captured on, which image sequences are numbered by
+        int slotNum; // for debugging
+        Slot() : inPixels(nullptr), inPixelsAllocated(0),
             aviPixels(nullptr), aviPixelsAllocated(0),
-//            inPixels(nullptr), inPixelsAllocated(0),
             audioBuffer(nullptr), audioBufferAllocated(0),
             audioFrameSamples(0), inAudioSize(0), inAudioSeconds(0)
         {
             framecount = -1;
+            repeatsPrevious = false;
+            firstInRow = nullptr;
+            width = height = pitch = 0;
+            stripsLeft = 0;
+            convertedEvent = CreateEvent(nullptr, TRUE, TRUE, nullptr);
         }
         ~Slot()
         {
+            WaitUntilConverted();
+            CloseHandle(convertedEvent);
             Deallocate();
         }
 
+        void ConvertRows(int firstRow, int numRows)
+        {
+            // the AVI frame is stored bottom-up
+            unsigned char* aviPix = aviPixels + firstRow * width * (24 / 8);
+            for(int row = firstRow; row < firstRow + numRows; row++, aviPix += width * (24 / 8))
+                converter.ConvertRow(firstInRow + (height - 1 - row) * pitch, aviPix, width);
+            if(InterlockedDecrement(&stripsLeft) == 0)
+                SetEvent(convertedEvent);
+        }
+
+        void WaitUntilConverted()
+        {
+            if(stripsLeft)
+                WaitForSingleObject(convertedEvent, INFINITE);
+        }
+
         void Deallocate()
         {
             //hasProcessedAudio.WaitUntilFalse();
             //hasProcessedVideo.WaitUntilFalse();
-//			free(inPixels);
-//			inPixels = nullptr;
+            free(inPixels);
+            inPixels = nullptr;
             free(aviPixels);
             aviPixels = nullptr;
             free(audioBuffer);
             audioBuffer = nullptr;
-//			inPixelsAllocated = 0;
+            inPixelsAllocated = 0;
             aviPixelsAllocated = 0;
             audioBufferAllocated = 0;
         }
@@ -802,17 +975,76 @@ struct AviFrameQueue
                     int videoFrameSize = curAviWidth * curAviHeight * (24 / 8);
                     LONG bytesWritten = 0;
 
+                    if(Config::aviSkipDuplicateFrames && aviEmptyFramesAllowed)
                     {
-                        AutoCritSect cs(&s_aviCS);
-
-                        if(!aviCompressedStream)
+                        // frames the game drew exactly the same as the last one are repeats too
+                        bool repeat = repeatsPrevious;
+                        if(!repeat)
+                        {
+                            // a matching hash is only taken as a repeat if the pixels match too.
+                            // the previous frame's slot may already be refilled by the capture side
+                            // once it's been read, so the comparison is against our own copy of it.
+                            unsigned long long hash = HashFrame(aviPixels, videoFrameSize);
+                            repeat = aviHasPrevFrameHash && hash == aviPrevFrameHash
+                                && memcmp(aviPixels, aviPrevFramePixels, videoFrameSize) == 0;
+                            if(!repeat)
+                            {
+                                ReserveBuffer(aviPrevFramePixels, aviPrevFramePixelsAllocated, videoFrameSize);
+                                memcpy(aviPrevFramePixels, aviPixels, videoFrameSize);
+                                aviPrevFrameHash = hash;
+                                aviHasPrevFrameHash = true;
+                            }
+                        }
+                        if(repeat)
+                        {
+                            OutputRepeatedFrame();
                             return;
+                        }
+                    }
 
+                    if(imageSequence)
+                    {
+                        if(!imageSequence->WriteFrame(aviPixels, curAviWidth, curAviHeight, framecount))
+                        {
+                            EncoderWriteFailed();
+                            return;
+                        }
+                        bytesWritten = videoFrameSize;
+                    }
+                    else if(encoderVideo)
+                    {
+                        if(!encoderVideo->WriteFrame(aviPixels))
+                        {
+                            EncoderWriteFailed();
+                            return;
+                        }
+                        bytesWritten = videoFrameSize;
+                    }
+                    else
+                    {
 #ifdef _DEBUG
                         DWORD time1 = timeGetTime();
 #endif
 
-                        HRESULT hr = SafeAVIStreamWrite(aviCompressedStream, aviFrameCount, 1, aviPixels, videoFrameSize, 0, nullptr, &bytesWritten);
+                        // the built-in codec runs before taking s_aviCS, so the audio can be written meanwhile
+                        const unsigned char* frameData = aviPixels;
+                        unsigned int frameSize = videoFrameSize;
+                        DWORD frameFlags = 0;
+                        if(losslessEncoder)
+                        {
+                            bool keyframe;
+                            frameData = EncodeLosslessFrame(aviPixels, &frameSize, &keyframe);
+                            if(keyframe)
+                                frameFlags = AVIIF_KEYFRAME;
+                        }
+
+                        AutoCritSect cs(&s_aviCS);
+
+                        PAVISTREAM stream = losslessEncoder ? aviStream : aviCompressedStream;
+                        if(!stream)
+                            return;
+
+                        HRESULT hr = SafeAVIStreamWrite(stream, aviFrameCount, 1, (LPVOID)frameData, frameSize, frameFlags, nullptr, &bytesWritten);
                         //debugprintf("0x%X = SafeAVIStreamWrite(0x%X, %d, 1, 0x%X, %d, 0, nullptr, %d)\n", hr, aviCompressedStream, aviFrameCount, aviPixels, videoFrameSize, bytesWritten);
 
 #ifdef _DEBUG
@@ -838,7 +1070,8 @@ struct AviFrameQueue
                             CustomMessageBox("The video encoder you chose is outputting some null frames.\nThis may confuse video players into adding delays and letting the sound stream get out of sync.", "Warning", MB_OK | MB_ICONWARNING);
                         aviEmptyFrameCount++;;
                     }
-                    aviFilesize += bytesWritten;
+                    if(aviFile) // the other outputs have no file size limit to split at
+                        aviFilesize += bytesWritten;
 
                     if(aviFrameCount == 1)
                         mainMenuNeedsRebuilding = true;
@@ -852,11 +1085,54 @@ struct AviFrameQueue
                 }
             }
 
+            // the AVI file gets an empty frame, which players show by keeping the previous frame up,
+            // so the codec never sees it. the encoder pipe has no such thing and gets the last frame again,
+            // and so does an image sequence, as a copy of the last file.
+            // VfW codecs never get here (see aviEmptyFramesAllowed): a frame written past a codec that
+            // predicts from earlier frames would throw its keyframe spacing and reference frames off.
+            void OutputRepeatedFrame()
+            {
+                if(imageSequence)
+                {
+                    if(!imageSequence->RepeatFrame(framecount))
+                    {
+                        EncoderWriteFailed();
+                        return;
+                    }
+                }
+                else if(encoderVideo)
+                {
+                    if(!encoderVideo->RepeatFrame())
+                    {
+                        EncoderWriteFailed();
+                        return;
+                    }
+                }
+                else
+                {
+                    AutoCritSect cs(&s_aviCS);
+
+                    if(!aviStream)
+                        return;
+
+                    // straight to the file stream, past the codec. the buffer only has to be valid, nothing is read from it.
+                    static BYTE noPixels;
+                    HRESULT hr = SafeAVIStreamWrite(aviStream, aviFrameCount, 1, &noPixels, 0, 0, nullptr, nullptr);
+                    if(FAILED(hr))
+                        debugprintf("AVIStreamWrite(repeated frame) failed! (0x%X)\n", hr);
+                }
+
+                aviFrameCount++;
+                aviRepeatFrameCount++;
+
+                avidebugprintf("Output:    slot %d, movie frame %d, video frame %d (repeat)\n", slotNum, framecount, aviFrameCount);
+            }
+
             void OutputAudioFrame()
             {
                 if(Config::localTASflags.aviMode & 2)
                 {
-                    if(!audioConverterStream)
+                    if(!audioConverterStream && !encoderAudio)
                         return;
 
                     double nextAviSoundSecondsCount;
@@ -879,15 +1155,28 @@ struct AviFrameQueue
                         //	nextAviSoundSecondsCount -= subtract;
                         //}
                     }
- 
-                    AudioConverterStream::ConvertOutput output = audioConverterStream->Convert((const BYTE*)audioBuffer, inAudioSize);
-                    if(audioConverterStream->failed)
-                        return;
 
-                    int audioFrameSize = output.size;
+                    int audioFrameSize = inAudioSize;
                     LONG bytesWritten = audioFrameSize;
 
+                    if(encoderAudio)
                     {
+                        // the encoder gets the game's PCM as it is
+                        if(!encoderAudio->Write(audioBuffer, inAudioSize))
+                        {
+                            EncoderWriteFailed();
+                            return;
+                        }
+                    }
+                    else
+                    {
+                        AudioConverterStream::ConvertOutput output = audioConverterStream->Convert((const BYTE*)audioBuffer, inAudioSize);
+                        if(audioConverterStream->failed)
+                            return;
+
+                        audioFrameSize = output.size;
+                        bytesWritten = audioFrameSize;
+
                         AutoCritSect cs(&s_aviCS);
 
                         if(!aviSoundStream)
@@ -919,7 +1208,8 @@ struct AviFrameQueue
                     {
                         aviSoundFrameCount++;
                     }
-                    aviFilesize += bytesWritten;
+                    if(aviFile) // the other outputs have no file size limit to split at
+                        aviFilesize += bytesWritten;
 
                     if(aviSoundFrameCount == 1)
                         mainMenuNeedsRebuilding = true;
@@ -931,87 +1221,74 @@ struct AviFrameQueue
                 }
             }
 
-            friend AviFrameQueue<numSlots>;
+            friend struct AviFrameQueue;
     };
 
     HANDLE thread;
     HANDLE threadAudio;
-    bool threadDone;
     static DWORD WINAPI OutputVideoThreadFunc(LPVOID lpParam)
     {
-        ((AviFrameQueue<numSlots>*)lpParam)->OutputVideo();
+        ((AviFrameQueue*)lpParam)->OutputVideo();
         return 0;
     }
     static DWORD WINAPI OutputAudioThreadFunc(LPVOID lpParam)
     {
-        ((AviFrameQueue<numSlots>*)lpParam)->OutputAudio();
+        ((AviFrameQueue*)lpParam)->OutputAudio();
         return 0;
     }
 
     void OutputVideo()
     {
-        while(!threadDone)
+        int slotNum;
+        while((slotNum = m_videoRing.BeginRead()) >= 0)
         {
-            Slot& slot = m_slots[m_nextRead];
-
-            slot.hasProcessedVideo.WaitUntilTrue();
-            if(!threadDone)
-                slot.OutputVideoFrame();
-            slot.hasProcessedVideo = false;
-
-            //// leave last video slot occupied until next new frame so RefillFrame can reuse its data
-            //m_slots[(numSlots+m_nextRead-1)%numSlots].hasProcessedVideo = false;
-
-            m_nextRead++;
-            m_nextRead %= numSlots;
+            m_videoSlots[slotNum].WaitUntilConverted();
+            m_videoSlots[slotNum].OutputVideoFrame();
+            m_videoRing.EndRead();
         }
     }
     void OutputAudio()
     {
-        while(!threadDone)
+        int slotNum;
+        while((slotNum = m_audioRing.BeginRead()) >= 0)
         {
-            Slot& slot = m_slots[m_nextReadAudio];
-
-            slot.hasProcessedAudio.WaitUntilTrue();
-            if(!threadDone)
-                slot.OutputAudioFrame();
-            slot.hasProcessedAudio = false;
-
-            m_nextReadAudio++;
-            m_nextReadAudio %= numSlots;
+            m_audioSlots[slotNum].OutputAudioFrame();
+            m_audioRing.EndRead();
         }
     }
 
+    // 1 slot would mean single-buffered = bad for threading, 2 means double-buffered = slightly better...
+    static unsigned int QueueDepth()
+    {
+        return (unsigned int)max(2, min(Config::aviQueueDepth, 256));
+    }
+    static unsigned int MaxQueueBytes()
+    {
+        return (unsigned int)max(1, min(Config::aviQueueMegabytes, 2047)) << 20;
+    }
+    static unsigned int VideoDepth(int videoSlotSize)
+    {
+        unsigned int depth = QueueDepth();
+        if(videoSlotSize > 0)
+            depth = max(2u, min(depth, MaxQueueBytes() / (unsigned int)videoSlotSize));
+        return depth;
+    }
+    // a video slot holds the converted frame and also the game's pixels, with their pitch, until they've been converted
+    static int VideoSlotSize(int width, int height, int pitch)
+    {
+        return width * height * (24 / 8) + 8 + (pitch > 0 ? pitch : -pitch) * height;
+    }
+
 private:
-    Slot m_slots [numSlots];
-    int m_nextWrite;
-    int m_nextWriteAudio;
-    int m_nextRead;
-    int m_nextReadAudio;
+    FrameRing m_videoRing;
+    FrameRing m_audioRing;
+    Slot* m_videoSlots;
+    Slot* m_audioSlots;
+    int m_prevVideoSlot;
     bool m_disableFills;
 };
 
-// the number here decides how many buffers we keep
-// (1 means single-buffered = bad for threading, 2 means double-buffered = slightly better...)
-AviFrameQueue<4>* aviFrameQueue = new AviFrameQueue<4>();
-
-
-static bool aviLibraryOpened = false;
-static PAVIFILE aviFile = nullptr;
-static PAVISTREAM aviStream = nullptr;
-static PAVISTREAM aviSoundStream = nullptr;
-static PAVISTREAM aviCompressedStream = nullptr;
-//static PAVISTREAM aviCompressedSoundStream = nullptr;
-static int curAviWidth=0, curAviHeight=0, curAviFps=0;
-int aviFrameCount = 0, aviEmptyFrameCount = 0;
-static bool oldIsBasicallyEmpty = false;
-static int aviSoundSampleCount = 0;
-int aviSoundFrameCount = 0;
-static double aviSoundSecondsCount = 0;
-static int aviFilesize = 0;
-static CRITICAL_SECTION s_aviCS;
-static CRITICAL_SECTION s_fqaCS;
-static CRITICAL_SECTION s_fqvCS;
+AviFrameQueue* aviFrameQueue = new AviFrameQueue();
 
 
 void InitAVICriticalSections()
@@ -1021,15 +1298,42 @@ void InitAVICriticalSections()
     InitializeCriticalSection(&s_fqvCS);
 }
 
-void CloseAVI()
+static void LogQueueStats(const char* name, const FrameRingStats& stats)
 {
-    if(aviStream)
+    debugprintf("AVI %s queue: %u frames, %u/%u slots peak, %u stalls (%.3f s), latency %.1f ms avg %.1f ms max\n",
+        name, stats.frames, stats.peak_occupancy, stats.depth, stats.producer_stalls, stats.stall_seconds,
+        stats.average_latency * 1000.0, stats.max_latency * 1000.0);
+}
+
+void GetAVIQueueStats(FrameRingStats* video, FrameRingStats* audio)
+{
+    memset(video, 0, sizeof(*video));
+    memset(audio, 0, sizeof(*audio));
+    AutoCritSect cs1(&s_fqaCS);
+    AutoCritSect cs2(&s_fqvCS);
+    if(aviFrameQueue)
+        aviFrameQueue->GetStats(video, audio);
+}
+
+// nextVideoSlotSize is passed on to the new frame queue, see AviFrameQueue
+static void CloseAVI(int nextVideoSlotSize)
+{
+    if(aviStream || encoderVideo || imageSequenceVideo)
         oldIsBasicallyEmpty |= (aviFrameCount-aviEmptyFrameCount < 5 && aviSoundFrameCount < 15);
 
     if(aviFrameQueue)
         aviFrameQueue->Flush();
     AutoCritSect cs1(&s_fqaCS);
     AutoCritSect cs2(&s_fqvCS);
+    if(aviFrameQueue)
+    {
+        FrameRingStats videoStats, audioStats;
+        aviFrameQueue->GetStats(&videoStats, &audioStats);
+        if(videoStats.frames)
+            LogQueueStats("video", videoStats);
+        if(audioStats.frames)
+            LogQueueStats("audio", audioStats);
+    }
     delete aviFrameQueue;
     aviFrameQueue = nullptr;
 
@@ -1037,8 +1341,16 @@ void CloseAVI()
     aviSplitCount = 0;
     aviSplitDiscardCount = 0;
 
+    if(aviRepeatFrameCount)
+        debugprintf("AVI: %d of %d video frames repeated the previous one\n", aviRepeatFrameCount, aviFrameCount);
+
     aviFrameCount = 0;
     aviEmptyFrameCount = 0;
+    aviRepeatFrameCount = 0;
+    aviHasPrevFrameHash = false;
+    free(aviPrevFramePixels);
+    aviPrevFramePixels = nullptr;
+    aviPrevFramePixelsAllocated = 0;
     aviSoundFrameCount = 0;
     aviSoundSampleCount = 0;
     aviSoundSecondsCount = 0;
@@ -1060,6 +1372,9 @@ void CloseAVI()
         AVIStreamClose(aviCompressedStream);
     aviCompressedStream = nullptr;
 
+    delete losslessEncoder;
+    losslessEncoder = nullptr;
+
     if(aviSoundStream)
         AVIStreamClose(aviSoundStream);
     aviSoundStream = nullptr;
@@ -1075,12 +1390,33 @@ void CloseAVI()
         AVIFileExit();
     aviLibraryOpened = false;
 
-    aviFrameQueue = new AviFrameQueue<4>();
+    // the encoder threads are gone by now, so nothing else is using these
+    delete encoderVideo;
+    encoderVideo = nullptr;
+    delete encoderAudio;
+    encoderAudio = nullptr;
+    if(encoderProcess && !encoderProcess->Finish())
+        debugprintf("The encoder failed or is still running, see its .log file.\n");
+    delete encoderProcess;
+    encoderProcess = nullptr;
+    if(imageSequence && !imageSequence->Finish())
+        debugprintf("Some of the image files or the WAV file couldn't be written.\n");
+    delete imageSequence;
+    imageSequence = nullptr;
+    imageSequenceVideo = false;
+    encoderFailed = 0;
+
+    aviFrameQueue = new AviFrameQueue(nextVideoSlotSize);
 
     tasFlagsDirty = true;
     mainMenuNeedsRebuilding = true;
 }
 
+void CloseAVI()
+{
+    CloseAVI(0);
+}
+
 bool SetAVIFilename(char* filename)
 {
     if(strlen(filename) > MAX_PATH+1) // filename too long
@@ -1091,9 +1427,52 @@ bool SetAVIFilename(char* filename)
     return true;
 }
 
+static void CloseSharedFrames()
+{
+    sharedFrames.Detach();
+    if(sharedFramesMemory)
+        UnmapViewOfFile(sharedFramesMemory);
+    if(sharedFramesMapping)
+        CloseHandle(sharedFramesMapping);
+    sharedFramesMemory = nullptr;
+    sharedFramesMapping = nullptr;
+    sharedFramesProcessId = 0;
+}
+
+// sets up the shared frame ring for the game to find, the next time it sends a frame.
+// if this fails, or is turned off, the game just keeps sending frames the old way.
+static void OpenSharedFrames(HANDLE process)
+{
+    DWORD processId = GetProcessId(process);
+    if(processId == sharedFramesProcessId && sharedFrames.IsAttached())
+        return;
+    CloseSharedFrames();
+    if(Config::aviSharedFrameMemory <= 0 || !processId)
+        return;
+
+    // the whole ring is mapped into the game too, so keep it to what it was given
+    unsigned int size = (unsigned int)min(Config::aviSharedFrameMemory, 256) << 20;
+    unsigned int slotSize = ((size - SharedFrameRing::GetMemorySize(sharedFrameSlots, 0)) / sharedFrameSlots) & ~63u;
+    size = SharedFrameRing::GetMemorySize(sharedFrameSlots, slotSize);
+
+    std::string name = SharedFrameRing::GetName(processId);
+    sharedFramesMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, name.c_str());
+    if(sharedFramesMapping)
+        sharedFramesMemory = MapViewOfFile(sharedFramesMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(!sharedFramesMemory || !sharedFrames.Create(sharedFramesMemory, size, sharedFrameSlots, slotSize))
+    {
+        debugprintf("AVI: couldn't set up the shared frame ring (error %d), reading frames from the game instead\n", (int)GetLastError());
+        CloseSharedFrames();
+        return;
+    }
+    sharedFramesProcessId = processId;
+    sharedFrames.SetEnabled(true);
+}
+
 void SetCaptureProcess(HANDLE process)
 {
     captureProcess = process;
+    OpenSharedFrames(process);
 }
 
 void SetLastFrameSoundInfo(void* soundInfoPointer)
@@ -1106,12 +1485,87 @@ void SetPaletteEntriesPointer(void* pointer)
     paletteEntriesPointer = pointer;
 }
 
+// the part of OpenAVIFile that starts the encoder command, in place of opening an AVI file
+static bool OpenEncoderProcess(const char* filename, int width, int height, int fps)
+{
+    AutoCritSect cs(&s_aviCS);
+
+    bool video = width && height && fps;
+    bool audio = (Config::localTASflags.aviMode & 2) != 0;
+    std::string error;
+    encoderProcess = new EncoderProcess();
+    if(!encoderProcess->Start(Config::aviEncoderCommand, filename, video, audio, &error))
+    {
+        error += "\n";
+        debugprintf("%s", error.c_str());
+        NormalMessageBox(error.c_str(), "Error", MB_OK|MB_ICONERROR);
+        delete encoderProcess;
+        encoderProcess = nullptr;
+        return false;
+    }
+
+    if(video)
+    {
+        encoderVideo = new Y4MStream(encoderProcess->GetVideoSink());
+        encoderVideo->SetFormat(width, height, fps);
+    }
+    // the format is set once the game's sound format is known, see OpenAVIAudioStream
+    if(encoderProcess->GetAudioSink())
+        encoderAudio = new WavStream(encoderProcess->GetAudioSink());
+
+    aviFrameCount = 0;
+    aviEmptyFrameCount = 0;
+
+    curAviWidth = width;
+    curAviHeight = height;
+    curAviFps = fps;
+    return true;
+}
+
+// the part of OpenAVIFile that starts an image sequence, in place of opening an AVI file
+static bool OpenImageSequence(const char* filename, ImageFormat format, int width, int height, int fps)
+{
+    AutoCritSect cs(&s_aviCS);
+
+    if(!conversionPool)
+        conversionPool = new WorkerPool(Config::aviConversionThreads);
+    // enough frames in flight to keep every thread busy, within the same memory limit as the frame queue
+    unsigned int maxFrames = conversionPool->GetThreadCount() * 2;
+    unsigned int maxBytes = (unsigned int)max(1, min(Config::aviQueueMegabytes, 2047)) << 20;
+    bool video = width && height && fps;
+    bool audio = (Config::localTASflags.aviMode & 2) != 0;
+    std::string error;
+    imageSequence = new ImageSequence(format, conversionPool, maxFrames, maxBytes);
+    if(!imageSequence->Start(filename, audio, &error))
+    {
+        error += "\n";
+        debugprintf("%s", error.c_str());
+        NormalMessageBox(error.c_str(), "Error", MB_OK|MB_ICONERROR);
+        delete imageSequence;
+        imageSequence = nullptr;
+        return false;
+    }
+
+    imageSequenceVideo = video;
+    // the format is set once the game's sound format is known, see OpenAVIAudioStream
+    if(imageSequence->GetAudioSink())
+        encoderAudio = new WavStream(imageSequence->GetAudioSink());
+
+    aviFrameCount = 0;
+    aviEmptyFrameCount = 0;
+
+    curAviWidth = width;
+    curAviHeight = height;
+    curAviFps = fps;
+    return true;
+}
+
 bool OpenAVIFile(int width, int height, int bpp, int fps)
 {
     int oldAviMode = Config::localTASflags.aviMode;
     int oldAviSplitCount = aviSplitCount;
     int oldAviSplitDiscardCount = aviSplitDiscardCount;
-    CloseAVI();
+    CloseAVI(AviFrameQueue::VideoSlotSize(width, height, curAviInputPitch));
     Config::localTASflags.aviMode = oldAviMode;
     aviSplitCount = oldAviSplitCount;
     aviSplitDiscardCount = oldAviSplitDiscardCount;
@@ -1165,6 +1619,18 @@ bool OpenAVIFile(int width, int height, int bpp, int fps)
 
     debugprintf(__FUNCTION__ "(filename=\"%s\", width=%d, height=%d, bpp=%d, fps=%d)\n", filename, width, height, bpp, fps);
 
+    ImageFormat imageFormat;
+    if(GetImageFormat(filename, &imageFormat))
+    {
+        aviEmptyFramesAllowed = true;
+        return OpenImageSequence(filename, imageFormat, width, height, fps);
+    }
+    if(*Config::aviEncoderCommand)
+    {
+        aviEmptyFramesAllowed = true;
+        return OpenEncoderProcess(filename, width, height, fps);
+    }
+
     AutoCritSect cs(&s_aviCS);
 
     if(!aviLibraryOpened)
@@ -1198,6 +1664,8 @@ bool OpenAVIFile(int width, int height, int bpp, int fps)
         };  
 
         AVISTREAMINFO streamInfo = { streamtypeVIDEO };
+        if(Config::aviLosslessCodec)
+            streamInfo.fccHandler = LosslessEncoder::FOURCC;
         streamInfo.dwRate = fps;
         streamInfo.dwScale = 1;
         streamInfo.dwQuality = -1;
@@ -1213,42 +1681,70 @@ bool OpenAVIFile(int width, int height, int bpp, int fps)
             return false;
         }
 
-        int chooseIter = 0;
-chooseAnotherFormat:
-        chooseIter++;
-        static AVICOMPRESSOPTIONS options = {0};
-        AVICOMPRESSOPTIONS* pOptions = &options;
-        if(!aviSplitCount || chooseIter > 1)
+        if(Config::aviLosslessCodec)
         {
-            if (!AVISaveOptions(/*hWnd*/nullptr, ICMF_CHOOSE_KEYFRAME | ICMF_CHOOSE_DATARATE, 1, &aviStream, &pOptions))
-            {
+            // no codec to choose, the frames are compressed by losslessEncoder before they're written
+            bmpInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+            bmpInfo.bmiHeader.biBitCount = 24;
+            bmpInfo.bmiHeader.biCompression = LosslessEncoder::FOURCC;
+            bmpInfo.bmiHeader.biSizeImage = width * height * 3;
+            hr = AVIStreamSetFormat(aviStream, 0, &bmpInfo, sizeof(bmpInfo.bmiHeader));
+            if(FAILED(hr))
+            { 
+                debugprintf("AVIStreamSetFormat failed! (0x%X)\n", hr);
+                NormalMessageBox("AVIStreamSetFormat failed!\n", "Error", MB_OK|MB_ICONERROR);
                 CloseAVI();
                 return false;
             }
+            if(!conversionPool)
+                conversionPool = new WorkerPool(Config::aviConversionThreads);
+            if(!losslessTilesDone)
+                losslessTilesDone = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+            losslessEncoder = new LosslessEncoder(width, height, fps * losslessKeyframeSeconds);
+            aviEmptyFramesAllowed = true;
         }
+        else
+        {
+            int chooseIter = 0;
+chooseAnotherFormat:
+            chooseIter++;
+            static AVICOMPRESSOPTIONS options = {0};
+            AVICOMPRESSOPTIONS* pOptions = &options;
+            if(!aviSplitCount || chooseIter > 1)
+            {
+                if (!AVISaveOptions(/*hWnd*/nullptr, ICMF_CHOOSE_KEYFRAME | ICMF_CHOOSE_DATARATE, 1, &aviStream, &pOptions))
+                {
+                    CloseAVI();
+                    return false;
+                }
+            }
 
-        hr = AVIMakeCompressedStream(&aviCompressedStream, aviStream, pOptions, nullptr);
-        if(FAILED(hr))
-        { 
-            debugprintf("AVIMakeCompressedStream failed! (0x%X)\n", hr);
-            NormalMessageBox("AVIMakeCompressedStream failed!\n", "Error", MB_OK|MB_ICONERROR);
-            //CloseAVI();
-            //return false;
-            goto chooseAnotherFormat;
-        }
+            hr = AVIMakeCompressedStream(&aviCompressedStream, aviStream, pOptions, nullptr);
+            if(FAILED(hr))
+            { 
+                debugprintf("AVIMakeCompressedStream failed! (0x%X)\n", hr);
+                NormalMessageBox("AVIMakeCompressedStream failed!\n", "Error", MB_OK|MB_ICONERROR);
+                //CloseAVI();
+                //return false;
+                goto chooseAnotherFormat;
+            }
 
-        if(bmpInfo.bmiHeader.biWidth & 1) bmpInfo.bmiHeader.biWidth--;
-        if(bmpInfo.bmiHeader.biHeight & 1) bmpInfo.bmiHeader.biHeight--;
-        hr = AVIStreamSetFormat(aviCompressedStream, 0, &bmpInfo, sizeof(bmpInfo));
-        if(FAILED(hr))
-        { 
-            debugprintf("AVIStreamSetFormat failed! (0x%X)\n", hr);
-            NormalMessageBox("AVIStreamSetFormat failed!\n", "Error", MB_OK|MB_ICONERROR);
-            //CloseAVI();
-            //return false;
-            AVIStreamClose(aviCompressedStream);
-            aviCompressedStream = nullptr;
-            goto chooseAnotherFormat;
+            if(bmpInfo.bmiHeader.biWidth & 1) bmpInfo.bmiHeader.biWidth--;
+            if(bmpInfo.bmiHeader.biHeight & 1) bmpInfo.bmiHeader.biHeight--;
+            hr = AVIStreamSetFormat(aviCompressedStream, 0, &bmpInfo, sizeof(bmpInfo));
+            if(FAILED(hr))
+            { 
+                debugprintf("AVIStreamSetFormat failed! (0x%X)\n", hr);
+                NormalMessageBox("AVIStreamSetFormat failed!\n", "Error", MB_OK|MB_ICONERROR);
+                //CloseAVI();
+                //return false;
+                AVIStreamClose(aviCompressedStream);
+                aviCompressedStream = nullptr;
+                goto chooseAnotherFormat;
+            }
+
+            // uncompressed frames don't depend on each other, so empty frames are fine there
+            aviEmptyFramesAllowed = (pOptions->fccHandler == comptypeDIB || pOptions->fccHandler == 0);
         }
     }
 
@@ -1261,7 +1757,8 @@ chooseAnotherFormat:
     return true;
 }
 
-void WriteAVIFrame(void* remotePixels, int width, int height, int pitch, int bpp, int rmask, int gmask, int bmask)
+static void WriteAVIFrame(void* remotePixels, const unsigned char* localPixels, const PALETTEENTRY* localPalette,
+                          int width, int height, int pitch, int bpp, int rmask, int gmask, int bmask)
 {
     if(!(Config::localTASflags.aviMode & 1))
         return; // double-check...
@@ -1270,10 +1767,11 @@ void WriteAVIFrame(void* remotePixels, int width, int height, int pitch, int bpp
     if(fps <= 0)
         fps = 60;
 
-    if(!aviFile || !aviCompressedStream || curAviWidth != width || curAviHeight != height || curAviFps != fps)
+    if(!IsCaptureOpen() || !IsVideoStreamOpen() || curAviWidth != width || curAviHeight != height || curAviFps != fps)
     {
-        if(aviFile)
+        if(IsCaptureOpen())
             aviSplitCount++;
+        curAviInputPitch = pitch;
         if(!OpenAVIFile(width, height, 24, fps))
         {
             //CheckDlgButton(hWnd, IDC_AVIVIDEO, 0);
@@ -1285,12 +1783,42 @@ void WriteAVIFrame(void* remotePixels, int width, int height, int pitch, int bpp
     }
 
     // producer
-    aviFrameQueue->FillFrame(remotePixels, width, height, pitch, bpp, rmask, gmask, bmask);
+    aviFrameQueue->FillFrame(remotePixels, width, height, pitch, bpp, rmask, gmask, bmask, localPixels, localPalette);
+}
+
+void WriteAVIFrame(void* remotePixels, int width, int height, int pitch, int bpp, int rmask, int gmask, int bmask)
+{
+    WriteAVIFrame(remotePixels, nullptr, nullptr, width, height, pitch, bpp, rmask, gmask, bmask);
+}
+
+// write the frame the game put in the shared frame ring
+static void WriteSharedAVIFrame(unsigned int sequence)
+{
+    if(!sharedFrames.IsAttached())
+        return;
+    const unsigned char* pixels;
+    const SharedFrameInfo* info = sharedFrames.BeginRead(sequence, &pixels);
+    if(!info)
+    {
+        debugprintf("AVI: frame %u isn't in the shared frame ring\n", sequence);
+        return;
+    }
+    // the game can write to the ring, so don't take its word for how big the frame is
+    SharedFrameInfo frame = *info;
+    unsigned int rowSize = (unsigned int)frame.width * (unsigned int)(frame.bpp >> 3);
+    if(frame.width > 0 && frame.height > 0 && frame.width <= 0x8000 && frame.height <= 0x8000
+    && frame.bpp >= 8 && frame.bpp <= 32 && frame.pitch > 0 && (unsigned int)frame.pitch >= rowSize
+    && (unsigned int)frame.pitch <= sharedFrames.GetSlotSize() / (unsigned int)frame.height)
+    {
+        WriteAVIFrame(nullptr, pixels, (const PALETTEENTRY*)frame.palette, frame.width, frame.height, frame.pitch,
+            frame.bpp, frame.rmask, frame.gmask, frame.bmask);
+    }
+    sharedFrames.EndRead();
 }
 
 void RewriteAVIFrame()
 {
-    if((Config::localTASflags.aviMode & 1) && aviCompressedStream)
+    if((Config::localTASflags.aviMode & 1) && IsVideoStreamOpen())
     {
         aviFrameQueue->RefillFrame();
     }
@@ -1343,13 +1871,14 @@ int OpenAVIAudioStream()
             return -1;
 
         // open the output file if it's not already open
-        if(!aviFile)
+        if(!IsCaptureOpen())
         {
             if(!(Config::localTASflags.aviMode & 1))
             {
                 curAviWidth = 0;
                 curAviHeight = 0;
                 curAviFps = 0;
+                curAviInputPitch = 0;
             }
             else
             {
@@ -1367,71 +1896,98 @@ int OpenAVIAudioStream()
             }
         }
 
-        LPWAVEFORMATEX outputFormat = &format;
-        int outputFormatSize = sizeof(WAVEFORMATEX) + outputFormat->cbSize;
-
-        for(int chooseIter = 1;; chooseIter++)
+        if(encoderProcess || imageSequence)
         {
-            if((aviSplitCount && chooseIter <= 1) || ChooseAudioCodec(&format))
+            if(!encoderAudio)
             {
-                // user chose a format
-                outputFormat = chooseFormat;
-                outputFormatSize = sizeof(WAVEFORMATEX) + outputFormat->cbSize;
+                debugprintf("The encoder command has no audio input!\n");
+                NormalMessageBox("The encoder command has no %audio% input for the audio.\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
+                Config::localTASflags.aviMode &= ~2;
+                tasFlagsDirty = true;
+                return -1;
             }
-            else
+            if(format.wFormatTag != WAVE_FORMAT_PCM)
             {
-                // user cancelled
-                //CheckDlgButton(hWnd, IDC_AVIAUDIO, 0);
+                debugprintf("The game's sound format (0x%X) isn't PCM!\n", format.wFormatTag);
+                if(imageSequence)
+                    NormalMessageBox("The game's sound isn't PCM, so it can't be written to a WAV file.\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
+                else
+                    NormalMessageBox("The game's sound isn't PCM, so it can't be sent to the encoder.\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
                 Config::localTASflags.aviMode &= ~2;
                 tasFlagsDirty = true;
                 return -1;
             }
+            if(!encoderAudio->HasFormat())
+                encoderAudio->SetFormat(format.nChannels, format.nSamplesPerSec, format.wBitsPerSample);
+        }
+        else
+        {
+            LPWAVEFORMATEX outputFormat = &format;
+            int outputFormatSize = sizeof(WAVEFORMATEX) + outputFormat->cbSize;
 
-            // figure out how to convert to the chosen format
-            audioConverterStream = new AudioConverterStream(format, chooseFormat);
-            if(audioConverterStream->failed)
-            {
-                // try again
-                debugprintf("AudioConverterStream() failed!\n");
-                NormalMessageBox("Couldn't find a valid conversion sequence.\nTry a different audio codec.\n", "Error", MB_OK|MB_ICONERROR);
-                delete audioConverterStream;
-                audioConverterStream = nullptr;
-            }
-            else
+            for(int chooseIter = 1;; chooseIter++)
             {
-                // done choosing format
-                break;
+                if((aviSplitCount && chooseIter <= 1) || ChooseAudioCodec(&format))
+                {
+                    // user chose a format
+                    outputFormat = chooseFormat;
+                    outputFormatSize = sizeof(WAVEFORMATEX) + outputFormat->cbSize;
+                }
+                else
+                {
+                    // user cancelled
+                    //CheckDlgButton(hWnd, IDC_AVIAUDIO, 0);
+                    Config::localTASflags.aviMode &= ~2;
+                    tasFlagsDirty = true;
+                    return -1;
+                }
+
+                // figure out how to convert to the chosen format
+                audioConverterStream = new AudioConverterStream(format, chooseFormat);
+                if(audioConverterStream->failed)
+                {
+                    // try again
+                    debugprintf("AudioConverterStream() failed!\n");
+                    NormalMessageBox("Couldn't find a valid conversion sequence.\nTry a different audio codec.\n", "Error", MB_OK|MB_ICONERROR);
+                    delete audioConverterStream;
+                    audioConverterStream = nullptr;
+                }
+                else
+                {
+                    // done choosing format
+                    break;
+                }
             }
-        }
 
-        AVISTREAMINFO streamInfo = { streamtypeAUDIO };
-        streamInfo.dwRate = outputFormat->nAvgBytesPerSec;
-        streamInfo.dwScale = outputFormat->nBlockAlign;
-        streamInfo.dwSampleSize = outputFormat->nBlockAlign;
-        streamInfo.dwQuality = -1;
-        //streamInfo.dwInitialFrames = aviCompressedStream ? aviFrameCount : 0;
-        streamInfo.dwInitialFrames = 0;
+            AVISTREAMINFO streamInfo = { streamtypeAUDIO };
+            streamInfo.dwRate = outputFormat->nAvgBytesPerSec;
+            streamInfo.dwScale = outputFormat->nBlockAlign;
+            streamInfo.dwSampleSize = outputFormat->nBlockAlign;
+            streamInfo.dwQuality = -1;
+            //streamInfo.dwInitialFrames = aviCompressedStream ? aviFrameCount : 0;
+            streamInfo.dwInitialFrames = 0;
 
-        HRESULT hr = AVIFileCreateStream(aviFile, &aviSoundStream, &streamInfo);
-        if(FAILED(hr))
-        { 
-            debugprintf("AVIFileCreateStream(audio) failed!\n");
-            NormalMessageBox("AVIFileCreateStream(audio) failed!\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
-            //CheckDlgButton(hWnd, IDC_AVIAUDIO, 0);
-            Config::localTASflags.aviMode &= ~2;
-            tasFlagsDirty = true;
-            return -1;
-        }
+            HRESULT hr = AVIFileCreateStream(aviFile, &aviSoundStream, &streamInfo);
+            if(FAILED(hr))
+            { 
+                debugprintf("AVIFileCreateStream(audio) failed!\n");
+                NormalMessageBox("AVIFileCreateStream(audio) failed!\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
+                //CheckDlgButton(hWnd, IDC_AVIAUDIO, 0);
+                Config::localTASflags.aviMode &= ~2;
+                tasFlagsDirty = true;
+                return -1;
+            }
 
-        hr = AVIStreamSetFormat(aviSoundStream, 0, outputFormat, outputFormatSize);
-        if(FAILED(hr))
-        { 
-            debugprintf("AVIStreamSetFormat(audio) failed!\n");
-            NormalMessageBox("AVIStreamSetFormat(audio) failed!\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
-            //CheckDlgButton(hWnd, IDC_AVIAUDIO, 0);
-            Config::localTASflags.aviMode &= ~2;
-            tasFlagsDirty = true;
-            return -1;
+            hr = AVIStreamSetFormat(aviSoundStream, 0, outputFormat, outputFormatSize);
+            if(FAILED(hr))
+            { 
+                debugprintf("AVIStreamSetFormat(audio) failed!\n");
+                NormalMessageBox("AVIStreamSetFormat(audio) failed!\nCapture will continue without audio\n", "Error", MB_OK|MB_ICONERROR);
+                //CheckDlgButton(hWnd, IDC_AVIAUDIO, 0);
+                Config::localTASflags.aviMode &= ~2;
+                tasFlagsDirty = true;
+                return -1;
+            }
         }
     }
 
@@ -1446,7 +2002,7 @@ void WriteAVIAudio()
 {
     //	AutoCritSect cs(&s_aviCS);
 
-    if(!aviSoundStream)
+    if(!IsAudioStreamOpen())
     {
         int res = OpenAVIAudioStream();
         if(!res)
@@ -1460,12 +2016,12 @@ void WriteAVIAudio()
         }
     }
 
-    if(aviCompressedStream && (aviSoundFrameCount < 30 || aviSoundFrameCount+8 < aviFrameCount) && !aviSplitCount)
+    if(IsVideoStreamOpen() && (aviSoundFrameCount < 30 || aviSoundFrameCount+8 < aviFrameCount) && !aviSplitCount)
     {
         if(aviSoundFrameCount < aviFrameCount/*-aviEmptyFrameCount*/)
         {
             AutoCritSect cs(&s_fqaCS); // critical section and check again in case we got here while CloseAVI is running
-            if(aviCompressedStream && (aviSoundFrameCount < 30 || aviSoundFrameCount+8 < aviFrameCount) && !aviSplitCount)
+            if(IsVideoStreamOpen() && (aviSoundFrameCount < 30 || aviSoundFrameCount+8 < aviFrameCount) && !aviSplitCount)
                 while(aviSoundFrameCount < aviFrameCount/*-aviEmptyFrameCount*/)
                     aviFrameQueue->FillEmptyAudioFrame(); // in case video started before audio
         }
@@ -1556,8 +2112,15 @@ void ProcessCaptureFrameInfo(void* frameCaptureInfoRemoteAddr, CAPTUREINFO frame
             ReadProcessMemory(captureProcess, frameCaptureInfoRemoteAddr, &desc, sizeof(desc), nullptr);
             WriteAVIFrame(desc.lpSurface, desc.dwWidth, desc.dwHeight, desc.lPitch, desc.ddpfPixelFormat.dwRGBBitCount,
                 desc.ddpfPixelFormat.dwRBitMask, desc.ddpfPixelFormat.dwGBitMask, desc.ddpfPixelFormat.dwBBitMask);
+            // the game didn't use the ring for this one, whatever it left there is stale now
+            if(sharedFrames.IsAttached())
+                sharedFrames.DropFrames();
         }
         break;
+    case CAPTUREINFO::TYPE_SHARED:
+        if(Config::localTASflags.aviMode & 1)
+            WriteSharedAVIFrame((unsigned int)(size_t)frameCaptureInfoRemoteAddr);
+        break;
     }
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <shared/ipc.h>
+#include "framering.h"
 
 void ProcessCaptureFrameInfo(void* frameCaptureInfoRemoteAddr, CAPTUREINFO frameCaptureInfoType);
 void ProcessCaptureSoundInfo();
@@ -15,6 +16,9 @@ void SetPaletteEntriesPointer(void* pointer);
 void SetCaptureProcess(HANDLE process);
 
 void CloseAVI();
+// Counters of the queues between the capture and the encoder threads, for the current file.
+// Both are zeroed while nothing is being captured.
+void GetAVIQueueStats(FrameRingStats* video, FrameRingStats* audio);
 //bool OpenAVIFile(int width, int height, int bpp, int fps);
 //void WriteAVIFrame(void* remotePixels, int width, int height, int pitch, int bpp, int rmask, int gmask, int bmask);
 //void RewriteAVIFrame();
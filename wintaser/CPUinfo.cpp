@@ -4,6 +4,9 @@
 #include "CPUinfo.h"
 
 #include <intrin.h>
+#if _MSC_VER >= 1700
+#include <immintrin.h> // _xgetbv
+#endif
 #include <string>
 
 void CPUInfo(/*optional*/ int* logicalCores, /*optional*/ int* physicalCores, /*optional*/ bool* hyperThreading)
@@ -46,4 +49,41 @@ void CPUInfo(/*optional*/ int* logicalCores, /*optional*/ int* physicalCores, /*
 		unsigned cpuFeatures = regs[3]; // EDX
 		*hyperThreading = cpuFeatures & (1 << 28) && physical < cores;
 	}
-}
\ No newline at end of file
+}
+
+bool CPUHasSSE2()
+{
+	int regs[4];
+	__cpuid(regs, 1);
+	return (regs[3] & (1 << 26)) != 0; // EDX[26]
+}
+
+bool CPUHasSSSE3()
+{
+	int regs[4];
+	__cpuid(regs, 1);
+	return (regs[2] & (1 << 9)) != 0; // ECX[9]
+}
+
+bool CPUHasAVX2()
+{
+#if _MSC_VER >= 1700
+	int regs[4];
+	__cpuid(regs, 0);
+	if(regs[0] < 7)
+		return false;
+
+	// AVX (ECX[28]) and the OS saving the YMM registers on task switches (ECX[27] OSXSAVE, then XCR0[2:1])
+	__cpuid(regs, 1);
+	if((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+		return false;
+	if((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0; // EBX[5]
+#else
+	// _xgetbv and __cpuidex aren't available before VS2012, and neither are the AVX2 paths
+	return false;
+#endif
+}
@@ -1,3 +1,8 @@
 #pragma once
 
-void CPUInfo(/*optional*/ int* logicalCores, /*optional*/ int* physicalCores, /*optional*/ bool* hyperThreading);
\ No newline at end of file
+void CPUInfo(/*optional*/ int* logicalCores, /*optional*/ int* physicalCores, /*optional*/ bool* hyperThreading);
+
+// Instruction set extensions usable by this process (AVX2 also needs support from the OS)
+bool CPUHasSSE2();
+bool CPUHasSSSE3();
+bool CPUHasAVX2();
@@ -45,6 +45,13 @@ namespace Config
     //int waitSyncMode;
     int aviFrameCount;
     int aviSoundFrameCount;
+    int aviQueueDepth = 8;
+    int aviQueueMegabytes = 256;
+    int aviConversionThreads = 0;
+    bool aviSkipDuplicateFrames = true;
+    bool aviLosslessCodec = false;
+    int aviSharedFrameMemory = 20;
+    char aviEncoderCommand [1024] = "";
     bool traceEnabled = true;
     bool crcVerifyEnabled = true;
     //int storeVideoMemoryInSavestates;
@@ -85,6 +92,7 @@ namespace Config
         SetPrivateProfileIntA("General", "Movie Read Only", nextLoadRecords, Conf_File);
         //SetPrivateProfileIntA("Graphics", "Force Windowed", localTASflags.forceWindowed, Conf_File);
         SetPrivateProfileIntA("Tools", "Fast Forward Flags", localTASflags.fastForwardFlags, Conf_File);
+        SetPrivateProfileIntA("Sound", "High Quality Resampling", (localTASflags.emuMode & EMUMODE_HIGHQUALITYRESAMPLE) ? 1 : 0, Conf_File);
         if(advancePastNonVideoFramesConfigured)
             SetPrivateProfileIntA("Input", "Skip Lag Frames", advancePastNonVideoFrames, Conf_File);
         SetPrivateProfileIntA("Input", "Background Input Focus Flags", inputFocusFlags, Conf_File);
@@ -93,6 +101,13 @@ namespace Config
         SetPrivateProfileIntA("Debug", "Debug Logging Mode", localTASflags.debugPrintMode, Conf_File);
         SetPrivateProfileIntA("Debug", "Load Debug Tracing", traceEnabled, Conf_File);
         SetPrivateProfileIntA("General", "Verify CRCs", crcVerifyEnabled, Conf_File);
+        SetPrivateProfileIntA("AVI", "Queue Depth", aviQueueDepth, Conf_File);
+        SetPrivateProfileIntA("AVI", "Queue Megabytes", aviQueueMegabytes, Conf_File);
+        SetPrivateProfileIntA("AVI", "Conversion Threads", aviConversionThreads, Conf_File);
+        SetPrivateProfileIntA("AVI", "Skip Duplicate Frames", aviSkipDuplicateFrames, Conf_File);
+        SetPrivateProfileIntA("AVI", "Lossless Codec", aviLosslessCodec, Conf_File);
+        SetPrivateProfileIntA("AVI", "Shared Frame Memory", aviSharedFrameMemory, Conf_File);
+        WritePrivateProfileStringA("AVI", "Encoder Command", aviEncoderCommand, Conf_File);
 
         wsprintf(Str_Tmp, "%d", AutoRWLoad);
         WritePrivateProfileString("Watches", "AutoLoadWatches", Str_Tmp, Conf_File);
@@ -170,6 +185,10 @@ namespace Config
         nextLoadRecords = 0!=GetPrivateProfileIntA("General", "Movie Read Only", nextLoadRecords, Conf_File);
         //localTASflags.forceWindowed = GetPrivateProfileIntA("Graphics", "Force Windowed", localTASflags.forceWindowed, Conf_File);
         localTASflags.fastForwardFlags = GetPrivateProfileIntA("Tools", "Fast Forward Flags", localTASflags.fastForwardFlags, Conf_File);
+        if(GetPrivateProfileIntA("Sound", "High Quality Resampling", 0, Conf_File))
+            localTASflags.emuMode |= EMUMODE_HIGHQUALITYRESAMPLE;
+        else
+            localTASflags.emuMode &= ~EMUMODE_HIGHQUALITYRESAMPLE;
         advancePastNonVideoFrames = GetPrivateProfileIntA("Input", "Skip Lag Frames", advancePastNonVideoFrames, Conf_File);
         advancePastNonVideoFramesConfigured = 0!=GetPrivateProfileIntA("Input", "Skip Lag Frames", 0, Conf_File);
         inputFocusFlags = GetPrivateProfileIntA("Input", "Background Input Focus Flags", inputFocusFlags, Conf_File);
@@ -178,6 +197,13 @@ namespace Config
         localTASflags.debugPrintMode = static_cast<DebugPrintModeMask>(GetPrivateProfileIntA("Debug", "Debug Logging Mode", static_cast<int>(localTASflags.debugPrintMode), Conf_File));
         traceEnabled = 0!=GetPrivateProfileIntA("Debug", "Load Debug Tracing", traceEnabled, Conf_File);
         crcVerifyEnabled = 0!=GetPrivateProfileIntA("General", "Verify CRCs", crcVerifyEnabled, Conf_File);
+        aviQueueDepth = GetPrivateProfileIntA("AVI", "Queue Depth", aviQueueDepth, Conf_File);
+        aviQueueMegabytes = GetPrivateProfileIntA("AVI", "Queue Megabytes", aviQueueMegabytes, Conf_File);
+        aviConversionThreads = GetPrivateProfileIntA("AVI", "Conversion Threads", aviConversionThreads, Conf_File);
+        aviSkipDuplicateFrames = 0!=GetPrivateProfileIntA("AVI", "Skip Duplicate Frames", aviSkipDuplicateFrames, Conf_File);
+        aviLosslessCodec = 0!=GetPrivateProfileIntA("AVI", "Lossless Codec", aviLosslessCodec, Conf_File);
+        aviSharedFrameMemory = GetPrivateProfileIntA("AVI", "Shared Frame Memory", aviSharedFrameMemory, Conf_File);
+        GetPrivateProfileStringA("AVI", "Encoder Command", aviEncoderCommand, aviEncoderCommand, ARRAYSIZE(aviEncoderCommand), Conf_File);
 
         if (RWSaveWindowPos)
         {
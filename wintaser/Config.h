@@ -59,6 +59,13 @@ namespace Config{ // A namespace is maybe not the best solution...
     //extern int waitSyncMode;
     extern int aviFrameCount;
     extern int aviSoundFrameCount;
+    extern int aviQueueDepth; // how many frames can wait for the encoder
+    extern int aviQueueMegabytes; // how much memory the waiting frames may take up
+    extern int aviConversionThreads; // threads that convert captured frames, 0 for one per processor
+    extern bool aviSkipDuplicateFrames; // repeated frames are written as empty frames instead of encoded again (not with VfW codecs)
+    extern bool aviLosslessCodec; // compress AVI video with the built-in lossless codec instead of asking for a VfW codec, tools/hglc2avi decodes it
+    extern int aviSharedFrameMemory; // MB of memory shared with the game to hand captured frames over in, 0 to read them out of the game instead
+    extern char aviEncoderCommand [1024]; // if set, captures are piped to this command instead of written as AVI, see EncoderProcess
     extern bool traceEnabled;
     extern bool crcVerifyEnabled;
     //extern int storeVideoMemoryInSavestates;
@@ -272,6 +272,7 @@ void Build_Main_Menu(HMENU& MainMenu, HWND hWnd)
     MENU_L(TimeFastForward, i++, Flags | ((localTASflags.fastForwardFlags&FFMODE_FRONTSKIP)?MF_CHECKED:MF_UNCHECKED), ID_TIME_FF_FRONTSKIP, "", "Frontbuffer Frameskip", 0);
     MENU_L(TimeFastForward, i++, Flags | ((localTASflags.fastForwardFlags&FFMODE_BACKSKIP)?MF_CHECKED:MF_UNCHECKED), ID_TIME_FF_BACKSKIP, "", "Backbuffer Frameskip", 0);
     MENU_L(TimeFastForward, i++, Flags | ((recoveringStale||(localTASflags.fastForwardFlags&FFMODE_SOUNDSKIP))?MF_CHECKED:MF_UNCHECKED) | (recoveringStale ? MF_GRAYED : 0), ID_TIME_FF_SOUNDSKIP, "", "Soundskip", "always on while recovering stale");
+    MENU_L(TimeFastForward, i++, Flags | ((localTASflags.fastForwardFlags&FFMODE_LAZYMIX)?MF_CHECKED:MF_UNCHECKED) | (!(localTASflags.emuMode&EMUMODE_EMULATESOUND) ? MF_GRAYED : 0), ID_TIME_FF_LAZYMIX, "", "Lazy Sound Mixing", "software mixing must be enabled");
     MENU_L(TimeFastForward, i++, Flags | ((localTASflags.fastForwardFlags&FFMODE_RAMSKIP)?MF_CHECKED:MF_UNCHECKED), ID_TIME_FF_RAMSKIP, "", "RAM Search/Watch Skip", 0);
     MENU_L(TimeFastForward, i++, Flags | ((localTASflags.fastForwardFlags&FFMODE_SLEEPSKIP)?MF_CHECKED:MF_UNCHECKED), ID_TIME_FF_SLEEPSKIP, "", "Sleep Skip", 0);
     MENU_L(TimeFastForward, i++, Flags | ((localTASflags.fastForwardFlags&FFMODE_WAITSKIP)?MF_CHECKED:MF_UNCHECKED), ID_TIME_FF_WAITSKIP, "", "Wait Skip", 0);
@@ -481,6 +482,7 @@ void Build_Main_Menu(HMENU& MainMenu, HWND hWnd)
     InsertMenu(Sound, i++, MF_SEPARATOR, 0, nullptr);
     MENU_L(Sound, i++, Flags | ((localTASflags.emuMode & EMUMODE_NOPLAYBUFFERS) ? MF_CHECKED : MF_UNCHECKED), ID_SOUND_NOPLAYBUFFERS, "", (localTASflags.emuMode&EMUMODE_EMULATESOUND) ? ((localTASflags.aviMode&2) ? "&Mute Sound" : "&Mute Sound (Skip Mixing)") : "&Mute Sound (Skip Playing)", 0);
     MENU_L(Sound, i++, Flags | ((localTASflags.emuMode & EMUMODE_VIRTUALDIRECTSOUND) ? MF_CHECKED : MF_UNCHECKED), ID_SOUND_VIRTUALDIRECTSOUND, "", /*(emuMode&EMUMODE_EMULATESOUND) ? "&Virtual DirectSound" :*/ "&Disable DirectSound Creation", 0);
+    MENU_L(Sound, i++, Flags | ((localTASflags.emuMode & EMUMODE_HIGHQUALITYRESAMPLE) ? MF_CHECKED : MF_UNCHECKED) | (!(localTASflags.emuMode&EMUMODE_EMULATESOUND) ? MF_GRAYED : 0), ID_SOUND_HIGHQUALITYRESAMPLE, "", "&High Quality Resampling", "software mixing must be enabled");
 
 
 
@@ -509,6 +511,8 @@ void Build_Main_Menu(HMENU& MainMenu, HWND hWnd)
     const char* ramSearchString = "&RAM Search (not done)";
 
     MENU_L(TAS_Tools,i++,Flags|(ramSearchAvailable ? MF_ENABLED : MF_DISABLED | MF_GRAYED),ID_RAM_SEARCH,"",ramSearchString,"compiler too old");
+    MENU_L(TAS_Tools,i++,Flags,ID_POINTER_SCAN,"","&Pointer Scan", 0);
+    MENU_L(TAS_Tools,i++,Flags,ID_WATCH_TRIGGERS,"","Watch &Triggers", 0);
 
     //i = 0;
     //MENU_L(Lua_Script,i++,Flags,IDC_NEW_LUA_SCRIPT,"New Lua Script Window...","","&New Lua Script Window...");
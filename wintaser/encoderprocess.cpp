@@ -0,0 +1,293 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <windows.h>
+
+#include <cstdio>
+#include <string>
+
+#include "encoderprocess.h"
+
+namespace
+{
+    const DWORD PIPE_BUFFER_SIZE = 1 << 20;
+    /*
+     * Encoders can take a while to drain their lookahead after the input ends.
+     */
+    const DWORD FINISH_TIMEOUT_MS = 30000;
+
+    volatile LONG s_pipe_counter = 0;
+
+    bool ReplaceAll(std::string* text, const std::string& from, const std::string& to)
+    {
+        bool found = false;
+        size_t position = 0;
+        while ((position = text->find(from, position)) != std::string::npos)
+        {
+            text->replace(position, from.size(), to);
+            position += to.size();
+            found = true;
+        }
+        return found;
+    }
+
+    std::string FormatError(const char* what, DWORD error)
+    {
+        char text[256];
+        _snprintf(text, sizeof(text), "%s (error %u)", what, static_cast<unsigned int>(error));
+        text[sizeof(text) - 1] = '\0';
+        return text;
+    }
+
+    HANDLE OpenInheritable(const std::string& name, DWORD access, DWORD creation)
+    {
+        SECURITY_ATTRIBUTES attributes = { sizeof(attributes), nullptr, TRUE };
+        return CreateFileA(name.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, &attributes, creation,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+}
+
+EncoderProcess::PipeSink::PipeSink() :
+    m_pipe(INVALID_HANDLE_VALUE),
+    m_event(nullptr),
+    m_process(nullptr),
+    m_connected(false)
+{
+    ZeroMemory(&m_overlapped, sizeof(m_overlapped));
+}
+
+EncoderProcess::PipeSink::~PipeSink()
+{
+    Close();
+}
+
+bool EncoderProcess::PipeSink::Create(const std::string& name)
+{
+    m_name = name;
+    m_pipe = CreateNamedPipeA(name.c_str(), PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                              PIPE_TYPE_BYTE | PIPE_WAIT, 1, PIPE_BUFFER_SIZE, 0, 0, nullptr);
+    m_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    m_overlapped.hEvent = m_event;
+    return m_pipe != INVALID_HANDLE_VALUE && m_event != nullptr;
+}
+
+void EncoderProcess::PipeSink::SetProcess(HANDLE process)
+{
+    m_process = process;
+}
+
+HANDLE EncoderProcess::PipeSink::OpenClientEnd()
+{
+    HANDLE client = OpenInheritable(m_name, GENERIC_READ, OPEN_EXISTING);
+    if (client != INVALID_HANDLE_VALUE)
+    {
+        m_connected = true;
+    }
+    return client;
+}
+
+bool EncoderProcess::PipeSink::Write(const void* data, unsigned int size)
+{
+    if (m_pipe == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    DWORD transferred = 0;
+    if (!m_connected)
+    {
+        /*
+         * The encoder opens its inputs whenever it gets to them, which may be well after the
+         * first frame, so this is where the wait for that happens, on the thread writing.
+         */
+        ResetEvent(m_event);
+        if (ConnectNamedPipe(m_pipe, &m_overlapped) == FALSE)
+        {
+            DWORD error = GetLastError();
+            if (error == ERROR_IO_PENDING)
+            {
+                if (!Wait(&transferred))
+                {
+                    return false;
+                }
+            }
+            else if (error != ERROR_PIPE_CONNECTED)
+            {
+                return false;
+            }
+        }
+        m_connected = true;
+    }
+    ResetEvent(m_event);
+    if (WriteFile(m_pipe, data, size, nullptr, &m_overlapped) == FALSE && GetLastError() != ERROR_IO_PENDING)
+    {
+        return false;
+    }
+    return Wait(&transferred) && transferred == size;
+}
+
+void EncoderProcess::PipeSink::Close()
+{
+    if (m_pipe != INVALID_HANDLE_VALUE)
+    {
+        if (m_connected)
+        {
+            /*
+             * Closing the pipe throws away whatever the encoder hasn't read yet.
+             */
+            FlushFileBuffers(m_pipe);
+        }
+        CloseHandle(m_pipe);
+        m_pipe = INVALID_HANDLE_VALUE;
+    }
+    if (m_event != nullptr)
+    {
+        CloseHandle(m_event);
+        m_event = nullptr;
+    }
+    m_process = nullptr;
+    m_connected = false;
+}
+
+const std::string& EncoderProcess::PipeSink::GetName() const
+{
+    return m_name;
+}
+
+bool EncoderProcess::PipeSink::Wait(DWORD* transferred)
+{
+    HANDLE handles[2] = { m_event, m_process };
+    DWORD count = (m_process != nullptr) ? 2 : 1;
+    if (WaitForMultipleObjects(count, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+    {
+        /*
+         * The encoder exited without reading everything.
+         */
+        CancelIo(m_pipe);
+        GetOverlappedResult(m_pipe, &m_overlapped, transferred, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(m_pipe, &m_overlapped, transferred, FALSE) != FALSE;
+}
+
+EncoderProcess::EncoderProcess() :
+    m_video_sink(nullptr),
+    m_audio_sink(nullptr),
+    m_process(nullptr)
+{
+}
+
+EncoderProcess::~EncoderProcess()
+{
+    Finish();
+}
+
+bool EncoderProcess::Start(const char* command, const char* output_filename, bool video, bool audio,
+                           std::string* error)
+{
+    char prefix[64];
+    _snprintf(prefix, sizeof(prefix), "\\\\.\\pipe\\hourglass-%u-%d-", static_cast<unsigned int>(GetCurrentProcessId()),
+              static_cast<int>(InterlockedIncrement(&s_pipe_counter)));
+    prefix[sizeof(prefix) - 1] = '\0';
+    std::string video_name = std::string(prefix) + "video";
+    std::string audio_name = std::string(prefix) + "audio";
+
+    std::string command_line = command;
+    bool video_named = ReplaceAll(&command_line, "%video%", video_name);
+    bool audio_named = ReplaceAll(&command_line, "%audio%", audio_name);
+    ReplaceAll(&command_line, "%output%", output_filename);
+
+    PipeSink* stdin_sink = nullptr;
+    if (video && !video_named)
+    {
+        stdin_sink = &m_video;
+    }
+    else if (audio && !audio_named)
+    {
+        stdin_sink = &m_audio;
+    }
+    if ((video_named || stdin_sink == &m_video) && !m_video.Create(video_name))
+    {
+        *error = FormatError("Couldn't create the video pipe", GetLastError());
+        Finish();
+        return false;
+    }
+    if ((audio_named || stdin_sink == &m_audio) && !m_audio.Create(audio_name))
+    {
+        *error = FormatError("Couldn't create the audio pipe", GetLastError());
+        Finish();
+        return false;
+    }
+
+    HANDLE input = (stdin_sink != nullptr) ? stdin_sink->OpenClientEnd()
+                                           : OpenInheritable("NUL", GENERIC_READ, OPEN_EXISTING);
+    if (input == INVALID_HANDLE_VALUE)
+    {
+        *error = FormatError("Couldn't open the encoder's standard input", GetLastError());
+        Finish();
+        return false;
+    }
+    HANDLE log = OpenInheritable(std::string(output_filename) + ".log", GENERIC_WRITE, CREATE_ALWAYS);
+
+    STARTUPINFOA startup_info = { sizeof(startup_info) };
+    startup_info.dwFlags = STARTF_USESTDHANDLES;
+    startup_info.hStdInput = input;
+    startup_info.hStdOutput = log;
+    startup_info.hStdError = log;
+    PROCESS_INFORMATION process_info = { 0 };
+    BOOL started = CreateProcessA(nullptr, &command_line[0], nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr,
+                                  nullptr, &startup_info, &process_info);
+    DWORD start_error = GetLastError();
+
+    /*
+     * The encoder has its own copies of these now.
+     */
+    CloseHandle(input);
+    if (log != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(log);
+    }
+    if (started == FALSE)
+    {
+        *error = FormatError("Couldn't run the encoder command", start_error);
+        Finish();
+        return false;
+    }
+    CloseHandle(process_info.hThread);
+    m_process = process_info.hProcess;
+    m_video.SetProcess(m_process);
+    m_audio.SetProcess(m_process);
+
+    m_video_sink = (video && (video_named || stdin_sink == &m_video)) ? &m_video : nullptr;
+    m_audio_sink = (audio && (audio_named || stdin_sink == &m_audio)) ? &m_audio : nullptr;
+    return true;
+}
+
+StreamSink* EncoderProcess::GetVideoSink()
+{
+    return m_video_sink;
+}
+
+StreamSink* EncoderProcess::GetAudioSink()
+{
+    return m_audio_sink;
+}
+
+bool EncoderProcess::Finish()
+{
+    m_video_sink = nullptr;
+    m_audio_sink = nullptr;
+    m_video.Close();
+    m_audio.Close();
+    if (m_process == nullptr)
+    {
+        return true;
+    }
+    DWORD exit_code = STILL_ACTIVE;
+    if (WaitForSingleObject(m_process, FINISH_TIMEOUT_MS) == WAIT_OBJECT_0)
+    {
+        GetExitCodeProcess(m_process, &exit_code);
+    }
+    CloseHandle(m_process);
+    m_process = nullptr;
+    return exit_code == 0;
+}
@@ -0,0 +1,86 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+
+#include "rawstreams.h"
+
+/*
+ * Runs an external encoder and feeds it the capture through pipes.
+ *
+ * In the command, %video% and %audio% are replaced by the names of pipes that the video and
+ * audio streams are written to, and %output% by the name of the file being captured to.
+ * A stream that the command doesn't name goes to the encoder's standard input instead, which only
+ * one of them can use. The encoder's own output goes to a log next to the capture file.
+ */
+class EncoderProcess
+{
+public:
+    EncoderProcess();
+    ~EncoderProcess();
+
+    /*
+     * On failure error is set to what went wrong.
+     */
+    bool Start(const char* command, const char* output_filename, bool video, bool audio,
+               std::string* error);
+    /*
+     * Where to write each stream, or nullptr if the command gives it nowhere to go.
+     * Each sink must only be used by one thread at a time, but the two can be used at once.
+     */
+    StreamSink* GetVideoSink();
+    StreamSink* GetAudioSink();
+    /*
+     * Closes the pipes, so that the encoder sees the end of its input, and gives it a while to
+     * finish. Returns false if it failed or is still running.
+     */
+    bool Finish();
+
+private:
+    class PipeSink : public StreamSink
+    {
+    public:
+        PipeSink();
+        ~PipeSink();
+
+        bool Create(const std::string& name);
+        void SetProcess(HANDLE process);
+        /*
+         * Opens the other end of the pipe for the encoder to inherit as its standard input.
+         */
+        HANDLE OpenClientEnd();
+        virtual bool Write(const void* data, unsigned int size);
+        void Close();
+
+        const std::string& GetName() const;
+
+    private:
+        PipeSink(const PipeSink&);
+        PipeSink& operator=(const PipeSink&);
+
+        /*
+         * Waits for an overlapped operation, giving up if the encoder exits first.
+         */
+        bool Wait(DWORD* transferred);
+
+        std::string m_name;
+        HANDLE m_pipe;
+        HANDLE m_event;
+        HANDLE m_process;
+        OVERLAPPED m_overlapped;
+        bool m_connected;
+    };
+
+    EncoderProcess(const EncoderProcess&);
+    EncoderProcess& operator=(const EncoderProcess&);
+
+    PipeSink m_video;
+    PipeSink m_audio;
+    PipeSink* m_video_sink;
+    PipeSink* m_audio_sink;
+    HANDLE m_process;
+};
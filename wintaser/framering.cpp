@@ -0,0 +1,212 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * A side that finds the ring full or empty sets its waiting flag, checks again and only then
+ * sleeps on its event. The other side clears the flag after publishing its change and signals
+ * the event only if the flag was set. Both the flags and the counters are changed with
+ * interlocked operations, which are full barriers, so whichever order the two sides get there
+ * in, either the check sees the change or the other side sees the flag. A leftover signal only
+ * causes one extra check.
+ */
+
+#include <windows.h>
+
+#include <vector>
+
+#include "framering.h"
+
+namespace
+{
+    LONGLONG GetTicks()
+    {
+        LARGE_INTEGER ticks;
+        QueryPerformanceCounter(&ticks);
+        return ticks.QuadPart;
+    }
+}
+
+FrameRing::FrameRing(unsigned int depth, unsigned int max_bytes) :
+    m_depth((depth > 0) ? depth : 1),
+    m_max_bytes(max_bytes),
+    m_sizes(m_depth),
+    m_queue_times(m_depth),
+    m_written(0),
+    m_read(0),
+    m_queued_bytes(0),
+    m_closed(0),
+    m_producer_waiting(0),
+    m_consumer_waiting(0),
+    m_space_event(CreateEvent(nullptr, FALSE, FALSE, nullptr)),
+    m_frame_event(CreateEvent(nullptr, FALSE, FALSE, nullptr)),
+    m_write_slot(0),
+    m_write_size(0),
+    m_peak_occupancy(0),
+    m_frames(0),
+    m_producer_stalls(0),
+    m_stall_ticks(0),
+    m_read_slot(0),
+    m_frames_read(0),
+    m_latency_ticks(0),
+    m_max_latency_ticks(0),
+    m_ticks_per_second(1)
+{
+    LARGE_INTEGER frequency;
+    if (QueryPerformanceFrequency(&frequency) != FALSE && frequency.QuadPart > 0)
+    {
+        m_ticks_per_second = frequency.QuadPart;
+    }
+}
+
+FrameRing::~FrameRing()
+{
+    CloseHandle(m_space_event);
+    CloseHandle(m_frame_event);
+}
+
+unsigned int FrameRing::GetDepth() const
+{
+    return m_depth;
+}
+
+void FrameRing::GetStats(FrameRingStats* stats) const
+{
+    double ticks_per_second = static_cast<double>(m_ticks_per_second);
+    stats->depth = m_depth;
+    stats->max_bytes = m_max_bytes;
+    stats->occupancy = GetUsed();
+    stats->peak_occupancy = m_peak_occupancy;
+    stats->queued_bytes = static_cast<unsigned int>(m_queued_bytes);
+    stats->frames = m_frames;
+    stats->producer_stalls = m_producer_stalls;
+    stats->stall_seconds = static_cast<double>(m_stall_ticks) / ticks_per_second;
+    stats->average_latency = (m_frames_read == 0) ? 0.0 : static_cast<double>(m_latency_ticks)
+                                                          / ticks_per_second
+                                                          / static_cast<double>(m_frames_read);
+    stats->max_latency = static_cast<double>(m_max_latency_ticks) / ticks_per_second;
+}
+
+int FrameRing::BeginWrite(unsigned int size)
+{
+    LONGLONG stall_start = 0;
+    while (m_closed == 0 && !HasRoom(size))
+    {
+        if (stall_start == 0)
+        {
+            stall_start = GetTicks();
+            m_producer_stalls++;
+        }
+        InterlockedExchange(&m_producer_waiting, 1);
+        if (m_closed != 0 || HasRoom(size))
+        {
+            InterlockedExchange(&m_producer_waiting, 0);
+        }
+        else
+        {
+            WaitForSingleObject(m_space_event, INFINITE);
+        }
+    }
+    if (stall_start != 0)
+    {
+        m_stall_ticks += GetTicks() - stall_start;
+    }
+    if (m_closed != 0)
+    {
+        return -1;
+    }
+    m_write_size = size;
+    return static_cast<int>(m_write_slot);
+}
+
+void FrameRing::EndWrite()
+{
+    m_sizes[m_write_slot] = m_write_size;
+    m_queue_times[m_write_slot] = GetTicks();
+    InterlockedExchangeAdd(&m_queued_bytes, static_cast<LONG>(m_write_size));
+    m_write_slot = (m_write_slot + 1) % m_depth;
+    m_frames++;
+    unsigned int used = static_cast<unsigned int>(InterlockedIncrement(&m_written) - m_read);
+    if (used > m_peak_occupancy)
+    {
+        m_peak_occupancy = used;
+    }
+    Wake(&m_consumer_waiting, m_frame_event);
+}
+
+int FrameRing::BeginRead()
+{
+    while (m_closed == 0 && GetUsed() == 0)
+    {
+        InterlockedExchange(&m_consumer_waiting, 1);
+        if (m_closed != 0 || GetUsed() != 0)
+        {
+            InterlockedExchange(&m_consumer_waiting, 0);
+        }
+        else
+        {
+            WaitForSingleObject(m_frame_event, INFINITE);
+        }
+    }
+    if (m_closed != 0)
+    {
+        return -1;
+    }
+    LONGLONG latency = GetTicks() - m_queue_times[m_read_slot];
+    m_latency_ticks += latency;
+    if (latency > m_max_latency_ticks)
+    {
+        m_max_latency_ticks = latency;
+    }
+    m_frames_read++;
+    return static_cast<int>(m_read_slot);
+}
+
+void FrameRing::EndRead()
+{
+    InterlockedExchangeAdd(&m_queued_bytes, -static_cast<LONG>(m_sizes[m_read_slot]));
+    m_read_slot = (m_read_slot + 1) % m_depth;
+    InterlockedIncrement(&m_read);
+    Wake(&m_producer_waiting, m_space_event);
+}
+
+void FrameRing::Close()
+{
+    InterlockedExchange(&m_closed, 1);
+    SetEvent(m_space_event);
+    SetEvent(m_frame_event);
+}
+
+void FrameRing::WaitUntilEmpty() const
+{
+    /*
+     * This is only used when closing a file, so polling is good enough and keeps the waiting
+     * flags to the two threads that use the ring.
+     */
+    while (m_closed == 0 && GetUsed() != 0)
+    {
+        Sleep(1);
+    }
+}
+
+unsigned int FrameRing::GetUsed() const
+{
+    return static_cast<unsigned int>(m_written - m_read);
+}
+
+bool FrameRing::HasRoom(unsigned int size) const
+{
+    unsigned int used = GetUsed();
+    if (used >= m_depth)
+    {
+        return false;
+    }
+    return used == 0 || static_cast<unsigned int>(m_queued_bytes) + size <= m_max_bytes;
+}
+
+void FrameRing::Wake(volatile LONG* waiting, HANDLE event)
+{
+    if (InterlockedCompareExchange(waiting, 0, 1) == 1)
+    {
+        SetEvent(event);
+    }
+}
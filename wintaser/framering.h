@@ -0,0 +1,121 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+#include <vector>
+
+struct FrameRingStats
+{
+    unsigned int depth;
+    unsigned int max_bytes;
+    /*
+     * Frames queued right now, and the most there have been at once.
+     */
+    unsigned int occupancy;
+    unsigned int peak_occupancy;
+    unsigned int queued_bytes;
+    unsigned int frames;
+    /*
+     * How often, and for how long in total, the producer had to wait for room.
+     */
+    unsigned int producer_stalls;
+    double stall_seconds;
+    /*
+     * Time from a frame being queued to the consumer taking it.
+     */
+    double average_latency;
+    double max_latency;
+};
+
+/*
+ * Hands frames from one producer thread to one consumer thread through a ring of depth slots.
+ * The ring only deals in slot indexes, the caller owns whatever the slots hold.
+ *
+ * Neither side takes a lock. Waiting only happens when the ring is full or empty, and then on an
+ * event that the other side only signals if someone is actually waiting. Besides the slot count,
+ * the producer also waits while the frames in the ring add up to more than max_bytes, unless the
+ * ring is empty, so big frames can't pile up without bound when the consumer falls behind.
+ */
+class FrameRing
+{
+public:
+    FrameRing(unsigned int depth, unsigned int max_bytes);
+    ~FrameRing();
+
+    unsigned int GetDepth() const;
+    /*
+     * The counters are updated without synchronization, so they can be slightly off while
+     * frames are going through.
+     */
+    void GetStats(FrameRingStats* stats) const;
+
+    /*
+     * Producer side. Waits for room for a frame of size bytes and returns the slot to fill in,
+     * or -1 if the ring has been closed. EndWrite hands the filled slot to the consumer.
+     */
+    int BeginWrite(unsigned int size);
+    void EndWrite();
+    /*
+     * Consumer side. Waits for a frame and returns its slot, or -1 once the ring is closed.
+     * EndRead gives the slot back to the producer.
+     */
+    int BeginRead();
+    void EndRead();
+
+    /*
+     * Wakes up both sides and makes every Begin call fail from now on.
+     */
+    void Close();
+    /*
+     * Waits until the consumer is done with every frame written so far, or the ring is closed.
+     */
+    void WaitUntilEmpty() const;
+
+private:
+    FrameRing(const FrameRing&);
+    FrameRing& operator=(const FrameRing&);
+
+    unsigned int GetUsed() const;
+    bool HasRoom(unsigned int size) const;
+    static void Wake(volatile LONG* waiting, HANDLE event);
+
+    unsigned int m_depth;
+    unsigned int m_max_bytes;
+    std::vector<unsigned int> m_sizes;
+    std::vector<LONGLONG> m_queue_times;
+
+    /*
+     * Frames written and read so far. Each is only changed by its own side.
+     */
+    volatile LONG m_written;
+    volatile LONG m_read;
+    volatile LONG m_queued_bytes;
+    volatile LONG m_closed;
+    volatile LONG m_producer_waiting;
+    volatile LONG m_consumer_waiting;
+    HANDLE m_space_event;
+    HANDLE m_frame_event;
+
+    /*
+     * Owned by the producer.
+     */
+    unsigned int m_write_slot;
+    unsigned int m_write_size;
+    unsigned int m_peak_occupancy;
+    unsigned int m_frames;
+    unsigned int m_producer_stalls;
+    LONGLONG m_stall_ticks;
+
+    /*
+     * Owned by the consumer.
+     */
+    unsigned int m_read_slot;
+    unsigned int m_frames_read;
+    LONGLONG m_latency_ticks;
+    LONGLONG m_max_latency_ticks;
+
+    LONGLONG m_ticks_per_second;
+};
@@ -0,0 +1,923 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "imageencoder.h"
+
+namespace
+{
+    const unsigned char PNG_SIGNATURE[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    const unsigned int BMP_HEADER_SIZE = 54;
+    const unsigned int TGA_HEADER_SIZE = 18;
+    const char TGA_SIGNATURE[] = "TRUEVISION-XFILE.";
+
+    /*
+     * The zlib header for a deflate stream with a 32 KB window, marked as compressed with the
+     * fast settings.
+     */
+    const unsigned char ZLIB_CMF = 0x78;
+    const unsigned char ZLIB_FLG = 0x5E;
+
+    const int WINDOW_SIZE = 32768;
+    const int HASH_BITS = 15;
+    const int HASH_SIZE = 1 << HASH_BITS;
+    const int MIN_MATCH = 3;
+    const int MAX_MATCH = 258;
+    /*
+     * How many earlier positions with the same hash the match finder tries, and the length of
+     * match it stops looking at.
+     */
+    const int MAX_CHAIN = 32;
+    const int NICE_MATCH = 128;
+
+    /*
+     * Each block gets its own Huffman codes, made for this many symbols.
+     */
+    const unsigned int BLOCK_SYMBOLS = 1 << 15;
+    const unsigned int MAX_STORED = 65535;
+    const unsigned int MATCH_FLAG = 0x80000000;
+
+    const int LITERAL_CODES = 286;
+    const int DISTANCE_CODES = 30;
+    const int CODE_LENGTH_CODES = 19;
+    const int END_OF_BLOCK = 256;
+    const int FIRST_LENGTH_CODE = 257;
+    const int MAX_CODE_LENGTH = 15;
+    const int MAX_CODE_LENGTH_LENGTH = 7;
+
+    enum BlockType
+    {
+        BLOCK_STORED = 0,
+        BLOCK_DYNAMIC = 2,
+    };
+
+    const unsigned short LENGTH_BASES[29] =
+    {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115,
+        131, 163, 195, 227, 258,
+    };
+    const unsigned char LENGTH_EXTRA_BITS[29] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+    };
+    const unsigned short DISTANCE_BASES[30] =
+    {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+        2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+    };
+    const unsigned char DISTANCE_EXTRA_BITS[30] =
+    {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+        13, 13,
+    };
+    const unsigned char CODE_LENGTH_ORDER[CODE_LENGTH_CODES] =
+    {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+    };
+
+    enum CodeLengthSymbol
+    {
+        REPEAT_PREVIOUS = 16,
+        REPEAT_ZERO = 17,
+        REPEAT_ZERO_LONG = 18,
+    };
+
+    void PutLE(std::vector<unsigned char>& out, unsigned int value, unsigned int bytes)
+    {
+        for (unsigned int i = 0; i < bytes; i++)
+        {
+            out.push_back(static_cast<unsigned char>(value >> (i * 8)));
+        }
+    }
+
+    void PutBE(std::vector<unsigned char>& out, unsigned int value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            out.push_back(static_cast<unsigned char>(value >> shift));
+        }
+    }
+
+    /*
+     * The table is small enough to make on every call, which keeps this safe to use from
+     * several threads without any set up.
+     */
+    unsigned int Crc32(const unsigned char* data, size_t size)
+    {
+        unsigned int table[256];
+        for (unsigned int n = 0; n < 256; n++)
+        {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++)
+            {
+                c = ((c & 1) != 0) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        unsigned int crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    unsigned int Adler32(const unsigned char* data, size_t size)
+    {
+        /*
+         * The most bytes that can be summed before the sums have to be reduced.
+         */
+        const size_t MAX_RUN = 5552;
+        unsigned int a = 1;
+        unsigned int b = 0;
+        while (size > 0)
+        {
+            size_t run = (size < MAX_RUN) ? size : MAX_RUN;
+            size -= run;
+            for (size_t i = 0; i < run; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            data += run;
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    /*
+     * Adds a PNG chunk with the data that has been put after position start, which is where
+     * the chunk's length goes.
+     */
+    void FinishChunk(std::vector<unsigned char>& out, size_t start)
+    {
+        unsigned int length = static_cast<unsigned int>(out.size() - start - 8);
+        for (int i = 0; i < 4; i++)
+        {
+            out[start + i] = static_cast<unsigned char>(length >> (24 - i * 8));
+        }
+        PutBE(out, Crc32(&out[start + 4], length + 4));
+    }
+
+    size_t StartChunk(std::vector<unsigned char>& out, const char* type)
+    {
+        size_t start = out.size();
+        PutBE(out, 0);
+        out.insert(out.end(), type, type + 4);
+        return start;
+    }
+
+    /*
+     * Codes are written from their least significant bit, and fill bytes from their least
+     * significant bit, as deflate has it.
+     */
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<unsigned char>* out) :
+            m_out(out),
+            m_bits(0),
+            m_count(0)
+        {
+        }
+
+        void Write(unsigned int bits, int count)
+        {
+            m_bits |= static_cast<unsigned long long>(bits) << m_count;
+            m_count += count;
+            while (m_count >= 8)
+            {
+                m_out->push_back(static_cast<unsigned char>(m_bits));
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        void AlignToByte()
+        {
+            if (m_count > 0)
+            {
+                m_out->push_back(static_cast<unsigned char>(m_bits));
+            }
+            m_bits = 0;
+            m_count = 0;
+        }
+
+        /*
+         * Only after AlignToByte.
+         */
+        void WriteBytes(const unsigned char* data, unsigned int size)
+        {
+            m_out->insert(m_out->end(), data, data + size);
+        }
+
+    private:
+        std::vector<unsigned char>* m_out;
+        unsigned long long m_bits;
+        int m_count;
+    };
+
+    /*
+     * Huffman code lengths for the symbol counts, none longer than max_length. If the tree
+     * comes out too deep, the counts are halved until it doesn't.
+     */
+    void BuildCodeLengths(const unsigned int* counts, int symbols, int max_length, unsigned char* lengths)
+    {
+        typedef std::pair<unsigned long long, int> Node;
+        std::vector<unsigned long long> weights(counts, counts + symbols);
+        std::vector<int> parents(2 * symbols);
+        for (;;)
+        {
+            std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+            for (int symbol = 0; symbol < symbols; symbol++)
+            {
+                lengths[symbol] = 0;
+                if (weights[symbol] != 0)
+                {
+                    queue.push(Node(weights[symbol], symbol));
+                }
+            }
+            if (queue.empty())
+            {
+                return;
+            }
+            if (queue.size() == 1)
+            {
+                lengths[queue.top().second] = 1;
+                return;
+            }
+            int next = symbols;
+            while (queue.size() > 1)
+            {
+                Node first = queue.top();
+                queue.pop();
+                Node second = queue.top();
+                queue.pop();
+                parents[first.second] = next;
+                parents[second.second] = next;
+                queue.push(Node(first.first + second.first, next));
+                next++;
+            }
+            int root = next - 1;
+
+            int longest = 0;
+            for (int symbol = 0; symbol < symbols; symbol++)
+            {
+                if (weights[symbol] == 0)
+                {
+                    continue;
+                }
+                int length = 0;
+                for (int node = symbol; node != root; node = parents[node])
+                {
+                    length++;
+                }
+                lengths[symbol] = static_cast<unsigned char>((length <= max_length) ? length : 0);
+                if (length > longest)
+                {
+                    longest = length;
+                }
+            }
+            if (longest <= max_length)
+            {
+                return;
+            }
+            for (int symbol = 0; symbol < symbols; symbol++)
+            {
+                if (weights[symbol] != 0)
+                {
+                    weights[symbol] = (weights[symbol] + 1) >> 1;
+                }
+            }
+        }
+    }
+
+    /*
+     * Canonical codes, bit reversed so that BitWriter writes them from their first bit.
+     */
+    void AssignCodes(const unsigned char* lengths, int symbols, unsigned short* codes)
+    {
+        int length_counts[MAX_CODE_LENGTH + 1] = {0};
+        for (int symbol = 0; symbol < symbols; symbol++)
+        {
+            length_counts[lengths[symbol]]++;
+        }
+        length_counts[0] = 0;
+        unsigned int next_codes[MAX_CODE_LENGTH + 1];
+        unsigned int code = 0;
+        for (int length = 1; length <= MAX_CODE_LENGTH; length++)
+        {
+            code = (code + length_counts[length - 1]) << 1;
+            next_codes[length] = code;
+        }
+        for (int symbol = 0; symbol < symbols; symbol++)
+        {
+            int length = lengths[symbol];
+            if (length == 0)
+            {
+                codes[symbol] = 0;
+                continue;
+            }
+            unsigned int canonical = next_codes[length]++;
+            unsigned int reversed = 0;
+            for (int bit = 0; bit < length; bit++)
+            {
+                reversed = (reversed << 1) | ((canonical >> bit) & 1);
+            }
+            codes[symbol] = static_cast<unsigned short>(reversed);
+        }
+    }
+
+    /*
+     * The last entry of bases that isn't more than value.
+     */
+    int FindCode(const unsigned short* bases, int count, int value)
+    {
+        int low = 0;
+        int high = count - 1;
+        while (low < high)
+        {
+            int middle = (low + high + 1) / 2;
+            if (bases[middle] <= value)
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle - 1;
+            }
+        }
+        return low;
+    }
+
+    unsigned int Hash(const unsigned char* data)
+    {
+        unsigned int bytes = data[0] | (data[1] << 8) | (data[2] << 16);
+        return (bytes * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    /*
+     * The code lengths of a dynamic block's two codes, run-length coded with the code length
+     * symbols. Each entry is a symbol with its extra bits above it.
+     */
+    void CompressCodeLengths(const unsigned char* lengths, int count, std::vector<unsigned int>* entries)
+    {
+        int i = 0;
+        while (i < count)
+        {
+            int length = lengths[i];
+            int run = 1;
+            while (i + run < count && lengths[i + run] == length)
+            {
+                run++;
+            }
+            i += run;
+            if (length == 0)
+            {
+                while (run >= 11)
+                {
+                    int part = (run < 138) ? run : 138;
+                    entries->push_back(REPEAT_ZERO_LONG | ((part - 11) << 8));
+                    run -= part;
+                }
+                if (run >= 3)
+                {
+                    entries->push_back(REPEAT_ZERO | ((run - 3) << 8));
+                    run = 0;
+                }
+            }
+            else
+            {
+                entries->push_back(length);
+                run--;
+                while (run >= 3)
+                {
+                    int part = (run < 6) ? run : 6;
+                    entries->push_back(REPEAT_PREVIOUS | ((part - 3) << 8));
+                    run -= part;
+                }
+            }
+            while (run > 0)
+            {
+                entries->push_back(length);
+                run--;
+            }
+        }
+    }
+
+    int GetCodeLengthExtraBits(unsigned int symbol)
+    {
+        switch (symbol)
+        {
+        case REPEAT_PREVIOUS:
+            return 2;
+        case REPEAT_ZERO:
+            return 3;
+        case REPEAT_ZERO_LONG:
+            return 7;
+        default:
+            return 0;
+        }
+    }
+
+    void WriteStoredBlocks(const unsigned char* data, unsigned int size, bool last, BitWriter* writer)
+    {
+        do
+        {
+            unsigned int part = (size < MAX_STORED) ? size : MAX_STORED;
+            size -= part;
+            writer->Write((last && size == 0) ? 1 : 0, 1);
+            writer->Write(BLOCK_STORED, 2);
+            writer->AlignToByte();
+            writer->Write(part, 16);
+            writer->Write(~part & 0xFFFF, 16);
+            writer->WriteBytes(data, part);
+            data += part;
+        } while (size > 0);
+    }
+
+    /*
+     * Writes the symbols as one dynamic block, or the bytes they stand for as stored blocks if
+     * that's smaller.
+     */
+    void WriteBlock(const std::vector<unsigned int>& symbols, const unsigned char* data, unsigned int size,
+                    bool last, BitWriter* writer)
+    {
+        if (symbols.empty())
+        {
+            WriteStoredBlocks(data, size, last, writer);
+            return;
+        }
+
+        unsigned int literal_counts[LITERAL_CODES] = {0};
+        unsigned int distance_counts[DISTANCE_CODES] = {0};
+        for (size_t i = 0; i < symbols.size(); i++)
+        {
+            unsigned int symbol = symbols[i];
+            if ((symbol & MATCH_FLAG) == 0)
+            {
+                literal_counts[symbol]++;
+                continue;
+            }
+            int length = (symbol >> 16) & 0x1FF;
+            int distance = symbol & 0xFFFF;
+            literal_counts[FIRST_LENGTH_CODE + FindCode(LENGTH_BASES, 29, length)]++;
+            distance_counts[FindCode(DISTANCE_BASES, DISTANCE_CODES, distance)]++;
+        }
+        literal_counts[END_OF_BLOCK] = 1;
+
+        unsigned char literal_lengths[LITERAL_CODES];
+        unsigned char distance_lengths[DISTANCE_CODES];
+        BuildCodeLengths(literal_counts, LITERAL_CODES, MAX_CODE_LENGTH, literal_lengths);
+        BuildCodeLengths(distance_counts, DISTANCE_CODES, MAX_CODE_LENGTH, distance_lengths);
+        /*
+         * A block without any matches still needs a distance code, one code of one bit is
+         * what decoders expect then.
+         */
+        int literal_count = LITERAL_CODES;
+        while (literal_count > FIRST_LENGTH_CODE && literal_lengths[literal_count - 1] == 0)
+        {
+            literal_count--;
+        }
+        int distance_count = DISTANCE_CODES;
+        while (distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+        {
+            distance_count--;
+        }
+        if (distance_lengths[0] == 0 && distance_count == 1)
+        {
+            distance_lengths[0] = 1;
+        }
+        unsigned char lengths[LITERAL_CODES + DISTANCE_CODES];
+        memcpy(lengths, literal_lengths, literal_count);
+        memcpy(lengths + literal_count, distance_lengths, distance_count);
+
+        std::vector<unsigned int> entries;
+        CompressCodeLengths(lengths, literal_count + distance_count, &entries);
+        unsigned int code_length_counts[CODE_LENGTH_CODES] = {0};
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            code_length_counts[entries[i] & 0xFF]++;
+        }
+        unsigned char code_length_lengths[CODE_LENGTH_CODES];
+        BuildCodeLengths(code_length_counts, CODE_LENGTH_CODES, MAX_CODE_LENGTH_LENGTH, code_length_lengths);
+        int code_length_count = CODE_LENGTH_CODES;
+        while (code_length_count > 4 && code_length_lengths[CODE_LENGTH_ORDER[code_length_count - 1]] == 0)
+        {
+            code_length_count--;
+        }
+
+        unsigned long long bits = 3 + 5 + 5 + 4 + 3 * code_length_count;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            unsigned int symbol = entries[i] & 0xFF;
+            bits += code_length_lengths[symbol] + GetCodeLengthExtraBits(symbol);
+        }
+        for (int code = 0; code < LITERAL_CODES; code++)
+        {
+            bits += static_cast<unsigned long long>(literal_counts[code]) * literal_lengths[code];
+            if (code >= FIRST_LENGTH_CODE)
+            {
+                bits += static_cast<unsigned long long>(literal_counts[code])
+                        * LENGTH_EXTRA_BITS[code - FIRST_LENGTH_CODE];
+            }
+        }
+        for (int code = 0; code < DISTANCE_CODES; code++)
+        {
+            bits += static_cast<unsigned long long>(distance_counts[code])
+                    * (distance_lengths[code] + DISTANCE_EXTRA_BITS[code]);
+        }
+        unsigned long long stored_bits = (size + 5ull * (size / MAX_STORED + 1)) * 8;
+        if (stored_bits <= bits)
+        {
+            WriteStoredBlocks(data, size, last, writer);
+            return;
+        }
+
+        unsigned short literal_codes[LITERAL_CODES];
+        unsigned short distance_codes[DISTANCE_CODES];
+        unsigned short code_length_codes[CODE_LENGTH_CODES];
+        AssignCodes(literal_lengths, LITERAL_CODES, literal_codes);
+        AssignCodes(distance_lengths, DISTANCE_CODES, distance_codes);
+        AssignCodes(code_length_lengths, CODE_LENGTH_CODES, code_length_codes);
+
+        writer->Write(last ? 1 : 0, 1);
+        writer->Write(BLOCK_DYNAMIC, 2);
+        writer->Write(literal_count - FIRST_LENGTH_CODE, 5);
+        writer->Write(distance_count - 1, 5);
+        writer->Write(code_length_count - 4, 4);
+        for (int i = 0; i < code_length_count; i++)
+        {
+            writer->Write(code_length_lengths[CODE_LENGTH_ORDER[i]], 3);
+        }
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            unsigned int symbol = entries[i] & 0xFF;
+            writer->Write(code_length_codes[symbol], code_length_lengths[symbol]);
+            int extra_bits = GetCodeLengthExtraBits(symbol);
+            if (extra_bits > 0)
+            {
+                writer->Write(entries[i] >> 8, extra_bits);
+            }
+        }
+
+        for (size_t i = 0; i < symbols.size(); i++)
+        {
+            unsigned int symbol = symbols[i];
+            if ((symbol & MATCH_FLAG) == 0)
+            {
+                writer->Write(literal_codes[symbol], literal_lengths[symbol]);
+                continue;
+            }
+            int length = (symbol >> 16) & 0x1FF;
+            int distance = symbol & 0xFFFF;
+            int length_code = FindCode(LENGTH_BASES, 29, length);
+            writer->Write(literal_codes[FIRST_LENGTH_CODE + length_code], literal_lengths[FIRST_LENGTH_CODE + length_code]);
+            writer->Write(length - LENGTH_BASES[length_code], LENGTH_EXTRA_BITS[length_code]);
+            int distance_code = FindCode(DISTANCE_BASES, DISTANCE_CODES, distance);
+            writer->Write(distance_codes[distance_code], distance_lengths[distance_code]);
+            writer->Write(distance - DISTANCE_BASES[distance_code], DISTANCE_EXTRA_BITS[distance_code]);
+        }
+        writer->Write(literal_codes[END_OF_BLOCK], literal_lengths[END_OF_BLOCK]);
+    }
+
+    int Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = (p > a) ? p - a : a - p;
+        int pb = (p > b) ? p - b : b - p;
+        int pc = (p > c) ? p - c : c - p;
+        if (pa <= pb && pa <= pc)
+        {
+            return a;
+        }
+        return (pb <= pc) ? b : c;
+    }
+
+    enum PngFilter
+    {
+        FILTER_NONE,
+        FILTER_SUB,
+        FILTER_UP,
+        FILTER_AVERAGE,
+        FILTER_PAETH,
+        FILTER_COUNT,
+    };
+
+    /*
+     * Filters a row of RGB pixels, with previous being the row above it (all zeros for the
+     * first row).
+     */
+    void FilterRow(int filter, const unsigned char* row, const unsigned char* previous, int size, unsigned char* out)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            int left = (i >= 3) ? row[i - 3] : 0;
+            int up = previous[i];
+            int up_left = (i >= 3) ? previous[i - 3] : 0;
+            int prediction;
+            switch (filter)
+            {
+            case FILTER_SUB:
+                prediction = left;
+                break;
+            case FILTER_UP:
+                prediction = up;
+                break;
+            case FILTER_AVERAGE:
+                prediction = (left + up) >> 1;
+                break;
+            case FILTER_PAETH:
+                prediction = Paeth(left, up, up_left);
+                break;
+            default:
+                prediction = 0;
+                break;
+            }
+            out[i] = static_cast<unsigned char>(row[i] - prediction);
+        }
+    }
+
+    unsigned int GetFilterCost(const unsigned char* filtered, int size)
+    {
+        unsigned int cost = 0;
+        for (int i = 0; i < size; i++)
+        {
+            cost += (filtered[i] < 128) ? filtered[i] : 256 - filtered[i];
+        }
+        return cost;
+    }
+}
+
+bool GetImageFormat(const char* filename, ImageFormat* format)
+{
+    const char* extension = strrchr(filename, '.');
+    if (extension == nullptr)
+    {
+        return false;
+    }
+    const ImageFormat formats[] = { IMAGE_FORMAT_PNG, IMAGE_FORMAT_BMP, IMAGE_FORMAT_TGA };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        const char* candidate = GetImageExtension(formats[i]);
+        size_t j = 0;
+        while (candidate[j] != '\0' && tolower(static_cast<unsigned char>(extension[j])) == candidate[j])
+        {
+            j++;
+        }
+        if (candidate[j] == '\0' && extension[j] == '\0')
+        {
+            *format = formats[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetImageExtension(ImageFormat format)
+{
+    switch (format)
+    {
+    case IMAGE_FORMAT_BMP:
+        return ".bmp";
+    case IMAGE_FORMAT_TGA:
+        return ".tga";
+    default:
+        return ".png";
+    }
+}
+
+ImageEncoder::ImageEncoder(ImageFormat format) :
+    m_format(format)
+{
+}
+
+ImageFormat ImageEncoder::GetFormat() const
+{
+    return m_format;
+}
+
+void ImageEncoder::Encode(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out)
+{
+    out->clear();
+    switch (m_format)
+    {
+    case IMAGE_FORMAT_BMP:
+        EncodeBMP(pixels, width, height, out);
+        break;
+    case IMAGE_FORMAT_TGA:
+        EncodeTGA(pixels, width, height, out);
+        break;
+    default:
+        EncodePNG(pixels, width, height, out);
+        break;
+    }
+}
+
+void ImageEncoder::EncodePNG(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out)
+{
+    int row_size = width * 3;
+    m_filtered.resize(static_cast<size_t>(row_size + 1) * height);
+    /*
+     * The RGB rows being filtered: the current one, the one above it, and room for trying
+     * out a filter.
+     */
+    m_row.assign(static_cast<size_t>(row_size) * 3, 0);
+    unsigned char* row = &m_row[0];
+    unsigned char* previous = row + row_size;
+    unsigned char* trial = previous + row_size;
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* source = pixels + static_cast<size_t>(height - 1 - y) * row_size;
+        for (int x = 0; x < row_size; x += 3)
+        {
+            row[x] = source[x + 2];
+            row[x + 1] = source[x + 1];
+            row[x + 2] = source[x];
+        }
+        unsigned char* filtered = &m_filtered[static_cast<size_t>(row_size + 1) * y];
+        unsigned int best_cost = 0;
+        for (int filter = FILTER_NONE; filter < FILTER_COUNT; filter++)
+        {
+            FilterRow(filter, row, previous, row_size, trial);
+            unsigned int cost = GetFilterCost(trial, row_size);
+            if (filter == FILTER_NONE || cost < best_cost)
+            {
+                best_cost = cost;
+                filtered[0] = static_cast<unsigned char>(filter);
+                memcpy(filtered + 1, trial, row_size);
+            }
+        }
+        unsigned char* swap = previous;
+        previous = row;
+        row = swap;
+    }
+
+    out->insert(out->end(), PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+    size_t chunk = StartChunk(*out, "IHDR");
+    PutBE(*out, width);
+    PutBE(*out, height);
+    out->push_back(8); /* bits per channel */
+    out->push_back(2); /* RGB */
+    out->push_back(0); /* deflate */
+    out->push_back(0); /* adaptive filtering */
+    out->push_back(0); /* not interlaced */
+    FinishChunk(*out, chunk);
+
+    chunk = StartChunk(*out, "IDAT");
+    out->push_back(ZLIB_CMF);
+    out->push_back(ZLIB_FLG);
+    Deflate(&m_filtered[0], static_cast<unsigned int>(m_filtered.size()), out);
+    PutBE(*out, Adler32(&m_filtered[0], m_filtered.size()));
+    FinishChunk(*out, chunk);
+
+    chunk = StartChunk(*out, "IEND");
+    FinishChunk(*out, chunk);
+}
+
+void ImageEncoder::EncodeBMP(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out)
+{
+    int row_size = width * 3;
+    int stride = (row_size + 3) & ~3;
+    unsigned int image_size = static_cast<unsigned int>(stride) * height;
+    out->reserve(BMP_HEADER_SIZE + image_size);
+    out->push_back('B');
+    out->push_back('M');
+    PutLE(*out, BMP_HEADER_SIZE + image_size, 4);
+    PutLE(*out, 0, 4);
+    PutLE(*out, BMP_HEADER_SIZE, 4);
+    PutLE(*out, 40, 4); /* BITMAPINFOHEADER */
+    PutLE(*out, width, 4);
+    PutLE(*out, height, 4); /* positive, so bottom up like the frame */
+    PutLE(*out, 1, 2);
+    PutLE(*out, 24, 2);
+    PutLE(*out, 0, 4); /* BI_RGB */
+    PutLE(*out, image_size, 4);
+    PutLE(*out, 0, 4);
+    PutLE(*out, 0, 4);
+    PutLE(*out, 0, 4);
+    PutLE(*out, 0, 4);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* row = pixels + static_cast<size_t>(y) * row_size;
+        out->insert(out->end(), row, row + row_size);
+        out->insert(out->end(), stride - row_size, 0);
+    }
+}
+
+void ImageEncoder::EncodeTGA(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out)
+{
+    size_t image_size = static_cast<size_t>(width) * height * 3;
+    out->reserve(TGA_HEADER_SIZE + image_size + 8 + sizeof(TGA_SIGNATURE));
+    out->push_back(0); /* no image ID */
+    out->push_back(0); /* no color map */
+    out->push_back(2); /* uncompressed true color */
+    out->insert(out->end(), 5, 0);
+    PutLE(*out, 0, 2);
+    PutLE(*out, 0, 2);
+    PutLE(*out, width, 2);
+    PutLE(*out, height, 2);
+    out->push_back(24);
+    out->push_back(0); /* the first row is the bottom one, like the frame */
+    out->insert(out->end(), pixels, pixels + image_size);
+    /*
+     * The TGA 2.0 footer, without extension or developer areas.
+     */
+    PutLE(*out, 0, 4);
+    PutLE(*out, 0, 4);
+    out->insert(out->end(), TGA_SIGNATURE, TGA_SIGNATURE + sizeof(TGA_SIGNATURE));
+}
+
+void ImageEncoder::Deflate(const unsigned char* data, unsigned int size, std::vector<unsigned char>* out)
+{
+    BitWriter writer(out);
+    m_head.assign(HASH_SIZE, -1);
+    m_prev.resize(WINDOW_SIZE);
+    m_symbols.clear();
+    m_symbols.reserve(BLOCK_SYMBOLS);
+
+    int end = static_cast<int>(size);
+    int position = 0;
+    int block_start = 0;
+    while (position < end)
+    {
+        int max_length = (end - position < MAX_MATCH) ? end - position : MAX_MATCH;
+        int best_length = MIN_MATCH - 1;
+        int best_distance = 0;
+        if (max_length >= MIN_MATCH)
+        {
+            const unsigned char* current = data + position;
+            unsigned int hash = Hash(current);
+            int candidate = m_head[hash];
+            for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && position - candidate <= WINDOW_SIZE; chain++)
+            {
+                const unsigned char* earlier = data + candidate;
+                if (earlier[best_length] == current[best_length] && earlier[0] == current[0] && earlier[1] == current[1])
+                {
+                    int length = 2;
+                    while (length < max_length && earlier[length] == current[length])
+                    {
+                        length++;
+                    }
+                    if (length > best_length)
+                    {
+                        best_length = length;
+                        best_distance = position - candidate;
+                        if (length >= NICE_MATCH || length == max_length)
+                        {
+                            break;
+                        }
+                    }
+                }
+                int next = m_prev[candidate & (WINDOW_SIZE - 1)];
+                if (next >= candidate)
+                {
+                    break;
+                }
+                candidate = next;
+            }
+            m_prev[position & (WINDOW_SIZE - 1)] = m_head[hash];
+            m_head[hash] = position;
+        }
+
+        if (best_length >= MIN_MATCH)
+        {
+            m_symbols.push_back(MATCH_FLAG | (best_length << 16) | best_distance);
+            for (int i = 1; i < best_length; i++)
+            {
+                int inserted = position + i;
+                if (inserted + MIN_MATCH <= end)
+                {
+                    unsigned int hash = Hash(data + inserted);
+                    m_prev[inserted & (WINDOW_SIZE - 1)] = m_head[hash];
+                    m_head[hash] = inserted;
+                }
+            }
+            position += best_length;
+        }
+        else
+        {
+            m_symbols.push_back(data[position]);
+            position++;
+        }
+
+        if (m_symbols.size() >= BLOCK_SYMBOLS)
+        {
+            WriteBlock(m_symbols, data + block_start, position - block_start, position == end, &writer);
+            m_symbols.clear();
+            block_start = position;
+        }
+    }
+    if (!m_symbols.empty() || size == 0)
+    {
+        WriteBlock(m_symbols, data + block_start, position - block_start, true, &writer);
+    }
+    writer.AlignToByte();
+}
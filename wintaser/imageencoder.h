@@ -0,0 +1,61 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+/*
+ * Encodes captured frames as image files. Only the C++ standard library is used here.
+ *
+ * PNG files are 24-bit RGB, compressed with the deflate in here. Every row gets the PNG filter
+ * that leaves it with the smallest sum of absolute differences, and the filtered rows are
+ * compressed with greedy LZ77 matching and dynamic Huffman codes, or stored when that comes out
+ * smaller. BMP and TGA files are uncompressed 24-bit.
+ */
+
+#include <vector>
+
+enum ImageFormat
+{
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_TGA,
+};
+
+/*
+ * The format a file name's extension stands for. Returns false if it's none of them.
+ */
+bool GetImageFormat(const char* filename, ImageFormat* format);
+/*
+ * The extension of the format's files, with the dot.
+ */
+const char* GetImageExtension(ImageFormat format);
+
+class ImageEncoder
+{
+public:
+    explicit ImageEncoder(ImageFormat format);
+
+    ImageFormat GetFormat() const;
+    /*
+     * pixels is a frame in the layout of the AVI frames: width * height 24-bit BGR pixels with
+     * the rows from the bottom up. out is replaced by the whole file.
+     */
+    void Encode(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out);
+
+private:
+    void EncodePNG(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out);
+    void EncodeBMP(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out);
+    void EncodeTGA(const unsigned char* pixels, int width, int height, std::vector<unsigned char>* out);
+    void Deflate(const unsigned char* data, unsigned int size, std::vector<unsigned char>* out);
+
+    ImageFormat m_format;
+    /*
+     * Kept from one frame to the next so that they don't have to be allocated again: the
+     * filtered rows of a PNG, and the hash chains and LZ77 symbols of the deflate.
+     */
+    std::vector<unsigned char> m_filtered;
+    std::vector<unsigned char> m_row;
+    std::vector<int> m_head;
+    std::vector<int> m_prev;
+    std::vector<unsigned int> m_symbols;
+};
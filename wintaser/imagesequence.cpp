@@ -0,0 +1,317 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <windows.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "imagesequence.h"
+
+namespace
+{
+    /*
+     * Digits of the movie frame in the file names, more are used when the number needs them.
+     */
+    const int FRAME_DIGITS = 6;
+
+    std::string FormatError(const char* what, const std::string& name, DWORD error)
+    {
+        char text[MAX_PATH + 128];
+        _snprintf(text, sizeof(text), "%s \"%s\" (error %u)", what, name.c_str(), static_cast<unsigned int>(error));
+        text[sizeof(text) - 1] = '\0';
+        return text;
+    }
+
+    bool WriteAll(HANDLE file, const void* data, unsigned int size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            DWORD written = 0;
+            if (WriteFile(file, bytes, size, &written, nullptr) == FALSE || written == 0)
+            {
+                return false;
+            }
+            bytes += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    bool WriteAt(HANDLE file, LONG offset, unsigned int value)
+    {
+        unsigned char bytes[4];
+        for (int i = 0; i < 4; i++)
+        {
+            bytes[i] = static_cast<unsigned char>(value >> (i * 8));
+        }
+        return SetFilePointer(file, offset, nullptr, FILE_BEGIN) != INVALID_SET_FILE_POINTER
+               && WriteAll(file, bytes, sizeof(bytes));
+    }
+}
+
+ImageSequence::FileSink::FileSink() :
+    m_file(INVALID_HANDLE_VALUE),
+    m_size(0)
+{
+}
+
+ImageSequence::FileSink::~FileSink()
+{
+    Close();
+}
+
+bool ImageSequence::FileSink::Create(const std::string& name)
+{
+    m_file = CreateFileA(name.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    m_size = 0;
+    return m_file != INVALID_HANDLE_VALUE;
+}
+
+bool ImageSequence::FileSink::Write(const void* data, unsigned int size)
+{
+    if (m_file == INVALID_HANDLE_VALUE || !WriteAll(m_file, data, size))
+    {
+        return false;
+    }
+    m_size += size;
+    return true;
+}
+
+bool ImageSequence::FileSink::Close()
+{
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return true;
+    }
+    bool success = true;
+    /*
+     * Past 4 GB the sizes can't be given, and are left unknown like in a stream.
+     */
+    if (m_size >= WavStream::HEADER_SIZE && m_size - 8 <= 0xFFFFFFFF)
+    {
+        success = WriteAt(m_file, WavStream::RIFF_SIZE_OFFSET, static_cast<unsigned int>(m_size - 8))
+                  && WriteAt(m_file, WavStream::DATA_SIZE_OFFSET,
+                             static_cast<unsigned int>(m_size - WavStream::HEADER_SIZE));
+    }
+    CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+    return success;
+}
+
+ImageSequence::Frame::Frame() :
+    encoder(nullptr),
+    width(0),
+    height(0),
+    repeat(false),
+    encoded_event(CreateEvent(nullptr, TRUE, TRUE, nullptr))
+{
+}
+
+ImageSequence::Frame::~Frame()
+{
+    WaitForSingleObject(encoded_event, INFINITE);
+    CloseHandle(encoded_event);
+    delete encoder;
+}
+
+void ImageSequence::Frame::Run()
+{
+    encoder->Encode(&pixels[0], width, height, &data);
+    SetEvent(encoded_event);
+}
+
+ImageSequence::ImageSequence(ImageFormat format, WorkerPool* pool, unsigned int max_frames, unsigned int max_bytes) :
+    m_format(format),
+    m_pool(pool),
+    m_ring((max_frames > 1) ? max_frames : 2, max_bytes),
+    m_frames(nullptr),
+    m_has_audio(false),
+    m_writer_thread(nullptr),
+    m_failed(0),
+    m_last_movie_frame(0),
+    m_repeat_count(0),
+    m_has_frame(false)
+{
+    m_frames = new Frame[m_ring.GetDepth()];
+    for (unsigned int i = 0; i < m_ring.GetDepth(); i++)
+    {
+        m_frames[i].encoder = new ImageEncoder(format);
+    }
+}
+
+ImageSequence::~ImageSequence()
+{
+    Finish();
+    delete[] m_frames;
+}
+
+bool ImageSequence::Start(const char* filename, bool audio, std::string* error)
+{
+    m_base_name = filename;
+    size_t dot = m_base_name.find_last_of('.');
+    if (dot != std::string::npos && m_base_name.find_first_of("\\/", dot) == std::string::npos)
+    {
+        m_base_name.erase(dot);
+    }
+
+    if (audio)
+    {
+        std::string audio_name = m_base_name + ".wav";
+        if (!m_audio.Create(audio_name))
+        {
+            *error = FormatError("Couldn't create the audio file", audio_name, GetLastError());
+            return false;
+        }
+        m_has_audio = true;
+    }
+
+    m_writer_thread = CreateThread(nullptr, 0, WriterThreadFunc, this, 0, nullptr);
+    if (m_writer_thread == nullptr)
+    {
+        *error = FormatError("Couldn't start writing the frames of", m_base_name, GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool ImageSequence::WriteFrame(const unsigned char* pixels, int width, int height, int movie_frame)
+{
+    if (m_failed != 0)
+    {
+        return false;
+    }
+    unsigned int size = static_cast<unsigned int>(width) * height * 3;
+    Frame* frame = BeginFrame(movie_frame, size);
+    if (frame == nullptr)
+    {
+        return false;
+    }
+    frame->pixels.assign(pixels, pixels + size);
+    frame->width = width;
+    frame->height = height;
+    frame->repeat = false;
+    ResetEvent(frame->encoded_event);
+    m_pool->Submit(frame);
+    m_ring.EndWrite();
+    return true;
+}
+
+bool ImageSequence::RepeatFrame(int movie_frame)
+{
+    if (m_failed != 0)
+    {
+        return false;
+    }
+    Frame* frame = BeginFrame(movie_frame, 0);
+    if (frame == nullptr)
+    {
+        return false;
+    }
+    frame->repeat = true;
+    m_ring.EndWrite();
+    return true;
+}
+
+StreamSink* ImageSequence::GetAudioSink()
+{
+    return m_has_audio ? &m_audio : nullptr;
+}
+
+bool ImageSequence::Finish()
+{
+    if (m_writer_thread != nullptr)
+    {
+        m_ring.WaitUntilEmpty();
+        m_ring.Close();
+        WaitForSingleObject(m_writer_thread, INFINITE);
+        CloseHandle(m_writer_thread);
+        m_writer_thread = nullptr;
+    }
+    if (m_has_audio)
+    {
+        if (!m_audio.Close())
+        {
+            m_failed = 1;
+        }
+        m_has_audio = false;
+    }
+    return m_failed == 0;
+}
+
+DWORD WINAPI ImageSequence::WriterThreadFunc(LPVOID parameter)
+{
+    static_cast<ImageSequence*>(parameter)->WriteFrames();
+    return 0;
+}
+
+void ImageSequence::WriteFrames()
+{
+    int slot;
+    while ((slot = m_ring.BeginRead()) >= 0)
+    {
+        Frame& frame = m_frames[slot];
+        WaitForSingleObject(frame.encoded_event, INFINITE);
+        if (!frame.repeat)
+        {
+            /*
+             * The frame gets the old buffer, to encode into next time.
+             */
+            m_last_data.swap(frame.data);
+        }
+        if (!m_last_data.empty() && !SaveFile(frame.filename, m_last_data))
+        {
+            m_failed = 1;
+        }
+        m_ring.EndRead();
+    }
+}
+
+ImageSequence::Frame* ImageSequence::BeginFrame(int movie_frame, unsigned int size)
+{
+    int slot = m_ring.BeginWrite(size);
+    if (slot < 0)
+    {
+        return nullptr;
+    }
+    if (m_has_frame && movie_frame == m_last_movie_frame)
+    {
+        m_repeat_count++;
+    }
+    else
+    {
+        m_repeat_count = 0;
+    }
+    m_last_movie_frame = movie_frame;
+    m_has_frame = true;
+
+    char number[32];
+    if (m_repeat_count == 0)
+    {
+        _snprintf(number, sizeof(number), "_%0*d", FRAME_DIGITS, movie_frame);
+    }
+    else
+    {
+        _snprintf(number, sizeof(number), "_%0*d_%d", FRAME_DIGITS, movie_frame, m_repeat_count);
+    }
+    number[sizeof(number) - 1] = '\0';
+    Frame* frame = &m_frames[slot];
+    frame->filename = m_base_name + number + GetImageExtension(m_format);
+    return frame;
+}
+
+bool ImageSequence::SaveFile(const std::string& name, const std::vector<unsigned char>& data)
+{
+    HANDLE file = CreateFileA(name.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    bool success = WriteAll(file, &data[0], static_cast<unsigned int>(data.size()));
+    return CloseHandle(file) != FALSE && success;
+}
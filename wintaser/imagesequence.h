@@ -0,0 +1,135 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+#include "framering.h"
+#include "imageencoder.h"
+#include "rawstreams.h"
+#include "workerpool.h"
+
+/*
+ * Writes a capture as one image file per frame, with its audio in a WAV file next to them.
+ *
+ * The frames are named after the capture file with the movie frame they were captured on, so
+ * "capture.png" gets capture_000000.png, capture_000001.png and so on, and capture.wav. When
+ * more than one frame is captured on the same movie frame, the later ones get a suffix, as in
+ * capture_000041_1.png.
+ *
+ * Frames are encoded on a worker pool and written to disk by a thread of their own, in the order
+ * they came in. Only so many frames can be on their way at once, WriteFrame waits for room after
+ * that.
+ */
+class ImageSequence
+{
+public:
+    /*
+     * At most max_frames frames, and max_bytes bytes of them unless there's only one, are
+     * being encoded or waiting to be written at a time.
+     */
+    ImageSequence(ImageFormat format, WorkerPool* pool, unsigned int max_frames, unsigned int max_bytes);
+    ~ImageSequence();
+
+    /*
+     * On failure error is set to what went wrong.
+     */
+    bool Start(const char* filename, bool audio, std::string* error);
+    /*
+     * pixels is a frame in the layout of the AVI frames, see ImageEncoder. It's copied before
+     * this returns. Returns false once writing a frame has failed.
+     */
+    bool WriteFrame(const unsigned char* pixels, int width, int height, int movie_frame);
+    /*
+     * Writes the last frame again for another movie frame, without encoding it again.
+     */
+    bool RepeatFrame(int movie_frame);
+    /*
+     * Where to write the WAV stream, or nullptr if there's no audio.
+     */
+    StreamSink* GetAudioSink();
+    /*
+     * Waits for every frame to be written, and fills in the sizes in the WAV header.
+     * Returns false if anything failed to be written.
+     */
+    bool Finish();
+
+private:
+    class FileSink : public StreamSink
+    {
+    public:
+        FileSink();
+        ~FileSink();
+
+        bool Create(const std::string& name);
+        virtual bool Write(const void* data, unsigned int size);
+        /*
+         * Fills in the sizes that WavStream left unknown, and closes the file.
+         */
+        bool Close();
+
+    private:
+        FileSink(const FileSink&);
+        FileSink& operator=(const FileSink&);
+
+        HANDLE m_file;
+        unsigned long long m_size;
+    };
+
+    struct Frame : WorkerPool::Task
+    {
+        Frame();
+        ~Frame();
+        virtual void Run();
+
+        ImageEncoder* encoder;
+        std::vector<unsigned char> pixels;
+        std::vector<unsigned char> data;
+        int width;
+        int height;
+        std::string filename;
+        /*
+         * A repeated frame has no pixels of its own, the writer writes the file it wrote last.
+         */
+        bool repeat;
+        HANDLE encoded_event;
+    };
+
+    ImageSequence(const ImageSequence&);
+    ImageSequence& operator=(const ImageSequence&);
+
+    static DWORD WINAPI WriterThreadFunc(LPVOID parameter);
+    void WriteFrames();
+    /*
+     * Takes a slot for the next frame and names its file. Returns nullptr if the ring has been
+     * closed.
+     */
+    Frame* BeginFrame(int movie_frame, unsigned int size);
+    static bool SaveFile(const std::string& name, const std::vector<unsigned char>& data);
+
+    ImageFormat m_format;
+    WorkerPool* m_pool;
+    FrameRing m_ring;
+    Frame* m_frames;
+    std::string m_base_name;
+    FileSink m_audio;
+    bool m_has_audio;
+    HANDLE m_writer_thread;
+    volatile LONG m_failed;
+
+    /*
+     * Owned by the producer.
+     */
+    int m_last_movie_frame;
+    int m_repeat_count;
+    bool m_has_frame;
+
+    /*
+     * Owned by the writer, the file it wrote last.
+     */
+    std::vector<unsigned char> m_last_data;
+};
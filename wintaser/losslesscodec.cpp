@@ -0,0 +1,1081 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "losslesscodec.h"
+
+namespace
+{
+    const int VERSION = 1;
+    const int TILE_SIZE = 64;
+    const int HEADER_SIZE = 12;
+    const unsigned char FLAG_KEYFRAME = 1;
+
+    enum TileKind
+    {
+        TILE_UNCHANGED,
+        TILE_SOLID,
+        TILE_PALETTE,
+        TILE_SPATIAL,
+        TILE_TEMPORAL,
+    };
+
+    /*
+     * Tiles with at most this many colors always use a palette. Up to 256 colors, the palette
+     * is only used if it comes out smaller.
+     */
+    const int SMALL_PALETTE = 16;
+    const int MAX_PALETTE = 256;
+
+    enum BlockKind
+    {
+        BLOCK_RAW,
+        BLOCK_HUFFMAN,
+    };
+
+    /*
+     * The symbols of a block are the bytes 1 to 255 as themselves, and runs of zeros written as
+     * digits of RUN_A (1) and RUN_B (2) times increasing powers of 2.
+     */
+    const int SYMBOLS = 257;
+    const int RUN_A = 0;
+    const int RUN_B = 256;
+    const int MAX_CODE_LENGTH = 15;
+
+    struct TileRect
+    {
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+    TileRect GetTileRect(int tile, int width, int height)
+    {
+        int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        TileRect rect;
+        rect.x = (tile % tiles_x) * TILE_SIZE;
+        rect.y = (tile / tiles_x) * TILE_SIZE;
+        rect.width = (width - rect.x < TILE_SIZE) ? width - rect.x : TILE_SIZE;
+        rect.height = (height - rect.y < TILE_SIZE) ? height - rect.y : TILE_SIZE;
+        return rect;
+    }
+
+    int CountTiles(int width, int height)
+    {
+        return ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+    }
+
+    void PutU32(std::vector<unsigned char>& out, unsigned int value)
+    {
+        out.push_back(static_cast<unsigned char>(value));
+        out.push_back(static_cast<unsigned char>(value >> 8));
+        out.push_back(static_cast<unsigned char>(value >> 16));
+        out.push_back(static_cast<unsigned char>(value >> 24));
+    }
+
+    unsigned int GetU32(const unsigned char* in)
+    {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<unsigned int>(in[3]) << 24);
+    }
+
+    /*
+     * Reads from a piece of untrusted data, every read checks that there's enough left.
+     */
+    class Reader
+    {
+    public:
+        Reader(const unsigned char* data, unsigned int size) :
+            m_data(data),
+            m_size(size),
+            m_pos(0)
+        {
+        }
+
+        const unsigned char* Take(unsigned int size)
+        {
+            if (size > m_size - m_pos)
+            {
+                return nullptr;
+            }
+            const unsigned char* data = m_data + m_pos;
+            m_pos += size;
+            return data;
+        }
+
+        bool TakeByte(unsigned char* value)
+        {
+            const unsigned char* data = Take(1);
+            if (data == nullptr)
+            {
+                return false;
+            }
+            *value = *data;
+            return true;
+        }
+
+        bool TakeU32(unsigned int* value)
+        {
+            const unsigned char* data = Take(4);
+            if (data == nullptr)
+            {
+                return false;
+            }
+            *value = GetU32(data);
+            return true;
+        }
+
+        bool IsAtEnd() const
+        {
+            return m_pos == m_size;
+        }
+
+    private:
+        const unsigned char* m_data;
+        unsigned int m_size;
+        unsigned int m_pos;
+    };
+
+    /*
+     * Codes are written from their most significant bit, and fill bytes from their most
+     * significant bit.
+     */
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<unsigned char>* out) :
+            m_out(out),
+            m_bits(0),
+            m_count(0)
+        {
+        }
+
+        void Write(unsigned int code, int length)
+        {
+            m_bits = (m_bits << length) | code;
+            m_count += length;
+            while (m_count >= 8)
+            {
+                m_count -= 8;
+                m_out->push_back(static_cast<unsigned char>(m_bits >> m_count));
+            }
+        }
+
+        void Flush()
+        {
+            if (m_count > 0)
+            {
+                m_out->push_back(static_cast<unsigned char>(m_bits << (8 - m_count)));
+                m_count = 0;
+            }
+        }
+
+    private:
+        std::vector<unsigned char>* m_out;
+        unsigned int m_bits;
+        int m_count;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const unsigned char* data, unsigned int size) :
+            m_data(data),
+            m_size(size),
+            m_pos(0)
+        {
+        }
+
+        bool ReadBit(unsigned int* bit)
+        {
+            if ((m_pos >> 3) >= m_size)
+            {
+                return false;
+            }
+            *bit = (m_data[m_pos >> 3] >> (7 - (m_pos & 7))) & 1;
+            m_pos++;
+            return true;
+        }
+
+    private:
+        const unsigned char* m_data;
+        unsigned int m_size;
+        unsigned int m_pos;
+    };
+
+    void Tokenize(const unsigned char* data, int size, std::vector<unsigned short>* tokens)
+    {
+        int i = 0;
+        while (i < size)
+        {
+            if (data[i] != 0)
+            {
+                tokens->push_back(data[i]);
+                i++;
+                continue;
+            }
+            int run = 0;
+            while (i < size && data[i] == 0)
+            {
+                run++;
+                i++;
+            }
+            while (run > 0)
+            {
+                if ((run & 1) != 0)
+                {
+                    tokens->push_back(RUN_A);
+                    run = (run - 1) >> 1;
+                }
+                else
+                {
+                    tokens->push_back(RUN_B);
+                    run = (run - 2) >> 1;
+                }
+            }
+        }
+    }
+
+    /*
+     * Huffman code lengths for the symbol counts, none longer than MAX_CODE_LENGTH. If the
+     * tree comes out too deep, the counts are halved until it doesn't.
+     */
+    void BuildCodeLengths(const unsigned int* counts, unsigned char* lengths)
+    {
+        typedef std::pair<unsigned long long, int> Node;
+        std::vector<unsigned long long> weights(counts, counts + SYMBOLS);
+        std::vector<int> parents(2 * SYMBOLS);
+        for (;;)
+        {
+            std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+            for (int symbol = 0; symbol < SYMBOLS; symbol++)
+            {
+                lengths[symbol] = 0;
+                if (weights[symbol] != 0)
+                {
+                    queue.push(Node(weights[symbol], symbol));
+                }
+            }
+            if (queue.empty())
+            {
+                return;
+            }
+            if (queue.size() == 1)
+            {
+                lengths[queue.top().second] = 1;
+                return;
+            }
+            int next = SYMBOLS;
+            while (queue.size() > 1)
+            {
+                Node first = queue.top();
+                queue.pop();
+                Node second = queue.top();
+                queue.pop();
+                parents[first.second] = next;
+                parents[second.second] = next;
+                queue.push(Node(first.first + second.first, next));
+                next++;
+            }
+            int root = next - 1;
+
+            int longest = 0;
+            for (int symbol = 0; symbol < SYMBOLS; symbol++)
+            {
+                if (weights[symbol] == 0)
+                {
+                    continue;
+                }
+                int length = 0;
+                for (int node = symbol; node != root; node = parents[node])
+                {
+                    length++;
+                }
+                lengths[symbol] = static_cast<unsigned char>((length <= MAX_CODE_LENGTH) ? length : 0);
+                if (length > longest)
+                {
+                    longest = length;
+                }
+            }
+            if (longest <= MAX_CODE_LENGTH)
+            {
+                return;
+            }
+            for (int symbol = 0; symbol < SYMBOLS; symbol++)
+            {
+                if (weights[symbol] != 0)
+                {
+                    weights[symbol] = (weights[symbol] + 1) >> 1;
+                }
+            }
+        }
+    }
+
+    /*
+     * Canonical codes: shorter codes come first, codes of the same length go by symbol.
+     * Returns false if the lengths don't make a prefix code.
+     */
+    bool AssignCodes(const unsigned char* lengths, unsigned short* codes)
+    {
+        int length_counts[MAX_CODE_LENGTH + 1] = {0};
+        for (int symbol = 0; symbol < SYMBOLS; symbol++)
+        {
+            length_counts[lengths[symbol]]++;
+        }
+        length_counts[0] = 0;
+        unsigned int next_codes[MAX_CODE_LENGTH + 1];
+        unsigned int code = 0;
+        for (int length = 1; length <= MAX_CODE_LENGTH; length++)
+        {
+            code = (code + length_counts[length - 1]) << 1;
+            next_codes[length] = code;
+            if (code + length_counts[length] > (1u << length))
+            {
+                return false;
+            }
+        }
+        for (int symbol = 0; symbol < SYMBOLS; symbol++)
+        {
+            if (lengths[symbol] != 0)
+            {
+                codes[symbol] = static_cast<unsigned short>(next_codes[lengths[symbol]]++);
+            }
+        }
+        return true;
+    }
+
+    /*
+     * The code lengths as 4-bit numbers, high half of each byte first. A 0 is followed by the
+     * number of unused symbols it stands for, minus 1.
+     */
+    void WriteCodeLengths(const unsigned char* lengths, std::vector<unsigned char>* out)
+    {
+        std::vector<unsigned char> nibbles;
+        int symbol = 0;
+        while (symbol < SYMBOLS)
+        {
+            if (lengths[symbol] != 0)
+            {
+                nibbles.push_back(lengths[symbol]);
+                symbol++;
+                continue;
+            }
+            int run = 0;
+            while (symbol < SYMBOLS && lengths[symbol] == 0 && run < 16)
+            {
+                run++;
+                symbol++;
+            }
+            nibbles.push_back(0);
+            nibbles.push_back(static_cast<unsigned char>(run - 1));
+        }
+        for (size_t i = 0; i < nibbles.size(); i += 2)
+        {
+            unsigned char low = (i + 1 < nibbles.size()) ? nibbles[i + 1] : 0;
+            out->push_back(static_cast<unsigned char>((nibbles[i] << 4) | low));
+        }
+    }
+
+    bool ReadCodeLengths(Reader* reader, unsigned char* lengths)
+    {
+        int symbol = 0;
+        unsigned char byte = 0;
+        bool low_half = false;
+        bool expecting_run = false;
+        while (symbol < SYMBOLS)
+        {
+            if (!low_half && !reader->TakeByte(&byte))
+            {
+                return false;
+            }
+            int nibble = low_half ? (byte & 15) : (byte >> 4);
+            low_half = !low_half;
+            if (expecting_run)
+            {
+                if (symbol + nibble + 1 > SYMBOLS)
+                {
+                    return false;
+                }
+                for (int i = 0; i <= nibble; i++)
+                {
+                    lengths[symbol++] = 0;
+                }
+                expecting_run = false;
+            }
+            else if (nibble == 0)
+            {
+                expecting_run = true;
+            }
+            else
+            {
+                lengths[symbol++] = static_cast<unsigned char>(nibble);
+            }
+        }
+        return !expecting_run;
+    }
+
+    /*
+     * Codes size bytes as a block: its kind, then either the bytes as they are or the number of
+     * symbols, the code lengths, the size of the coded bits and the bits.
+     */
+    void EncodeBlock(const unsigned char* data, int size, std::vector<unsigned char>* out)
+    {
+        std::vector<unsigned short> tokens;
+        tokens.reserve(size);
+        Tokenize(data, size, &tokens);
+
+        unsigned int counts[SYMBOLS] = {0};
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            counts[tokens[i]]++;
+        }
+        unsigned char lengths[SYMBOLS];
+        unsigned short codes[SYMBOLS];
+        BuildCodeLengths(counts, lengths);
+        AssignCodes(lengths, codes);
+
+        size_t start = out->size();
+        out->push_back(BLOCK_HUFFMAN);
+        PutU32(*out, static_cast<unsigned int>(tokens.size()));
+        WriteCodeLengths(lengths, out);
+        size_t bits_size_pos = out->size();
+        PutU32(*out, 0);
+        BitWriter writer(out);
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            writer.Write(codes[tokens[i]], lengths[tokens[i]]);
+        }
+        writer.Flush();
+        unsigned int bits_size = static_cast<unsigned int>(out->size() - bits_size_pos - 4);
+        (*out)[bits_size_pos] = static_cast<unsigned char>(bits_size);
+        (*out)[bits_size_pos + 1] = static_cast<unsigned char>(bits_size >> 8);
+        (*out)[bits_size_pos + 2] = static_cast<unsigned char>(bits_size >> 16);
+        (*out)[bits_size_pos + 3] = static_cast<unsigned char>(bits_size >> 24);
+
+        if (out->size() - start > static_cast<size_t>(size) + 1)
+        {
+            out->resize(start);
+            out->push_back(BLOCK_RAW);
+            out->insert(out->end(), data, data + size);
+        }
+    }
+
+    bool DecodeBlock(Reader* reader, unsigned char* data, int size)
+    {
+        unsigned char kind;
+        if (!reader->TakeByte(&kind))
+        {
+            return false;
+        }
+        if (kind == BLOCK_RAW)
+        {
+            const unsigned char* raw = reader->Take(size);
+            if (raw == nullptr)
+            {
+                return false;
+            }
+            memcpy(data, raw, size);
+            return true;
+        }
+        if (kind != BLOCK_HUFFMAN)
+        {
+            return false;
+        }
+
+        unsigned int token_count;
+        unsigned char lengths[SYMBOLS];
+        unsigned short codes[SYMBOLS];
+        unsigned int bits_size;
+        if (!reader->TakeU32(&token_count) || !ReadCodeLengths(reader, lengths) || !AssignCodes(lengths, codes)
+            || !reader->TakeU32(&bits_size))
+        {
+            return false;
+        }
+        const unsigned char* bits = reader->Take(bits_size);
+        if (bits == nullptr)
+        {
+            return false;
+        }
+
+        /*
+         * The symbols sorted like their codes, and for each length, where its codes start and
+         * how many there are.
+         */
+        int sorted[SYMBOLS];
+        int first_index[MAX_CODE_LENGTH + 1];
+        unsigned int first_code[MAX_CODE_LENGTH + 1];
+        int length_counts[MAX_CODE_LENGTH + 1];
+        int sorted_count = 0;
+        for (int length = 1; length <= MAX_CODE_LENGTH; length++)
+        {
+            first_index[length] = sorted_count;
+            length_counts[length] = 0;
+            first_code[length] = 0;
+            for (int symbol = 0; symbol < SYMBOLS; symbol++)
+            {
+                if (lengths[symbol] == length)
+                {
+                    if (length_counts[length] == 0)
+                    {
+                        first_code[length] = codes[symbol];
+                    }
+                    sorted[sorted_count++] = symbol;
+                    length_counts[length]++;
+                }
+            }
+        }
+
+        BitReader bit_reader(bits, bits_size);
+        int pos = 0;
+        int run = 0;
+        int run_weight = 1;
+        for (unsigned int token = 0; token < token_count; token++)
+        {
+            unsigned int code = 0;
+            int symbol = -1;
+            for (int length = 1; length <= MAX_CODE_LENGTH && symbol < 0; length++)
+            {
+                unsigned int bit;
+                if (!bit_reader.ReadBit(&bit))
+                {
+                    return false;
+                }
+                code = (code << 1) | bit;
+                if (length_counts[length] != 0 && code >= first_code[length]
+                    && code - first_code[length] < static_cast<unsigned int>(length_counts[length]))
+                {
+                    symbol = sorted[first_index[length] + code - first_code[length]];
+                }
+            }
+            if (symbol < 0)
+            {
+                return false;
+            }
+            if (symbol == RUN_A || symbol == RUN_B)
+            {
+                run += ((symbol == RUN_A) ? 1 : 2) * run_weight;
+                run_weight <<= 1;
+                if (run > size - pos)
+                {
+                    return false;
+                }
+                continue;
+            }
+            memset(data + pos, 0, run);
+            pos += run;
+            run = 0;
+            run_weight = 1;
+            if (pos >= size)
+            {
+                return false;
+            }
+            data[pos++] = static_cast<unsigned char>(symbol);
+        }
+        memset(data + pos, 0, run);
+        pos += run;
+        return pos == size;
+    }
+
+    unsigned char PredictMedian(int left, int up, int up_left)
+    {
+        int low = (left < up) ? left : up;
+        int high = (left < up) ? up : left;
+        if (up_left >= high)
+        {
+            return static_cast<unsigned char>(low);
+        }
+        if (up_left <= low)
+        {
+            return static_cast<unsigned char>(high);
+        }
+        return static_cast<unsigned char>(left + up - up_left);
+    }
+
+    /*
+     * Neighbours outside the tile aren't used, so that tiles don't depend on each other.
+     */
+    unsigned char PredictSpatial(const unsigned char* plane, int x, int y, int width)
+    {
+        if (y == 0)
+        {
+            return (x == 0) ? 0 : plane[x - 1];
+        }
+        const unsigned char* row = plane + y * width;
+        if (x == 0)
+        {
+            return row[x - width];
+        }
+        return PredictMedian(row[x - 1], row[x - width], row[x - width - 1]);
+    }
+
+    unsigned char PredictIndex(const unsigned char* indexes, int x, int y, int width)
+    {
+        if (x > 0)
+        {
+            return indexes[y * width + x - 1];
+        }
+        return (y > 0) ? indexes[(y - 1) * width] : 0;
+    }
+
+    /*
+     * The tile's pixels as the planes G, B-G and R-G, one after the other.
+     */
+    void ExtractPlanes(const unsigned char* frame, int frame_width, const TileRect& rect, unsigned char* planes)
+    {
+        int count = rect.width * rect.height;
+        for (int y = 0; y < rect.height; y++)
+        {
+            const unsigned char* pixel = frame + ((rect.y + y) * frame_width + rect.x) * 3;
+            for (int x = 0; x < rect.width; x++, pixel += 3)
+            {
+                int i = y * rect.width + x;
+                planes[i] = pixel[1];
+                planes[count + i] = static_cast<unsigned char>(pixel[0] - pixel[1]);
+                planes[2 * count + i] = static_cast<unsigned char>(pixel[2] - pixel[1]);
+            }
+        }
+    }
+
+    void StorePlanes(const unsigned char* planes, const TileRect& rect, int frame_width, unsigned char* frame)
+    {
+        int count = rect.width * rect.height;
+        for (int y = 0; y < rect.height; y++)
+        {
+            unsigned char* pixel = frame + ((rect.y + y) * frame_width + rect.x) * 3;
+            for (int x = 0; x < rect.width; x++, pixel += 3)
+            {
+                int i = y * rect.width + x;
+                pixel[0] = static_cast<unsigned char>(planes[count + i] + planes[i]);
+                pixel[1] = planes[i];
+                pixel[2] = static_cast<unsigned char>(planes[2 * count + i] + planes[i]);
+            }
+        }
+    }
+
+    bool TileEquals(const unsigned char* a, const unsigned char* b, int frame_width, const TileRect& rect)
+    {
+        for (int y = 0; y < rect.height; y++)
+        {
+            size_t offset = ((rect.y + y) * frame_width + rect.x) * 3;
+            if (memcmp(a + offset, b + offset, rect.width * 3) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Fills in the tile's colors in order of appearance and each pixel's index.
+     * Returns the number of colors, or 0 if there are more than MAX_PALETTE.
+     */
+    int BuildPalette(const unsigned char* frame, int frame_width, const TileRect& rect, unsigned int* palette,
+                     unsigned char* indexes)
+    {
+        const int HASH_SIZE = 1024;
+        unsigned int keys[HASH_SIZE];
+        unsigned char values[HASH_SIZE];
+        memset(keys, 0, sizeof(keys));
+        int colors = 0;
+        for (int y = 0; y < rect.height; y++)
+        {
+            const unsigned char* pixel = frame + ((rect.y + y) * frame_width + rect.x) * 3;
+            for (int x = 0; x < rect.width; x++, pixel += 3)
+            {
+                unsigned int color = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+                /*
+                 * Keys are stored plus 1, so that 0 means the entry is free.
+                 */
+                unsigned int slot = ((color + 1) * 2654435761u) >> 22;
+                while (keys[slot] != 0 && keys[slot] != color + 1)
+                {
+                    slot = (slot + 1) & (HASH_SIZE - 1);
+                }
+                if (keys[slot] == 0)
+                {
+                    if (colors == MAX_PALETTE)
+                    {
+                        return 0;
+                    }
+                    keys[slot] = color + 1;
+                    values[slot] = static_cast<unsigned char>(colors);
+                    palette[colors++] = color;
+                }
+                indexes[y * rect.width + x] = values[slot];
+            }
+        }
+        return colors;
+    }
+
+    void EncodePaletteTile(const unsigned int* palette, int colors, const unsigned char* indexes, const TileRect& rect,
+                           std::vector<unsigned char>* out)
+    {
+        out->push_back(TILE_PALETTE);
+        out->push_back(static_cast<unsigned char>(colors - 1));
+        for (int i = 0; i < colors; i++)
+        {
+            out->push_back(static_cast<unsigned char>(palette[i]));
+            out->push_back(static_cast<unsigned char>(palette[i] >> 8));
+            out->push_back(static_cast<unsigned char>(palette[i] >> 16));
+        }
+        int count = rect.width * rect.height;
+        std::vector<unsigned char> residuals(count);
+        for (int y = 0; y < rect.height; y++)
+        {
+            for (int x = 0; x < rect.width; x++)
+            {
+                int i = y * rect.width + x;
+                residuals[i] = static_cast<unsigned char>(indexes[i] - PredictIndex(indexes, x, y, rect.width));
+            }
+        }
+        EncodeBlock(&residuals[0], count, out);
+    }
+
+    /*
+     * Roughly how many bits the residuals will take, to choose between two predictions.
+     */
+    unsigned int EstimateCost(const unsigned char* residuals, int size)
+    {
+        unsigned int cost = 0;
+        for (int i = 0; i < size; i++)
+        {
+            int magnitude = (residuals[i] < 128) ? residuals[i] : 256 - residuals[i];
+            cost += magnitude;
+        }
+        return cost;
+    }
+}
+
+LosslessEncoder::LosslessEncoder(int width, int height, int keyframe_interval) :
+    m_width(width),
+    m_height(height),
+    m_keyframe_interval(keyframe_interval),
+    m_frames(0),
+    m_current(nullptr),
+    m_keyframe(true),
+    m_previous(width * height * 3),
+    m_tiles(CountTiles(width, height))
+{
+}
+
+void LosslessEncoder::BeginFrame(const unsigned char* pixels)
+{
+    m_current = pixels;
+    m_keyframe = m_frames == 0
+                 || (m_keyframe_interval > 0 && m_frames % static_cast<unsigned int>(m_keyframe_interval) == 0);
+}
+
+int LosslessEncoder::GetTileCount() const
+{
+    return static_cast<int>(m_tiles.size());
+}
+
+void LosslessEncoder::EncodeTile(int tile)
+{
+    std::vector<unsigned char>& out = m_tiles[tile];
+    out.clear();
+    TileRect rect = GetTileRect(tile, m_width, m_height);
+    const unsigned char* previous = &m_previous[0];
+    if (!m_keyframe && TileEquals(m_current, previous, m_width, rect))
+    {
+        out.push_back(TILE_UNCHANGED);
+        return;
+    }
+
+    int count = rect.width * rect.height;
+    unsigned int palette[MAX_PALETTE];
+    std::vector<unsigned char> indexes(count);
+    int colors = BuildPalette(m_current, m_width, rect, palette, &indexes[0]);
+    if (colors == 1)
+    {
+        out.push_back(TILE_SOLID);
+        out.push_back(static_cast<unsigned char>(palette[0]));
+        out.push_back(static_cast<unsigned char>(palette[0] >> 8));
+        out.push_back(static_cast<unsigned char>(palette[0] >> 16));
+        return;
+    }
+    std::vector<unsigned char> palette_out;
+    if (colors != 0)
+    {
+        EncodePaletteTile(palette, colors, &indexes[0], rect, &palette_out);
+        if (colors <= SMALL_PALETTE)
+        {
+            out.swap(palette_out);
+            return;
+        }
+    }
+
+    std::vector<unsigned char> planes(count * 3);
+    std::vector<unsigned char> spatial(count * 3);
+    ExtractPlanes(m_current, m_width, rect, &planes[0]);
+    for (int plane = 0; plane < 3; plane++)
+    {
+        const unsigned char* values = &planes[plane * count];
+        unsigned char* residuals = &spatial[plane * count];
+        for (int y = 0; y < rect.height; y++)
+        {
+            for (int x = 0; x < rect.width; x++)
+            {
+                int i = y * rect.width + x;
+                residuals[i] = static_cast<unsigned char>(values[i] - PredictSpatial(values, x, y, rect.width));
+            }
+        }
+    }
+    unsigned char kind = TILE_SPATIAL;
+    std::vector<unsigned char>* residuals = &spatial;
+    std::vector<unsigned char> temporal;
+    if (!m_keyframe)
+    {
+        temporal.resize(count * 3);
+        ExtractPlanes(previous, m_width, rect, &temporal[0]);
+        for (int i = 0; i < count * 3; i++)
+        {
+            temporal[i] = static_cast<unsigned char>(planes[i] - temporal[i]);
+        }
+        if (EstimateCost(&temporal[0], count * 3) < EstimateCost(&spatial[0], count * 3))
+        {
+            kind = TILE_TEMPORAL;
+            residuals = &temporal;
+        }
+    }
+
+    out.push_back(kind);
+    for (int plane = 0; plane < 3; plane++)
+    {
+        EncodeBlock(&(*residuals)[plane * count], count, &out);
+    }
+    if (!palette_out.empty() && palette_out.size() <= out.size())
+    {
+        out.swap(palette_out);
+    }
+}
+
+const unsigned char* LosslessEncoder::FinishFrame(unsigned int* size, bool* keyframe)
+{
+    m_output.clear();
+    m_output.push_back(VERSION);
+    m_output.push_back(static_cast<unsigned char>(m_keyframe ? FLAG_KEYFRAME : 0));
+    m_output.push_back(static_cast<unsigned char>(TILE_SIZE));
+    m_output.push_back(static_cast<unsigned char>(TILE_SIZE >> 8));
+    PutU32(m_output, m_width);
+    PutU32(m_output, m_height);
+    for (size_t tile = 0; tile < m_tiles.size(); tile++)
+    {
+        PutU32(m_output, static_cast<unsigned int>(m_tiles[tile].size()));
+    }
+    for (size_t tile = 0; tile < m_tiles.size(); tile++)
+    {
+        m_output.insert(m_output.end(), m_tiles[tile].begin(), m_tiles[tile].end());
+    }
+
+    if (!m_previous.empty())
+    {
+        memcpy(&m_previous[0], m_current, m_previous.size());
+    }
+    m_current = nullptr;
+    m_frames++;
+
+    *size = static_cast<unsigned int>(m_output.size());
+    *keyframe = m_keyframe;
+    return &m_output[0];
+}
+
+const unsigned char* LosslessEncoder::EncodeFrame(const unsigned char* pixels, unsigned int* size, bool* keyframe)
+{
+    BeginFrame(pixels);
+    for (int tile = 0; tile < GetTileCount(); tile++)
+    {
+        EncodeTile(tile);
+    }
+    return FinishFrame(size, keyframe);
+}
+
+LosslessDecoder::LosslessDecoder(int width, int height) :
+    m_width(width),
+    m_height(height),
+    m_has_frame(false),
+    m_frame(width * height * 3)
+{
+}
+
+bool LosslessDecoder::DecodeFrame(const unsigned char* data, unsigned int size, unsigned char* pixels)
+{
+    if (size == 0)
+    {
+        if (!m_has_frame)
+        {
+            return false;
+        }
+        memcpy(pixels, &m_frame[0], m_frame.size());
+        return true;
+    }
+
+    Reader reader(data, size);
+    const unsigned char* header = reader.Take(HEADER_SIZE);
+    if (header == nullptr || header[0] != VERSION || (header[2] | (header[3] << 8)) != TILE_SIZE
+        || GetU32(header + 4) != static_cast<unsigned int>(m_width)
+        || GetU32(header + 8) != static_cast<unsigned int>(m_height))
+    {
+        return false;
+    }
+    bool keyframe = (header[1] & FLAG_KEYFRAME) != 0;
+    if (!keyframe && !m_has_frame)
+    {
+        return false;
+    }
+    /*
+     * Whatever goes wrong from here on leaves a partly decoded frame behind.
+     */
+    m_has_frame = false;
+
+    int tile_count = CountTiles(m_width, m_height);
+    std::vector<unsigned int> tile_sizes(tile_count);
+    for (int tile = 0; tile < tile_count; tile++)
+    {
+        if (!reader.TakeU32(&tile_sizes[tile]))
+        {
+            return false;
+        }
+    }
+
+    unsigned char* frame = &m_frame[0];
+    std::vector<unsigned char> planes(TILE_SIZE * TILE_SIZE * 3);
+    std::vector<unsigned char> previous(TILE_SIZE * TILE_SIZE * 3);
+    for (int tile = 0; tile < tile_count; tile++)
+    {
+        const unsigned char* tile_data = reader.Take(tile_sizes[tile]);
+        if (tile_data == nullptr)
+        {
+            return false;
+        }
+        Reader tile_reader(tile_data, tile_sizes[tile]);
+        TileRect rect = GetTileRect(tile, m_width, m_height);
+        int count = rect.width * rect.height;
+        unsigned char kind;
+        if (!tile_reader.TakeByte(&kind))
+        {
+            return false;
+        }
+
+        switch (kind)
+        {
+        case TILE_UNCHANGED:
+            if (keyframe)
+            {
+                return false;
+            }
+            break;
+
+        case TILE_SOLID:
+        {
+            const unsigned char* color = tile_reader.Take(3);
+            if (color == nullptr)
+            {
+                return false;
+            }
+            for (int y = 0; y < rect.height; y++)
+            {
+                unsigned char* pixel = frame + ((rect.y + y) * m_width + rect.x) * 3;
+                for (int x = 0; x < rect.width; x++, pixel += 3)
+                {
+                    pixel[0] = color[0];
+                    pixel[1] = color[1];
+                    pixel[2] = color[2];
+                }
+            }
+            break;
+        }
+
+        case TILE_PALETTE:
+        {
+            unsigned char last_index;
+            if (!tile_reader.TakeByte(&last_index))
+            {
+                return false;
+            }
+            int colors = last_index + 1;
+            const unsigned char* palette = tile_reader.Take(colors * 3);
+            unsigned char* indexes = &planes[0];
+            if (palette == nullptr || !DecodeBlock(&tile_reader, indexes, count))
+            {
+                return false;
+            }
+            for (int y = 0; y < rect.height; y++)
+            {
+                unsigned char* pixel = frame + ((rect.y + y) * m_width + rect.x) * 3;
+                for (int x = 0; x < rect.width; x++, pixel += 3)
+                {
+                    int i = y * rect.width + x;
+                    indexes[i] = static_cast<unsigned char>(indexes[i] + PredictIndex(indexes, x, y, rect.width));
+                    if (indexes[i] >= colors)
+                    {
+                        return false;
+                    }
+                    memcpy(pixel, palette + indexes[i] * 3, 3);
+                }
+            }
+            break;
+        }
+
+        case TILE_SPATIAL:
+        case TILE_TEMPORAL:
+        {
+            if (kind == TILE_TEMPORAL)
+            {
+                if (keyframe)
+                {
+                    return false;
+                }
+                ExtractPlanes(frame, m_width, rect, &previous[0]);
+            }
+            for (int plane = 0; plane < 3; plane++)
+            {
+                unsigned char* values = &planes[plane * count];
+                if (!DecodeBlock(&tile_reader, values, count))
+                {
+                    return false;
+                }
+                if (kind == TILE_TEMPORAL)
+                {
+                    for (int i = 0; i < count; i++)
+                    {
+                        values[i] = static_cast<unsigned char>(values[i] + previous[plane * count + i]);
+                    }
+                    continue;
+                }
+                for (int y = 0; y < rect.height; y++)
+                {
+                    for (int x = 0; x < rect.width; x++)
+                    {
+                        int i = y * rect.width + x;
+                        values[i] = static_cast<unsigned char>(values[i] + PredictSpatial(values, x, y, rect.width));
+                    }
+                }
+            }
+            StorePlanes(&planes[0], rect, m_width, frame);
+            break;
+        }
+
+        default:
+            return false;
+        }
+
+        if (!tile_reader.IsAtEnd())
+        {
+            return false;
+        }
+    }
+    if (!reader.IsAtEnd())
+    {
+        return false;
+    }
+
+    m_has_frame = true;
+    memcpy(pixels, frame, m_frame.size());
+    return true;
+}
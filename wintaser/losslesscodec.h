@@ -0,0 +1,90 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+/*
+ * A lossless video codec for AVI captures, made for the kind of frames games draw: large areas
+ * that don't change from one frame to the next, few colors, flat backgrounds. Only the C++
+ * standard library is used here. No VfW codec is installed for it, so files that use it are
+ * read back with LosslessDecoder: tools/hglc2avi turns them into uncompressed AVIs or raw
+ * frames, and tools/losslesstest checks that both round-trip.
+ *
+ * Frames are in the layout of the AVI frames, width * height 24-bit BGR pixels with the rows
+ * from the bottom up, and are split into TILE_SIZE square tiles that are coded independently of
+ * each other. A tile is one of:
+ *  - unchanged from the previous frame,
+ *  - a single color,
+ *  - up to 256 colors, as a palette and an index per pixel,
+ *  - predicted from its neighbours in the same frame, or from the same pixels in the previous
+ *    frame, whichever leaves smaller differences. Pixels are coded as the planes G, B-G and R-G.
+ * Indexes and differences are coded with zero runs and a Huffman code per tile and plane.
+ *
+ * Every keyframe_interval frames, and the first one, is a keyframe that doesn't refer to the
+ * previous frame.
+ *
+ * The layout of a frame, all numbers little-endian:
+ *  - 1 byte version, 1 byte flags (1 = keyframe), 2 bytes tile size, 4 bytes each width and
+ *    height,
+ *  - 4 bytes for the size of each tile's data, tiles left to right, then bottom to top,
+ *  - the data of each tile, starting with a byte for its kind.
+ */
+
+#include <vector>
+
+class LosslessEncoder
+{
+public:
+    /*
+     * What goes in the AVI stream header and biCompression: "HGLC".
+     */
+    static const unsigned int FOURCC = 'H' | ('G' << 8) | ('L' << 16) | ('C' << 24);
+
+    LosslessEncoder(int width, int height, int keyframe_interval);
+
+    /*
+     * Encodes a frame in three steps, so that the caller can spread the tiles over threads:
+     * BeginFrame, then EncodeTile for each tile in any order, from any thread, then FinishFrame.
+     * pixels must stay valid until FinishFrame. The result stays valid until the next frame.
+     */
+    void BeginFrame(const unsigned char* pixels);
+    int GetTileCount() const;
+    void EncodeTile(int tile);
+    const unsigned char* FinishFrame(unsigned int* size, bool* keyframe);
+
+    /*
+     * All three steps on the calling thread.
+     */
+    const unsigned char* EncodeFrame(const unsigned char* pixels, unsigned int* size, bool* keyframe);
+
+private:
+    int m_width;
+    int m_height;
+    int m_keyframe_interval;
+    unsigned int m_frames;
+
+    const unsigned char* m_current;
+    bool m_keyframe;
+    std::vector<unsigned char> m_previous;
+    std::vector<std::vector<unsigned char> > m_tiles;
+    std::vector<unsigned char> m_output;
+};
+
+class LosslessDecoder
+{
+public:
+    LosslessDecoder(int width, int height);
+
+    /*
+     * Decodes a frame into pixels, which has room for width * height * 3 bytes. An empty frame
+     * repeats the previous one. Returns false if the data is damaged or refers to a previous
+     * frame that wasn't decoded.
+     */
+    bool DecodeFrame(const unsigned char* data, unsigned int size, unsigned char* pixels);
+
+private:
+    int m_width;
+    int m_height;
+    bool m_has_frame;
+    std::vector<unsigned char> m_frame;
+};
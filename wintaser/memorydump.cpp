@@ -0,0 +1,282 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Memory dumps, a memory source that doesn't need a game.
+ *
+ * A dump is a copy of the game's read/write regions at one frame boundary. Once one is loaded
+ * it replaces the game process as the memory source, so the RAM search engine can be driven
+ * frame by frame from a recorded sequence of dumps, either to reproduce a search exactly or to
+ * measure how fast searching and updating is without anything else running.
+ *
+ * The file is a header followed by the regions in ascending address order:
+ *     "HGMD", version, region count
+ *     for each region: address, size, flags, then size bytes of memory
+ * All fields are 32-bit little-endian. This file doesn't depend on Windows on purpose.
+ *
+ * The pointer scanner reads memory from its worker threads, so the loaded regions are only ever
+ * touched with s_regions_lock held, and replacing them waits for any read in progress.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "memorydump.h"
+#include "ramsearch.h"
+#include "threadlock.h"
+
+namespace
+{
+    static const char DUMP_MAGIC[4] = { 'H', 'G', 'M', 'D' };
+    static const unsigned int DUMP_VERSION = 1;
+    static const unsigned int MAX_DUMP_REGIONS = 0x100000;
+
+    enum
+    {
+        REGION_TRUSTED = 0x1,
+        REGION_IMAGE = 0x2,
+    };
+
+    struct DumpRegion
+    {
+        WritableMemoryRegion info;
+        std::vector<unsigned char> data;
+    };
+
+    std::vector<DumpRegion> s_regions;
+    ThreadLock s_regions_lock;
+    MemorySource s_dump_source;
+    bool s_dump_loaded = false;
+
+    void CollectRegion(const WritableMemoryRegion& region, void* context)
+    {
+        static_cast<std::vector<WritableMemoryRegion>*>(context)->push_back(region);
+    }
+
+    bool WriteWord(FILE* file, unsigned int value)
+    {
+        return fwrite(&value, sizeof(value), 1, file) == 1;
+    }
+
+    bool ReadWord(FILE* file, unsigned int* value)
+    {
+        return fread(value, sizeof(*value), 1, file) == 1;
+    }
+
+    /*
+     * Returns the index of the region containing address, or s_regions.size() if there is none.
+     */
+    unsigned int FindRegion(HWAddressType address)
+    {
+        unsigned int low = 0;
+        unsigned int high = s_regions.size();
+        while (low < high)
+        {
+            unsigned int middle = low + (high - low) / 2;
+            if (s_regions[middle].info.address + s_regions[middle].info.size <= address)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        if (low < s_regions.size() && s_regions[low].info.address <= address)
+        {
+            return low;
+        }
+        return s_regions.size();
+    }
+
+    /*
+     * Copies between the dump and a buffer, ranges can span regions as long as they are adjacent.
+     */
+    bool CopyDumpMemory(HWAddressType address, unsigned char* buffer, unsigned int size,
+                        bool to_dump)
+    {
+        while (size > 0)
+        {
+            unsigned int index = FindRegion(address);
+            if (index == s_regions.size())
+            {
+                return false;
+            }
+            DumpRegion& region = s_regions[index];
+            unsigned int offset = address - region.info.address;
+            unsigned int length = region.info.size - offset;
+            if (length > size)
+            {
+                length = size;
+            }
+            if (to_dump)
+            {
+                memcpy(&region.data[offset], buffer, length);
+            }
+            else
+            {
+                memcpy(buffer, &region.data[offset], length);
+            }
+            address += length;
+            buffer += length;
+            size -= length;
+        }
+        return true;
+    }
+
+    void EnumerateDumpRegions(WritableMemoryRegionCallback callback, void* callback_context,
+                              void* context)
+    {
+        AutoThreadLock lock(s_regions_lock);
+        for (unsigned int i = 0; i < s_regions.size(); i++)
+        {
+            callback(s_regions[i].info, callback_context);
+        }
+    }
+
+    bool ReadDumpMemory(HWAddressType address, void* buffer, unsigned int size, void* context)
+    {
+        AutoThreadLock lock(s_regions_lock);
+        return CopyDumpMemory(address, static_cast<unsigned char*>(buffer), size, false);
+    }
+
+    bool WriteDumpMemory(HWAddressType address, const void* buffer, unsigned int size,
+                         void* context)
+    {
+        unsigned char* source = static_cast<unsigned char*>(const_cast<void*>(buffer));
+        AutoThreadLock lock(s_regions_lock);
+        return CopyDumpMemory(address, source, size, true);
+    }
+
+    bool ReadDumpFile(FILE* file, std::vector<DumpRegion>* regions)
+    {
+        char magic[4];
+        unsigned int version = 0;
+        unsigned int count = 0;
+        if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, DUMP_MAGIC, sizeof(magic)) != 0
+            || !ReadWord(file, &version) || version != DUMP_VERSION
+            || !ReadWord(file, &count) || count > MAX_DUMP_REGIONS)
+        {
+            return false;
+        }
+
+        regions->resize(count);
+        HWAddressType next_address = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            DumpRegion& region = (*regions)[i];
+            unsigned int address = 0;
+            unsigned int size = 0;
+            unsigned int flags = 0;
+            if (!ReadWord(file, &address) || !ReadWord(file, &size) || !ReadWord(file, &flags)
+                || size == 0 || address < next_address || address + size < address)
+            {
+                return false;
+            }
+            region.info.address = static_cast<HWAddressType>(address);
+            region.info.size = size;
+            region.info.trusted = (flags & REGION_TRUSTED) != 0;
+            region.info.image = (flags & REGION_IMAGE) != 0;
+            region.data.resize(size);
+            if (fread(&region.data[0], size, 1, file) != 1)
+            {
+                return false;
+            }
+            next_address = address + size;
+        }
+        return true;
+    }
+}
+
+bool SaveMemoryDump(const char* filename)
+{
+    std::vector<WritableMemoryRegion> regions;
+    EnumerateWritableMemoryRegions(CollectRegion, &regions);
+
+    /* Regions that can't be read right now are left out, the rest are read first to get the count. */
+    std::vector<DumpRegion> readable;
+    for (unsigned int i = 0; i < regions.size(); i++)
+    {
+        DumpRegion region;
+        region.info = regions[i];
+        region.data.resize(regions[i].size);
+        if (regions[i].size != 0 && ReadRemoteMemory(regions[i].address, &region.data[0], regions[i].size))
+        {
+            readable.push_back(DumpRegion());
+            readable.back().info = region.info;
+            readable.back().data.swap(region.data);
+        }
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool ok = fwrite(DUMP_MAGIC, sizeof(DUMP_MAGIC), 1, file) == 1
+              && WriteWord(file, DUMP_VERSION)
+              && WriteWord(file, static_cast<unsigned int>(readable.size()));
+    for (unsigned int i = 0; ok && i < readable.size(); i++)
+    {
+        const DumpRegion& region = readable[i];
+        unsigned int flags = (region.info.trusted ? REGION_TRUSTED : 0)
+                             | (region.info.image ? REGION_IMAGE : 0);
+        ok = WriteWord(file, static_cast<unsigned int>(region.info.address))
+             && WriteWord(file, region.info.size)
+             && WriteWord(file, flags)
+             && fwrite(&region.data[0], region.info.size, 1, file) == 1;
+    }
+    if (fclose(file) != 0)
+    {
+        ok = false;
+    }
+    return ok;
+}
+
+bool LoadMemoryDump(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    std::vector<DumpRegion> regions;
+    bool ok = ReadDumpFile(file, &regions);
+    fclose(file);
+    if (!ok)
+    {
+        return false;
+    }
+
+    {
+        AutoThreadLock lock(s_regions_lock);
+        s_regions.swap(regions);
+    }
+    s_dump_loaded = true;
+    s_dump_source.enumerate = EnumerateDumpRegions;
+    s_dump_source.read = ReadDumpMemory;
+    s_dump_source.write = WriteDumpMemory;
+    s_dump_source.context = nullptr;
+    /* Also drops whatever was cached from the previous frame's dump. */
+    SetMemorySource(&s_dump_source);
+    return true;
+}
+
+void UnloadMemoryDump()
+{
+    if (!s_dump_loaded)
+    {
+        return;
+    }
+    SetMemorySource(nullptr);
+    s_dump_loaded = false;
+    std::vector<DumpRegion> regions;
+    AutoThreadLock lock(s_regions_lock);
+    s_regions.swap(regions);
+}
+
+bool IsMemoryDumpLoaded()
+{
+    return s_dump_loaded;
+}
@@ -0,0 +1,24 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include "ramsearch.h"
+
+/*
+ * Writes every readable region of the current memory source to a file, with the flags RAM
+ * search uses to pick the regions it searches. Returns false if the file couldn't be written.
+ */
+bool SaveMemoryDump(const char* filename);
+/*
+ * Loads a file written by SaveMemoryDump and makes it the memory source, so RAM search and the
+ * other memory tools see the recorded memory instead of the game's. Loading another dump while
+ * one is in use replaces its contents, which is how a recorded sequence of frames is replayed.
+ * Returns false and leaves the current source alone if the file isn't a valid dump.
+ */
+bool LoadMemoryDump(const char* filename);
+/*
+ * Goes back to reading the game process and frees the loaded dump.
+ */
+void UnloadMemoryDump();
+bool IsMemoryDumpLoaded();
@@ -0,0 +1,344 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <cmath>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "pcmconvert.h"
+
+namespace
+{
+    const double PI = 3.14159265358979323846;
+    /*
+     * The Kaiser window's shape, about 70 dB of stopband attenuation.
+     */
+    const double KAISER_BETA = 7.0;
+    /*
+     * Where the passband ends, relative to the lower of the two Nyquist frequencies.
+     */
+    const double PASSBAND = 0.95;
+
+    unsigned int GreatestCommonDivisor(unsigned int a, unsigned int b)
+    {
+        while (b != 0)
+        {
+            unsigned int remainder = a % b;
+            a = b;
+            b = remainder;
+        }
+        return a;
+    }
+
+    double BesselI0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; k++)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12)
+            {
+                break;
+            }
+        }
+        return sum;
+    }
+
+    short Clamp16(int sample)
+    {
+        if (sample > 32767)
+        {
+            return 32767;
+        }
+        if (sample < -32768)
+        {
+            return -32768;
+        }
+        return static_cast<short>(sample);
+    }
+
+    int DotScalar(const short* samples, const short* coefficients, int count)
+    {
+        int sum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            sum += samples[i] * coefficients[i];
+        }
+        return sum;
+    }
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+    /*
+     * count must be a multiple of 8. Each product fits in 30 bits, so the pairwise sums of
+     * pmaddwd can't overflow and the result is the same as DotScalar's.
+     */
+    int DotSSE2(const short* samples, const short* coefficients, int count)
+    {
+        __m128i sum = _mm_setzero_si128();
+        for (int i = 0; i < count; i += 8)
+        {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients + i));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(s, c));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sum);
+    }
+#endif
+
+    short DecodeSample(const unsigned char* in, int bits_per_sample)
+    {
+        switch (bits_per_sample)
+        {
+        case 8:
+            return static_cast<short>((in[0] - 128) << 8);
+        case 16:
+            return static_cast<short>(in[0] | (in[1] << 8));
+        case 24:
+            return static_cast<short>(in[1] | (in[2] << 8));
+        default:
+            return static_cast<short>(in[2] | (in[3] << 8));
+        }
+    }
+
+    void EncodeSample(short sample, int bits_per_sample, unsigned char* out)
+    {
+        switch (bits_per_sample)
+        {
+        case 8:
+            out[0] = static_cast<unsigned char>((sample >> 8) + 128);
+            break;
+        case 16:
+            out[0] = static_cast<unsigned char>(sample);
+            out[1] = static_cast<unsigned char>(sample >> 8);
+            break;
+        case 24:
+            out[0] = 0;
+            out[1] = static_cast<unsigned char>(sample);
+            out[2] = static_cast<unsigned char>(sample >> 8);
+            break;
+        default:
+            out[0] = 0;
+            out[1] = 0;
+            out[2] = static_cast<unsigned char>(sample);
+            out[3] = static_cast<unsigned char>(sample >> 8);
+            break;
+        }
+    }
+}
+
+PcmConverter::PcmConverter(const PcmFormat& from, const PcmFormat& to, bool use_sse2) :
+    m_from(from),
+    m_to(to),
+    m_use_sse2(use_sse2),
+    m_resampling(from.samples_per_second != to.samples_per_second),
+    m_l(1),
+    m_m(1),
+    m_phases(1),
+    m_taps(0),
+    m_time(0),
+    m_history(to.channels),
+    m_resampled(to.channels)
+{
+    if (m_resampling)
+    {
+        unsigned int divisor = GreatestCommonDivisor(from.samples_per_second, to.samples_per_second);
+        m_l = to.samples_per_second / divisor;
+        m_m = from.samples_per_second / divisor;
+        m_phases = (m_l < static_cast<unsigned int>(MAX_PHASES)) ? m_l : MAX_PHASES;
+        BuildFilter();
+        /*
+         * Silence before the first sample, so that the first output sample lines up with it.
+         */
+        for (int channel = 0; channel < to.channels; channel++)
+        {
+            m_history[channel].assign(m_taps / 2 - 1, 0);
+        }
+    }
+}
+
+bool PcmConverter::IsSupported(const PcmFormat& format)
+{
+    return format.channels >= 1 && format.channels <= 8 && format.samples_per_second > 0
+           && (format.bits_per_sample == 8 || format.bits_per_sample == 16 || format.bits_per_sample == 24
+               || format.bits_per_sample == 32);
+}
+
+const unsigned char* PcmConverter::Convert(const unsigned char* in, unsigned int size, unsigned int* out_size)
+{
+    unsigned int frame_size = m_from.channels * (m_from.bits_per_sample / 8);
+    DecodeInput(in, size / frame_size);
+    EncodeOutput(Resample());
+    *out_size = static_cast<unsigned int>(m_output.size());
+    return m_output.empty() ? nullptr : &m_output[0];
+}
+
+void PcmConverter::BuildFilter()
+{
+    double cutoff = (m_l < m_m) ? static_cast<double>(m_l) / m_m : 1.0;
+    int taps = static_cast<int>(std::ceil(BASE_TAPS / cutoff));
+    taps = (taps + 7) & ~7;
+    if (taps > MAX_TAPS)
+    {
+        taps = MAX_TAPS;
+    }
+    m_taps = taps;
+    cutoff *= PASSBAND;
+
+    const int half = taps / 2;
+    const int one = 1 << COEFFICIENT_BITS;
+    const double window_scale = 1.0 / BesselI0(KAISER_BETA);
+    m_coefficients.resize(m_phases * taps);
+    for (unsigned int phase = 0; phase < m_phases; phase++)
+    {
+        short* row = &m_coefficients[phase * taps];
+        double fraction = static_cast<double>(phase) / m_phases;
+        int sum = 0;
+        int largest = 0;
+        for (int tap = 0; tap < taps; tap++)
+        {
+            /*
+             * How far the output sample is from the input sample this tap is multiplied with.
+             */
+            double distance = fraction + (half - 1) - tap;
+            double position = distance / half;
+            double inside = 1.0 - position * position;
+            double window = BesselI0(KAISER_BETA * std::sqrt((inside > 0.0) ? inside : 0.0)) * window_scale;
+            double x = PI * cutoff * distance;
+            double sinc = (x == 0.0) ? 1.0 : std::sin(x) / x;
+            int coefficient = static_cast<int>(std::floor(cutoff * sinc * window * one + 0.5));
+            row[tap] = static_cast<short>(coefficient);
+            sum += coefficient;
+            if (coefficient > row[largest])
+            {
+                largest = tap;
+            }
+        }
+        /*
+         * Rounding leaves the taps a little off from adding up to 1, which would change the
+         * volume slightly from one phase to the next. The difference goes to the largest tap.
+         */
+        row[largest] = static_cast<short>(row[largest] + one - sum);
+    }
+}
+
+void PcmConverter::DecodeInput(const unsigned char* in, unsigned int frames)
+{
+    const int in_channels = m_from.channels;
+    const int out_channels = m_to.channels;
+    const int sample_size = m_from.bits_per_sample / 8;
+    short samples[8];
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        for (int channel = 0; channel < in_channels; channel++, in += sample_size)
+        {
+            samples[channel] = DecodeSample(in, m_from.bits_per_sample);
+        }
+        if (out_channels == 1 && in_channels > 1)
+        {
+            int sum = 0;
+            for (int channel = 0; channel < in_channels; channel++)
+            {
+                sum += samples[channel];
+            }
+            m_history[0].push_back(static_cast<short>(sum / in_channels));
+        }
+        else
+        {
+            /*
+             * Channels that the input doesn't have repeat the ones it has, so mono goes to
+             * every channel.
+             */
+            for (int channel = 0; channel < out_channels; channel++)
+            {
+                m_history[channel].push_back(samples[channel % in_channels]);
+            }
+        }
+    }
+}
+
+unsigned int PcmConverter::Resample()
+{
+    const int channels = m_to.channels;
+    if (!m_resampling)
+    {
+        for (int channel = 0; channel < channels; channel++)
+        {
+            m_resampled[channel].swap(m_history[channel]);
+            m_history[channel].clear();
+        }
+        return static_cast<unsigned int>(m_resampled[0].size());
+    }
+
+    const unsigned long long available = m_history[0].size();
+    for (int channel = 0; channel < channels; channel++)
+    {
+        m_resampled[channel].clear();
+    }
+    unsigned int frames = 0;
+    for (;;)
+    {
+        unsigned long long start = m_time / m_l;
+        if (start + m_taps > available)
+        {
+            break;
+        }
+        unsigned int fraction = static_cast<unsigned int>(m_time % m_l);
+        unsigned int phase = static_cast<unsigned int>(static_cast<unsigned long long>(fraction) * m_phases / m_l);
+        const short* coefficients = &m_coefficients[phase * m_taps];
+        for (int channel = 0; channel < channels; channel++)
+        {
+            const short* samples = &m_history[channel][static_cast<size_t>(start)];
+            int sum;
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+            if (m_use_sse2)
+            {
+                sum = DotSSE2(samples, coefficients, m_taps);
+            }
+            else
+#endif
+            {
+                sum = DotScalar(samples, coefficients, m_taps);
+            }
+            m_resampled[channel].push_back(Clamp16((sum + (1 << (COEFFICIENT_BITS - 1))) >> COEFFICIENT_BITS));
+        }
+        m_time += m_m;
+        frames++;
+    }
+
+    /*
+     * Drop the input that no later output sample reaches back to.
+     */
+    unsigned long long consumed = m_time / m_l;
+    if (consumed > available)
+    {
+        consumed = available;
+    }
+    for (int channel = 0; channel < channels; channel++)
+    {
+        m_history[channel].erase(m_history[channel].begin(), m_history[channel].begin() + static_cast<size_t>(consumed));
+    }
+    m_time -= consumed * m_l;
+    return frames;
+}
+
+void PcmConverter::EncodeOutput(unsigned int frames)
+{
+    const int channels = m_to.channels;
+    const int sample_size = m_to.bits_per_sample / 8;
+    m_output.resize(frames * channels * sample_size);
+    unsigned char* out = m_output.empty() ? nullptr : &m_output[0];
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        for (int channel = 0; channel < channels; channel++, out += sample_size)
+        {
+            EncodeSample(m_resampled[channel][frame], m_to.bits_per_sample, out);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+/*
+ * Converts PCM audio between sample sizes, channel counts and sample rates without going
+ * through ACM. Only the C++ standard library and SSE2 intrinsics are used here.
+ *
+ * Everything is done in 16-bit fixed point, so the output only depends on the input and the two
+ * formats: the SSE2 and plain versions of the resampler give the same bits. Samples wider than
+ * 16 bits are reduced to 16 bits on the way in.
+ *
+ * Rates are changed with a polyphase windowed-sinc filter. The ratio between the rates is
+ * reduced to L output samples per M input samples, and the filter has one set of taps for each
+ * of the L positions an output sample can fall at between two input samples, up to MAX_PHASES
+ * of them. When converting down, the cutoff moves down with the output rate so nothing above the
+ * new Nyquist frequency is folded back in.
+ */
+
+#include <vector>
+
+struct PcmFormat
+{
+    int channels;
+    int samples_per_second;
+    /*
+     * 8-bit samples are unsigned, 16, 24 and 32-bit ones signed, all little-endian.
+     */
+    int bits_per_sample;
+};
+
+class PcmConverter
+{
+public:
+    PcmConverter(const PcmFormat& from, const PcmFormat& to, bool use_sse2);
+
+    static bool IsSupported(const PcmFormat& format);
+
+    /*
+     * Converts size bytes of interleaved samples, which must be whole sample frames. The result
+     * stays valid until the next call. Resampling holds back the last few input samples until
+     * the input that follows them arrives.
+     */
+    const unsigned char* Convert(const unsigned char* in, unsigned int size, unsigned int* out_size);
+
+private:
+    static const int MAX_PHASES = 1024;
+    static const int BASE_TAPS = 32;
+    static const int MAX_TAPS = 256;
+    static const int COEFFICIENT_BITS = 14;
+
+    void BuildFilter();
+    void DecodeInput(const unsigned char* in, unsigned int frames);
+    unsigned int Resample();
+    void EncodeOutput(unsigned int frames);
+
+    PcmFormat m_from;
+    PcmFormat m_to;
+    bool m_use_sse2;
+
+    /*
+     * Resampling state: the input rate is M, the output rate L after dividing by their greatest
+     * common divisor. m_time is the position of the next output sample, in 1/L input samples
+     * from the start of m_history.
+     */
+    bool m_resampling;
+    unsigned int m_l;
+    unsigned int m_m;
+    unsigned int m_phases;
+    int m_taps;
+    unsigned long long m_time;
+    /*
+     * m_phases rows of m_taps coefficients, in the order they're multiplied with the history.
+     */
+    std::vector<short> m_coefficients;
+
+    /*
+     * One buffer per output channel, the decoded input still needed by the filter followed by
+     * the new input.
+     */
+    std::vector<std::vector<short> > m_history;
+    std::vector<std::vector<short> > m_resampled;
+    std::vector<unsigned char> m_output;
+};
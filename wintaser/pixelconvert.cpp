@@ -0,0 +1,493 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Pixel format conversion for AVI capture.
+ *
+ * Every kernel converts a row into tightly packed BGR triplets. The vectorized ones first build
+ * BGRX pixels in registers, four to a 128-bit register or eight to a 256-bit one, and then drop
+ * every fourth byte with a byte shuffle. The pixels at the end of a row that don't fill a whole
+ * register go through the scalar code, which is also what's used on CPUs without SSSE3.
+ *
+ * The gamma ramp is applied in the same pass: it's folded into the palette, gathered per pixel
+ * by the AVX2 kernels, and otherwise looked up for each block of pixels right after it's been
+ * written, while it's still in the cache.
+ *
+ * The AVX2 kernels need the Visual Studio 2012 compiler or later, with older ones the SSSE3
+ * kernels are the fastest available. tools/pixelconverttest builds this file on its own with
+ * PIXELCONVERT_STANDALONE, where they're in if the compiler was told to use AVX2.
+ */
+
+#include <windows.h>
+
+#include <cstring>
+#include <intrin.h>
+#include <tmmintrin.h>
+#if _MSC_VER >= 1700 || (defined(PIXELCONVERT_STANDALONE) && defined(__AVX2__))
+#define PIXELCONVERT_HAS_AVX2 1
+#include <immintrin.h>
+#else
+#define PIXELCONVERT_HAS_AVX2 0
+#endif
+
+#include "CPUinfo.h"
+#include "pixelconvert.h"
+
+namespace
+{
+    /*
+     * How far a channel mask has to be shifted left (or right, if negative) for its highest bit
+     * to end up in bit 7, for example 0x1FE -> -1, 0xFF -> 0, 0x7F -> 1, 0x3F -> 2.
+     */
+    int ShiftFromMask(unsigned int mask)
+    {
+        int shift = 0;
+        if (mask != 0)
+        {
+            if (mask < 0xFF)
+            {
+                while ((mask << shift) < 128)
+                {
+                    shift++;
+                }
+            }
+            else
+            {
+                while ((mask >> -shift) > 255)
+                {
+                    shift--;
+                }
+            }
+        }
+        return shift;
+    }
+
+    void ConvertBGRX32Scalar(const unsigned char* in, unsigned char* out, int width,
+                             const PixelConversion& conversion)
+    {
+        const unsigned char* gamma = conversion.gamma;
+        for (int x = 0; x < width; x++, in += 4, out += 3)
+        {
+            out[0] = gamma[in[0]];
+            out[1] = gamma[256 + in[1]];
+            out[2] = gamma[512 + in[2]];
+        }
+    }
+
+    void ConvertPalette8Scalar(const unsigned char* in, unsigned char* out, int width,
+                               const PixelConversion& conversion)
+    {
+        for (int x = 0; x < width; x++, out += 3)
+        {
+            unsigned int pixel = conversion.palette[in[x]];
+            out[0] = static_cast<unsigned char>(pixel);
+            out[1] = static_cast<unsigned char>(pixel >> 8);
+            out[2] = static_cast<unsigned char>(pixel >> 16);
+        }
+    }
+
+    void ConvertMaskedScalar(const unsigned char* in, unsigned char* out, int width,
+                             const PixelConversion& conversion)
+    {
+        int bytes_per_pixel = conversion.bytes_per_pixel;
+        int pixel_size = (bytes_per_pixel < 4) ? bytes_per_pixel : 4;
+        for (int x = 0; x < width; x++, in += bytes_per_pixel, out += 3)
+        {
+            unsigned int pixel = 0;
+            for (int i = 0; i < pixel_size; i++)
+            {
+                pixel |= static_cast<unsigned int>(in[i]) << (i * 8);
+            }
+            for (int channel = 0; channel < 3; channel++)
+            {
+                unsigned int value = (pixel & conversion.masks[channel]) << conversion.left_shifts[channel]
+                                     >> conversion.right_shifts[channel];
+                out[channel] = conversion.gamma[channel * 256 + (value & 0xFF)];
+            }
+        }
+    }
+
+    /*
+     * Runs count freshly converted pixels through the gamma ramp while they're still in the cache.
+     */
+    inline void ApplyGamma(unsigned char* out, int count, const unsigned char* gamma)
+    {
+        for (int i = 0; i < count; i++, out += 3)
+        {
+            out[0] = gamma[out[0]];
+            out[1] = gamma[256 + out[1]];
+            out[2] = gamma[512 + out[2]];
+        }
+    }
+
+    /*
+     * Writes the 16 BGRX pixels in pixels[0] to pixels[3] as 48 bytes of BGR.
+     * The registers are passed through an array since 32-bit MSVC can only pass three by value.
+     */
+    inline void StoreSSSE3(unsigned char* out, const __m128i* pixels)
+    {
+        const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        __m128i first = _mm_shuffle_epi8(pixels[0], compact);
+        __m128i second = _mm_shuffle_epi8(pixels[1], compact);
+        __m128i third = _mm_shuffle_epi8(pixels[2], compact);
+        __m128i fourth = _mm_shuffle_epi8(pixels[3], compact);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         _mm_or_si128(first, _mm_slli_si128(second, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16),
+                         _mm_or_si128(_mm_srli_si128(second, 4), _mm_slli_si128(third, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32),
+                         _mm_or_si128(_mm_srli_si128(third, 8), _mm_slli_si128(fourth, 4)));
+    }
+
+    void ConvertBGRX32SSSE3(const unsigned char* in, unsigned char* out, int width,
+                            const PixelConversion& conversion)
+    {
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i pixels[4];
+            for (int i = 0; i < 4; i++)
+            {
+                pixels[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x * 4 + i * 16));
+            }
+            StoreSSSE3(out + x * 3, pixels);
+            if (conversion.gamma_enabled)
+            {
+                ApplyGamma(out + x * 3, 16, conversion.gamma);
+            }
+        }
+        ConvertBGRX32Scalar(in + x * 4, out + x * 3, width - x, conversion);
+    }
+
+    void ConvertMasked16SSSE3(const unsigned char* in, unsigned char* out, int width,
+                              const PixelConversion& conversion)
+    {
+        __m128i channel_masks[3];
+        __m128i channel_lefts[3];
+        __m128i channel_rights[3];
+        for (int channel = 0; channel < 3; channel++)
+        {
+            channel_masks[channel] = _mm_set1_epi16(static_cast<short>(conversion.masks[channel]));
+            channel_lefts[channel] = _mm_cvtsi32_si128(conversion.left_shifts[channel]);
+            channel_rights[channel] = _mm_cvtsi32_si128(conversion.right_shifts[channel]);
+        }
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i pixels[4];
+            for (int i = 0; i < 2; i++)
+            {
+                __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x * 2 + i * 16));
+                __m128i values[3];
+                for (int channel = 0; channel < 3; channel++)
+                {
+                    __m128i value = _mm_and_si128(input, channel_masks[channel]);
+                    value = _mm_sll_epi16(value, channel_lefts[channel]);
+                    values[channel] = _mm_srl_epi16(value, channel_rights[channel]);
+                }
+                __m128i blue_green = _mm_or_si128(values[0], _mm_slli_epi16(values[1], 8));
+                pixels[i * 2] = _mm_unpacklo_epi16(blue_green, values[2]);
+                pixels[i * 2 + 1] = _mm_unpackhi_epi16(blue_green, values[2]);
+            }
+            StoreSSSE3(out + x * 3, pixels);
+            if (conversion.gamma_enabled)
+            {
+                ApplyGamma(out + x * 3, 16, conversion.gamma);
+            }
+        }
+        ConvertMaskedScalar(in + x * 2, out + x * 3, width - x, conversion);
+    }
+
+    void ConvertPalette8SSSE3(const unsigned char* in, unsigned char* out, int width,
+                              const PixelConversion& conversion)
+    {
+        const unsigned int* palette = conversion.palette;
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i pixels[4];
+            for (int i = 0; i < 4; i++)
+            {
+                const unsigned char* indexes = in + x + i * 4;
+                pixels[i] = _mm_setr_epi32(static_cast<int>(palette[indexes[0]]),
+                                           static_cast<int>(palette[indexes[1]]),
+                                           static_cast<int>(palette[indexes[2]]),
+                                           static_cast<int>(palette[indexes[3]]));
+            }
+            StoreSSSE3(out + x * 3, pixels);
+        }
+        ConvertPalette8Scalar(in + x, out + x * 3, width - x, conversion);
+    }
+
+#if PIXELCONVERT_HAS_AVX2
+    /*
+     * Looks up each channel of 8 BGRX pixels in the gamma ramp, one gather per channel.
+     */
+    inline __m256i GammaAVX2(__m256i pixels, const PixelConversion& conversion)
+    {
+        const int* gamma = reinterpret_cast<const int*>(conversion.gamma_pixels);
+        const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+        __m256i blue = _mm256_i32gather_epi32(gamma, _mm256_and_si256(pixels, byte_mask), 4);
+        __m256i green = _mm256_i32gather_epi32(gamma + 256,
+                                               _mm256_and_si256(_mm256_srli_epi32(pixels, 8), byte_mask), 4);
+        __m256i red = _mm256_i32gather_epi32(gamma + 512,
+                                             _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byte_mask), 4);
+        return _mm256_or_si256(_mm256_or_si256(blue, green), red);
+    }
+
+    /*
+     * Writes 8 BGRX pixels as 24 bytes of BGR. The shuffle can't cross the 128-bit lanes, so
+     * each lane is packed on its own and the two halves are then moved next to each other.
+     */
+    inline void StoreAVX2(unsigned char* out, __m256i pixels)
+    {
+        const __m256i compact = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        const __m256i order = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, compact), order);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm256_extracti128_si256(packed, 1));
+    }
+
+    void ConvertBGRX32AVX2(const unsigned char* in, unsigned char* out, int width,
+                           const PixelConversion& conversion)
+    {
+        int x = 0;
+        if (conversion.gamma_enabled)
+        {
+            for (; x + 8 <= width; x += 8)
+            {
+                __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + x * 4));
+                StoreAVX2(out + x * 3, GammaAVX2(pixels, conversion));
+            }
+        }
+        else
+        {
+            for (; x + 8 <= width; x += 8)
+            {
+                StoreAVX2(out + x * 3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + x * 4)));
+            }
+        }
+        _mm256_zeroupper();
+        ConvertBGRX32Scalar(in + x * 4, out + x * 3, width - x, conversion);
+    }
+
+    void ConvertMasked16AVX2(const unsigned char* in, unsigned char* out, int width,
+                             const PixelConversion& conversion)
+    {
+        __m256i channel_masks[3];
+        __m128i channel_lefts[3];
+        __m128i channel_rights[3];
+        for (int channel = 0; channel < 3; channel++)
+        {
+            channel_masks[channel] = _mm256_set1_epi16(static_cast<short>(conversion.masks[channel]));
+            channel_lefts[channel] = _mm_cvtsi32_si128(conversion.left_shifts[channel]);
+            channel_rights[channel] = _mm_cvtsi32_si128(conversion.right_shifts[channel]);
+        }
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            /*
+             * Put pixels 0-3 and 8-11 in the low lane and 4-7 and 12-15 in the high one, so that
+             * the in-lane unpacks below give pixels 0-7 and 8-15 in order.
+             */
+            __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + x * 2));
+            input = _mm256_permute4x64_epi64(input, 0xD8);
+            __m256i values[3];
+            for (int channel = 0; channel < 3; channel++)
+            {
+                __m256i value = _mm256_and_si256(input, channel_masks[channel]);
+                value = _mm256_sll_epi16(value, channel_lefts[channel]);
+                values[channel] = _mm256_srl_epi16(value, channel_rights[channel]);
+            }
+            __m256i blue_green = _mm256_or_si256(values[0], _mm256_slli_epi16(values[1], 8));
+            __m256i low = _mm256_unpacklo_epi16(blue_green, values[2]);
+            __m256i high = _mm256_unpackhi_epi16(blue_green, values[2]);
+            if (conversion.gamma_enabled)
+            {
+                low = GammaAVX2(low, conversion);
+                high = GammaAVX2(high, conversion);
+            }
+            StoreAVX2(out + x * 3, low);
+            StoreAVX2(out + x * 3 + 24, high);
+        }
+        _mm256_zeroupper();
+        ConvertMaskedScalar(in + x * 2, out + x * 3, width - x, conversion);
+    }
+
+    void ConvertPalette8AVX2(const unsigned char* in, unsigned char* out, int width,
+                             const PixelConversion& conversion)
+    {
+        const int* palette = reinterpret_cast<const int*>(conversion.palette);
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i indexes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x)));
+            StoreAVX2(out + x * 3, _mm256_i32gather_epi32(palette, indexes, 4));
+        }
+        _mm256_zeroupper();
+        ConvertPalette8Scalar(in + x, out + x * 3, width - x, conversion);
+    }
+#endif
+}
+
+PixelConverter::PixelConverter() :
+    m_level(LEVEL_SCALAR),
+    m_layout(LAYOUT_BGRX32)
+{
+    memset(m_palette, 0, sizeof(m_palette));
+    SetFormat(32, 0x00FF0000, 0x0000FF00, 0x000000FF);
+    ClearGammaRamp();
+    if (CPUHasSSSE3())
+    {
+        m_level = LEVEL_SSSE3;
+    }
+#if PIXELCONVERT_HAS_AVX2
+    if (CPUHasAVX2())
+    {
+        m_level = LEVEL_AVX2;
+    }
+#endif
+}
+
+void PixelConverter::SetFormat(int bpp, unsigned int rmask, unsigned int gmask, unsigned int bmask)
+{
+    m_conversion.bytes_per_pixel = bpp / 8;
+    m_conversion.masks[0] = bmask;
+    m_conversion.masks[1] = gmask;
+    m_conversion.masks[2] = rmask;
+    for (int channel = 0; channel < 3; channel++)
+    {
+        int shift = ShiftFromMask(m_conversion.masks[channel]);
+        m_conversion.left_shifts[channel] = (shift > 0) ? shift : 0;
+        m_conversion.right_shifts[channel] = (shift < 0) ? -shift : 0;
+    }
+
+    int bytes_per_pixel = m_conversion.bytes_per_pixel;
+    if (bytes_per_pixel == 4 && rmask == 0x00FF0000 && gmask == 0x0000FF00 && bmask == 0x000000FF)
+    {
+        m_layout = LAYOUT_BGRX32;
+    }
+    else if (bytes_per_pixel == 1 && rmask == 0 && gmask == 0 && bmask == 0)
+    {
+        m_layout = LAYOUT_PALETTE8;
+    }
+    else if (bytes_per_pixel == 2 && (rmask | gmask | bmask) <= 0xFFFF)
+    {
+        m_layout = LAYOUT_MASKED16;
+    }
+    else
+    {
+        m_layout = LAYOUT_MASKED;
+    }
+}
+
+void PixelConverter::SetPalette(const PALETTEENTRY* palette)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        m_palette[i] = static_cast<unsigned int>(palette[i].peBlue)
+                       | (static_cast<unsigned int>(palette[i].peGreen) << 8)
+                       | (static_cast<unsigned int>(palette[i].peRed) << 16);
+    }
+    UpdatePalette();
+}
+
+void PixelConverter::SetGammaRamp(const WORD* red, const WORD* green, const WORD* blue)
+{
+    const WORD* ramps[3] = { blue, green, red };
+    for (int channel = 0; channel < 3; channel++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            unsigned char value = static_cast<unsigned char>(ramps[channel][i] >> 8);
+            m_conversion.gamma[channel * 256 + i] = value;
+            m_conversion.gamma_pixels[channel * 256 + i] = static_cast<unsigned int>(value) << (channel * 8);
+        }
+    }
+    m_conversion.gamma_enabled = true;
+    UpdatePalette();
+}
+
+void PixelConverter::ClearGammaRamp()
+{
+    for (int channel = 0; channel < 3; channel++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            m_conversion.gamma[channel * 256 + i] = static_cast<unsigned char>(i);
+            m_conversion.gamma_pixels[channel * 256 + i] = static_cast<unsigned int>(i) << (channel * 8);
+        }
+    }
+    m_conversion.gamma_enabled = false;
+    UpdatePalette();
+}
+
+/*
+ * Palettized frames get gamma for free by going through the ramp once per palette entry.
+ */
+void PixelConverter::UpdatePalette()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        unsigned int entry = m_palette[i];
+        m_conversion.palette[i] = m_conversion.gamma_pixels[entry & 0xFF]
+                                  | m_conversion.gamma_pixels[256 + ((entry >> 8) & 0xFF)]
+                                  | m_conversion.gamma_pixels[512 + ((entry >> 16) & 0xFF)];
+    }
+}
+
+void PixelConverter::ConvertRow(const unsigned char* in, unsigned char* out, int width) const
+{
+    switch (m_layout)
+    {
+    case LAYOUT_BGRX32:
+#if PIXELCONVERT_HAS_AVX2
+        if (m_level == LEVEL_AVX2)
+        {
+            ConvertBGRX32AVX2(in, out, width, m_conversion);
+            break;
+        }
+#endif
+        if (m_level >= LEVEL_SSSE3)
+        {
+            ConvertBGRX32SSSE3(in, out, width, m_conversion);
+            break;
+        }
+        ConvertBGRX32Scalar(in, out, width, m_conversion);
+        break;
+    case LAYOUT_PALETTE8:
+#if PIXELCONVERT_HAS_AVX2
+        if (m_level == LEVEL_AVX2)
+        {
+            ConvertPalette8AVX2(in, out, width, m_conversion);
+            break;
+        }
+#endif
+        if (m_level >= LEVEL_SSSE3)
+        {
+            ConvertPalette8SSSE3(in, out, width, m_conversion);
+            break;
+        }
+        ConvertPalette8Scalar(in, out, width, m_conversion);
+        break;
+    case LAYOUT_MASKED16:
+#if PIXELCONVERT_HAS_AVX2
+        if (m_level == LEVEL_AVX2)
+        {
+            ConvertMasked16AVX2(in, out, width, m_conversion);
+            break;
+        }
+#endif
+        if (m_level >= LEVEL_SSSE3)
+        {
+            ConvertMasked16SSSE3(in, out, width, m_conversion);
+            break;
+        }
+        ConvertMaskedScalar(in, out, width, m_conversion);
+        break;
+    default:
+        ConvertMaskedScalar(in, out, width, m_conversion);
+        break;
+    }
+}
@@ -0,0 +1,87 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+/*
+ * Everything the conversion kernels need, prepared by PixelConverter whenever the format,
+ * palette or gamma ramp changes. Channels are in output order: blue, green, red.
+ */
+struct PixelConversion
+{
+    int bytes_per_pixel;
+    unsigned int masks[3];
+    int left_shifts[3];
+    int right_shifts[3];
+    /*
+     * Palette entries as 0x00RRGGBB with the gamma ramp already applied.
+     */
+    unsigned int palette[256];
+    /*
+     * The gamma ramp reduced to 8 bits, 256 entries per channel. It's the identity when there
+     * is no ramp, so that the scalar code can always go through it.
+     */
+    bool gamma_enabled;
+    unsigned char gamma[3 * 256];
+    /*
+     * The same ramp with every entry shifted to its channel's byte of a 0x00RRGGBB pixel, for
+     * looking up whole pixels at once.
+     */
+    unsigned int gamma_pixels[3 * 256];
+};
+
+/*
+ * Converts rows of the game's frame pixels to the 24-bit BGR rows that AVI frames are made of.
+ * The common formats are converted with SSSE3 or AVX2 when the CPU has them, the result is the
+ * same whichever way a row is converted.
+ */
+class PixelConverter
+{
+public:
+    PixelConverter();
+
+    /*
+     * Sets up conversion from bpp-bit little-endian pixels with the given channel masks.
+     * 8-bit pixels without any masks are indexes into the palette.
+     */
+    void SetFormat(int bpp, unsigned int rmask, unsigned int gmask, unsigned int bmask);
+    void SetPalette(const PALETTEENTRY* palette);
+    /*
+     * Applies a gamma ramp of 256 16-bit entries per channel, like the ones in DDGAMMARAMP, to
+     * everything converted from now on. Only the high byte of each entry is used.
+     */
+    void SetGammaRamp(const WORD* red, const WORD* green, const WORD* blue);
+    void ClearGammaRamp();
+    /*
+     * Converts width pixels from in to out, which must have room for width * 3 bytes.
+     * Nothing is written outside of that, so different rows can be converted at the same time.
+     */
+    void ConvertRow(const unsigned char* in, unsigned char* out, int width) const;
+
+private:
+    enum Layout
+    {
+        LAYOUT_BGRX32,
+        LAYOUT_MASKED16,
+        LAYOUT_PALETTE8,
+        LAYOUT_MASKED,
+    };
+    enum Level
+    {
+        LEVEL_SCALAR,
+        LEVEL_SSSE3,
+        LEVEL_AVX2,
+    };
+
+    void UpdatePalette();
+
+    Level m_level;
+    Layout m_layout;
+    /*
+     * The palette as it was set, without gamma.
+     */
+    unsigned int m_palette[256];
+    PixelConversion m_conversion;
+};
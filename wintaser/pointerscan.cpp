@@ -0,0 +1,625 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Pointer path scanner.
+ *
+ * RAM search only finds where a value lives right now. Anything allocated on the heap
+ * moves between runs (and between savestate loads that replay allocations differently),
+ * so this finds chains of pointers that start at a fixed address inside one of the game's
+ * own modules and end at the address found with RAM search.
+ *
+ * The scan works backwards from the target:
+ * 1. Every aligned dword in the writable memory of the game is read once, and those that
+ *    point into writable memory are stored as (value, location) pairs sorted by value.
+ * 2. Level n+1 of a breadth-first search holds every location whose value points at most
+ *    max_offset bytes below some address of level n. With the index sorted by value that
+ *    is a binary search per address, and every address of a level is independent of the
+ *    others, so both steps are split over all processors.
+ * 3. Locations inside the game's modules end a path; they are the static bases.
+ *    Data sections of system DLLs are skipped entirely, they are neither stable bases
+ *    nor where the game keeps its objects.
+ */
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pointerscan.h"
+#include "ramsearch.h"
+#include "remotememory.h"
+#include "resource.h"
+
+namespace
+{
+    static const unsigned int MAX_WORKER_THREADS = 16;
+    static const unsigned int INDEX_CHUNK_SIZE = 1024 * 1024;
+    static const unsigned int MAX_FRONTIER_SIZE = 1024 * 1024;
+    static const unsigned int DEFAULT_MAX_DEPTH = 4;
+    static const unsigned int DEFAULT_MAX_OFFSET = 0x400;
+    static const unsigned int DEFAULT_MAX_RESULTS = 4096;
+
+    struct ScanRegion
+    {
+        HWAddressType address;
+        unsigned int size;
+        bool is_static;
+    };
+
+    struct ScanChunk
+    {
+        HWAddressType address;
+        unsigned int size;
+    };
+
+    struct PointerEntry
+    {
+        HWAddressType value;
+        HWAddressType address;
+    };
+
+    struct PathNode
+    {
+        HWAddressType address;
+        unsigned int offset;
+        int parent;
+    };
+
+    bool EntryValueLess(const PointerEntry& left, const PointerEntry& right)
+    {
+        return left.value < right.value || (left.value == right.value && left.address < right.address);
+    }
+
+    bool EntryValueBelow(const PointerEntry& entry, HWAddressType value)
+    {
+        return entry.value < value;
+    }
+
+    bool NodeAddressLess(const PathNode& left, const PathNode& right)
+    {
+        return left.address < right.address;
+    }
+
+    bool NodeAddressEqual(const PathNode& left, const PathNode& right)
+    {
+        return left.address == right.address;
+    }
+
+    bool RegionEndsBefore(HWAddressType address, const ScanRegion& region)
+    {
+        return address < region.address;
+    }
+
+    /*
+     * Returns the region containing address, or nullptr.
+     * The regions are sorted and never overlap since they come straight from VirtualQueryEx.
+     */
+    const ScanRegion* FindRegion(const std::vector<ScanRegion>& regions, HWAddressType address)
+    {
+        std::vector<ScanRegion>::const_iterator iter = std::upper_bound(regions.begin(), regions.end(),
+                                                                         address, RegionEndsBefore);
+        if (iter == regions.begin())
+        {
+            return nullptr;
+        }
+        --iter;
+        if (address - iter->address >= iter->size)
+        {
+            return nullptr;
+        }
+        return &*iter;
+    }
+
+    void AddScanRegion(const WritableMemoryRegion& writable, void* context)
+    {
+        if (writable.image && !writable.trusted)
+        {
+            return;
+        }
+        ScanRegion region = { writable.address, writable.size, writable.trusted };
+        static_cast<std::vector<ScanRegion>*>(context)->push_back(region);
+    }
+
+    unsigned int GetWorkerCount()
+    {
+        SYSTEM_INFO si = { 0 };
+        GetSystemInfo(&si);
+        unsigned int count = static_cast<unsigned int>(si.dwNumberOfProcessors);
+        if (count > MAX_WORKER_THREADS)
+        {
+            count = MAX_WORKER_THREADS;
+        }
+        return count ? count : 1;
+    }
+
+    template<class Job>
+    struct WorkerStart
+    {
+        Job* job;
+        unsigned int index;
+        unsigned int count;
+    };
+
+    template<class Job>
+    DWORD WINAPI WorkerThreadProc(LPVOID param)
+    {
+        WorkerStart<Job>* start = static_cast<WorkerStart<Job>*>(param);
+        (*start->job)(start->index, start->count);
+        return 0;
+    }
+
+    /*
+     * Calls job(index, count) for every index below count, each on its own thread,
+     * and returns once all of them are done. Index 0 runs on the calling thread.
+     */
+    template<class Job>
+    void RunParallel(Job& job, unsigned int count)
+    {
+        WorkerStart<Job> starts[MAX_WORKER_THREADS];
+        HANDLE threads[MAX_WORKER_THREADS];
+        DWORD num_threads = 0;
+        for (unsigned int i = 1; i < count; i++)
+        {
+            starts[i].job = &job;
+            starts[i].index = i;
+            starts[i].count = count;
+            HANDLE thread = CreateThread(nullptr, 0, WorkerThreadProc<Job>, &starts[i], 0, nullptr);
+            if (thread != nullptr)
+            {
+                threads[num_threads] = thread;
+                num_threads++;
+            }
+            else
+            {
+                job(i, count);
+            }
+        }
+        job(0, count);
+        if (num_threads > 0)
+        {
+            WaitForMultipleObjects(num_threads, threads, TRUE, INFINITE);
+        }
+        for (DWORD i = 0; i < num_threads; i++)
+        {
+            CloseHandle(threads[i]);
+        }
+    }
+
+    /*
+     * Step 1: reads all the chunks and collects the dwords that point into scanned memory.
+     * Chunks are handed out through a shared counter since region sizes vary wildly.
+     */
+    struct BuildIndexJob
+    {
+        const std::vector<ScanRegion>* regions;
+        const std::vector<ScanChunk>* chunks;
+        volatile LONG next_chunk;
+        std::vector<PointerEntry> entries[MAX_WORKER_THREADS];
+
+        void operator()(unsigned int index, unsigned int count)
+        {
+            std::vector<DWORD> buffer(INDEX_CHUNK_SIZE / sizeof(DWORD));
+            std::vector<PointerEntry>& found = entries[index];
+            HWAddressType lowest = regions->front().address;
+            HWAddressType span = regions->back().address + regions->back().size - lowest;
+            const ScanRegion* last_hit = &regions->front();
+
+            LONG chunk_index;
+            LONG num_chunks = static_cast<LONG>(chunks->size());
+            while ((chunk_index = InterlockedIncrement(&next_chunk) - 1) < num_chunks)
+            {
+                const ScanChunk& chunk = (*chunks)[chunk_index];
+                /*
+                 * Pages can be freed while we scan, losing a chunk is fine.
+                 */
+                unsigned int num_dwords = 0;
+                if (ReadRemoteMemory(chunk.address, &buffer[0], chunk.size))
+                {
+                    num_dwords = chunk.size / sizeof(DWORD);
+                }
+                for (unsigned int i = 0; i < num_dwords; i++)
+                {
+                    HWAddressType value = static_cast<HWAddressType>(buffer[i]);
+                    /*
+                     * Most pointers land in the same heap as the previous one.
+                     */
+                    if (value - lowest < span && value - last_hit->address >= last_hit->size)
+                    {
+                        const ScanRegion* region = FindRegion(*regions, value);
+                        if (region != nullptr)
+                        {
+                            last_hit = region;
+                        }
+                    }
+                    if (value - last_hit->address < last_hit->size)
+                    {
+                        HWAddressType location = chunk.address
+                                               + static_cast<HWAddressType>(i * sizeof(DWORD));
+                        PointerEntry entry = { value, location };
+                        found.push_back(entry);
+                    }
+                }
+            }
+            std::sort(found.begin(), found.end(), EntryValueLess);
+        }
+    };
+
+    /*
+     * Step 2: finds every pointer to the addresses of the current level.
+     * Each thread takes a contiguous slice of the level so the results keep their order.
+     */
+    struct ExpandLevelJob
+    {
+        const std::vector<ScanRegion>* regions;
+        const std::vector<PointerEntry>* pointers;
+        const std::vector<PathNode>* level;
+        unsigned int max_offset;
+        std::vector<PathNode> next[MAX_WORKER_THREADS];
+        std::vector<PathNode> bases[MAX_WORKER_THREADS];
+
+        void operator()(unsigned int index, unsigned int count)
+        {
+            unsigned int begin = static_cast<unsigned int>(level->size() * index / count);
+            unsigned int end = static_cast<unsigned int>(level->size() * (index + 1) / count);
+            for (unsigned int i = begin; i < end; i++)
+            {
+                HWAddressType target = (*level)[i].address;
+                HWAddressType low = (target >= max_offset) ? (target - max_offset) : 0;
+                std::vector<PointerEntry>::const_iterator iter = std::lower_bound(pointers->begin(),
+                                                                                  pointers->end(),
+                                                                                  low,
+                                                                                  EntryValueBelow);
+                for (; iter != pointers->end() && iter->value <= target; ++iter)
+                {
+                    PathNode node = { iter->address, target - iter->value, static_cast<int>(i) };
+                    const ScanRegion* region = FindRegion(*regions, iter->address);
+                    if (region != nullptr && region->is_static)
+                    {
+                        bases[index].push_back(node);
+                    }
+                    else
+                    {
+                        next[index].push_back(node);
+                    }
+                }
+            }
+        }
+    };
+
+    void BuildPointerIndex(const std::vector<ScanRegion>& regions, unsigned int num_workers,
+                           std::vector<PointerEntry>* index, PointerScanStats* stats)
+    {
+        std::vector<ScanChunk> chunks;
+        for (unsigned int i = 0; i < regions.size(); i++)
+        {
+            for (unsigned int offset = 0; offset < regions[i].size; offset += INDEX_CHUNK_SIZE)
+            {
+                unsigned int size = regions[i].size - offset;
+                ScanChunk chunk = { regions[i].address + offset,
+                                    size < INDEX_CHUNK_SIZE ? size : INDEX_CHUNK_SIZE };
+                chunks.push_back(chunk);
+            }
+            stats->bytes_scanned += regions[i].size;
+        }
+
+        BuildIndexJob* job = new BuildIndexJob();
+        job->regions = &regions;
+        job->chunks = &chunks;
+        job->next_chunk = 0;
+        RunParallel(*job, num_workers);
+
+        size_t total = 0;
+        for (unsigned int i = 0; i < num_workers; i++)
+        {
+            total += job->entries[i].size();
+        }
+        index->clear();
+        index->reserve(total);
+        for (unsigned int i = 0; i < num_workers; i++)
+        {
+            size_t middle = index->size();
+            index->insert(index->end(), job->entries[i].begin(), job->entries[i].end());
+            std::vector<PointerEntry>().swap(job->entries[i]);
+            std::inplace_merge(index->begin(), index->begin() + middle, index->end(), EntryValueLess);
+        }
+        delete job;
+
+        stats->pointers_indexed = static_cast<unsigned int>(index->size());
+    }
+
+    void AppendResult(const std::vector<std::vector<PathNode> >& levels, const PathNode& base,
+                      std::vector<PointerPath>* results)
+    {
+        PointerPath path;
+        path.base = base.address;
+        path.offsets.push_back(base.offset);
+        int parent = base.parent;
+        for (size_t depth = levels.size() - 1; depth > 0; depth--)
+        {
+            const PathNode& node = levels[depth][parent];
+            path.offsets.push_back(node.offset);
+            parent = node.parent;
+        }
+        results->push_back(path);
+    }
+
+    HWND s_pointer_scan_hwnd = nullptr;
+    std::vector<PointerPath> s_pointer_scan_results;
+
+    void FormatPointerPath(const PointerPath& path, char* output, size_t size)
+    {
+        std::string text(path.offsets.size(), '[');
+        char part[16];
+        _snprintf_s(part, sizeof(part), _TRUNCATE, "%08X", path.base);
+        text += part;
+        for (size_t i = 0; i < path.offsets.size(); i++)
+        {
+            _snprintf_s(part, sizeof(part), _TRUNCATE, "]+%X", path.offsets[i]);
+            text += part;
+        }
+        strncpy_s(output, size, text.c_str(), _TRUNCATE);
+    }
+
+    void FillPointerScanList(HWND hDlg)
+    {
+        HWND list = GetDlgItem(hDlg, IDC_PS_RESULTS);
+        SendMessage(list, WM_SETREDRAW, FALSE, 0);
+        SendMessage(list, LB_RESETCONTENT, 0, 0);
+        char text[256];
+        for (size_t i = 0; i < s_pointer_scan_results.size(); i++)
+        {
+            FormatPointerPath(s_pointer_scan_results[i], text, sizeof(text));
+            SendMessage(list, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(text));
+        }
+        SendMessage(list, WM_SETREDRAW, TRUE, 0);
+        InvalidateRect(list, nullptr, TRUE);
+    }
+
+    bool ReadControlUInt(HWND hDlg, int control_id, int base, unsigned int* value)
+    {
+        char text[64];
+        if (!GetDlgItemText(hDlg, control_id, text, sizeof(text)))
+        {
+            return false;
+        }
+        char* end = nullptr;
+        *value = static_cast<unsigned int>(strtoul(text, &end, base));
+        return end != text && *end == '\0';
+    }
+
+    void DoPointerScan(HWND hDlg)
+    {
+        PointerScanSettings settings;
+        settings.max_results = DEFAULT_MAX_RESULTS;
+        if (!ReadControlUInt(hDlg, IDC_PS_ADDRESS, 16, &settings.target)
+            || !ReadControlUInt(hDlg, IDC_PS_DEPTH, 10, &settings.max_depth)
+            || !ReadControlUInt(hDlg, IDC_PS_MAXOFFSET, 16, &settings.max_offset)
+            || settings.max_depth == 0)
+        {
+            MessageBox(hDlg, "Invalid address, depth or offset.", "Pointer Scan", MB_OK | MB_ICONSTOP);
+            return;
+        }
+
+        HCURSOR old_cursor = SetCursor(LoadCursor(nullptr, IDC_WAIT));
+        PointerScanStats stats;
+        bool scanned = ScanPointerPaths(settings, &s_pointer_scan_results, &stats);
+        SetCursor(old_cursor);
+
+        char status[256];
+        if (scanned)
+        {
+            _snprintf_s(status, sizeof(status), _TRUNCATE,
+                        "%u paths%s, %u pointers in %u MB, %u ms",
+                        static_cast<unsigned int>(s_pointer_scan_results.size()),
+                        stats.truncated ? " (truncated)" : "",
+                        stats.pointers_indexed, stats.bytes_scanned >> 20, stats.milliseconds);
+        }
+        else
+        {
+            _snprintf_s(status, sizeof(status), _TRUNCATE, "No game is running.");
+        }
+        SetDlgItemText(hDlg, IDC_PS_STATUS, status);
+        FillPointerScanList(hDlg);
+    }
+
+    /*
+     * Keeps the paths that lead to the address in the edit box now,
+     * so paths found in one run can be narrowed down after restarting the game.
+     */
+    void DoPointerFilter(HWND hDlg)
+    {
+        HWAddressType target;
+        if (!ReadControlUInt(hDlg, IDC_PS_ADDRESS, 16, &target))
+        {
+            MessageBox(hDlg, "Invalid address.", "Pointer Scan", MB_OK | MB_ICONSTOP);
+            return;
+        }
+        std::vector<PointerPath> kept;
+        for (size_t i = 0; i < s_pointer_scan_results.size(); i++)
+        {
+            HWAddressType address;
+            if (ResolvePointerPath(s_pointer_scan_results[i], &address) && address == target)
+            {
+                kept.push_back(s_pointer_scan_results[i]);
+            }
+        }
+        s_pointer_scan_results.swap(kept);
+
+        char status[64];
+        _snprintf_s(status, sizeof(status), _TRUNCATE, "%u paths left",
+                    static_cast<unsigned int>(s_pointer_scan_results.size()));
+        SetDlgItemText(hDlg, IDC_PS_STATUS, status);
+        FillPointerScanList(hDlg);
+    }
+
+    LRESULT CALLBACK PointerScanProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        switch (uMsg)
+        {
+        case WM_INITDIALOG:
+        {
+            char text[16];
+            _snprintf_s(text, sizeof(text), _TRUNCATE, "%u", DEFAULT_MAX_DEPTH);
+            SetDlgItemText(hDlg, IDC_PS_DEPTH, text);
+            _snprintf_s(text, sizeof(text), _TRUNCATE, "%X", DEFAULT_MAX_OFFSET);
+            SetDlgItemText(hDlg, IDC_PS_MAXOFFSET, text);
+            FillPointerScanList(hDlg);
+            return TRUE;
+        }
+        case WM_COMMAND:
+            switch (LOWORD(wParam))
+            {
+            case IDC_PS_SCAN:
+                DoPointerScan(hDlg);
+                return TRUE;
+            case IDC_PS_FILTER:
+                DoPointerFilter(hDlg);
+                return TRUE;
+            case IDCANCEL:
+                DestroyWindow(hDlg);
+                return TRUE;
+            }
+            break;
+        case WM_CLOSE:
+            DestroyWindow(hDlg);
+            return TRUE;
+        case WM_DESTROY:
+            s_pointer_scan_hwnd = nullptr;
+            break;
+        }
+        return FALSE;
+    }
+}
+
+bool ScanPointerPaths(const PointerScanSettings& settings, std::vector<PointerPath>* results,
+                      PointerScanStats* stats)
+{
+    DWORD start_time = GetTickCount();
+    results->clear();
+    ZeroMemory(stats, sizeof(*stats));
+
+    std::vector<ScanRegion> regions;
+    EnumerateWritableMemoryRegions(AddScanRegion, &regions);
+    if (regions.empty())
+    {
+        return false;
+    }
+    stats->regions = static_cast<unsigned int>(regions.size());
+
+    unsigned int num_workers = GetWorkerCount();
+    std::vector<PointerEntry> index;
+    BuildPointerIndex(regions, num_workers, &index, stats);
+
+    std::vector<std::vector<PathNode> > levels(1);
+    PathNode root = { settings.target, 0, -1 };
+    levels[0].push_back(root);
+    std::vector<HWAddressType> visited(1, settings.target);
+
+    while (levels.size() <= settings.max_depth && !levels.back().empty()
+           && results->size() < settings.max_results)
+    {
+        ExpandLevelJob* job = new ExpandLevelJob();
+        job->regions = &regions;
+        job->pointers = &index;
+        job->level = &levels.back();
+        job->max_offset = settings.max_offset;
+        unsigned int num_jobs = static_cast<unsigned int>(levels.back().size());
+        if (num_jobs > num_workers)
+        {
+            num_jobs = num_workers;
+        }
+        RunParallel(*job, num_jobs);
+
+        for (unsigned int i = 0; i < num_jobs; i++)
+        {
+            for (size_t j = 0; j < job->bases[i].size() && results->size() < settings.max_results; j++)
+            {
+                AppendResult(levels, job->bases[i][j], results);
+            }
+        }
+        if (results->size() >= settings.max_results)
+        {
+            stats->truncated = true;
+        }
+
+        /*
+         * An address already reached through a shorter path only adds longer duplicates,
+         * so each address is expanded once, from the first level that reached it.
+         */
+        std::vector<PathNode> next;
+        for (unsigned int i = 0; i < num_jobs; i++)
+        {
+            next.insert(next.end(), job->next[i].begin(), job->next[i].end());
+        }
+        delete job;
+        std::stable_sort(next.begin(), next.end(), NodeAddressLess);
+        next.erase(std::unique(next.begin(), next.end(), NodeAddressEqual), next.end());
+
+        std::vector<PathNode> level;
+        std::vector<HWAddressType>::const_iterator seen = visited.begin();
+        for (size_t i = 0; i < next.size(); i++)
+        {
+            while (seen != visited.end() && *seen < next[i].address)
+            {
+                ++seen;
+            }
+            if (seen == visited.end() || *seen != next[i].address)
+            {
+                level.push_back(next[i]);
+            }
+        }
+        if (level.size() > MAX_FRONTIER_SIZE)
+        {
+            level.resize(MAX_FRONTIER_SIZE);
+            stats->truncated = true;
+        }
+
+        size_t middle = visited.size();
+        for (size_t i = 0; i < level.size(); i++)
+        {
+            visited.push_back(level[i].address);
+        }
+        std::inplace_merge(visited.begin(), visited.begin() + middle, visited.end());
+        stats->nodes_visited += static_cast<unsigned int>(level.size());
+
+        levels.push_back(std::vector<PathNode>());
+        levels.back().swap(level);
+    }
+
+    stats->milliseconds = GetTickCount() - start_time;
+    return true;
+}
+
+bool ResolvePointerPath(const PointerPath& path, HWAddressType* address)
+{
+    HWAddressType current = path.base;
+    for (size_t i = 0; i < path.offsets.size(); i++)
+    {
+        DWORD value;
+        if (!ReadRemoteMemoryCached(current, &value, sizeof(value)))
+        {
+            return false;
+        }
+        current = static_cast<HWAddressType>(value) + path.offsets[i];
+    }
+    *address = current;
+    return true;
+}
+
+void OpenPointerScanWindow(HINSTANCE instance, HWND parent)
+{
+    if (s_pointer_scan_hwnd == nullptr)
+    {
+        s_pointer_scan_hwnd = CreateDialog(instance, MAKEINTRESOURCE(IDD_POINTERSCAN), parent,
+                                           reinterpret_cast<DLGPROC>(PointerScanProc));
+    }
+    else
+    {
+        SetForegroundWindow(s_pointer_scan_hwnd);
+    }
+}
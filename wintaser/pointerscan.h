@@ -0,0 +1,51 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+#include <vector>
+
+#include "ramsearch.h"
+
+/*
+ * A static base address followed by the offsets to add after each dereference,
+ * so that [[base]+offsets[0]]+offsets[1] is the address that was scanned for.
+ */
+struct PointerPath
+{
+    HWAddressType base;
+    std::vector<unsigned int> offsets;
+};
+
+struct PointerScanSettings
+{
+    HWAddressType target;
+    unsigned int max_depth;
+    unsigned int max_offset;
+    unsigned int max_results;
+};
+
+struct PointerScanStats
+{
+    unsigned int regions;
+    unsigned int bytes_scanned;
+    unsigned int pointers_indexed;
+    unsigned int nodes_visited;
+    DWORD milliseconds;
+    bool truncated;
+};
+
+/*
+ * Finds chains of pointers that start in the game's own modules and lead to settings.target.
+ * Returns false if there is no game process to scan.
+ */
+bool ScanPointerPaths(const PointerScanSettings& settings, std::vector<PointerPath>* results,
+                      PointerScanStats* stats);
+/*
+ * Follows a path through the current game memory, returns false if a link can't be read.
+ */
+bool ResolvePointerPath(const PointerPath& path, HWAddressType* address);
+
+void OpenPointerScanWindow(HINSTANCE instance, HWND parent);
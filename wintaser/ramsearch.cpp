@@ -52,13 +52,20 @@
 #include <windows.h>
 #include "resource.h"
 #include "ramsearch.h"
+#include "ramsearchengine.h"
 #include "ramwatch.h"
+#include "memorydump.h"
+#include "remotememory.h"
+#include "watchtrace.h"
+#include "watchtrigger.h"
 #include "Config.h"
+#include "logging.h"
 #include <shared/winutil.h>
 #include <assert.h>
 #include <commctrl.h>
 #include <list>
 #include <vector>
+#include <algorithm>
 #include <math.h>
 #ifdef _WIN32
 #include "BaseTsd.h"
@@ -67,24 +74,6 @@ typedef INT_PTR intptr_t;
 #include "stdint.h"
 #endif
 
-struct MemoryRegion
-{
-    HWAddressType hardwareAddress; // hardware address of the start of this region
-    unsigned int size; // number of bytes to the end of this region
-
-    unsigned int virtualIndex; // index into s_prevValues, s_curValues, and s_numChanges, valid after being initialized in ResetMemoryRegions()
-    unsigned int itemIndex; // index into listbox items, valid when s_itemIndicesInvalid is false
-};
-
-int MAX_RAM_SIZE = 0;
-static unsigned char* s_prevValues = 0; // values at last search or reset
-static unsigned char* s_curValues = 0; // values at last frame update
-static unsigned short* s_numChanges = 0; // number of changes of the item starting at this virtual index address
-static MemoryRegion** s_itemIndexToRegionPointer = 0; // used for random access into the memory list (trading memory size to get speed here, too bad it's so much memory), only valid when s_itemIndicesInvalid is false
-static BOOL s_itemIndicesInvalid = true; // if true, the link from listbox items to memory regions (s_itemIndexToRegionPointer) and the link from memory regions to list box items (MemoryRegion::itemIndex) both need to be recalculated
-static BOOL s_prevValuesNeedUpdate = true; // if true, the "prev" values should be updated using the "cur" values on the next frame update signaled
-static unsigned int s_maxItemIndex = 0; // max currently valid item index, the listbox sometimes tries to update things past the end of the list so we need to know this to ignore those attempts
-
 extern HWND RamSearchHWnd;
 extern HWND RamWatchHWnd;
 extern HWND hWnd;
@@ -104,196 +93,102 @@ int disableRamSearchUpdate = false;
 //static const MemoryRegion s_68kRegion    = {  0xFF0000, _68K_RAM_SIZE,       (unsigned char*)Ram_68k,     true};
 //static const MemoryRegion s_32xRegion    = {0x06000000, _32X_RAM_SIZE,       (unsigned char*)_32X_Ram,    false};
 
-// list of contiguous uneliminated memory regions
-typedef std::list<MemoryRegion> MemoryList;
-static MemoryList s_activeMemoryRegions;
-static CRITICAL_SECTION s_activeMemoryRegionsCS;
+// regions as they were right after the last reset, used to map virtual indices back to hardware addresses
+static std::vector<MemoryRegion> s_baseRegions;
 
-// for undo support (could be better, but this way was really easy)
-static MemoryList s_activeMemoryRegionsBackup;
-static int s_undoType = 0; // 0 means can't undo, 1 means can undo, 2 means can redo
+// for undo support: a step is the set of items an action removed and the set it added
+struct UndoStep
+{
+    std::vector<unsigned char> removed;
+    std::vector<unsigned char> added;
+};
+static std::vector<UndoStep> s_undoSteps;
+static unsigned int s_undoCount = 0; // the first s_undoCount steps can be undone, the rest can be redone
+static unsigned int s_undoBytes = 0;
+static std::vector<unsigned char> s_undoPendingState; // results before the action in progress
+static bool s_undoPending = false;
+static const unsigned int maxUndoSteps = 256;
+static const unsigned int maxUndoBytes = 32 * 1024 * 1024;
 
-void RamSearchSaveUndoStateIfNotTooBig(HWND hDlg);
-static const int tooManyRegionsForUndo = 10000;
+void RamSearchSaveUndoState(HWND hDlg);
+void DiscardRamSearchUndoState(HWND hDlg);
+void ClearRamSearchUndo(HWND hDlg);
+static bool RamSearchUndo(HWND hDlg, bool redo);
+static void UpdateUndoButtons(HWND hDlg);
 
 
 
 bool IsInNonCurrentYetTrustedAddressSpace(DWORD address);
 
 
-void ResetMemoryRegions()
+static void EnumerateGameProcessRegions(WritableMemoryRegionCallback callback, void* callbackContext, void* context)
 {
-    //	Clear_Sound_Buffer();
-    EnterCriticalSection(&s_activeMemoryRegionsCS);
+    if (!hGameProcess)
+        return;
 
-    s_activeMemoryRegions.clear();
+    EnterCriticalSection(&g_processMemCS);
 
-    if (hGameProcess)
+    MEMORY_BASIC_INFORMATION mbi = { 0 };
+    SYSTEM_INFO si = { 0 };
+    GetSystemInfo(&si);
+    // walk process addresses
+    void* lpMem = si.lpMinimumApplicationAddress;
+    while (lpMem < si.lpMaximumApplicationAddress)
     {
-        EnterCriticalSection(&g_processMemCS);
-
-        MEMORY_BASIC_INFORMATION mbi = { 0 };
-        SYSTEM_INFO si = { 0 };
-        GetSystemInfo(&si);
-        // walk process addresses
-        void* lpMem = si.lpMinimumApplicationAddress;
-        int totalSize = 0;
-        while (lpMem < si.lpMaximumApplicationAddress)
+        if (!VirtualQueryEx(hGameProcess, lpMem, &mbi, sizeof(MEMORY_BASIC_INFORMATION)))
+            break;
+        // increment lpMem to next region of memory
+        lpMem = (LPVOID)((unsigned char*)mbi.BaseAddress + (DWORD)mbi.RegionSize);
+
+        // check if it's readable and writable
+        // (including read-only regions gives us WAY too much memory to search)
+        if (((mbi.Protect & PAGE_READWRITE)
+            || (mbi.Protect & PAGE_EXECUTE_READWRITE))
+            && !(mbi.Protect & PAGE_GUARD)
+            && (mbi.State & MEM_COMMIT))
         {
-            VirtualQueryEx(hGameProcess, lpMem, &mbi, sizeof(MEMORY_BASIC_INFORMATION));
-            // increment lpMem to next region of memory
-            lpMem = (LPVOID)((unsigned char*)mbi.BaseAddress + (DWORD)mbi.RegionSize);
-
-            // check if it's readable and writable
-            // (including read-only regions gives us WAY too much memory to search)
-            if (((mbi.Protect & PAGE_READWRITE)
-                || (mbi.Protect & PAGE_EXECUTE_READWRITE))
-                && !(mbi.Protect & PAGE_GUARD)
-                && (mbi.State & MEM_COMMIT)
-                //			&& (mbi.Type & (MEM_PRIVATE | MEM_IMAGE))
-                )
-            {
-                //if((unsigned int)mbi.BaseAddress >= 0x01400000
-                //&& (unsigned int)-(signed int)((unsigned int)mbi.BaseAddress|0xF0000000) >= 0x01400000
-                //&& mbi.RegionSize > 0x4000)
-                //if(mbi.RegionSize > 0x40000)
-                //	mbi.RegionSize = 0x40000;
-                //if(!((unsigned int)mbi.BaseAddress >= 0x400000 && mbi.BaseAddress < 0x400000 + 0x400000))
-                //if((unsigned int)mbi.BaseAddress > 0x00400000 + 0x00800000
-                //&& ((unsigned int)mbi.BaseAddress < 0x7ff00000 || (unsigned int)mbi.BaseAddress >= 0x80000000))
-                //	continue; // 0x7f000000  ... 0x7ffb0000
-                if (!IsInNonCurrentYetTrustedAddressSpace((unsigned int)mbi.BaseAddress))
-                    continue;
-                //BOOL a = (mbi.State & MEM_PRIVATE);
-                //BOOL b = (mbi.State & MEM_IMAGE);
-                //BOOL c = (mbi.State & MEM_MAPPED);
-
-                if (IsHardwareAddressValid((HWAddressType)mbi.BaseAddress))
-                {
-                    //static const int maxRegionSize = 1024*1024*2;
-                    //if(mbi.RegionSize > maxRegionSize)
-                    //	mbi.RegionSize = maxRegionSize;
-
-                    MemoryRegion region = { (HWAddressType)mbi.BaseAddress, mbi.RegionSize };
-                    s_activeMemoryRegions.push_back(region);
-                }
-            }
+            WritableMemoryRegion region;
+            region.address = (HWAddressType)mbi.BaseAddress;
+            region.size = mbi.RegionSize;
+            region.trusted = IsInNonCurrentYetTrustedAddressSpace((unsigned int)mbi.BaseAddress);
+            region.image = (mbi.Type & MEM_IMAGE) != 0;
+            callback(region, callbackContext);
         }
-
-        LeaveCriticalSection(&g_processMemCS);
     }
 
-
-
-
-    int nextVirtualIndex = 0;
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-    {
-        MemoryRegion& region = *iter;
-        region.virtualIndex = nextVirtualIndex;
-        //assert(((intptr_t)region.softwareAddress & 1) == 0 && "somebody needs to reimplement ReadValueAtSoftwareAddress()");
-        nextVirtualIndex = region.virtualIndex + region.size;
-    }
-    //assert(nextVirtualIndex <= MAX_RAM_SIZE);
-
-    if (nextVirtualIndex > MAX_RAM_SIZE)
-    {
-        s_prevValues = (unsigned char*)realloc(s_prevValues, sizeof(char)*(nextVirtualIndex + 8));
-        memset(s_prevValues, 0, sizeof(char)*(nextVirtualIndex + 8));
-
-        s_curValues = (unsigned char*)realloc(s_curValues, sizeof(char)*(nextVirtualIndex + 8));
-        memset(s_curValues, 0, sizeof(char)*(nextVirtualIndex + 8));
-
-        s_numChanges = (unsigned short*)realloc(s_numChanges, sizeof(short)*(nextVirtualIndex + 8));
-        memset(s_numChanges, 0, sizeof(short)*(nextVirtualIndex + 8));
-
-        s_itemIndexToRegionPointer = (MemoryRegion**)realloc(s_itemIndexToRegionPointer, sizeof(MemoryRegion*)*(nextVirtualIndex + 8));
-        memset(s_itemIndexToRegionPointer, 0, sizeof(MemoryRegion*)*(nextVirtualIndex + 8));
-
-        MAX_RAM_SIZE = nextVirtualIndex;
-    }
-    LeaveCriticalSection(&s_activeMemoryRegionsCS);
+    LeaveCriticalSection(&g_processMemCS);
 }
 
-// eliminates a range of hardware addresses from the search results
-// returns 2 if it changed the region and moved the iterator to another region
-// returns 1 if it changed the region but didn't move the iterator
-// returns 0 if it had no effect
-// warning: don't call anything that takes an itemIndex in a loop that calls DeactivateRegion...
-//   doing so would be tremendously slow because DeactivateRegion invalidates the index cache
-int DeactivateRegion(MemoryRegion& region, MemoryList::iterator& iter, HWAddressType hardwareAddress, unsigned int size)
+static bool ReadGameProcessMemory(HWAddressType address, void* buffer, unsigned int size, void* context)
 {
-    if (hardwareAddress + size <= region.hardwareAddress || hardwareAddress >= region.hardwareAddress + region.size)
-    {
-        // region is unaffected
-        return 0;
-    }
-    else if (hardwareAddress > region.hardwareAddress && hardwareAddress + size >= region.hardwareAddress + region.size)
-    {
-        // erase end of region
-        region.size = hardwareAddress - region.hardwareAddress;
-        return 1;
-    }
-    else if (hardwareAddress <= region.hardwareAddress && hardwareAddress + size < region.hardwareAddress + region.size)
-    {
-        // erase start of region
-        int eraseSize = (hardwareAddress + size) - region.hardwareAddress;
-        region.hardwareAddress += eraseSize;
-        region.size -= eraseSize;
-        //region.softwareAddress += eraseSize;
-        region.virtualIndex += eraseSize;
-        return 1;
-    }
-    else if (hardwareAddress <= region.hardwareAddress && hardwareAddress + size >= region.hardwareAddress + region.size)
-    {
-        // erase entire region
-        iter = s_activeMemoryRegions.erase(iter);
-        s_itemIndicesInvalid = TRUE;
-        return 2;
-    }
-    else //if(hardwareAddress > region.hardwareAddress && hardwareAddress + size < region.hardwareAddress + region.size)
-    {
-        // split region
-        int eraseSize = (hardwareAddress + size) - region.hardwareAddress;
-        MemoryRegion region2 = { region.hardwareAddress + eraseSize, region.size - eraseSize, /*region.softwareAddress + eraseSize,*/ region.virtualIndex + eraseSize };
-        region.size = hardwareAddress - region.hardwareAddress;
-        iter = s_activeMemoryRegions.insert(++iter, region2);
-        s_itemIndicesInvalid = TRUE;
-        return 2;
-    }
+    SIZE_T bytesRead = 0;
+    return ReadProcessMemory(hGameProcess, (const void*)address, buffer, size, &bytesRead) && bytesRead == size;
 }
 
-/*
-// eliminates a range of hardware addresses from the search results
-// this is a simpler but usually slower interface for the above function
-void DeactivateRegion(HWAddressType hardwareAddress, unsigned int size)
+static bool WriteGameProcessMemory(HWAddressType address, const void* buffer, unsigned int size, void* context)
 {
-for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
-{
-MemoryRegion& region = *iter;
-if(2 != DeactivateRegion(region, iter, hardwareAddress, size))
-++iter;
-}
+    SIZE_T bytesWritten = 0;
+    return WriteProcessMemory(hGameProcess, (void*)address, buffer, size, &bytesWritten) && bytesWritten == size;
 }
-*/
 
-// warning: can be slow
-void CalculateItemIndices(int itemSize)
+static const MemorySource s_gameProcessMemorySource = { EnumerateGameProcessRegions, ReadGameProcessMemory, WriteGameProcessMemory, nullptr };
+
+void ResetMemoryRegions()
 {
-    AutoCritSect cs(&s_activeMemoryRegionsCS);
-    unsigned int itemIndex = 0;
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-    {
-        MemoryRegion& region = *iter;
-        region.itemIndex = itemIndex;
-        int startSkipSize = ((unsigned int)(itemSize - (unsigned int)region.hardwareAddress)) % itemSize; // FIXME: is this still ok?
-        unsigned int start = startSkipSize;
-        unsigned int end = region.size;
-        for (unsigned int i = start; i < end; i += itemSize)
-            s_itemIndexToRegionPointer[itemIndex++] = &region;
-    }
-    s_maxItemIndex = itemIndex;
-    s_itemIndicesInvalid = FALSE;
+    //	Clear_Sound_Buffer();
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+
+    ResetSearchRegions();
+
+    // the undo steps are only meaningful as long as the virtual indices still refer to the same memory
+    std::vector<MemoryRegion> baseRegions(s_activeMemoryRegions.begin(), s_activeMemoryRegions.end());
+    bool sameLayout = (baseRegions.size() == s_baseRegions.size());
+    for (unsigned int i = 0; i < baseRegions.size() && sameLayout; i++)
+        sameLayout = baseRegions[i].hardwareAddress == s_baseRegions[i].hardwareAddress
+            && baseRegions[i].size == s_baseRegions[i].size;
+    if (!sameLayout)
+        ClearRamSearchUndo(RamSearchHWnd);
+    s_baseRegions.swap(baseRegions);
 }
 
 bool RSVal::print(char* output, char sizeTypeID, char typeID)
@@ -455,422 +350,586 @@ bool RSVal::scan(const char* input, char sizeTypeID, char typeID)
 
 
 
-template<typename stepType, typename compareType>
-void UpdateRegionT(const MemoryRegion& region, const MemoryRegion* nextRegionPtr)
-{
-    //if(GetAsyncKeyState(VK_SHIFT) & 0x8000) // speed hack
-    //	return;
+char rs_c = 's';
+char rs_o = '=';
+char rs_t = 's';
+RSVal rs_param = 0, rs_val = 0;
+bool rs_val_valid = false;
+char rs_type_size = 'b', rs_last_type_size = rs_type_size;
+bool noMisalign = true, rs_last_no_misalign = noMisalign;
+//bool littleEndian = false;
+int last_rs_possible = -1;
+int last_rs_regions = -1;
 
-    if (s_prevValuesNeedUpdate)
-        memcpy(s_prevValues + region.virtualIndex, s_curValues + region.virtualIndex, region.size + sizeof(compareType) - sizeof(stepType));
 
-    unsigned int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+// value history:
+// once the number of results is small enough, the values of every remaining item
+// are recorded each frame into a ring of columns (one column per frame, one entry per item).
+// keeping the frames as contiguous columns means a query over the history
+// (e.g. "increased exactly 3 times", "same as 10 frames ago")
+// is a few straight passes over arrays instead of per-item bookkeeping every frame.
+// the values are stored as raw bytes of the search's data size,
+// so switching between signed/unsigned/hex/float keeps the history.
+static const int maxHistoryDepth = 1024;
+static const unsigned int maxHistoryBytes = 64 * 1024 * 1024;
+static bool s_historyEnabled = false;
+static int s_historyDepth = 60; // number of frames kept
+static int s_historyFrames = 0; // number of valid frames, up to s_historyDepth
+static int s_historyHead = 0; // column the next frame gets recorded into
+static int s_historyItemSize = 0;
+static bool s_historyNoMisalign = true;
+static std::vector<unsigned int> s_historyVirtualIndices; // virtual index of each recorded item, ascending
+static std::vector<unsigned char> s_historyValues; // s_historyDepth columns of s_historyVirtualIndices.size() values
+static std::vector<unsigned short> s_historyCounts; // scratch space for counting queries
+
+static void UpdateHistoryStatus()
+{
+    if (!RamSearchHWnd)
+        return;
+    char status[64];
+    if (!s_historyEnabled)
+        strcpy(status, "");
+    else if (s_historyVirtualIndices.empty())
+        strcpy(status, ResultCount ? "(waiting for fewer results)" : "");
+    else
+        sprintf(status, "%d of %d frames, %d items", s_historyFrames, s_historyDepth, (int)s_historyVirtualIndices.size());
+    SetDlgItemText(RamSearchHWnd, IDC_HISTORY_STATUS, status);
+}
 
+static void ClearValueHistory()
+{
+    s_historyFrames = 0;
+    s_historyHead = 0;
+    std::vector<unsigned int>().swap(s_historyVirtualIndices);
+    std::vector<unsigned char>().swap(s_historyValues);
+    std::vector<unsigned short>().swap(s_historyCounts);
+}
 
-    //unsigned char* sourceAddr = region.softwareAddress - region.virtualIndex;
-    static unsigned char* memoryBuffer = nullptr;
-    static unsigned int memoryBufferAllocated = 0;
-    if (memoryBufferAllocated < region.size + 8)
+template<typename stepType, typename compareType>
+void CollectHistoryIndicesT(std::vector<unsigned int>& indices)
+{
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
     {
-        memoryBufferAllocated = region.size + 8;
-        memoryBuffer = (unsigned char*)realloc(memoryBuffer, memoryBufferAllocated);
+        MemoryRegion& region = *iter;
+        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+        unsigned int start = region.virtualIndex + startSkipSize;
+        unsigned int end = region.virtualIndex + region.size;
+        for (unsigned int i = start; i < end; i += sizeof(stepType))
+            indices.push_back(i);
     }
-    ReadProcessMemory(hGameProcess, (const void*)region.hardwareAddress, (void*)memoryBuffer, region.size, nullptr);
-    if (sizeof(compareType) > 1)
-        ReadProcessMemory(hGameProcess, (const void*)(region.hardwareAddress + region.size), (void*)(memoryBuffer + region.size), sizeof(compareType) - 1, nullptr);
-    unsigned char* sourceAddr = memoryBuffer - region.virtualIndex;
-
-    unsigned int indexStart = region.virtualIndex + startSkipSize;
-    unsigned int indexEnd = region.virtualIndex + region.size;
+}
 
-    if (sizeof(compareType) == 1)
+// makes the recorded items match the current search results.
+// searches only ever remove items, so the history of the survivors is kept by compacting every column,
+// anything else (reset, undo, a different data size) starts over.
+static void SyncValueHistory()
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    int itemSize = sizeTypeIDToSize(rs_type_size);
+    if (!s_historyEnabled || !ResultCount
+        || (unsigned long long)ResultCount * s_historyDepth * itemSize > maxHistoryBytes)
     {
-        for (unsigned int i = indexStart; i < indexEnd; i++)
-        {
-            if (s_curValues[i] != sourceAddr[i]) // if value changed
-            {
-                s_curValues[i] = sourceAddr[i]; // update value
-                //if(s_numChanges[i] != 0xFFFF)
-                s_numChanges[i]++; // increase change count
-            }
-        }
+        ClearValueHistory();
+        UpdateHistoryStatus();
+        return;
     }
-    else // it's more complicated for non-byte sizes because:
-    {    // - more than one byte can affect a given change count entry
-        // - when more than one of those bytes changes simultaneously the entry's change count should only increase by 1
-        // - a few of those bytes can be outside the region
-
-        unsigned int endSkipSize = ((unsigned int)(startSkipSize - region.size)) % sizeof(stepType);
-        unsigned int lastIndexToRead = indexEnd + endSkipSize + sizeof(compareType) - sizeof(stepType);
-        unsigned int lastIndexToCopy = lastIndexToRead;
-        if (nextRegionPtr)
-        {
-            const MemoryRegion& nextRegion = *nextRegionPtr;
-            int nextStartSkipSize = ((unsigned int)(sizeof(stepType) - nextRegion.hardwareAddress)) % sizeof(stepType);
-            unsigned int nextIndexStart = nextRegion.virtualIndex + nextStartSkipSize;
-            if (lastIndexToCopy > nextIndexStart)
-                lastIndexToCopy = nextIndexStart;
-        }
 
-        unsigned int nextValidChange[sizeof(compareType)];
-        for (unsigned int i = 0; i < sizeof(compareType); i++)
-            nextValidChange[i] = indexStart + i;
+    std::vector<unsigned int> indices;
+    indices.reserve(ResultCount);
+    CALL_WITH_T_SIZE_TYPES(CollectHistoryIndicesT, rs_type_size, rs_t, noMisalign, indices);
+
+    if (itemSize != s_historyItemSize || noMisalign != s_historyNoMisalign)
+        s_historyFrames = 0;
 
-        for (unsigned int i = indexStart, j = 0; i < lastIndexToRead; i++, j++)
+    if (s_historyFrames && indices != s_historyVirtualIndices)
+    {
+        // find where each surviving item was in the old columns
+        std::vector<unsigned int> oldPositions(indices.size());
+        unsigned int j = 0;
+        for (unsigned int i = 0; i < indices.size() && s_historyFrames; i++)
         {
-            if (s_curValues[i] != sourceAddr[i]) // if value of this byte changed
+            while (j < s_historyVirtualIndices.size() && s_historyVirtualIndices[j] < indices[i])
+                j++;
+            if (j < s_historyVirtualIndices.size() && s_historyVirtualIndices[j] == indices[i])
+                oldPositions[i] = j;
+            else
+                s_historyFrames = 0; // an item came back, can't keep the history
+        }
+        if (s_historyFrames)
+        {
+            // the new columns are never larger and every item moves towards the front,
+            // so this can be done in place in a single forward pass
+            size_t oldCount = s_historyVirtualIndices.size();
+            size_t newCount = indices.size();
+            for (int frame = 0; frame < s_historyDepth; frame++)
             {
-                if (i < lastIndexToCopy)
-                    s_curValues[i] = sourceAddr[i]; // update value
-                for (int k = 0; k < sizeof(compareType); k++) // loop through the previous entries that contain this byte
-                {
-                    if (i >= indexEnd + k)
-                        continue;
-                    int m = (j - k + sizeof(compareType)) & (sizeof(compareType) - 1);
-                    if (nextValidChange[m] <= i) // if we didn't already increase the change count for this entry
-                    {
-                        //if(s_numChanges[i-k] != 0xFFFF)
-                        s_numChanges[i - k]++; // increase the change count for this entry
-                        nextValidChange[m] = i - k + sizeof(compareType); // and remember not to increase it again
-                    }
-                }
+                const unsigned char* src = &s_historyValues[frame * oldCount * itemSize];
+                unsigned char* dst = &s_historyValues[frame * newCount * itemSize];
+                for (size_t i = 0; i < newCount; i++)
+                    memmove(dst + i * itemSize, src + oldPositions[i] * itemSize, itemSize);
             }
         }
     }
+
+    if (!s_historyFrames)
+    {
+        s_historyHead = 0;
+        s_historyValues.resize(indices.size() * s_historyDepth * itemSize);
+    }
+    s_historyVirtualIndices.swap(indices);
+    s_historyItemSize = itemSize;
+    s_historyNoMisalign = noMisalign;
+    UpdateHistoryStatus();
 }
 
-template<typename stepType, typename compareType>
-void UpdateRegionsT()
+template<typename T>
+static void RecordHistoryColumn(T* column)
 {
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
-    {
-        const MemoryRegion& region = *iter;
-        ++iter;
-        const MemoryRegion* nextRegion = (iter == s_activeMemoryRegions.end()) ? nullptr : &*iter;
+    const unsigned int* indices = &s_historyVirtualIndices[0];
+    size_t count = s_historyVirtualIndices.size();
+    for (size_t i = 0; i < count; i++)
+        column[i] = *(const T*)(s_curValues + indices[i]);
+}
 
-        UpdateRegionT<stepType, compareType>(region, nextRegion);
+// called once per frame after the current values have been updated
+void RecordValueHistory()
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    if (!s_historyEnabled || s_historyVirtualIndices.empty())
+        return;
+
+    void* column = &s_historyValues[s_historyHead * s_historyVirtualIndices.size() * s_historyItemSize];
+    switch (s_historyItemSize)
+    {
+    case 1: RecordHistoryColumn((unsigned char*)column); break;
+    case 2: RecordHistoryColumn((unsigned short*)column); break;
+    case 4: RecordHistoryColumn((unsigned long*)column); break;
+    case 8: RecordHistoryColumn((unsigned long long*)column); break;
     }
+    s_historyHead = (s_historyHead + 1) % s_historyDepth;
+    if (s_historyFrames < s_historyDepth)
+    {
+        s_historyFrames++;
+        UpdateHistoryStatus();
+    }
+}
 
-    s_prevValuesNeedUpdate = false;
+// returns the column recorded framesAgo frames before the most recent one
+template<typename T>
+const T* GetHistoryColumn(int framesAgo)
+{
+    int column = (s_historyHead - 1 - framesAgo + 2 * s_historyDepth) % s_historyDepth;
+    return (const T*)&s_historyValues[column * s_historyVirtualIndices.size() * s_historyItemSize];
 }
 
-template<typename stepType, typename compareType>
-int CountRegionItemsT()
+// counts how many times each item increased (or changed at all) over the recorded frames
+template<typename stepType, typename T>
+void CountHistoryT(bool increasesOnly)
 {
-    AutoCritSect cs(&s_activeMemoryRegionsCS);
-    if (sizeof(stepType) == 1)
+    size_t count = s_historyVirtualIndices.size();
+    s_historyCounts.assign(count, 0);
+    unsigned short* counts = &s_historyCounts[0];
+    for (int frame = s_historyFrames - 1; frame > 0; frame--)
     {
-        if (s_activeMemoryRegions.empty())
-            return 0;
+        const T* before = GetHistoryColumn<T>(frame);
+        const T* after = GetHistoryColumn<T>(frame - 1);
+        if (increasesOnly)
+            for (size_t i = 0; i < count; i++)
+                counts[i] += (after[i] > before[i]);
+        else
+            for (size_t i = 0; i < count; i++)
+                counts[i] += (after[i] != before[i]);
+    }
+}
 
-        if (s_itemIndicesInvalid)
-            CalculateItemIndices(sizeof(stepType));
+// finds the position of the item at virtualIndex in the history columns, or -1
+static int VirtualIndexToHistoryIndex(unsigned int virtualIndex)
+{
+    std::vector<unsigned int>::const_iterator iter = std::lower_bound(s_historyVirtualIndices.begin(), s_historyVirtualIndices.end(), virtualIndex);
+    if (iter == s_historyVirtualIndices.end() || *iter != virtualIndex)
+        return -1;
+    return (int)(iter - s_historyVirtualIndices.begin());
+}
 
-        MemoryRegion& lastRegion = s_activeMemoryRegions.back();
-        return lastRegion.itemIndex + lastRegion.size;
-    }
-    else // the branch above is faster but won't work if the step size isn't 1
+// eliminates every recorded item whose entry in keep is false
+template<typename stepType>
+void EliminateByHistory(const std::vector<unsigned char>& keep)
+{
+    unsigned int h = 0;
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
     {
-        int total = 0;
-        for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+        MemoryRegion& region = *iter;
+        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+        unsigned int start = region.virtualIndex + startSkipSize;
+        unsigned int end = region.virtualIndex + region.size;
+        for (unsigned int i = start, hwaddr = region.hardwareAddress + startSkipSize; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
         {
-            MemoryRegion& region = *iter;
-            int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-            total += (region.size - startSkipSize + (sizeof(stepType) - 1)) / sizeof(stepType);
+            while (h < s_historyVirtualIndices.size() && s_historyVirtualIndices[h] < i)
+                h++;
+            if (h < s_historyVirtualIndices.size() && s_historyVirtualIndices[h] == i && !keep[h])
+                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
+                    goto outerContinue;
         }
-        return total;
+        ++iter;
+    outerContinue:
+        continue;
     }
 }
 
-// returns information about the item in the form of a "fake" region
-// that has the item in it and nothing else
-template<typename stepType, typename compareType>
-void ItemIndexToVirtualRegion(unsigned int itemIndex, MemoryRegion& virtualRegion)
+template<typename stepType, typename T>
+void SearchFramesAgo(bool(*cmpFun)(T, T, T), int framesAgo, T param)
 {
-    if (s_itemIndicesInvalid)
-        CalculateItemIndices(sizeof(stepType));
+    size_t count = s_historyVirtualIndices.size();
+    std::vector<unsigned char> keep(count);
+    const T* now = GetHistoryColumn<T>(0);
+    const T* then = GetHistoryColumn<T>(framesAgo);
+    for (size_t i = 0; i < count; i++)
+        keep[i] = cmpFun(now[i], then[i], param);
+    EliminateByHistory<stepType>(keep);
+}
+template<typename stepType, typename T>
+void SearchHistoryCounts(bool(*cmpFun)(T, T, T), T value, T param)
+{
+    size_t count = s_historyVirtualIndices.size();
+    std::vector<unsigned char> keep(count);
+    const unsigned short* counts = &s_historyCounts[0];
+    for (size_t i = 0; i < count; i++)
+        keep[i] = cmpFun(counts[i], value, param);
+    EliminateByHistory<stepType>(keep);
+}
 
-    if (itemIndex >= s_maxItemIndex)
+template<typename stepType, typename T>
+bool CompareFramesAgoAtItem(bool(*cmpFun)(T, T, T), int itemIndex, int framesAgo, T param)
+{
+    int h = VirtualIndexToHistoryIndex(ItemIndexToVirtualIndex<stepType, T>(itemIndex));
+    if (h < 0 || framesAgo < 0 || framesAgo >= s_historyFrames)
+        return true;
+    return cmpFun(GetHistoryColumn<T>(0)[h], GetHistoryColumn<T>(framesAgo)[h], param);
+}
+template<typename stepType, typename T>
+unsigned short CountHistoryAtIndexT(int h, bool increasesOnly)
+{
+    unsigned short count = 0;
+    for (int frame = s_historyFrames - 1; frame > 0; frame--)
     {
-        memset(&virtualRegion, 0, sizeof(MemoryRegion));
-        return;
+        T before = GetHistoryColumn<T>(frame)[h];
+        T after = GetHistoryColumn<T>(frame - 1)[h];
+        if (increasesOnly ? (after > before) : (after != before))
+            count++;
     }
-
-    const MemoryRegion* regionPtr = s_itemIndexToRegionPointer[itemIndex];
-    const MemoryRegion& region = *regionPtr;
-
-    int bytesWithinRegion = (itemIndex - region.itemIndex) * sizeof(stepType);
-    int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-    bytesWithinRegion += startSkipSize;
-
-    virtualRegion.size = sizeof(compareType);
-    virtualRegion.hardwareAddress = region.hardwareAddress + bytesWithinRegion;
-    //virtualRegion.softwareAddress = region.softwareAddress + bytesWithinRegion;
-    virtualRegion.virtualIndex = region.virtualIndex + bytesWithinRegion;
-    virtualRegion.itemIndex = itemIndex;
-    return;
+    return count;
 }
-
-template<typename stepType, typename compareType>
-unsigned int ItemIndexToVirtualIndex(unsigned int itemIndex)
+template<typename stepType, typename T>
+bool CompareHistoryCountAtItem(bool(*cmpFun)(T, T, T), int itemIndex, T value, T param, bool increasesOnly)
 {
-    MemoryRegion virtualRegion;
-    ItemIndexToVirtualRegion<stepType, compareType>(itemIndex, virtualRegion);
-    return virtualRegion.virtualIndex;
+    int h = VirtualIndexToHistoryIndex(ItemIndexToVirtualIndex<stepType, T>(itemIndex));
+    if (h < 0)
+        return true;
+    unsigned short count = CALL_WITH_T_SIZE_TYPES(CountHistoryAtIndexT, rs_type_size, rs_t, noMisalign, h, increasesOnly);
+    return cmpFun(count, value, param);
 }
 
-template<typename T>
-T ReadLocalValue(const unsigned char* data)
+// returns whether enough history has been recorded to run a search of type c
+static bool IsHistoryReady(char c, RSVal v)
 {
-    return *(const T*)data;
+    if (c != 'f' && c != 'i' && c != 'c')
+        return true;
+    if (s_historyVirtualIndices.empty() || (int)s_historyVirtualIndices.size() != ResultCount)
+        return false;
+    if (c == 'f')
+        return (int)v >= 0 && (int)v < s_historyFrames;
+    return s_historyFrames > 1;
 }
-//template<> signed char ReadLocalValue(const unsigned char* data) { return *data; }
-//template<> unsigned char ReadLocalValue(const unsigned char* data) { return *data; }
 
 
-template<typename stepType, typename compareType>
-compareType GetPrevValueFromVirtualIndex(unsigned int virtualIndex)
+// compound searches:
+// a search can AND together several conditions, e.g. "changed AND > previous AND modulo 4 is 0".
+// rather than doing a full pass (and taking an undo snapshot) for every condition,
+// each condition gets compiled once into a kernel that's specialized for its data type and comparison,
+// then all of the kernels are run over the same small block of items while it's still in the cache,
+// and an item is only eliminated (as part of a run of eliminated items) if any of them rejected it.
+struct SearchTerm
 {
-    return ReadLocalValue<compareType>(s_prevValues + virtualIndex);
-    //return *(compareType*)(s_prevValues+virtualIndex);
-}
-template<typename stepType, typename compareType>
-compareType GetCurValueFromVirtualIndex(unsigned int virtualIndex)
+    char c; // compare to: see rs_c
+    char o; // operator: see rs_o
+    RSVal val;
+    RSVal param;
+};
+static std::vector<SearchTerm> s_extraSearchTerms; // added with "Add Condition", ANDed with the selected search every time
+
+struct CompiledSearchTerm;
+struct SearchBlock
 {
-    return ReadLocalValue<compareType>(s_curValues + virtualIndex);
-    //	return *(compareType*)(s_curValues+virtualIndex);
+    unsigned int virtualIndex; // of the first item
+    HWAddressType hardwareAddress; // of the first item
+    unsigned int historyIndex; // position of the first item in the value history columns
+    unsigned int count;
+};
+// clears keep[k] for every item k of the block that fails the term
+typedef void(*SearchKernel)(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep);
+struct CompiledSearchTerm
+{
+    SearchKernel kernel;
+    RSVal val;
+    RSVal param;
+    int framesAgo; // for 'f', kept apart from val so it isn't cut down to the size of the data type
+    std::vector<unsigned short> historyCounts; // for 'i' and 'c', one count per value history item
+};
+static const unsigned int searchBlockSize = 4096;
+
+// the comparison is a template argument here so it gets inlined into the loops,
+// which are simple enough for the compiler to vectorize when the items are packed
+template<typename stepType, typename T, bool(*cmpFun)(T, T, T)>
+void RelativeKernel(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep)
+{
+    T param = term.param;
+    const unsigned char* cur = s_curValues + block.virtualIndex;
+    const unsigned char* prev = s_prevValues + block.virtualIndex;
+    for (unsigned int k = 0; k < block.count; k++)
+        keep[k] &= cmpFun(ReadLocalValue<T>(cur + k * sizeof(stepType)), ReadLocalValue<T>(prev + k * sizeof(stepType)), param);
 }
-template<typename stepType, typename compareType>
-unsigned short GetNumChangesFromVirtualIndex(unsigned int virtualIndex)
+template<typename stepType, typename T, bool(*cmpFun)(T, T, T)>
+void SpecificKernel(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep)
 {
-    unsigned short num = s_numChanges[virtualIndex];
-    //for(unsigned int i = 1; i < sizeof(stepType); i++)
-    //	if(num < s_numChanges[virtualIndex+i])
-    //		num = s_numChanges[virtualIndex+i];
-    return num;
+    T value = term.val;
+    T param = term.param;
+    const unsigned char* cur = s_curValues + block.virtualIndex;
+    for (unsigned int k = 0; k < block.count; k++)
+        keep[k] &= cmpFun(ReadLocalValue<T>(cur + k * sizeof(stepType)), value, param);
 }
-
-template<typename stepType, typename compareType>
-compareType GetPrevValueFromItemIndex(unsigned int itemIndex)
+template<typename stepType, typename T, bool(*cmpFun)(T, T, T)>
+void AddressKernel(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep)
 {
-    int virtualIndex = ItemIndexToVirtualIndex<stepType, compareType>(itemIndex);
-    return GetPrevValueFromVirtualIndex<stepType, compareType>(virtualIndex);
+    T address = term.val;
+    T param = term.param;
+    for (unsigned int k = 0; k < block.count; k++)
+        keep[k] &= cmpFun((T)(block.hardwareAddress + k * sizeof(stepType)), address, param);
 }
-template<typename stepType, typename compareType>
-compareType GetCurValueFromItemIndex(unsigned int itemIndex)
+template<typename stepType, typename T, bool(*cmpFun)(T, T, T)>
+void ChangesKernel(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep)
 {
-    int virtualIndex = ItemIndexToVirtualIndex<stepType, compareType>(itemIndex);
-    return GetCurValueFromVirtualIndex<stepType, compareType>(virtualIndex);
+    T changes = term.val;
+    T param = term.param;
+    const unsigned short* numChanges = s_numChanges + block.virtualIndex;
+    for (unsigned int k = 0; k < block.count; k++)
+        keep[k] &= cmpFun(numChanges[k * sizeof(stepType)], changes, param);
 }
-template<typename stepType, typename compareType>
-unsigned short GetNumChangesFromItemIndex(unsigned int itemIndex)
+template<typename stepType, typename T, bool(*cmpFun)(T, T, T)>
+void FramesAgoKernel(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep)
 {
-    int virtualIndex = ItemIndexToVirtualIndex<stepType, compareType>(itemIndex);
-    return GetNumChangesFromVirtualIndex<stepType, compareType>(virtualIndex);
+    T param = term.param;
+    const T* now = GetHistoryColumn<T>(0) + block.historyIndex;
+    const T* then = GetHistoryColumn<T>(term.framesAgo) + block.historyIndex;
+    for (unsigned int k = 0; k < block.count; k++)
+        keep[k] &= cmpFun(now[k], then[k], param);
 }
-template<typename stepType, typename compareType>
-unsigned int GetHardwareAddressFromItemIndex(unsigned int itemIndex)
+template<typename stepType, typename T, bool(*cmpFun)(T, T, T)>
+void HistoryCountKernel(const SearchBlock& block, const CompiledSearchTerm& term, unsigned char* keep)
 {
-    MemoryRegion virtualRegion;
-    ItemIndexToVirtualRegion<stepType, compareType>(itemIndex, virtualRegion);
-    return virtualRegion.hardwareAddress;
+    T value = term.val;
+    T param = term.param;
+    const unsigned short* counts = &term.historyCounts[block.historyIndex];
+    for (unsigned int k = 0; k < block.count; k++)
+        keep[k] &= cmpFun(counts[k], value, param);
 }
 
-// this one might be unreliable, haven't used it much
-template<typename stepType, typename compareType>
-unsigned int HardwareAddressToItemIndex(HWAddressType hardwareAddress)
+template<typename stepType, typename T>
+SearchKernel CompileSearchKernel(char c, char o)
 {
-    if (s_itemIndicesInvalid)
-        CalculateItemIndices(sizeof(stepType));
+#define SELECT_KERNEL(kernel, U) \
+    switch (o) \
+        { \
+        case '<': return kernel<stepType, U, LessCmp<U> >; \
+        case '>': return kernel<stepType, U, MoreCmp<U> >; \
+        case '=': return kernel<stepType, U, EqualCmp<U> >; \
+        case '!': return kernel<stepType, U, UnequalCmp<U> >; \
+        case 'l': return kernel<stepType, U, LessEqualCmp<U> >; \
+        case 'm': return kernel<stepType, U, MoreEqualCmp<U> >; \
+        case 'd': return kernel<stepType, U, DiffByCmp<U> >; \
+        case '%': return kernel<stepType, U, ModIsCmp<U> >; \
+        } \
+    break
 
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+    switch (c)
     {
-        MemoryRegion& region = *iter;
-        if (hardwareAddress >= region.hardwareAddress && hardwareAddress < region.hardwareAddress + region.size)
-        {
-            int indexWithinRegion = (hardwareAddress - region.hardwareAddress) / sizeof(stepType);
-            return region.itemIndex + indexWithinRegion;
-        }
+    case 'r': SELECT_KERNEL(RelativeKernel, T);
+    case 's': SELECT_KERNEL(SpecificKernel, T);
+    case 'f': SELECT_KERNEL(FramesAgoKernel, T);
+    case 'a': SELECT_KERNEL(AddressKernel, unsigned int);
+    case 'n': SELECT_KERNEL(ChangesKernel, unsigned short);
+    case 'i':
+    case 'c': SELECT_KERNEL(HistoryCountKernel, unsigned short);
     }
+#undef SELECT_KERNEL
+    return nullptr;
+}
 
-    return -1;
-}
-
-
-
-// it's ugly but I can't think of a better way to call these functions that isn't also slower, since
-// I need the current values of these arguments to determine which primitive types are used within the function
-#define CALL_WITH_T_SIZE_TYPES(functionName, sizeTypeID, typeID, requireAligned, ...) \
-    (typeID == 'f' \
-        ? (sizeTypeID == 'l' \
-            ? (requireAligned \
-                ? functionName<long long, double>(##__VA_ARGS__) \
-                : functionName<char, double>(##__VA_ARGS__)) \
-            : (requireAligned \
-                ? functionName<long, float>(##__VA_ARGS__) \
-                : functionName<char, float>(##__VA_ARGS__))) \
-    : sizeTypeID == 'b' \
-        ? (typeID == 's' \
-            ? functionName<char, signed char>(##__VA_ARGS__) \
-            : functionName<char, unsigned char>(##__VA_ARGS__)) \
-    : sizeTypeID == 'w' \
-        ? (typeID == 's' \
-            ? (requireAligned \
-                ? functionName<short, signed short>(##__VA_ARGS__) \
-                : functionName<char, signed short>(##__VA_ARGS__)) \
-            : (requireAligned \
-                ? functionName<short, unsigned short>(##__VA_ARGS__) \
-                : functionName<char, unsigned short>(##__VA_ARGS__))) \
-    : sizeTypeID == 'd' \
-        ? (typeID == 's' \
-            ? (requireAligned \
-                ? functionName<long, signed long>(##__VA_ARGS__) \
-                : functionName<char, signed long>(##__VA_ARGS__)) \
-            : (requireAligned \
-                ? functionName<long, unsigned long>(##__VA_ARGS__) \
-                : functionName<char, unsigned long>(##__VA_ARGS__))) \
-    : sizeTypeID == 'l' \
-        ? (typeID == 's' \
-            ? (requireAligned \
-                ? functionName<long long, signed long long>(##__VA_ARGS__) \
-                : functionName<char, signed long long>(##__VA_ARGS__)) \
-            : (requireAligned \
-                ? functionName<long long, unsigned long long>(##__VA_ARGS__) \
-                : functionName<char, unsigned long long>(##__VA_ARGS__))) \
-    : functionName<char, signed char>(##__VA_ARGS__))
-
-// version that takes a forced comparison type
-#define CALL_WITH_T_STEP(functionName, sizeTypeID, sign,type, requireAligned, ...) \
-    (sizeTypeID == 'b' \
-        ? functionName<char, sign type>(##__VA_ARGS__) \
-    : sizeTypeID == 'w' \
-        ? (requireAligned \
-            ? functionName<short, sign type>(##__VA_ARGS__) \
-            : functionName<char, sign type>(##__VA_ARGS__)) \
-    : sizeTypeID == 'd' \
-        ? (requireAligned \
-            ? functionName<long, sign type>(##__VA_ARGS__) \
-            : functionName<char, sign type>(##__VA_ARGS__)) \
-    : sizeTypeID == 'l' \
-        ? (requireAligned \
-            ? functionName<long long, sign type>(##__VA_ARGS__) \
-            : functionName<char, sign type>(##__VA_ARGS__)) \
-    : functionName<char, sign type>(##__VA_ARGS__))
-
-
-// basic comparison functions:
-template <typename T> inline bool LessCmp(T x, T y, T i)        { return x < y; }
-template <typename T> inline bool MoreCmp(T x, T y, T i)        { return x > y; }
-template <typename T> inline bool LessEqualCmp(T x, T y, T i)   { return x <= y; }
-template <typename T> inline bool MoreEqualCmp(T x, T y, T i)   { return x >= y; }
-template <typename T> inline bool EqualCmp(T x, T y, T i)       { return x == y; }
-template <typename T> inline bool UnequalCmp(T x, T y, T i)     { return x != y; }
-template <typename T> inline bool DiffByCmp(T x, T y, T p)      { return x - y == p || y - x == p; }
-template <typename T> inline bool ModIsCmp(T x, T y, T p)       { return p && x % p == y; }
-template <> inline bool ModIsCmp(float x, float y, float p)     { return p && fmodf(x, p) == y; }
-template <> inline bool ModIsCmp(double x, double y, double p)  { return p && fmod(x, p) == y; }
-
-// compare-to type functions:
 template<typename stepType, typename T>
-void SearchRelative(bool(*cmpFun)(T, T, T), T ignored, T param)
+void SearchCompound(const std::vector<SearchTerm>& terms)
 {
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    std::vector<CompiledSearchTerm> compiled(terms.size());
+    for (unsigned int t = 0; t < terms.size(); t++)
     {
-        MemoryRegion& region = *iter;
-        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-        unsigned int start = region.virtualIndex + startSkipSize;
-        unsigned int end = region.virtualIndex + region.size;
-        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-            if (!cmpFun(GetCurValueFromVirtualIndex<stepType, T>(i), GetPrevValueFromVirtualIndex<stepType, T>(i), param))
-                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-                    goto outerContinue;
-        ++iter;
-    outerContinue:
-        continue;
+        compiled[t].kernel = CompileSearchKernel<stepType, T>(terms[t].c, terms[t].o);
+        compiled[t].val = terms[t].val;
+        compiled[t].param = terms[t].param;
+        compiled[t].framesAgo = (int)terms[t].val;
+        if (terms[t].c == 'i' || terms[t].c == 'c')
+        {
+            CountHistoryT<stepType, T>(terms[t].c == 'i');
+            compiled[t].historyCounts.swap(s_historyCounts);
+        }
+        if (!compiled[t].kernel)
+        {
+            assert(!"Invalid search condition.");
+            return;
+        }
     }
-}
-template<typename stepType, typename T>
-void SearchSpecific(bool(*cmpFun)(T, T, T), T value, T param)
-{
+
+    unsigned char keep[searchBlockSize];
+    std::vector<std::pair<unsigned int, unsigned int> > eliminated; // [first, last) item runs within the current region
+    unsigned int historyIndex = 0;
     for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
     {
         MemoryRegion& region = *iter;
         int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
         unsigned int start = region.virtualIndex + startSkipSize;
         unsigned int end = region.virtualIndex + region.size;
-        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-            if (!cmpFun(GetCurValueFromVirtualIndex<stepType, T>(i), value, param))
-                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-                    goto outerContinue;
-        ++iter;
-    outerContinue:
-        continue;
+        unsigned int numItems = (end > start) ? (end - start + sizeof(stepType) - 1) / sizeof(stepType) : 0;
+        HWAddressType regionAddress = region.hardwareAddress;
+        HWAddressType firstAddress = region.hardwareAddress + startSkipSize;
+
+        eliminated.clear();
+        for (unsigned int first = 0; first < numItems; first += searchBlockSize)
+        {
+            SearchBlock block;
+            block.virtualIndex = start + first * sizeof(stepType);
+            block.hardwareAddress = firstAddress + first * sizeof(stepType);
+            block.historyIndex = historyIndex + first;
+            block.count = min(numItems - first, searchBlockSize);
+
+            memset(keep, 1, block.count);
+            for (unsigned int t = 0; t < compiled.size(); t++)
+                compiled[t].kernel(block, compiled[t], keep);
+
+            for (unsigned int k = 0; k < block.count; k++)
+            {
+                if (keep[k])
+                    continue;
+                unsigned int item = first + k;
+                if (!eliminated.empty() && eliminated.back().second == item)
+                    eliminated.back().second++;
+                else
+                    eliminated.push_back(std::make_pair(item, item + 1));
+            }
+        }
+        historyIndex += numItems;
+
+        // the runs are separated by kept items, so only a run that reaches the end of the region
+        // can remove what's left of it (which moves the iterator past it)
+        bool erased = false;
+        for (unsigned int r = 0; r < eliminated.size(); r++)
+        {
+            HWAddressType address = firstAddress + eliminated[r].first * sizeof(stepType);
+            unsigned int size = (eliminated[r].second - eliminated[r].first) * sizeof(stepType);
+            if (eliminated[r].first == 0)
+            {
+                size += address - regionAddress;
+                address = regionAddress;
+            }
+            if (2 == DeactivateRegion(*iter, iter, address, size) && eliminated[r].second == numItems)
+                erased = true;
+        }
+        if (!erased)
+            ++iter;
     }
 }
-template<typename stepType, typename T>
-void SearchAddress(bool(*cmpFun)(T, T, T), T address, T param)
+
+// returns whether every condition of the next search can be evaluated yet
+static bool IsSearchReady(char c, RSVal v)
 {
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
-    {
-        MemoryRegion& region = *iter;
-        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-        unsigned int start = region.virtualIndex + startSkipSize;
-        unsigned int end = region.virtualIndex + region.size;
-        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-            if (!cmpFun(hwaddr, address, param))
-                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-                    goto outerContinue;
-        ++iter;
-    outerContinue:
-        continue;
-    }
+    for (unsigned int i = 0; i < s_extraSearchTerms.size(); i++)
+        if (!IsHistoryReady(s_extraSearchTerms[i].c, s_extraSearchTerms[i].val))
+            return false;
+    return IsHistoryReady(c, v);
 }
-template<typename stepType, typename T>
-void SearchChanges(bool(*cmpFun)(T, T, T), T changes, T param)
+
+static void DescribeSearchTerm(const SearchTerm& term, char* output)
 {
-    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    const char* subject = "value";
+    if (term.c == 'a')
+        subject = "address";
+    else if (term.c == 'n')
+        subject = "changes";
+    else if (term.c == 'i')
+        subject = "increases";
+    else if (term.c == 'c')
+        subject = "history changes";
+
+    RSVal val = term.val;
+    RSVal param = term.param;
+    bool valueTyped = (term.c == 'r' || term.c == 's' || term.c == 'f');
+    char object[64];
+    switch (term.c)
     {
-        MemoryRegion& region = *iter;
-        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-        unsigned int start = region.virtualIndex + startSkipSize;
-        unsigned int end = region.virtualIndex + region.size;
-        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-            if (!cmpFun(GetNumChangesFromVirtualIndex<stepType, T>(i), changes, param))
-                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-                    goto outerContinue;
-        ++iter;
-    outerContinue:
-        continue;
+    case 'r': strcpy(object, "previous"); break;
+    case 'f': sprintf(object, "%d frames ago", (int)val); break;
+    case 's': val.print(object, rs_type_size, rs_t); break;
+    case 'a': sprintf(object, "%08X", (int)val); break;
+    default: sprintf(object, "%d", (int)val); break;
     }
-}
+    char paramText[64];
+    param.print(paramText, valueTyped ? rs_type_size : 'd', valueTyped ? rs_t : (term.c == 'a' ? 'h' : 'u'));
 
+    char op[80];
+    switch (term.o)
+    {
+    case '<': strcpy(op, "<"); break;
+    case '>': strcpy(op, ">"); break;
+    case '=': strcpy(op, "="); break;
+    case '!': strcpy(op, "!="); break;
+    case 'l': strcpy(op, "<="); break;
+    case 'm': strcpy(op, ">="); break;
+    case 'd': sprintf(op, "differs by %s from", paramText); break;
+    case '%': sprintf(op, "modulo %s is", paramText); break;
+    default: strcpy(op, "?"); break;
+    }
+    sprintf(output, "%s %s %s", subject, op, object);
+}
 
-char rs_c = 's';
-char rs_o = '=';
-char rs_t = 's';
-RSVal rs_param = 0, rs_val = 0;
-bool rs_val_valid = false;
-char rs_type_size = 'b', rs_last_type_size = rs_type_size;
-bool noMisalign = true, rs_last_no_misalign = noMisalign;
-//bool littleEndian = false;
-int last_rs_possible = -1;
-int last_rs_regions = -1;
-
-int sizeTypeIDToSize(char id)
+static void UpdateSearchTermsStatus()
 {
-    if (id == 'd')
-        return 4;
-    if (id == 'w')
-        return 2;
-    if (id == 'l')
-        return 8;
-    return 1;
+    if (!RamSearchHWnd)
+        return;
+    char status[512];
+    status[0] = 0;
+    for (unsigned int i = 0; i < s_extraSearchTerms.size(); i++)
+    {
+        char term[160];
+        DescribeSearchTerm(s_extraSearchTerms[i], term);
+        if (strlen(status) + strlen(term) + 8 >= sizeof(status))
+        {
+            strcat(status, ", ...");
+            break;
+        }
+        strcat(status, i ? ", " : "AND ");
+        strcat(status, term);
+    }
+    SetDlgItemText(RamSearchHWnd, IDC_CONDITIONS_STATUS, status);
 }
 
 
 void prune(char c, char o, char t, RSVal v, RSVal p)
 {
-    EnterCriticalSection(&s_activeMemoryRegionsCS);
+    s_activeMemoryRegionsLock.Enter();
+
+    // the value history searches read columns that might not have been recorded yet
+    // (e.g. right after the history was reset, or when autosearch runs with a new frame count)
+    if (!IsSearchReady(c, v))
+    {
+        s_activeMemoryRegionsLock.Leave();
+        return;
+    }
 
     // repetition-reducing macros
 #define DO_SEARCH(sf) \
@@ -888,24 +947,38 @@ void prune(char c, char o, char t, RSVal v, RSVal p)
         }
 
     // perform the search, eliminating nonmatching values
-    switch (c)
+    if (!s_extraSearchTerms.empty())
     {
-#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_SIZE_TYPES(sf, rs_type_size, t, noMisalign, CmpFun,v,p)
-    case 'r': DO_SEARCH(SearchRelative); break;
-    case 's': DO_SEARCH(SearchSpecific); break;
+        // several conditions, evaluate them all in a single pass
+        std::vector<SearchTerm> terms(s_extraSearchTerms);
+        SearchTerm term = { c, o, v, p };
+        terms.push_back(term);
+        CALL_WITH_T_SIZE_TYPES(SearchCompound, rs_type_size, t, noMisalign, terms);
+    }
+    else switch (c)
+    {
+    case 'r':
+    case 's':
+    case 'a':
+    case 'n':
+        SearchRegions(c, o, t, v, p, rs_type_size, noMisalign);
+        break;
 
-#undef DO_SEARCH_2
-#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_STEP(sf, rs_type_size, unsigned,int, noMisalign, CmpFun,v,p);
-    case 'a': DO_SEARCH(SearchAddress); break;
+#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_SIZE_TYPES(sf, rs_type_size, t, noMisalign, CmpFun,v,p)
+    case 'f': DO_SEARCH(SearchFramesAgo); break;
 
 #undef DO_SEARCH_2
 #define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_STEP(sf, rs_type_size, unsigned,short, noMisalign, CmpFun,v,p);
-    case 'n': DO_SEARCH(SearchChanges); break;
+    case 'i':
+    case 'c':
+        CALL_WITH_T_SIZE_TYPES(CountHistoryT, rs_type_size, t, noMisalign, c == 'i');
+        DO_SEARCH(SearchHistoryCounts);
+        break;
 
     default: assert(!"Invalid search comparison type."); break;
     }
 
-    LeaveCriticalSection(&s_activeMemoryRegionsCS);
+    s_activeMemoryRegionsLock.Leave();
 
     s_prevValuesNeedUpdate = true;
 
@@ -915,7 +988,7 @@ void prune(char c, char o, char t, RSVal v, RSVal p)
 
     if (prevNumItems == last_rs_possible)
     {
-        SetRamSearchUndoType(RamSearchHWnd, 0); // nothing to undo
+        DiscardRamSearchUndoState(RamSearchHWnd); // nothing to undo
     }
 }
 
@@ -988,6 +1061,17 @@ bool Set_RS_Val()
             if (!success || (int)rs_val < 0 || (int)rs_val > 0xFFFF)
                 return false;
         }	break;
+    case 'f': {
+            rs_val = ReadControlInt(IDC_EDIT_COMPAREFRAMESAGO, 'd', 'u', success);
+            if (!success || (int)rs_val < 1 || (int)rs_val >= maxHistoryDepth)
+                return false;
+        }	break;
+    case 'i':
+    case 'c': {
+            rs_val = ReadControlInt(rs_c == 'i' ? IDC_EDIT_COMPAREINCREASES : IDC_EDIT_COMPAREHISTORYCHANGES, 'd', 'u', success);
+            if (!success || (int)rs_val < 0 || (int)rs_val > 0xFFFF)
+                return false;
+        }	break;
     }
 
     // also update rs_param
@@ -997,14 +1081,14 @@ bool Set_RS_Val()
         rs_param = 0;
         break;
     case 'd':
-        rs_param = ReadControlInt(IDC_EDIT_DIFFBY, (rs_c == 'r' || rs_c == 's') ? rs_type_size : 'd', (rs_c == 'r' || rs_c == 's') ? rs_t : (rs_c == 'a' ? 'h' : 's'), success);
+        rs_param = ReadControlInt(IDC_EDIT_DIFFBY, (rs_c == 'r' || rs_c == 's' || rs_c == 'f') ? rs_type_size : 'd', (rs_c == 'r' || rs_c == 's' || rs_c == 'f') ? rs_t : (rs_c == 'a' ? 'h' : 's'), success);
         if (!success)
             return false;
         if ((int)rs_param < 0)
             rs_param = -(int)rs_param;
         break;
     case '%':
-        rs_param = ReadControlInt(IDC_EDIT_MODBY, (rs_c == 'r' || rs_c == 's') ? rs_type_size : 'd', (rs_c == 'r' || rs_c == 's') ? rs_t : (rs_c == 'a' ? 'h' : 's'), success);
+        rs_param = ReadControlInt(IDC_EDIT_MODBY, (rs_c == 'r' || rs_c == 's' || rs_c == 'f') ? rs_type_size : 'd', (rs_c == 'r' || rs_c == 's' || rs_c == 'f') ? rs_t : (rs_c == 'a' ? 'h' : 's'), success);
         if (!success || (int)rs_param == 0)
             return false;
         break;
@@ -1014,7 +1098,7 @@ bool Set_RS_Val()
     {
         int appliedSize = rs_type_size;
         int appliedSign = rs_t;
-        if (rs_c == 'n')
+        if (rs_c == 'n' || rs_c == 'i' || rs_c == 'c')
             appliedSize = 'w', appliedSign = 'u';
         if (rs_c == 'a')
             appliedSize = 'd', appliedSign = 'u';
@@ -1028,35 +1112,51 @@ bool Set_RS_Val()
     return true;
 }
 
-bool IsSatisfied(int itemIndex)
+static bool IsTermSatisfied(int itemIndex, char c, char o, RSVal val, RSVal param)
 {
-    if (!rs_val_valid)
-        return true;
-    int o = rs_o;
-    switch (rs_c)
+    switch (c)
     {
 #undef DO_SEARCH_2
-#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_SIZE_TYPES(sf, rs_type_size,rs_t,noMisalign, CmpFun,itemIndex,rs_val,rs_param);
+#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_SIZE_TYPES(sf, rs_type_size,rs_t,noMisalign, CmpFun,itemIndex,val,param);
     case 'r': DO_SEARCH(CompareRelativeAtItem); break;
     case 's': DO_SEARCH(CompareSpecificAtItem); break;
+    case 'f': DO_SEARCH(CompareFramesAgoAtItem); break;
 
 #undef DO_SEARCH_2
-#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP(sf, rs_type_size, unsigned,int, noMisalign, CmpFun,itemIndex,rs_val,rs_param);
+#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP(sf, rs_type_size, unsigned,int, noMisalign, CmpFun,itemIndex,val,param);
     case 'a': DO_SEARCH(CompareAddressAtItem); break;
 
 #undef DO_SEARCH_2
-#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP(sf, rs_type_size, unsigned,short, noMisalign, CmpFun,itemIndex,rs_val,rs_param);
+#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP(sf, rs_type_size, unsigned,short, noMisalign, CmpFun,itemIndex,val,param);
     case 'n': DO_SEARCH(CompareChangesAtItem); break;
+
+#undef DO_SEARCH_2
+#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP(sf, rs_type_size, unsigned,short, noMisalign, CmpFun,itemIndex,val,param,c == 'i');
+    case 'i':
+    case 'c': DO_SEARCH(CompareHistoryCountAtItem); break;
     }
     return false;
 }
 
+bool IsSatisfied(int itemIndex)
+{
+    if (!rs_val_valid)
+        return true;
+    for (unsigned int i = 0; i < s_extraSearchTerms.size(); i++)
+    {
+        const SearchTerm& term = s_extraSearchTerms[i];
+        if (!IsTermSatisfied(itemIndex, term.c, term.o, term.val, term.param))
+            return false;
+    }
+    return IsTermSatisfied(itemIndex, rs_c, rs_o, rs_val, rs_param);
+}
+
 
 
 RSVal ReadValueAtSoftwareAddress(const unsigned char* address, char sizeTypeID, char typeID)
 {
     RSVal value = 0;
-    ReadProcessMemory(hGameProcess, (const void*)address, (void*)&value, sizeTypeIDToSize(sizeTypeID), nullptr);
+    ReadRemoteMemoryCached((HWAddressType)address, (void*)&value, sizeTypeIDToSize(sizeTypeID));
     if (typeID == 'f')
         if (sizeTypeID == 'l')
             value.t = RSVal::t_d;
@@ -1071,7 +1171,8 @@ RSVal ReadValueAtSoftwareAddress(const unsigned char* address, char sizeTypeID,
 }
 void WriteValueAtSoftwareAddress(unsigned char* address, RSVal value, char sizeTypeID, char typeID)
 {
-    WriteProcessMemory(hGameProcess, (void*)address, (const void*)&value, sizeTypeIDToSize(sizeTypeID), nullptr);
+    WriteRemoteMemory((HWAddressType)address, (const void*)&value, sizeTypeIDToSize(sizeTypeID));
+    InvalidateRemoteMemoryRange((HWAddressType)address, sizeTypeIDToSize(sizeTypeID));
 }
 RSVal ReadValueAtHardwareAddress(HWAddressType address, char sizeTypeID, char typeID)
 {
@@ -1084,12 +1185,6 @@ bool WriteValueAtHardwareAddress(HWAddressType address, RSVal value, char sizeTy
     //	CallRegisteredLuaMemHook(address, size, value, LUAMEMHOOK_WRITE);
     return true;
 }
-bool IsHardwareAddressValid(HWAddressType address)
-{
-    char temp[4];
-    return ReadProcessMemory(hGameProcess, (const void*)address, (void*)temp, 1, nullptr)
-        && WriteProcessMemory(hGameProcess, (void*)address, (const void*)temp, 1, nullptr);
-}
 
 
 
@@ -1106,12 +1201,14 @@ void CompactAddrs()
     int prevResultCount = ResultCount;
 
     CalculateItemIndices(size);
-    ResultCount = CALL_WITH_T_SIZE_TYPES(CountRegionItemsT, rs_type_size, rs_t, noMisalign);
+    ResultCount = CountSearchItems(rs_type_size, rs_t, noMisalign);
 
     UpdatePossibilities(ResultCount, (int)s_activeMemoryRegions.size());
 
     if (ResultCount != prevResultCount)
         ListView_SetItemCount(GetDlgItem(RamSearchHWnd, IDC_RAMLIST), ResultCount);
+
+    SyncValueHistory();
 }
 
 void soft_reset_address_info()
@@ -1136,19 +1233,16 @@ void soft_reset_address_info()
 }
 void reset_address_info()
 {
-    SetRamSearchUndoType(RamSearchHWnd, 0);
-    EnterCriticalSection(&s_activeMemoryRegionsCS);
-    s_activeMemoryRegionsBackup.clear(); // not necessary, but we'll take the time hit here instead of at the next thing that sets up an undo
-    LeaveCriticalSection(&s_activeMemoryRegionsCS);
+    ClearRamSearchUndo(RamSearchHWnd);
     if (s_prevValues)
         memcpy(s_prevValues, s_curValues, (sizeof(*s_prevValues)*(MAX_RAM_SIZE)));
     s_prevValuesNeedUpdate = false;
     ResetMemoryRegions();
     if (!RamSearchHWnd)
     {
-        EnterCriticalSection(&s_activeMemoryRegionsCS);
+        s_activeMemoryRegionsLock.Enter();
         s_activeMemoryRegions.clear();
-        LeaveCriticalSection(&s_activeMemoryRegionsCS);
+        s_activeMemoryRegionsLock.Leave();
         ResultCount = 0;
     }
     else
@@ -1164,11 +1258,11 @@ void reset_address_info()
 
 void signal_new_frame()
 {
-    EnterCriticalSection(&s_activeMemoryRegionsCS);
+    s_activeMemoryRegionsLock.Enter();
     EnterCriticalSection(&g_processMemCS);
-    CALL_WITH_T_SIZE_TYPES(UpdateRegionsT, rs_type_size, rs_t, noMisalign);
+    UpdateSearchRegions(rs_type_size, rs_t, noMisalign);
     LeaveCriticalSection(&g_processMemCS);
-    LeaveCriticalSection(&s_activeMemoryRegionsCS);
+    s_activeMemoryRegionsLock.Leave();
 }
 
 
@@ -1394,6 +1488,9 @@ LRESULT CustomDraw(LPARAM lParam)
 
 void Update_RAM_Search() //keeps RAM values up to date in the search and watch windows
 {
+    // this is called at every frame boundary, anything cached during the last frame is stale now
+    InvalidateRemoteMemoryCache();
+
     if (disableRamSearchUpdate)
         return;
 
@@ -1438,6 +1535,7 @@ void Update_RAM_Search() //keeps RAM values up to date in the search and watch w
         {
             // update active RAM values
             signal_new_frame();
+            RecordValueHistory();
         }
 
         if (AutoSearch && ResultCount)
@@ -1515,6 +1613,56 @@ static void SelectEditControl(int controlID)
     SendMessage(hEdit, EM_SETSEL, 0, -1);
 }
 
+static void EnableHistoryCompareEdits(HWND hDlg, int enabledID)
+{
+    EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREFRAMESAGO), enabledID == IDC_EDIT_COMPAREFRAMESAGO);
+    EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREINCREASES), enabledID == IDC_EDIT_COMPAREINCREASES);
+    EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREHISTORYCHANGES), enabledID == IDC_EDIT_COMPAREHISTORYCHANGES);
+}
+
+// memory dumps: saving one records the memory as it is right now,
+// loading one searches it instead of the game, and loading the next dump of a recorded sequence
+// counts as a frame passing, so a search can be repeated exactly without the game.
+int Change_File_L(char *Dest, char *Dir, char *Titre, char *Filter, char *Ext, HWND hwnd);
+int Change_File_S(char *Dest, char *Dir, char *Titre, char *Filter, char *Ext, HWND hwnd);
+static char s_dumpName[MAX_PATH];
+
+static void UpdateDumpControls(HWND hDlg)
+{
+    bool loaded = IsMemoryDumpLoaded();
+    EnableWindow(GetDlgItem(hDlg, IDC_C_UNLOADDUMP), loaded);
+    SetDlgItemText(hDlg, IDC_DUMP_STATUS, loaded ? s_dumpName : "");
+}
+
+static void SaveRamSearchDump(HWND hDlg)
+{
+    char filename[2048] = "";
+    if (!Change_File_S(filename, Config::thisprocessPath, "Save Memory Dump", "Memory Dump\0*.hgmd\0All Files\0*.*\0\0", "hgmd", hDlg))
+        return;
+    if (!SaveMemoryDump(filename))
+        MessageBox(hDlg, "Couldn't write the memory dump.", "Save Memory Dump", MB_OK | MB_ICONERROR);
+}
+
+static void LoadRamSearchDump(HWND hDlg)
+{
+    char filename[2048] = "";
+    if (!Change_File_L(filename, Config::thisprocessPath, "Load Memory Dump", "Memory Dump\0*.hgmd\0All Files\0*.*\0\0", "hgmd", hDlg))
+        return;
+    bool wasLoaded = IsMemoryDumpLoaded();
+    if (!LoadMemoryDump(filename))
+    {
+        MessageBox(hDlg, "Couldn't load the memory dump, the file isn't a valid dump.", "Load Memory Dump", MB_OK | MB_ICONERROR);
+        return;
+    }
+    const char* slash = max(strrchr(filename, '\\'), strrchr(filename, '/'));
+    strncpy(s_dumpName, slash ? slash + 1 : filename, sizeof(s_dumpName) - 1);
+    if (wasLoaded)
+        Update_RAM_Search(); // the next frame of the sequence
+    else
+        ResetResults(); // none of the results refer to this memory
+    UpdateDumpControls(hDlg);
+}
+
 static BOOL SelectingByKeyboard()
 {
     int a = GetKeyState(VK_LEFT);
@@ -1606,7 +1754,22 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                 SendDlgItemMessage(hDlg, IDC_NUMBEROFCHANGES, BM_SETCHECK, BST_CHECKED, 0);
                 EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPARECHANGES), true);
                 break;
+            case 'f':
+                SendDlgItemMessage(hDlg, IDC_FRAMESAGO, BM_SETCHECK, BST_CHECKED, 0);
+                EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREFRAMESAGO), true);
+                break;
+            case 'i':
+                SendDlgItemMessage(hDlg, IDC_HISTORYINCREASES, BM_SETCHECK, BST_CHECKED, 0);
+                EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREINCREASES), true);
+                break;
+            case 'c':
+                SendDlgItemMessage(hDlg, IDC_HISTORYCHANGES, BM_SETCHECK, BST_CHECKED, 0);
+                EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREHISTORYCHANGES), true);
+                break;
             }
+            SendDlgItemMessage(hDlg, IDC_C_HISTORY, BM_SETCHECK, s_historyEnabled ? BST_CHECKED : BST_UNCHECKED, 0);
+            SetDlgItemInt(hDlg, IDC_EDIT_HISTORYFRAMES, s_historyDepth, FALSE);
+            UpdateSearchTermsStatus();
             switch (rs_t)
             {
             case 's':
@@ -1671,10 +1834,9 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
             // force misalign checkbox to refresh
             signal_new_size();
 
-            // force undo button to refresh
-            int undoType = s_undoType;
-            SetRamSearchUndoType(hDlg, -2);
-            SetRamSearchUndoType(hDlg, undoType);
+            // force undo buttons to refresh
+            UpdateUndoButtons(hDlg);
+            UpdateDumpControls(hDlg);
 
             // force possibility count to refresh
             last_rs_possible--;
@@ -1877,6 +2039,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                 EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREVALUE), false);
                 EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREADDRESS), false);
                 EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPARECHANGES), false);
+                EnableHistoryCompareEdits(hDlg, 0);
                 {rv = true; break; }
             case IDC_SPECIFICVALUE:
                 {
@@ -1884,6 +2047,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREVALUE), true);
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREADDRESS), false);
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPARECHANGES), false);
+                    EnableHistoryCompareEdits(hDlg, 0);
                     if (!SelectingByKeyboard())
                         SelectEditControl(IDC_EDIT_COMPAREVALUE);
                     {rv = true; break; }
@@ -1894,6 +2058,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREADDRESS), true);
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREVALUE), false);
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPARECHANGES), false);
+                    EnableHistoryCompareEdits(hDlg, 0);
                     if (!SelectingByKeyboard())
                         SelectEditControl(IDC_EDIT_COMPAREADDRESS);
                 }	{rv = true; break; }
@@ -1903,9 +2068,59 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPARECHANGES), true);
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREVALUE), false);
                     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREADDRESS), false);
+                    EnableHistoryCompareEdits(hDlg, 0);
                     if (!SelectingByKeyboard())
                         SelectEditControl(IDC_EDIT_COMPARECHANGES);
                 }	{rv = true; break; }
+            case IDC_FRAMESAGO:
+            case IDC_HISTORYINCREASES:
+            case IDC_HISTORYCHANGES:
+                {
+                    int editID = IDC_EDIT_COMPAREFRAMESAGO;
+                    rs_c = 'f';
+                    if (LOWORD(wParam) == IDC_HISTORYINCREASES)
+                        rs_c = 'i', editID = IDC_EDIT_COMPAREINCREASES;
+                    if (LOWORD(wParam) == IDC_HISTORYCHANGES)
+                        rs_c = 'c', editID = IDC_EDIT_COMPAREHISTORYCHANGES;
+                    EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREVALUE), false);
+                    EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPAREADDRESS), false);
+                    EnableWindow(GetDlgItem(hDlg, IDC_EDIT_COMPARECHANGES), false);
+                    EnableHistoryCompareEdits(hDlg, editID);
+                    if (!SelectingByKeyboard())
+                        SelectEditControl(editID);
+                }	{rv = true; break; }
+            case IDC_C_HISTORY:
+                s_historyEnabled = SendDlgItemMessage(hDlg, IDC_C_HISTORY, BM_GETCHECK, 0, 0) != 0;
+                SyncValueHistory();
+                {rv = true; break; }
+            case IDC_EDIT_HISTORYFRAMES:
+                if (HIWORD(wParam) == EN_CHANGE)
+                {
+                    BOOL success;
+                    int depth = GetDlgItemInt(hDlg, IDC_EDIT_HISTORYFRAMES, &success, FALSE);
+                    if (success && depth >= 2 && depth <= maxHistoryDepth && depth != s_historyDepth)
+                    {
+                        s_historyDepth = depth;
+                        s_historyFrames = 0;
+                        SyncValueHistory();
+                    }
+                }
+                {rv = true; break; }
+            case IDC_C_ADDCONDITION:
+                {
+                    if (!rs_val_valid && !(rs_val_valid = Set_RS_Val()))
+                    {
+                        MessageBox(RamSearchHWnd, "Invalid or out-of-bound entered value.", "Error", MB_OK | MB_ICONSTOP);
+                        {rv = true; break; }
+                    }
+                    SearchTerm term = { rs_c, rs_o, rs_val, rs_param };
+                    s_extraSearchTerms.push_back(term);
+                    UpdateSearchTermsStatus();
+                }	{rv = true; break; }
+            case IDC_C_CLEARCONDITIONS:
+                s_extraSearchTerms.clear();
+                UpdateSearchTermsStatus();
+                {rv = true; break; }
             case IDC_C_ADDCHEAT:
                 {
                     //HWND ramListControl = GetDlgItem(hDlg,IDC_RAMLIST);
@@ -1922,13 +2137,13 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                 }
             case IDC_C_RESET:
                 {
-                    RamSearchSaveUndoStateIfNotTooBig(RamSearchHWnd);
+                    RamSearchSaveUndoState(RamSearchHWnd);
                     int prevNumItems = last_rs_possible;
 
                     soft_reset_address_info();
 
                     if (prevNumItems == last_rs_possible)
-                        SetRamSearchUndoType(RamSearchHWnd, 0); // nothing to undo
+                        DiscardRamSearchUndoState(RamSearchHWnd); // nothing to undo
 
                     ListView_SetItemState(GetDlgItem(hDlg, IDC_RAMLIST), -1, 0, LVIS_SELECTED); // deselect all
                     //ListView_SetItemCount(GetDlgItem(hDlg,IDC_RAMLIST),ResultCount);
@@ -1939,27 +2154,23 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
             case IDC_C_RESET_CHANGES:
                 memset(s_numChanges, 0, (sizeof(*s_numChanges)*(MAX_RAM_SIZE)));
                 ListView_Update(GetDlgItem(hDlg, IDC_RAMLIST), -1);
-                //SetRamSearchUndoType(hDlg, 0);
+                {rv = true; break; }
+            case IDC_C_SAVEDUMP:
+                SaveRamSearchDump(hDlg);
+                {rv = true; break; }
+            case IDC_C_LOADDUMP:
+                LoadRamSearchDump(hDlg);
+                {rv = true; break; }
+            case IDC_C_UNLOADDUMP:
+                UnloadMemoryDump();
+                ResetResults(); // back to the game's memory
+                UpdateDumpControls(hDlg);
                 {rv = true; break; }
             case IDC_C_UNDO:
-                if (s_undoType > 0)
+            case IDC_C_REDO:
+                if (RamSearchUndo(hDlg, LOWORD(wParam) == IDC_C_REDO))
                 {
                     //						Clear_Sound_Buffer();
-                    EnterCriticalSection(&s_activeMemoryRegionsCS);
-                    if (s_activeMemoryRegions.size() < tooManyRegionsForUndo)
-                    {
-                        MemoryList tempMemoryList = s_activeMemoryRegions;
-                        s_activeMemoryRegions = s_activeMemoryRegionsBackup;
-                        s_activeMemoryRegionsBackup = tempMemoryList;
-                        LeaveCriticalSection(&s_activeMemoryRegionsCS);
-                        SetRamSearchUndoType(hDlg, 3 - s_undoType);
-                    }
-                    else
-                    {
-                        s_activeMemoryRegions = s_activeMemoryRegionsBackup;
-                        LeaveCriticalSection(&s_activeMemoryRegionsCS);
-                        SetRamSearchUndoType(hDlg, -1);
-                    }
                     CompactAddrs();
                     ListView_SetItemState(GetDlgItem(hDlg, IDC_RAMLIST), -1, 0, LVIS_SELECTED); // deselect all
                     ListView_SetSelectionMark(GetDlgItem(hDlg, IDC_RAMLIST), 0);
@@ -1977,9 +2188,20 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                     if (!rs_val_valid && !(rs_val_valid = Set_RS_Val()))
                         goto invalid_field;
 
+                    if (ResultCount && !IsSearchReady(rs_c, rs_val))
+                    {
+                        MessageBox(RamSearchHWnd, "Not enough value history has been recorded for this search yet.\nEnable \"Record last\" and let some frames pass first.", "Value History", MB_OK | MB_ICONINFORMATION);
+                        if (AutoSearch)
+                        {
+                            SendDlgItemMessage(hDlg, IDC_C_AUTOSEARCH, BM_SETCHECK, BST_UNCHECKED, 0);
+                            SendMessage(hDlg, WM_COMMAND, IDC_C_AUTOSEARCH, 0);
+                        }
+                        {rv = true; break; }
+                    }
+
                     if (ResultCount)
                     {
-                        RamSearchSaveUndoStateIfNotTooBig(hDlg);
+                        RamSearchSaveUndoState(hDlg);
 
                         prune(rs_c, rs_o, rs_t, rs_val, rs_param);
 
@@ -2037,7 +2259,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                 // eliminate all selected items
             case IDC_C_ELIMINATE:
                 {
-                    RamSearchSaveUndoStateIfNotTooBig(hDlg);
+                    RamSearchSaveUndoState(hDlg);
 
                     HWND ramListControl = GetDlgItem(hDlg, IDC_RAMLIST);
                     int size = noMisalign ? sizeTypeIDToSize(rs_type_size) : 1;
@@ -2117,6 +2339,9 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
             case IDC_SPECIFICVALUE:
             case IDC_SPECIFICADDRESS:
             case IDC_NUMBEROFCHANGES:
+            case IDC_FRAMESAGO:
+            case IDC_HISTORYINCREASES:
+            case IDC_HISTORYCHANGES:
             case IDC_SIGNED:
             case IDC_UNSIGNED:
             case IDC_HEX:
@@ -2124,9 +2349,16 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
                 rs_val_valid = Set_RS_Val();
                 needRefresh = true;
                 break;
+            case IDC_C_ADDCONDITION:
+            case IDC_C_CLEARCONDITIONS:
+                needRefresh = true;
+                break;
             case IDC_EDIT_COMPAREVALUE:
             case IDC_EDIT_COMPAREADDRESS:
             case IDC_EDIT_COMPARECHANGES:
+            case IDC_EDIT_COMPAREFRAMESAGO:
+            case IDC_EDIT_COMPAREINCREASES:
+            case IDC_EDIT_COMPAREHISTORYCHANGES:
             case IDC_EDIT_DIFFBY:
             case IDC_EDIT_MODBY:
                 if (HIWORD(wParam) == EN_CHANGE)
@@ -2179,37 +2411,236 @@ void UpdatePossibilities(int rs_possible, int regions)
     }
 }
 
-void SetRamSearchUndoType(HWND hDlg, int type)
+// undo support:
+// the search results are a set of virtual indices, which can be written down compactly
+// as the sorted list of indices where membership flips (the start and end of every run),
+// stored as variable-length deltas. each step keeps only what it removed and what it added,
+// so even a search that leaves hundreds of thousands of regions costs a few bytes per region.
+static void EncodeBoundaries(const std::vector<unsigned int>& boundaries, std::vector<unsigned char>& output)
 {
-    if (s_undoType != type)
+    output.clear();
+    unsigned int prev = 0;
+    for (unsigned int i = 0; i < boundaries.size(); i++)
     {
-        if ((s_undoType != 2 && s_undoType != -1) != (type != 2 && type != -1))
-            SendDlgItemMessage(hDlg, IDC_C_UNDO, WM_SETTEXT, 0, (LPARAM)((type == 2 || type == -1) ? "Redo" : "Undo"));
-        if ((s_undoType > 0) != (type > 0))
-            EnableWindow(GetDlgItem(hDlg, IDC_C_UNDO), type > 0);
-        s_undoType = type;
+        unsigned int delta = boundaries[i] - prev;
+        while (delta >= 0x80)
+        {
+            output.push_back((unsigned char)(delta | 0x80));
+            delta >>= 7;
+        }
+        output.push_back((unsigned char)delta);
+        prev = boundaries[i];
     }
 }
 
-void RamSearchSaveUndoStateIfNotTooBig(HWND hDlg)
+static void DecodeBoundaries(const std::vector<unsigned char>& input, std::vector<unsigned int>& boundaries)
 {
-    EnterCriticalSection(&s_activeMemoryRegionsCS);
-    if (s_activeMemoryRegions.size() < tooManyRegionsForUndo)
+    boundaries.clear();
+    unsigned int prev = 0;
+    for (unsigned int i = 0; i < input.size();)
     {
-        s_activeMemoryRegionsBackup = s_activeMemoryRegions;
-        LeaveCriticalSection(&s_activeMemoryRegionsCS);
-        SetRamSearchUndoType(hDlg, 1);
+        unsigned int delta = 0;
+        for (int shift = 0; i < input.size(); shift += 7)
+        {
+            unsigned char byte = input[i++];
+            delta |= (unsigned int)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        prev += delta;
+        boundaries.push_back(prev);
     }
-    else
+}
+
+static bool UnionOp(bool a, bool b) { return a || b; }
+static bool MinusOp(bool a, bool b) { return a && !b; }
+
+// applies a set operation to two sets given as boundary lists
+static void CombineBoundaries(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b, bool(*op)(bool, bool), std::vector<unsigned int>& output)
+{
+    output.clear();
+    bool inA = false, inB = false, inOutput = false;
+    unsigned int i = 0, j = 0;
+    while (i < a.size() || j < b.size())
     {
-        LeaveCriticalSection(&s_activeMemoryRegionsCS);
-        SetRamSearchUndoType(hDlg, 0);
+        unsigned int x = (j >= b.size() || (i < a.size() && a[i] < b[j])) ? a[i] : b[j];
+        if (i < a.size() && a[i] == x)
+            inA = !inA, i++;
+        if (j < b.size() && b[j] == x)
+            inB = !inB, j++;
+        if (op(inA, inB) != inOutput)
+        {
+            inOutput = !inOutput;
+            output.push_back(x);
+        }
     }
 }
 
+static void GetActiveBoundaries(std::vector<unsigned int>& boundaries)
+{
+    boundaries.clear();
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+    {
+        if (!boundaries.empty() && boundaries.back() == iter->virtualIndex)
+            boundaries.pop_back(); // continues the previous run
+        else
+            boundaries.push_back(iter->virtualIndex);
+        boundaries.push_back(iter->virtualIndex + iter->size);
+    }
+}
+
+// rebuilds the list of regions from a set of virtual indices
+static void SetActiveBoundaries(const std::vector<unsigned int>& boundaries)
+{
+    s_activeMemoryRegions.clear();
+    unsigned int base = 0;
+    for (unsigned int i = 0; i + 1 < boundaries.size(); i += 2)
+    {
+        unsigned int start = boundaries[i];
+        unsigned int end = boundaries[i + 1];
+        while (start < end && base < s_baseRegions.size())
+        {
+            const MemoryRegion& baseRegion = s_baseRegions[base];
+            unsigned int baseEnd = baseRegion.virtualIndex + baseRegion.size;
+            if (start >= baseEnd)
+            {
+                base++;
+                continue;
+            }
+            unsigned int regionEnd = min(end, baseEnd);
+            MemoryRegion region = { baseRegion.hardwareAddress + (start - baseRegion.virtualIndex), regionEnd - start, start, 0 };
+            s_activeMemoryRegions.push_back(region);
+            start = regionEnd;
+        }
+    }
+    s_itemIndicesInvalid = true;
+}
+
+static void UpdateUndoButtons(HWND hDlg)
+{
+    if (!hDlg)
+        return;
+    EnableWindow(GetDlgItem(hDlg, IDC_C_UNDO), s_undoPending || s_undoCount > 0);
+    EnableWindow(GetDlgItem(hDlg, IDC_C_REDO), !s_undoPending && s_undoCount < s_undoSteps.size());
+}
+
+// turns the results saved by RamSearchSaveUndoState into a step, now that the action is done
+static void FinishPendingUndoStep()
+{
+    if (!s_undoPending)
+        return;
+    s_undoPending = false;
+
+    std::vector<unsigned int> before, after, changes;
+    DecodeBoundaries(s_undoPendingState, before);
+    GetActiveBoundaries(after);
+    std::vector<unsigned char>().swap(s_undoPendingState);
+
+    UndoStep step;
+    CombineBoundaries(before, after, MinusOp, changes);
+    EncodeBoundaries(changes, step.removed);
+    CombineBoundaries(after, before, MinusOp, changes);
+    EncodeBoundaries(changes, step.added);
+    if (step.removed.empty() && step.added.empty())
+        return;
+
+    s_undoSteps.push_back(UndoStep());
+    s_undoSteps.back().removed.swap(step.removed);
+    s_undoSteps.back().added.swap(step.added);
+    s_undoCount = s_undoSteps.size();
+    s_undoBytes += s_undoSteps.back().removed.size() + s_undoSteps.back().added.size();
+
+    // forget the oldest steps once there are too many of them
+    unsigned int dropCount = 0;
+    while (dropCount + 1 < s_undoSteps.size()
+        && (s_undoSteps.size() - dropCount > maxUndoSteps || s_undoBytes > maxUndoBytes))
+    {
+        s_undoBytes -= s_undoSteps[dropCount].removed.size() + s_undoSteps[dropCount].added.size();
+        dropCount++;
+    }
+    s_undoSteps.erase(s_undoSteps.begin(), s_undoSteps.begin() + dropCount);
+    s_undoCount = s_undoSteps.size();
+}
+
+void RamSearchSaveUndoState(HWND hDlg)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    FinishPendingUndoStep();
+
+    // a new action makes the undone steps unreachable
+    while (s_undoSteps.size() > s_undoCount)
+    {
+        s_undoBytes -= s_undoSteps.back().removed.size() + s_undoSteps.back().added.size();
+        s_undoSteps.pop_back();
+    }
+
+    std::vector<unsigned int> boundaries;
+    GetActiveBoundaries(boundaries);
+    EncodeBoundaries(boundaries, s_undoPendingState);
+    s_undoPending = true;
+    UpdateUndoButtons(hDlg);
+}
+
+// drops the results saved by RamSearchSaveUndoState, for actions that turned out to change nothing
+void DiscardRamSearchUndoState(HWND hDlg)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    s_undoPending = false;
+    std::vector<unsigned char>().swap(s_undoPendingState);
+    UpdateUndoButtons(hDlg);
+}
+
+void ClearRamSearchUndo(HWND hDlg)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    s_undoPending = false;
+    std::vector<unsigned char>().swap(s_undoPendingState);
+    std::vector<UndoStep>().swap(s_undoSteps);
+    s_undoCount = 0;
+    s_undoBytes = 0;
+    UpdateUndoButtons(hDlg);
+}
+
+// returns false if there was nothing to undo (or redo)
+static bool RamSearchUndo(HWND hDlg, bool redo)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    FinishPendingUndoStep();
+    if (redo ? (s_undoCount >= s_undoSteps.size()) : (s_undoCount == 0))
+        return false;
+
+    const UndoStep& step = s_undoSteps[redo ? s_undoCount++ : --s_undoCount];
+    std::vector<unsigned int> current, removed, added, temp;
+    GetActiveBoundaries(current);
+    DecodeBoundaries(step.removed, removed);
+    DecodeBoundaries(step.added, added);
+    // undo puts back what the step removed and takes out what it added, redo does the opposite.
+    // this stays well-defined even if an autosearch changed the results in the meantime
+    CombineBoundaries(current, redo ? added : removed, UnionOp, temp);
+    CombineBoundaries(temp, redo ? removed : added, MinusOp, current);
+    SetActiveBoundaries(current);
+    UpdateUndoButtons(hDlg);
+    return true;
+}
+
+// logs how well the page cache did for everything that read the game's memory during this run
+static void LogRemoteMemoryStats()
+{
+    RemoteMemoryStats stats = GetRemoteMemoryStats();
+    unsigned int pages = stats.page_hits + stats.page_misses;
+    if (pages || stats.uncached_reads)
+    {
+        debugprintf("Game memory cache: %u page hits, %u page misses (%.1f%% hits), %u reads from the game, %u uncached reads\n",
+            stats.page_hits, stats.page_misses, pages ? stats.page_hits * 100.0 / pages : 0.0, stats.remote_reads, stats.uncached_reads);
+    }
+    ResetRemoteMemoryStats();
+}
+
 void InitRamSearch()
 {
-    InitializeCriticalSection(&s_activeMemoryRegionsCS);
+    SetDefaultMemorySource(&s_gameProcessMemorySource);
+    InitWatchTrace();
+    InitWatchTriggers();
 }
 
 
@@ -2239,18 +2670,12 @@ void DeallocateRamSearch()
         last_rs_possible--;
         UpdatePossibilities(0, 0);
     }
-    s_itemIndicesInvalid = true;
-    s_prevValuesNeedUpdate = true;
-    s_maxItemIndex = 0;
-    MAX_RAM_SIZE = 0;
-    s_undoType = 0;
-    free(s_prevValues); s_prevValues = 0;
-    free(s_curValues); s_curValues = 0;
-    free(s_numChanges); s_numChanges = 0;
-    free(s_itemIndexToRegionPointer); s_itemIndexToRegionPointer = 0;
-    EnterCriticalSection(&s_activeMemoryRegionsCS);
-    MemoryList temp1; s_activeMemoryRegions.swap(temp1);
-    MemoryList temp2; s_activeMemoryRegionsBackup.swap(temp2);
-    LeaveCriticalSection(&s_activeMemoryRegionsCS);
+    ClearRamSearchUndo(nullptr);
+    std::vector<MemoryRegion>().swap(s_baseRegions);
+    ClearValueHistory();
+    s_extraSearchTerms.clear();
+    StopWatchTrace(); // the game is gone, finish the trace file
+    LogRemoteMemoryStats();
+    FreeSearchRegions();
 }
 
@@ -70,11 +70,42 @@ void reset_address_info();
 void signal_new_frame();
 void signal_new_size();
 void UpdateRamSearchTitleBar(int percent = 0);
-void SetRamSearchUndoType(HWND hDlg, int type);
+int sizeTypeIDToSize(char id);
 RSVal ReadValueAtHardwareAddress(HWAddressType address, char sizeTypeID, char typeID);
 bool WriteValueAtHardwareAddress(HWAddressType address, RSVal value, char sizeTypeID, char typeID, bool hookless=false);
 bool IsHardwareAddressValid(HWAddressType address);
 
+// a committed read/write region of the game's address space.
+// trusted is set if the region lies inside one of the game's own modules,
+// image is set if the region is backed by an executable image (trusted or not).
+struct WritableMemoryRegion
+{
+    HWAddressType address;
+    unsigned int size;
+    bool trusted;
+    bool image;
+};
+typedef void (*WritableMemoryRegionCallback)(const WritableMemoryRegion& region, void* context);
+// calls callback for every read/write region of the game process, in ascending address order.
+void EnumerateWritableMemoryRegions(WritableMemoryRegionCallback callback, void* context);
+// reads size bytes of game memory, returns false unless all of them could be read. thread-safe.
+bool ReadRemoteMemory(HWAddressType address, void* buffer, unsigned int size);
+// writes size bytes of game memory, returns false unless all of them could be written.
+bool WriteRemoteMemory(HWAddressType address, const void* buffer, unsigned int size);
+
+// where the three functions above get the game's memory from.
+// this is the game process unless something else was set, for example a memory dump (see memorydump.h),
+// so that the search can be run and measured without a game.
+struct MemorySource
+{
+    void (*enumerate)(WritableMemoryRegionCallback callback, void* callbackContext, void* context);
+    bool (*read)(HWAddressType address, void* buffer, unsigned int size, void* context);
+    bool (*write)(HWAddressType address, const void* buffer, unsigned int size, void* context);
+    void* context;
+};
+// nullptr goes back to the game process. the source has to stay valid until it's replaced.
+void SetMemorySource(const MemorySource* source);
+
 void ResetResults();
 void CloseRamWindows(); //Close the Ram Search & Watch windows when rom closes
 void ReopenRamWindows(); //Reopen them when a new Rom is loaded
@@ -0,0 +1,479 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+// the parts of RAM search that don't need Windows, see ramsearchengine.h
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <vector>
+
+#include "ramsearchengine.h"
+#include "remotememory.h"
+
+int MAX_RAM_SIZE = 0;
+unsigned char* s_prevValues = 0; // values at last search or reset
+unsigned char* s_curValues = 0; // values at last frame update
+unsigned short* s_numChanges = 0; // number of changes of the item starting at this virtual index address
+MemoryRegion** s_itemIndexToRegionPointer = 0; // used for random access into the memory list (trading memory size to get speed here, too bad it's so much memory), only valid when s_itemIndicesInvalid is false
+bool s_itemIndicesInvalid = true; // if true, the link from listbox items to memory regions (s_itemIndexToRegionPointer) and the link from memory regions to list box items (MemoryRegion::itemIndex) both need to be recalculated
+bool s_prevValuesNeedUpdate = true; // if true, the "prev" values should be updated using the "cur" values on the next frame update signaled
+unsigned int s_maxItemIndex = 0; // max currently valid item index, the listbox sometimes tries to update things past the end of the list so we need to know this to ignore those attempts
+
+MemoryList s_activeMemoryRegions;
+ThreadLock s_activeMemoryRegionsLock;
+
+
+static void EnumerateNoRegions(WritableMemoryRegionCallback callback, void* callbackContext, void* context)
+{
+}
+
+static bool ReadNoMemory(HWAddressType address, void* buffer, unsigned int size, void* context)
+{
+    return false;
+}
+
+static bool WriteNoMemory(HWAddressType address, const void* buffer, unsigned int size, void* context)
+{
+    return false;
+}
+
+static const MemorySource s_noMemorySource = { EnumerateNoRegions, ReadNoMemory, WriteNoMemory, nullptr };
+static const MemorySource* s_defaultMemorySource = &s_noMemorySource;
+static const MemorySource* s_memorySource = &s_noMemorySource;
+
+void SetDefaultMemorySource(const MemorySource* source)
+{
+    if (s_memorySource == s_defaultMemorySource)
+        s_memorySource = source;
+    s_defaultMemorySource = source;
+}
+
+void SetMemorySource(const MemorySource* source)
+{
+    s_memorySource = source ? source : s_defaultMemorySource;
+    // nothing read from the previous source is valid anymore
+    InvalidateRemoteMemoryCache();
+}
+
+void EnumerateWritableMemoryRegions(WritableMemoryRegionCallback callback, void* context)
+{
+    s_memorySource->enumerate(callback, context, s_memorySource->context);
+}
+
+bool ReadRemoteMemory(HWAddressType address, void* buffer, unsigned int size)
+{
+    return s_memorySource->read(address, buffer, size, s_memorySource->context);
+}
+
+bool WriteRemoteMemory(HWAddressType address, const void* buffer, unsigned int size)
+{
+    return s_memorySource->write(address, buffer, size, s_memorySource->context);
+}
+
+int sizeTypeIDToSize(char id)
+{
+    if (id == 'd')
+        return 4;
+    if (id == 'w')
+        return 2;
+    if (id == 'l')
+        return 8;
+    return 1;
+}
+
+bool IsHardwareAddressValid(HWAddressType address)
+{
+    char temp[4];
+    return ReadRemoteMemory(address, (void*)temp, 1)
+        && WriteRemoteMemory(address, (const void*)temp, 1);
+}
+
+static void AddSearchableRegion(const WritableMemoryRegion& writable, void* context)
+{
+    // only the trusted modules are searched,
+    // the rest of the heap is way too much memory to keep updated every frame
+    if (!writable.trusted)
+        return;
+
+    if (IsHardwareAddressValid(writable.address))
+    {
+        //static const int maxRegionSize = 1024*1024*2;
+        //if(mbi.RegionSize > maxRegionSize)
+        //	mbi.RegionSize = maxRegionSize;
+
+        MemoryRegion region = { writable.address, writable.size };
+        s_activeMemoryRegions.push_back(region);
+    }
+}
+
+void ResetSearchRegions()
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+
+    s_activeMemoryRegions.clear();
+
+    EnumerateWritableMemoryRegions(AddSearchableRegion, nullptr);
+
+    int nextVirtualIndex = 0;
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+    {
+        MemoryRegion& region = *iter;
+        region.virtualIndex = nextVirtualIndex;
+        //assert(((intptr_t)region.softwareAddress & 1) == 0 && "somebody needs to reimplement ReadValueAtSoftwareAddress()");
+        nextVirtualIndex = region.virtualIndex + region.size;
+    }
+    //assert(nextVirtualIndex <= MAX_RAM_SIZE);
+
+    if (nextVirtualIndex > MAX_RAM_SIZE)
+    {
+        s_prevValues = (unsigned char*)realloc(s_prevValues, sizeof(char)*(nextVirtualIndex + 8));
+        memset(s_prevValues, 0, sizeof(char)*(nextVirtualIndex + 8));
+
+        s_curValues = (unsigned char*)realloc(s_curValues, sizeof(char)*(nextVirtualIndex + 8));
+        memset(s_curValues, 0, sizeof(char)*(nextVirtualIndex + 8));
+
+        s_numChanges = (unsigned short*)realloc(s_numChanges, sizeof(short)*(nextVirtualIndex + 8));
+        memset(s_numChanges, 0, sizeof(short)*(nextVirtualIndex + 8));
+
+        s_itemIndexToRegionPointer = (MemoryRegion**)realloc(s_itemIndexToRegionPointer, sizeof(MemoryRegion*)*(nextVirtualIndex + 8));
+        memset(s_itemIndexToRegionPointer, 0, sizeof(MemoryRegion*)*(nextVirtualIndex + 8));
+
+        MAX_RAM_SIZE = nextVirtualIndex;
+    }
+}
+
+void FreeSearchRegions()
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    s_itemIndicesInvalid = true;
+    s_prevValuesNeedUpdate = true;
+    s_maxItemIndex = 0;
+    MAX_RAM_SIZE = 0;
+    free(s_prevValues); s_prevValues = 0;
+    free(s_curValues); s_curValues = 0;
+    free(s_numChanges); s_numChanges = 0;
+    free(s_itemIndexToRegionPointer); s_itemIndexToRegionPointer = 0;
+    MemoryList temp1; s_activeMemoryRegions.swap(temp1);
+}
+
+// eliminates a range of hardware addresses from the search results
+// returns 2 if it changed the region and moved the iterator to another region
+// returns 1 if it changed the region but didn't move the iterator
+// returns 0 if it had no effect
+// warning: don't call anything that takes an itemIndex in a loop that calls DeactivateRegion...
+//   doing so would be tremendously slow because DeactivateRegion invalidates the index cache
+int DeactivateRegion(MemoryRegion& region, MemoryList::iterator& iter, HWAddressType hardwareAddress, unsigned int size)
+{
+    if (hardwareAddress + size <= region.hardwareAddress || hardwareAddress >= region.hardwareAddress + region.size)
+    {
+        // region is unaffected
+        return 0;
+    }
+    else if (hardwareAddress > region.hardwareAddress && hardwareAddress + size >= region.hardwareAddress + region.size)
+    {
+        // erase end of region
+        region.size = hardwareAddress - region.hardwareAddress;
+        return 1;
+    }
+    else if (hardwareAddress <= region.hardwareAddress && hardwareAddress + size < region.hardwareAddress + region.size)
+    {
+        // erase start of region
+        int eraseSize = (hardwareAddress + size) - region.hardwareAddress;
+        region.hardwareAddress += eraseSize;
+        region.size -= eraseSize;
+        //region.softwareAddress += eraseSize;
+        region.virtualIndex += eraseSize;
+        return 1;
+    }
+    else if (hardwareAddress <= region.hardwareAddress && hardwareAddress + size >= region.hardwareAddress + region.size)
+    {
+        // erase entire region
+        iter = s_activeMemoryRegions.erase(iter);
+        s_itemIndicesInvalid = true;
+        return 2;
+    }
+    else //if(hardwareAddress > region.hardwareAddress && hardwareAddress + size < region.hardwareAddress + region.size)
+    {
+        // split region
+        int eraseSize = (hardwareAddress + size) - region.hardwareAddress;
+        MemoryRegion region2 = { region.hardwareAddress + eraseSize, region.size - eraseSize, /*region.softwareAddress + eraseSize,*/ region.virtualIndex + eraseSize };
+        region.size = hardwareAddress - region.hardwareAddress;
+        iter = s_activeMemoryRegions.insert(++iter, region2);
+        s_itemIndicesInvalid = true;
+        return 2;
+    }
+}
+
+/*
+// eliminates a range of hardware addresses from the search results
+// this is a simpler but usually slower interface for the above function
+void DeactivateRegion(HWAddressType hardwareAddress, unsigned int size)
+{
+for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
+{
+MemoryRegion& region = *iter;
+if(2 != DeactivateRegion(region, iter, hardwareAddress, size))
+++iter;
+}
+}
+*/
+
+// warning: can be slow
+void CalculateItemIndices(int itemSize)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    unsigned int itemIndex = 0;
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+    {
+        MemoryRegion& region = *iter;
+        region.itemIndex = itemIndex;
+        int startSkipSize = ((unsigned int)(itemSize - (unsigned int)region.hardwareAddress)) % itemSize; // FIXME: is this still ok?
+        unsigned int start = startSkipSize;
+        unsigned int end = region.size;
+        for (unsigned int i = start; i < end; i += itemSize)
+            s_itemIndexToRegionPointer[itemIndex++] = &region;
+    }
+    s_maxItemIndex = itemIndex;
+    s_itemIndicesInvalid = false;
+}
+
+
+
+template<typename stepType, typename compareType>
+void UpdateRegionT(const MemoryRegion& region, const MemoryRegion* nextRegionPtr)
+{
+    //if(GetAsyncKeyState(VK_SHIFT) & 0x8000) // speed hack
+    //	return;
+
+    if (s_prevValuesNeedUpdate)
+        memcpy(s_prevValues + region.virtualIndex, s_curValues + region.virtualIndex, region.size + sizeof(compareType) - sizeof(stepType));
+
+    unsigned int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+
+
+    //unsigned char* sourceAddr = region.softwareAddress - region.virtualIndex;
+    static unsigned char* memoryBuffer = nullptr;
+    static unsigned int memoryBufferAllocated = 0;
+    if (memoryBufferAllocated < region.size + 8)
+    {
+        memoryBufferAllocated = region.size + 8;
+        memoryBuffer = (unsigned char*)realloc(memoryBuffer, memoryBufferAllocated);
+    }
+    // the last item can extend past the end of the region, read those bytes along with the rest
+    if (!ReadRemoteMemoryCached(region.hardwareAddress, memoryBuffer, region.size + sizeof(compareType) - 1))
+        ReadRemoteMemoryCached(region.hardwareAddress, memoryBuffer, region.size);
+    unsigned char* sourceAddr = memoryBuffer - region.virtualIndex;
+
+    unsigned int indexStart = region.virtualIndex + startSkipSize;
+    unsigned int indexEnd = region.virtualIndex + region.size;
+
+    if (sizeof(compareType) == 1)
+    {
+        for (unsigned int i = indexStart; i < indexEnd; i++)
+        {
+            if (s_curValues[i] != sourceAddr[i]) // if value changed
+            {
+                s_curValues[i] = sourceAddr[i]; // update value
+                //if(s_numChanges[i] != 0xFFFF)
+                s_numChanges[i]++; // increase change count
+            }
+        }
+    }
+    else // it's more complicated for non-byte sizes because:
+    {    // - more than one byte can affect a given change count entry
+        // - when more than one of those bytes changes simultaneously the entry's change count should only increase by 1
+        // - a few of those bytes can be outside the region
+
+        unsigned int endSkipSize = ((unsigned int)(startSkipSize - region.size)) % sizeof(stepType);
+        unsigned int lastIndexToRead = indexEnd + endSkipSize + sizeof(compareType) - sizeof(stepType);
+        unsigned int lastIndexToCopy = lastIndexToRead;
+        if (nextRegionPtr)
+        {
+            const MemoryRegion& nextRegion = *nextRegionPtr;
+            int nextStartSkipSize = ((unsigned int)(sizeof(stepType) - nextRegion.hardwareAddress)) % sizeof(stepType);
+            unsigned int nextIndexStart = nextRegion.virtualIndex + nextStartSkipSize;
+            if (lastIndexToCopy > nextIndexStart)
+                lastIndexToCopy = nextIndexStart;
+        }
+
+        unsigned int nextValidChange[sizeof(compareType)];
+        for (unsigned int i = 0; i < sizeof(compareType); i++)
+            nextValidChange[i] = indexStart + i;
+
+        for (unsigned int i = indexStart, j = 0; i < lastIndexToRead; i++, j++)
+        {
+            if (s_curValues[i] != sourceAddr[i]) // if value of this byte changed
+            {
+                if (i < lastIndexToCopy)
+                    s_curValues[i] = sourceAddr[i]; // update value
+                for (int k = 0; k < sizeof(compareType); k++) // loop through the previous entries that contain this byte
+                {
+                    if (i >= indexEnd + k)
+                        continue;
+                    int m = (j - k + sizeof(compareType)) & (sizeof(compareType) - 1);
+                    if (nextValidChange[m] <= i) // if we didn't already increase the change count for this entry
+                    {
+                        //if(s_numChanges[i-k] != 0xFFFF)
+                        s_numChanges[i - k]++; // increase the change count for this entry
+                        nextValidChange[m] = i - k + sizeof(compareType); // and remember not to increase it again
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<typename stepType, typename compareType>
+void UpdateRegionsT()
+{
+    // let the cache read neighboring regions together instead of one region at a time
+    static std::vector<RemoteMemoryRange> ranges;
+    ranges.clear();
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+    {
+        RemoteMemoryRange range = { iter->hardwareAddress, (unsigned int)(iter->size + sizeof(compareType) - 1) };
+        ranges.push_back(range);
+    }
+    PrefetchRemoteMemory(ranges);
+
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    {
+        const MemoryRegion& region = *iter;
+        ++iter;
+        const MemoryRegion* nextRegion = (iter == s_activeMemoryRegions.end()) ? nullptr : &*iter;
+
+        UpdateRegionT<stepType, compareType>(region, nextRegion);
+    }
+
+    s_prevValuesNeedUpdate = false;
+}
+
+void UpdateSearchRegions(char sizeTypeID, char typeID, bool requireAligned)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    CALL_WITH_T_SIZE_TYPES(UpdateRegionsT, sizeTypeID, typeID, requireAligned);
+}
+
+int CountSearchItems(char sizeTypeID, char typeID, bool requireAligned)
+{
+    return CALL_WITH_T_SIZE_TYPES(CountRegionItemsT, sizeTypeID, typeID, requireAligned);
+}
+
+
+
+// compare-to type functions:
+template<typename stepType, typename T>
+void SearchRelative(bool(*cmpFun)(T, T, T), T ignored, T param)
+{
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    {
+        MemoryRegion& region = *iter;
+        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+        unsigned int start = region.virtualIndex + startSkipSize;
+        unsigned int end = region.virtualIndex + region.size;
+        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
+            if (!cmpFun(GetCurValueFromVirtualIndex<stepType, T>(i), GetPrevValueFromVirtualIndex<stepType, T>(i), param))
+                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
+                    goto outerContinue;
+        ++iter;
+    outerContinue:
+        continue;
+    }
+}
+template<typename stepType, typename T>
+void SearchSpecific(bool(*cmpFun)(T, T, T), T value, T param)
+{
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    {
+        MemoryRegion& region = *iter;
+        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+        unsigned int start = region.virtualIndex + startSkipSize;
+        unsigned int end = region.virtualIndex + region.size;
+        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
+            if (!cmpFun(GetCurValueFromVirtualIndex<stepType, T>(i), value, param))
+                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
+                    goto outerContinue;
+        ++iter;
+    outerContinue:
+        continue;
+    }
+}
+template<typename stepType, typename T>
+void SearchAddress(bool(*cmpFun)(T, T, T), T address, T param)
+{
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    {
+        MemoryRegion& region = *iter;
+        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+        unsigned int start = region.virtualIndex + startSkipSize;
+        unsigned int end = region.virtualIndex + region.size;
+        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
+            if (!cmpFun(hwaddr, address, param))
+                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
+                    goto outerContinue;
+        ++iter;
+    outerContinue:
+        continue;
+    }
+}
+template<typename stepType, typename T>
+void SearchChanges(bool(*cmpFun)(T, T, T), T changes, T param)
+{
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+    {
+        MemoryRegion& region = *iter;
+        int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+        unsigned int start = region.virtualIndex + startSkipSize;
+        unsigned int end = region.virtualIndex + region.size;
+        for (unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
+            if (!cmpFun(GetNumChangesFromVirtualIndex<stepType, T>(i), changes, param))
+                if (2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
+                    goto outerContinue;
+        ++iter;
+    outerContinue:
+        continue;
+    }
+}
+
+void SearchRegions(char c, char o, char t, RSVal v, RSVal p, char sizeTypeID, bool requireAligned)
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+
+    // repetition-reducing macros
+#define DO_SEARCH(sf) \
+    switch (o) \
+        { \
+        case '<': DO_SEARCH_2(LessCmp,sf); break; \
+        case '>': DO_SEARCH_2(MoreCmp,sf); break; \
+        case '=': DO_SEARCH_2(EqualCmp,sf); break; \
+        case '!': DO_SEARCH_2(UnequalCmp,sf); break; \
+        case 'l': DO_SEARCH_2(LessEqualCmp,sf); break; \
+        case 'm': DO_SEARCH_2(MoreEqualCmp,sf); break; \
+        case 'd': DO_SEARCH_2(DiffByCmp,sf); break; \
+        case '%': DO_SEARCH_2(ModIsCmp,sf); break; \
+        default: assert(!"Invalid operator for this search type."); break; \
+        }
+
+    switch (c)
+    {
+#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_SIZE_TYPES(sf, sizeTypeID, t, requireAligned, CmpFun,v,p)
+    case 'r': DO_SEARCH(SearchRelative); break;
+    case 's': DO_SEARCH(SearchSpecific); break;
+
+#undef DO_SEARCH_2
+#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_STEP(sf, sizeTypeID, unsigned,int, requireAligned, CmpFun,v,p);
+    case 'a': DO_SEARCH(SearchAddress); break;
+
+#undef DO_SEARCH_2
+#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_STEP(sf, sizeTypeID, unsigned,short, requireAligned, CmpFun,v,p);
+    case 'n': DO_SEARCH(SearchChanges); break;
+
+    default: assert(!"Invalid search comparison type."); break;
+    }
+#undef DO_SEARCH_2
+#undef DO_SEARCH
+
+    s_prevValuesNeedUpdate = true;
+}
@@ -0,0 +1,284 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+// the RAM search engine: the searched regions, their values from one frame to the next,
+// the searches that eliminate items, and the mapping from list items back to addresses.
+// the dialog, undo, value history and combined conditions are built on top of this in ramsearch.cpp.
+//
+// nothing here depends on Windows, memory is only ever read through the current memory source
+// (see SetMemorySource), so the engine can also be built elsewhere and driven from memory dumps.
+// tools/ramsearchtest.cpp does that to test and time it.
+
+#include <list>
+#include <math.h>
+#include <string.h>
+
+#include "ramsearch.h"
+#include "remotememory.h"
+#include "threadlock.h"
+
+struct MemoryRegion
+{
+    HWAddressType hardwareAddress; // hardware address of the start of this region
+    unsigned int size; // number of bytes to the end of this region
+
+    unsigned int virtualIndex; // index into s_prevValues, s_curValues, and s_numChanges, valid after being initialized in ResetSearchRegions()
+    unsigned int itemIndex; // index into listbox items, valid when s_itemIndicesInvalid is false
+};
+
+extern int MAX_RAM_SIZE;
+extern unsigned char* s_prevValues; // values at last search or reset
+extern unsigned char* s_curValues; // values at last frame update
+extern unsigned short* s_numChanges; // number of changes of the item starting at this virtual index address
+extern MemoryRegion** s_itemIndexToRegionPointer; // used for random access into the memory list (trading memory size to get speed here, too bad it's so much memory), only valid when s_itemIndicesInvalid is false
+extern bool s_itemIndicesInvalid; // if true, the link from listbox items to memory regions (s_itemIndexToRegionPointer) and the link from memory regions to list box items (MemoryRegion::itemIndex) both need to be recalculated
+extern bool s_prevValuesNeedUpdate; // if true, the "prev" values should be updated using the "cur" values on the next frame update signaled
+extern unsigned int s_maxItemIndex; // max currently valid item index, the listbox sometimes tries to update things past the end of the list so we need to know this to ignore those attempts
+
+// list of contiguous uneliminated memory regions
+typedef std::list<MemoryRegion> MemoryList;
+extern MemoryList s_activeMemoryRegions;
+// held by anything that reads or changes the state above from outside the thread that updates it
+extern ThreadLock s_activeMemoryRegionsLock;
+
+// what nullptr passed to SetMemorySource goes back to. until this is called, there is no memory at all.
+void SetDefaultMemorySource(const MemorySource* source);
+
+// starts over with every searchable region of the memory source as one result each,
+// and makes sure the value arrays are large enough for all of them.
+void ResetSearchRegions();
+// frees everything the engine allocated, the next reset starts from scratch.
+void FreeSearchRegions();
+// eliminates a range of hardware addresses from the search results, see the definition for the return value
+int DeactivateRegion(MemoryRegion& region, MemoryList::iterator& iter, HWAddressType hardwareAddress, unsigned int size);
+// warning: can be slow
+void CalculateItemIndices(int itemSize);
+
+// reads the current values of every result from the memory source, counting the ones that changed.
+// call once per frame.
+void UpdateSearchRegions(char sizeTypeID, char typeID, bool requireAligned);
+// number of results of the given data size
+int CountSearchItems(char sizeTypeID, char typeID, bool requireAligned);
+// eliminates every result that doesn't satisfy the condition (see rs_c and rs_o in ramsearch.cpp for c and o).
+// only the conditions that don't need a value history ('r', 's', 'a' and 'n') can be searched here.
+void SearchRegions(char c, char o, char t, RSVal v, RSVal p, char sizeTypeID, bool requireAligned);
+
+template<typename stepType, typename compareType>
+int CountRegionItemsT()
+{
+    AutoThreadLock lock(s_activeMemoryRegionsLock);
+    if (sizeof(stepType) == 1)
+    {
+        if (s_activeMemoryRegions.empty())
+            return 0;
+
+        if (s_itemIndicesInvalid)
+            CalculateItemIndices(sizeof(stepType));
+
+        MemoryRegion& lastRegion = s_activeMemoryRegions.back();
+        return lastRegion.itemIndex + lastRegion.size;
+    }
+    else // the branch above is faster but won't work if the step size isn't 1
+    {
+        int total = 0;
+        for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+        {
+            MemoryRegion& region = *iter;
+            int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+            total += (region.size - startSkipSize + (sizeof(stepType) - 1)) / sizeof(stepType);
+        }
+        return total;
+    }
+}
+
+// returns information about the item in the form of a "fake" region
+// that has the item in it and nothing else
+template<typename stepType, typename compareType>
+void ItemIndexToVirtualRegion(unsigned int itemIndex, MemoryRegion& virtualRegion)
+{
+    if (s_itemIndicesInvalid)
+        CalculateItemIndices(sizeof(stepType));
+
+    if (itemIndex >= s_maxItemIndex)
+    {
+        memset(&virtualRegion, 0, sizeof(MemoryRegion));
+        return;
+    }
+
+    const MemoryRegion* regionPtr = s_itemIndexToRegionPointer[itemIndex];
+    const MemoryRegion& region = *regionPtr;
+
+    int bytesWithinRegion = (itemIndex - region.itemIndex) * sizeof(stepType);
+    int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
+    bytesWithinRegion += startSkipSize;
+
+    virtualRegion.size = sizeof(compareType);
+    virtualRegion.hardwareAddress = region.hardwareAddress + bytesWithinRegion;
+    //virtualRegion.softwareAddress = region.softwareAddress + bytesWithinRegion;
+    virtualRegion.virtualIndex = region.virtualIndex + bytesWithinRegion;
+    virtualRegion.itemIndex = itemIndex;
+    return;
+}
+
+template<typename stepType, typename compareType>
+unsigned int ItemIndexToVirtualIndex(unsigned int itemIndex)
+{
+    MemoryRegion virtualRegion;
+    ItemIndexToVirtualRegion<stepType, compareType>(itemIndex, virtualRegion);
+    return virtualRegion.virtualIndex;
+}
+
+template<typename T>
+T ReadLocalValue(const unsigned char* data)
+{
+    return *(const T*)data;
+}
+//template<> signed char ReadLocalValue(const unsigned char* data) { return *data; }
+//template<> unsigned char ReadLocalValue(const unsigned char* data) { return *data; }
+
+
+template<typename stepType, typename compareType>
+compareType GetPrevValueFromVirtualIndex(unsigned int virtualIndex)
+{
+    return ReadLocalValue<compareType>(s_prevValues + virtualIndex);
+    //return *(compareType*)(s_prevValues+virtualIndex);
+}
+template<typename stepType, typename compareType>
+compareType GetCurValueFromVirtualIndex(unsigned int virtualIndex)
+{
+    return ReadLocalValue<compareType>(s_curValues + virtualIndex);
+    //	return *(compareType*)(s_curValues+virtualIndex);
+}
+template<typename stepType, typename compareType>
+unsigned short GetNumChangesFromVirtualIndex(unsigned int virtualIndex)
+{
+    unsigned short num = s_numChanges[virtualIndex];
+    //for(unsigned int i = 1; i < sizeof(stepType); i++)
+    //	if(num < s_numChanges[virtualIndex+i])
+    //		num = s_numChanges[virtualIndex+i];
+    return num;
+}
+
+template<typename stepType, typename compareType>
+compareType GetPrevValueFromItemIndex(unsigned int itemIndex)
+{
+    int virtualIndex = ItemIndexToVirtualIndex<stepType, compareType>(itemIndex);
+    return GetPrevValueFromVirtualIndex<stepType, compareType>(virtualIndex);
+}
+template<typename stepType, typename compareType>
+compareType GetCurValueFromItemIndex(unsigned int itemIndex)
+{
+    int virtualIndex = ItemIndexToVirtualIndex<stepType, compareType>(itemIndex);
+    return GetCurValueFromVirtualIndex<stepType, compareType>(virtualIndex);
+}
+template<typename stepType, typename compareType>
+unsigned short GetNumChangesFromItemIndex(unsigned int itemIndex)
+{
+    int virtualIndex = ItemIndexToVirtualIndex<stepType, compareType>(itemIndex);
+    return GetNumChangesFromVirtualIndex<stepType, compareType>(virtualIndex);
+}
+template<typename stepType, typename compareType>
+unsigned int GetHardwareAddressFromItemIndex(unsigned int itemIndex)
+{
+    MemoryRegion virtualRegion;
+    ItemIndexToVirtualRegion<stepType, compareType>(itemIndex, virtualRegion);
+    return virtualRegion.hardwareAddress;
+}
+
+// this one might be unreliable, haven't used it much
+template<typename stepType, typename compareType>
+unsigned int HardwareAddressToItemIndex(HWAddressType hardwareAddress)
+{
+    if (s_itemIndicesInvalid)
+        CalculateItemIndices(sizeof(stepType));
+
+    for (MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
+    {
+        MemoryRegion& region = *iter;
+        if (hardwareAddress >= region.hardwareAddress && hardwareAddress < region.hardwareAddress + region.size)
+        {
+            int indexWithinRegion = (hardwareAddress - region.hardwareAddress) / sizeof(stepType);
+            return region.itemIndex + indexWithinRegion;
+        }
+    }
+
+    return -1;
+}
+
+
+
+
+// 4-byte items use int rather than long so that they're still 4 bytes where long isn't.
+// it's ugly but I can't think of a better way to call these functions that isn't also slower, since
+// I need the current values of these arguments to determine which primitive types are used within the function
+#define CALL_WITH_T_SIZE_TYPES(functionName, sizeTypeID, typeID, requireAligned, ...) \
+    (typeID == 'f' \
+        ? (sizeTypeID == 'l' \
+            ? (requireAligned \
+                ? functionName<long long, double>(__VA_ARGS__) \
+                : functionName<char, double>(__VA_ARGS__)) \
+            : (requireAligned \
+                ? functionName<int, float>(__VA_ARGS__) \
+                : functionName<char, float>(__VA_ARGS__))) \
+    : sizeTypeID == 'b' \
+        ? (typeID == 's' \
+            ? functionName<char, signed char>(__VA_ARGS__) \
+            : functionName<char, unsigned char>(__VA_ARGS__)) \
+    : sizeTypeID == 'w' \
+        ? (typeID == 's' \
+            ? (requireAligned \
+                ? functionName<short, signed short>(__VA_ARGS__) \
+                : functionName<char, signed short>(__VA_ARGS__)) \
+            : (requireAligned \
+                ? functionName<short, unsigned short>(__VA_ARGS__) \
+                : functionName<char, unsigned short>(__VA_ARGS__))) \
+    : sizeTypeID == 'd' \
+        ? (typeID == 's' \
+            ? (requireAligned \
+                ? functionName<int, signed int>(__VA_ARGS__) \
+                : functionName<char, signed int>(__VA_ARGS__)) \
+            : (requireAligned \
+                ? functionName<int, unsigned int>(__VA_ARGS__) \
+                : functionName<char, unsigned int>(__VA_ARGS__))) \
+    : sizeTypeID == 'l' \
+        ? (typeID == 's' \
+            ? (requireAligned \
+                ? functionName<long long, signed long long>(__VA_ARGS__) \
+                : functionName<char, signed long long>(__VA_ARGS__)) \
+            : (requireAligned \
+                ? functionName<long long, unsigned long long>(__VA_ARGS__) \
+                : functionName<char, unsigned long long>(__VA_ARGS__))) \
+    : functionName<char, signed char>(__VA_ARGS__))
+
+// version that takes a forced comparison type
+#define CALL_WITH_T_STEP(functionName, sizeTypeID, sign,type, requireAligned, ...) \
+    (sizeTypeID == 'b' \
+        ? functionName<char, sign type>(__VA_ARGS__) \
+    : sizeTypeID == 'w' \
+        ? (requireAligned \
+            ? functionName<short, sign type>(__VA_ARGS__) \
+            : functionName<char, sign type>(__VA_ARGS__)) \
+    : sizeTypeID == 'd' \
+        ? (requireAligned \
+            ? functionName<int, sign type>(__VA_ARGS__) \
+            : functionName<char, sign type>(__VA_ARGS__)) \
+    : sizeTypeID == 'l' \
+        ? (requireAligned \
+            ? functionName<long long, sign type>(__VA_ARGS__) \
+            : functionName<char, sign type>(__VA_ARGS__)) \
+    : functionName<char, sign type>(__VA_ARGS__))
+
+
+// basic comparison functions:
+template <typename T> inline bool LessCmp(T x, T y, T i)        { return x < y; }
+template <typename T> inline bool MoreCmp(T x, T y, T i)        { return x > y; }
+template <typename T> inline bool LessEqualCmp(T x, T y, T i)   { return x <= y; }
+template <typename T> inline bool MoreEqualCmp(T x, T y, T i)   { return x >= y; }
+template <typename T> inline bool EqualCmp(T x, T y, T i)       { return x == y; }
+template <typename T> inline bool UnequalCmp(T x, T y, T i)     { return x != y; }
+template <typename T> inline bool DiffByCmp(T x, T y, T p)      { return x - y == p || y - x == p; }
+template <typename T> inline bool ModIsCmp(T x, T y, T p)       { return p && x % p == y; }
+template <> inline bool ModIsCmp(float x, float y, float p)     { return p && fmodf(x, p) == y; }
+template <> inline bool ModIsCmp(double x, double y, double p)  { return p && fmod(x, p) == y; }
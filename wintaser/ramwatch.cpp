@@ -8,10 +8,13 @@
 #include "resource.h"
 #include "ramsearch.h"
 #include "ramwatch.h"
+#include "remotememory.h"
+#include "watchtrace.h"
 #include "Config.h"
 #include <assert.h>
 #include <windows.h>
 #include <string>
+#include <vector>
 
 #include <commctrl.h>
 #pragma comment(lib, "comctl32.lib")
@@ -188,6 +191,17 @@ void Update_RAM_Watch()
         // update cached values and detect changes to displayed listview items
 
         EnterCriticalSection(&g_processMemCS);
+
+        // watches tend to be close together, have the cache read them in as few calls as possible
+        static std::vector<RemoteMemoryRange> ranges;
+        ranges.clear();
+        for(int i = 0; i < WatchCount; i++)
+        {
+            RemoteMemoryRange range = { rswatches[i].Address, (unsigned int)sizeTypeIDToSize(rswatches[i].Size) };
+            ranges.push_back(range);
+        }
+        PrefetchRemoteMemory(ranges);
+
         for(int i = 0; i < WatchCount; i++)
         {
             RSVal prevCurValue = rswatches[i].CurValue;
@@ -536,6 +550,34 @@ bool Save_Watches()
     return false;
 }
 
+// starts recording the watches to a trace file, or stops the recording in progress
+bool ToggleWatchTrace()
+{
+    if(IsWatchTraceRecording())
+    {
+        StopWatchTrace();
+        return true;
+    }
+    if(!WatchCount)
+    {
+        MessageBox(MESSAGEBOXPARENT, "Add the watches to record first.", "Record Trace", MB_OK | MB_ICONINFORMATION);
+        return false;
+    }
+    char* slash = max(strrchr(Config::exefilename, '\\'), strrchr(Config::exefilename, '/'));
+    strcpy(Str_Tmp_RW,slash ? slash+1 : Config::exefilename);
+    char* dot = strrchr(Str_Tmp_RW, '.');
+    if(dot) *dot = 0;
+    strcat(Str_Tmp_RW,".hgwt");
+    if(!Change_File_S(Str_Tmp_RW, Config::thisprocessPath, "Record Trace", "Watch Trace\0*.hgwt\0All Files\0*.*\0\0", "hgwt", RamWatchHWnd))
+        return false;
+    if(!StartWatchTrace(Str_Tmp_RW))
+    {
+        MessageBox(MESSAGEBOXPARENT, "Couldn't create the trace file.", "Record Trace", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    return true;
+}
+
 bool QuickSaveWatches()
 {
 if(RWfileChanged==false) return true; //If file has not changed, no need to save changes
@@ -970,6 +1012,7 @@ LRESULT CALLBACK RamWatchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam
         case WM_INITMENU:
             CheckMenuItem(ramwatchmenu, RAMMENU_FILE_AUTOLOAD, AutoRWLoad ? MF_CHECKED : MF_UNCHECKED);
             CheckMenuItem(ramwatchmenu, RAMMENU_FILE_SAVEWINDOW, RWSaveWindowPos ? MF_CHECKED : MF_UNCHECKED);
+            CheckMenuItem(ramwatchmenu, RAMMENU_FILE_TRACE, IsWatchTraceRecording() ? MF_CHECKED : MF_UNCHECKED);
             break;
 
         case WM_MENUSELECT:
@@ -1038,6 +1081,8 @@ LRESULT CALLBACK RamWatchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam
                 case RAMMENU_FILE_APPEND:
                 //case IDC_C_LOAD:
                     return Load_Watches(false);
+                case RAMMENU_FILE_TRACE:
+                    return ToggleWatchTrace();
                 case RAMMENU_FILE_NEW:
                 //case IDC_C_RESET:
                     ResetWatches();
@@ -0,0 +1,193 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "rawstreams.h"
+
+namespace
+{
+    const unsigned int WAV_UNKNOWN_SIZE = 0xFFFFFFFF;
+    const unsigned short WAV_FORMAT_PCM = 1;
+
+    void StoreLE(unsigned int value, unsigned int bytes, unsigned char* out)
+    {
+        for (unsigned int i = 0; i < bytes; i++)
+        {
+            out[i] = static_cast<unsigned char>(value >> (i * 8));
+        }
+    }
+
+    /*
+     * BT.601 in 8.8 fixed point. The offsets are added before shifting, so that the sums are never
+     * negative.
+     */
+    unsigned char ToY(int r, int g, int b)
+    {
+        return static_cast<unsigned char>((66 * r + 129 * g + 25 * b + 128 + (16 << 8)) >> 8);
+    }
+
+    unsigned char ToCb(int r, int g, int b)
+    {
+        return static_cast<unsigned char>((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+    }
+
+    unsigned char ToCr(int r, int g, int b)
+    {
+        return static_cast<unsigned char>((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+    }
+}
+
+Y4MStream::Y4MStream(StreamSink* sink) :
+    m_sink(sink),
+    m_width(0),
+    m_height(0),
+    m_fps(0),
+    m_header_written(false),
+    m_frames(0),
+    m_frame_start(0)
+{
+}
+
+void Y4MStream::SetFormat(int width, int height, int fps)
+{
+    m_width = width;
+    m_height = height;
+    m_fps = fps;
+}
+
+bool Y4MStream::WriteFrame(const unsigned char* pixels)
+{
+    m_frame.clear();
+    if (!m_header_written)
+    {
+        char header[128];
+        int length = sprintf(header, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", m_width, m_height, m_fps);
+        m_frame.insert(m_frame.end(), header, header + length);
+    }
+    m_frame_start = m_frame.size();
+    static const char FRAME_HEADER[] = "FRAME\n";
+    m_frame.insert(m_frame.end(), FRAME_HEADER, FRAME_HEADER + sizeof(FRAME_HEADER) - 1);
+
+    const size_t plane_size = static_cast<size_t>(m_width) * m_height;
+    const size_t header_size = m_frame.size();
+    m_frame.resize(header_size + plane_size * 3);
+    unsigned char* y_plane = &m_frame[0] + header_size;
+    unsigned char* cb_plane = y_plane + plane_size;
+    unsigned char* cr_plane = cb_plane + plane_size;
+    for (int row = 0; row < m_height; row++)
+    {
+        const unsigned char* in = pixels + static_cast<size_t>(m_height - 1 - row) * m_width * 3;
+        size_t out = static_cast<size_t>(row) * m_width;
+        for (int x = 0; x < m_width; x++, in += 3, out++)
+        {
+            int b = in[0];
+            int g = in[1];
+            int r = in[2];
+            y_plane[out] = ToY(r, g, b);
+            cb_plane[out] = ToCb(r, g, b);
+            cr_plane[out] = ToCr(r, g, b);
+        }
+    }
+
+    if (!m_sink->Write(&m_frame[0], static_cast<unsigned int>(m_frame.size())))
+    {
+        return false;
+    }
+    m_header_written = true;
+    m_frames++;
+    return true;
+}
+
+bool Y4MStream::RepeatFrame()
+{
+    if (m_frames == 0)
+    {
+        return false;
+    }
+    if (!m_sink->Write(&m_frame[m_frame_start], static_cast<unsigned int>(m_frame.size() - m_frame_start)))
+    {
+        return false;
+    }
+    m_frames++;
+    return true;
+}
+
+unsigned int Y4MStream::GetFrameCount() const
+{
+    return m_frames;
+}
+
+WavStream::WavStream(StreamSink* sink) :
+    m_sink(sink),
+    m_channels(0),
+    m_samples_per_second(0),
+    m_bits_per_sample(0),
+    m_header_written(false),
+    m_sample_bytes(0)
+{
+}
+
+void WavStream::SetFormat(int channels, int samples_per_second, int bits_per_sample)
+{
+    m_channels = channels;
+    m_samples_per_second = samples_per_second;
+    m_bits_per_sample = bits_per_sample;
+}
+
+bool WavStream::HasFormat() const
+{
+    return m_channels > 0;
+}
+
+bool WavStream::Write(const void* samples, unsigned int size)
+{
+    if (size == 0)
+    {
+        return true;
+    }
+    if (m_header_written)
+    {
+        if (!m_sink->Write(samples, size))
+        {
+            return false;
+        }
+        m_sample_bytes += size;
+        return true;
+    }
+
+    unsigned int block_align = m_channels * ((m_bits_per_sample + 7) / 8);
+    m_buffer.resize(HEADER_SIZE + size);
+    unsigned char* header = &m_buffer[0];
+    memcpy(header, "RIFF", 4);
+    StoreLE(WAV_UNKNOWN_SIZE, 4, header + RIFF_SIZE_OFFSET);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    StoreLE(16, 4, header + 16);
+    StoreLE(WAV_FORMAT_PCM, 2, header + 20);
+    StoreLE(m_channels, 2, header + 22);
+    StoreLE(m_samples_per_second, 4, header + 24);
+    StoreLE(m_samples_per_second * block_align, 4, header + 28);
+    StoreLE(block_align, 2, header + 32);
+    StoreLE(m_bits_per_sample, 2, header + 34);
+    memcpy(header + 36, "data", 4);
+    StoreLE(WAV_UNKNOWN_SIZE, 4, header + DATA_SIZE_OFFSET);
+    memcpy(header + HEADER_SIZE, samples, size);
+    if (!m_sink->Write(&m_buffer[0], static_cast<unsigned int>(m_buffer.size())))
+    {
+        return false;
+    }
+    m_header_written = true;
+    m_sample_bytes += size;
+    /*
+     * Only the first write needs the buffer.
+     */
+    std::vector<unsigned char>().swap(m_buffer);
+    return true;
+}
+
+unsigned long long WavStream::GetSampleBytes() const
+{
+    return m_sample_bytes;
+}
@@ -0,0 +1,101 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+/*
+ * The streams that captured video and audio are handed to an external encoder in.
+ * Only the C++ standard library is used here, the pipes are behind StreamSink.
+ *
+ * Video is a YUV4MPEG2 stream: a header line with the size and frame rate, then every frame as
+ * "FRAME\n" followed by its Y, Cb and Cr planes at full resolution (4:4:4), converted from RGB
+ * with the BT.601 matrix to limited range. Audio is a PCM WAV stream. Its length isn't known
+ * while capturing, so the RIFF and data sizes are left at 0xFFFFFFFF, which is how streamed WAV
+ * is usually marked.
+ *
+ * Every frame, and every piece of audio, goes to the sink in a single write as soon as it's
+ * written. Holding data back would make an encoder that reads the two streams in turn wait for
+ * it, while the capture waits for the encoder to read the other stream.
+ */
+
+#include <vector>
+
+class StreamSink
+{
+public:
+    virtual ~StreamSink() {}
+    /*
+     * Writes all of data or returns false.
+     */
+    virtual bool Write(const void* data, unsigned int size) = 0;
+};
+
+class Y4MStream
+{
+public:
+    explicit Y4MStream(StreamSink* sink);
+
+    /*
+     * Must be called before the first frame, the stream can't change format after that.
+     */
+    void SetFormat(int width, int height, int fps);
+    /*
+     * pixels is a frame in the layout of the AVI frames: width * height 24-bit BGR pixels with
+     * the rows from the bottom up.
+     */
+    bool WriteFrame(const unsigned char* pixels);
+    /*
+     * Writes the last frame again. YUV4MPEG2 has no way to say a frame repeats, but this at least
+     * doesn't convert it again.
+     */
+    bool RepeatFrame();
+    unsigned int GetFrameCount() const;
+
+private:
+    StreamSink* m_sink;
+    int m_width;
+    int m_height;
+    int m_fps;
+    bool m_header_written;
+    unsigned int m_frames;
+    /*
+     * The header when it's still due, "FRAME\n" and the three planes, the frame starting at
+     * m_frame_start.
+     */
+    std::vector<unsigned char> m_frame;
+    size_t m_frame_start;
+};
+
+class WavStream
+{
+public:
+    explicit WavStream(StreamSink* sink);
+
+    /*
+     * Must be called before the first samples, the stream can't change format after that.
+     */
+    void SetFormat(int channels, int samples_per_second, int bits_per_sample);
+    bool HasFormat() const;
+    /*
+     * samples are interleaved PCM in the format given to SetFormat.
+     */
+    bool Write(const void* samples, unsigned int size);
+    unsigned long long GetSampleBytes() const;
+
+    /*
+     * Where the header leaves the RIFF and data sizes unknown, as 32-bit little-endian numbers,
+     * for sinks that can go back and fill them in once the stream is done.
+     */
+    static const unsigned int HEADER_SIZE = 44;
+    static const unsigned int RIFF_SIZE_OFFSET = 4;
+    static const unsigned int DATA_SIZE_OFFSET = 40;
+
+private:
+    StreamSink* m_sink;
+    int m_channels;
+    int m_samples_per_second;
+    int m_bits_per_sample;
+    bool m_header_written;
+    unsigned long long m_sample_bytes;
+    std::vector<unsigned char> m_buffer;
+};
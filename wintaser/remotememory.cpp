@@ -0,0 +1,251 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Per-frame page cache for reads from the game's memory.
+ *
+ * Every ReadProcessMemory call is a round trip through the kernel, and RAM search, RAM watch
+ * and the other readers used to make one or more of them for each region and each watch, every
+ * frame. Here the memory is cached a page at a time until the next frame boundary, missing
+ * pages that are next to each other get read with a single call, and every reader shares the
+ * cache, so a page is only paid for once per frame.
+ *
+ * Only pages something asked for are ever read. Reading the gaps between two requests as well
+ * would save a few more calls, but a gap can hold guard pages (thread stacks), and touching
+ * those from the outside would change how the game's stacks grow.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "remotememory.h"
+#include "ramsearch.h"
+#include "threadlock.h"
+
+namespace
+{
+    static const unsigned int PAGE_SIZE = 4096;
+    static const unsigned int MAX_CACHED_PAGES = 4096; /* 16 MB */
+    static const unsigned int UNREADABLE_SLOT = 0xFFFFFFFF;
+
+    ThreadLock s_cache_lock;
+    /* page number -> slot in s_page_data, or UNREADABLE_SLOT */
+    std::unordered_map<unsigned int, unsigned int> s_page_slots;
+    std::vector<unsigned char> s_page_data;
+    unsigned int s_used_slots = 0;
+    RemoteMemoryStats s_stats = { 0, 0, 0, 0 };
+
+    unsigned int FirstPage(HWAddressType address)
+    {
+        return address / PAGE_SIZE;
+    }
+
+    unsigned int LastPage(HWAddressType address, unsigned int size)
+    {
+        return (address + size - 1) / PAGE_SIZE;
+    }
+
+    bool IsPageCached(unsigned int page)
+    {
+        return s_page_slots.find(page) != s_page_slots.end();
+    }
+
+    /*
+     * Reads count consecutive pages into consecutive slots with one call if possible.
+     * When that fails part of the run isn't readable, so the pages are retried one at a time.
+     * Returns false if the cache is full.
+     */
+    bool FetchPages(unsigned int first_page, unsigned int count)
+    {
+        if (s_used_slots + count > MAX_CACHED_PAGES)
+        {
+            return false;
+        }
+        if (s_page_data.size() < (s_used_slots + count) * PAGE_SIZE)
+        {
+            s_page_data.resize((s_used_slots + count) * PAGE_SIZE);
+        }
+
+        unsigned char* data = &s_page_data[s_used_slots * PAGE_SIZE];
+        HWAddressType address = static_cast<HWAddressType>(first_page) * PAGE_SIZE;
+        s_stats.page_misses += count;
+        s_stats.remote_reads++;
+        if (ReadRemoteMemory(address, data, count * PAGE_SIZE))
+        {
+            for (unsigned int i = 0; i < count; i++)
+            {
+                s_page_slots[first_page + i] = s_used_slots + i;
+            }
+            s_used_slots += count;
+            return true;
+        }
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            bool readable = (count > 1) && ReadRemoteMemory(address + i * PAGE_SIZE, data + i * PAGE_SIZE,
+                                                            PAGE_SIZE);
+            if (count > 1)
+            {
+                s_stats.remote_reads++;
+            }
+            s_page_slots[first_page + i] = readable ? s_used_slots + i : UNREADABLE_SLOT;
+        }
+        s_used_slots += count;
+        return true;
+    }
+
+    /*
+     * Fetches the pages that aren't cached yet, pages must be sorted and unique.
+     * Returns false if the cache filled up before all of them were read.
+     */
+    bool FetchMissingPages(const std::vector<unsigned int>& pages)
+    {
+        unsigned int run_start = 0;
+        while (run_start < pages.size())
+        {
+            unsigned int run_end = run_start + 1;
+            while (run_end < pages.size() && pages[run_end] == pages[run_end - 1] + 1)
+            {
+                run_end++;
+            }
+            if (!FetchPages(pages[run_start], run_end - run_start))
+            {
+                return false;
+            }
+            run_start = run_end;
+        }
+        return true;
+    }
+
+    bool RangeLess(const RemoteMemoryRange& left, const RemoteMemoryRange& right)
+    {
+        return left.address < right.address;
+    }
+}
+
+void InvalidateRemoteMemoryCache()
+{
+    AutoThreadLock lock(s_cache_lock);
+    s_page_slots.clear();
+    s_used_slots = 0;
+}
+
+void InvalidateRemoteMemoryRange(HWAddressType address, unsigned int size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    AutoThreadLock lock(s_cache_lock);
+    for (unsigned int page = FirstPage(address); page <= LastPage(address, size); page++)
+    {
+        s_page_slots.erase(page);
+    }
+}
+
+void PrefetchRemoteMemory(const std::vector<RemoteMemoryRange>& ranges)
+{
+    std::vector<RemoteMemoryRange> sorted(ranges);
+    std::sort(sorted.begin(), sorted.end(), RangeLess);
+
+    AutoThreadLock lock(s_cache_lock);
+    std::vector<unsigned int> missing;
+    /* pages before this one have been looked at already, by an earlier range */
+    unsigned int next_page = 0;
+    for (unsigned int i = 0; i < sorted.size(); i++)
+    {
+        if (sorted[i].size != 0)
+        {
+            unsigned int page = FirstPage(sorted[i].address);
+            unsigned int last = LastPage(sorted[i].address, sorted[i].size);
+            if (page < next_page)
+            {
+                page = next_page;
+            }
+            for (; page <= last; page++)
+            {
+                if (!IsPageCached(page))
+                {
+                    missing.push_back(page);
+                }
+            }
+            if (last + 1 > next_page)
+            {
+                next_page = last + 1;
+            }
+        }
+    }
+    FetchMissingPages(missing);
+}
+
+bool ReadRemoteMemoryCached(HWAddressType address, void* buffer, unsigned int size)
+{
+    if (size == 0)
+    {
+        return true;
+    }
+
+    AutoThreadLock lock(s_cache_lock);
+    unsigned int first_page = FirstPage(address);
+    unsigned int last_page = LastPage(address, size);
+    std::vector<unsigned int> missing;
+    for (unsigned int page = first_page; page <= last_page; page++)
+    {
+        if (IsPageCached(page))
+        {
+            s_stats.page_hits++;
+        }
+        else
+        {
+            missing.push_back(page);
+        }
+    }
+    if (!FetchMissingPages(missing))
+    {
+        /* The cache is full, this frame is reading more than it can hold. */
+        s_stats.uncached_reads++;
+        return ReadRemoteMemory(address, buffer, size);
+    }
+
+    bool complete = true;
+    unsigned char* output = static_cast<unsigned char*>(buffer);
+    HWAddressType current = address;
+    HWAddressType end = address + size;
+    while (current < end)
+    {
+        unsigned int page = FirstPage(current);
+        unsigned int offset = current - page * PAGE_SIZE;
+        unsigned int length = PAGE_SIZE - offset;
+        if (length > end - current)
+        {
+            length = end - current;
+        }
+        unsigned int slot = s_page_slots[page];
+        if (slot == UNREADABLE_SLOT)
+        {
+            complete = false;
+        }
+        else
+        {
+            memcpy(output, &s_page_data[slot * PAGE_SIZE + offset], length);
+        }
+        output += length;
+        current += length;
+    }
+    return complete;
+}
+
+RemoteMemoryStats GetRemoteMemoryStats()
+{
+    AutoThreadLock lock(s_cache_lock);
+    return s_stats;
+}
+
+void ResetRemoteMemoryStats()
+{
+    AutoThreadLock lock(s_cache_lock);
+    RemoteMemoryStats empty = { 0, 0, 0, 0 };
+    s_stats = empty;
+}
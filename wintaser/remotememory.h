@@ -0,0 +1,45 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <vector>
+
+#include "ramsearch.h"
+
+struct RemoteMemoryRange
+{
+    HWAddressType address;
+    unsigned int size;
+};
+
+struct RemoteMemoryStats
+{
+    unsigned int page_hits;
+    unsigned int page_misses;
+    unsigned int remote_reads;
+    unsigned int uncached_reads;
+};
+
+/*
+ * Drops every cached page. Must be called at each frame boundary, the game changes its memory
+ * between frames.
+ */
+void InvalidateRemoteMemoryCache();
+/*
+ * Drops the cached pages overlapping a range, after the debugger wrote to the game's memory.
+ */
+void InvalidateRemoteMemoryRange(HWAddressType address, unsigned int size);
+/*
+ * Loads every page touched by the ranges, merging the ones that touch the same or neighbouring
+ * pages into single reads. Meant to be called with everything a reader is about to look at.
+ */
+void PrefetchRemoteMemory(const std::vector<RemoteMemoryRange>& ranges);
+/*
+ * Like ReadRemoteMemory, but each page is only read from the game once per frame.
+ * Returns false if part of the range couldn't be read, the rest of the buffer is still filled.
+ */
+bool ReadRemoteMemoryCached(HWAddressType address, void* buffer, unsigned int size);
+
+RemoteMemoryStats GetRemoteMemoryStats();
+void ResetRemoteMemoryStats();
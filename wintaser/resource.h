@@ -19,6 +19,8 @@
 #define IDD_PROMPT                      140
 #define IDD_HOTKEYS                     141
 #define IDD_SPLICE                      142
+#define IDD_POINTERSCAN                 143
+#define IDD_WATCHTRIGGERS               144
 #define IDC_RADIO_READONLY              1003
 #define IDC_RADIO_READWRITE             1004
 #define IDC_EDIT_MOVIE                  1005
@@ -274,6 +276,7 @@
 #define ID_SOUND_NOMMTIMERS             40251
 #define ID_SOUND_NOPLAYBUFFERS          40252
 #define ID_SOUND_VIRTUALDIRECTSOUND     40253
+#define ID_SOUND_HIGHQUALITYRESAMPLE    40254
 #define ID_SOUND_RATE_8000              40270
 #define ID_SOUND_RATE_11025             40271
 #define ID_SOUND_RATE_12000             40272
@@ -310,6 +313,7 @@
 #define ID_TIME_TOGGLE_PAUSE            40356
 #define ID_TIME_TOGGLE_FASTFORWARD      40357
 #define ID_TIME_FRAME_ADVANCE           40358
+#define ID_TIME_FF_LAZYMIX              40359
 #define ID_EXEC_USETRUEPAUSE            40362
 #define ID_EXEC_ONLYHOOKCHILDPROC       40363
 #define ID_INPUT_SKIPLAGFRAMES          40370
@@ -350,6 +354,8 @@
 #define ID_EXEC_THREADS_FULLSYNC        40450
 #define ID_RAM_SEARCH                   40522
 #define ID_RAM_WATCH                    40523
+#define ID_POINTER_SCAN                 40524
+#define ID_WATCH_TRIGGERS               40525
 #define ID_TIME_RATE_100                40550
 #define ID_TIME_RATE_75                 40551
 #define ID_TIME_RATE_50                 40552
@@ -408,6 +414,36 @@
 #define IDC_PROMPT_TEXT                 44000
 #define IDC_PROMPT_TEXT2                44001
 #define IDC_PROMPT_EDIT                 44005
+#define IDC_PS_ADDRESS                  44100
+#define IDC_PS_DEPTH                    44101
+#define IDC_PS_MAXOFFSET                44102
+#define IDC_PS_SCAN                     44103
+#define IDC_PS_FILTER                   44104
+#define IDC_PS_RESULTS                  44105
+#define IDC_PS_STATUS                   44106
+#define IDC_C_HISTORY                   44110
+#define IDC_EDIT_HISTORYFRAMES          44111
+#define IDC_HISTORY_STATUS              44112
+#define IDC_FRAMESAGO                   44113
+#define IDC_HISTORYINCREASES            44114
+#define IDC_HISTORYCHANGES              44115
+#define IDC_EDIT_COMPAREFRAMESAGO       44116
+#define IDC_EDIT_COMPAREINCREASES       44117
+#define IDC_EDIT_COMPAREHISTORYCHANGES  44118
+#define IDC_C_ADDCONDITION              44120
+#define IDC_C_CLEARCONDITIONS           44121
+#define IDC_CONDITIONS_STATUS           44122
+#define IDC_C_REDO                      44123
+#define RAMMENU_FILE_TRACE              44124
+#define IDC_TRIGGER_CONDITION           44125
+#define IDC_TRIGGER_ADD                 44126
+#define IDC_TRIGGER_LIST                44127
+#define IDC_TRIGGER_REMOVE              44128
+#define IDC_TRIGGER_STATUS              44129
+#define IDC_C_SAVEDUMP                  44130
+#define IDC_C_LOADDUMP                  44131
+#define IDC_C_UNLOADDUMP                44132
+#define IDC_DUMP_STATUS                 44133
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -0,0 +1,54 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include "threadlock.h"
+
+#ifdef _WIN32
+
+ThreadLock::ThreadLock()
+{
+    InitializeCriticalSection(&m_cs);
+}
+
+ThreadLock::~ThreadLock()
+{
+    DeleteCriticalSection(&m_cs);
+}
+
+void ThreadLock::Enter()
+{
+    EnterCriticalSection(&m_cs);
+}
+
+void ThreadLock::Leave()
+{
+    LeaveCriticalSection(&m_cs);
+}
+
+#else
+
+ThreadLock::ThreadLock()
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m_mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+ThreadLock::~ThreadLock()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void ThreadLock::Enter()
+{
+    pthread_mutex_lock(&m_mutex);
+}
+
+void ThreadLock::Leave()
+{
+    pthread_mutex_unlock(&m_mutex);
+}
+
+#endif
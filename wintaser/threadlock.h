@@ -0,0 +1,47 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+ * A recursive lock for the code that doesn't otherwise need Windows, so that it can also be
+ * built and tested elsewhere (see tools/). It's a CRITICAL_SECTION on Windows.
+ */
+class ThreadLock
+{
+public:
+    ThreadLock();
+    ~ThreadLock();
+
+    void Enter();
+    void Leave();
+
+private:
+    ThreadLock(const ThreadLock&);
+    ThreadLock& operator=(const ThreadLock&);
+
+#ifdef _WIN32
+    CRITICAL_SECTION m_cs;
+#else
+    pthread_mutex_t m_mutex;
+#endif
+};
+
+class AutoThreadLock
+{
+public:
+    explicit AutoThreadLock(ThreadLock& lock) : m_lock(lock) { m_lock.Enter(); }
+    ~AutoThreadLock() { m_lock.Leave(); }
+
+private:
+    AutoThreadLock(const AutoThreadLock&);
+    AutoThreadLock& operator=(const AutoThreadLock&);
+
+    ThreadLock& m_lock;
+};
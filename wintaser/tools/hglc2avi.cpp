@@ -0,0 +1,542 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Decodes the video of an AVI capture made with the built-in lossless codec (HGLC, see
+ * losslesscodec.h), which no player has a codec for.
+ *
+ *     hglc2avi capture.avi uncompressed.avi    uncompressed 24-bit AVI, the other streams copied
+ *     hglc2avi capture.avi -                   raw frames to standard output
+ *
+ * The AVI keeps the empty frames that stand for repeated frames. Raw output is every frame in
+ * full, as bottom-up BGR rows, for piping into an encoder, for example:
+ *     hglc2avi capture.avi - | ffmpeg -f rawvideo -pix_fmt bgr24 -s 640x480 -r 60 -i - -vf vflip out.mkv
+ * The size and frame rate to use are printed when it starts.
+ *
+ * An uncompressed AVI can't be larger than 4 GB, longer captures have to be converted raw.
+ * Build it with the makefile in this directory.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "../losslesscodec.h"
+
+namespace
+{
+    const unsigned int AVIIF_KEYFRAME = 0x10;
+    const unsigned int MAX_HEADER_SIZE = 0x100000;
+    const unsigned long long MAX_RIFF_SIZE = 0xFFFFFFFFull;
+
+    unsigned int FourCC(const char* text)
+    {
+        return static_cast<unsigned char>(text[0]) | (static_cast<unsigned char>(text[1]) << 8)
+               | (static_cast<unsigned char>(text[2]) << 16)
+               | (static_cast<unsigned int>(static_cast<unsigned char>(text[3])) << 24);
+    }
+
+    unsigned int GetU32(const unsigned char* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<unsigned int>(data[3]) << 24);
+    }
+
+    void PutU32(unsigned char* data, unsigned int value)
+    {
+        data[0] = static_cast<unsigned char>(value);
+        data[1] = static_cast<unsigned char>(value >> 8);
+        data[2] = static_cast<unsigned char>(value >> 16);
+        data[3] = static_cast<unsigned char>(value >> 24);
+    }
+
+    bool ReadU32(FILE* file, unsigned int* value)
+    {
+        unsigned char bytes[4];
+        if (fread(bytes, sizeof(bytes), 1, file) != 1)
+        {
+            return false;
+        }
+        *value = GetU32(bytes);
+        return true;
+    }
+
+    bool WriteU32(FILE* file, unsigned int value)
+    {
+        unsigned char bytes[4];
+        PutU32(bytes, value);
+        return fwrite(bytes, sizeof(bytes), 1, file) == 1;
+    }
+
+    /*
+     * Seeks past size bytes and the padding byte that keeps chunks at even offsets.
+     */
+    bool SkipChunk(FILE* file, unsigned int size)
+    {
+        return fseek(file, static_cast<long>(size + (size & 1)), SEEK_CUR) == 0;
+    }
+
+    /*
+     * The first two characters of a stream's chunk IDs, its number in decimal.
+     */
+    unsigned int StreamPrefix(int number)
+    {
+        return ('0' + number / 10 % 10) | (('0' + number % 10) << 8);
+    }
+
+    struct IndexEntry
+    {
+        unsigned int id;
+        unsigned int flags;
+        unsigned int offset;
+        unsigned int size;
+    };
+
+    /*
+     * What the header list says about the HGLC stream, and where to patch it.
+     */
+    struct VideoStream
+    {
+        int number;
+        int width;
+        int height;
+        unsigned int rate;
+        unsigned int scale;
+        unsigned char* stream_header;
+        unsigned char* format;
+    };
+
+    /*
+     * Finds the HGLC video stream in the data of the "hdrl" list.
+     */
+    bool FindVideoStream(std::vector<unsigned char>& header_list, VideoStream* video)
+    {
+        int stream = 0;
+        unsigned int position = 4;
+        while (position + 8 <= header_list.size())
+        {
+            unsigned int id = GetU32(&header_list[position]);
+            unsigned int size = GetU32(&header_list[position + 4]);
+            if (size > header_list.size() - position - 8)
+            {
+                return false;
+            }
+            if (id == FourCC("LIST") && size >= 4 && GetU32(&header_list[position + 8]) == FourCC("strl"))
+            {
+                unsigned char* stream_header = nullptr;
+                unsigned char* format = nullptr;
+                unsigned int format_size = 0;
+                unsigned int end = position + 8 + size;
+                for (unsigned int inner = position + 12; inner + 8 <= end;)
+                {
+                    unsigned int inner_id = GetU32(&header_list[inner]);
+                    unsigned int inner_size = GetU32(&header_list[inner + 4]);
+                    if (inner_size > end - inner - 8)
+                    {
+                        return false;
+                    }
+                    if (inner_id == FourCC("strh") && inner_size >= 48)
+                    {
+                        stream_header = &header_list[inner + 8];
+                    }
+                    else if (inner_id == FourCC("strf"))
+                    {
+                        format = &header_list[inner + 8];
+                        format_size = inner_size;
+                    }
+                    inner += 8 + inner_size + (inner_size & 1);
+                }
+                if (stream_header != nullptr && format != nullptr && format_size >= 40
+                    && GetU32(stream_header) == FourCC("vids")
+                    && GetU32(format + 16) == LosslessEncoder::FOURCC)
+                {
+                    video->number = stream;
+                    video->width = static_cast<int>(GetU32(format + 4));
+                    video->height = static_cast<int>(GetU32(format + 8));
+                    video->scale = GetU32(stream_header + 20);
+                    video->rate = GetU32(stream_header + 24);
+                    video->stream_header = stream_header;
+                    video->format = format;
+                    return video->width > 0 && video->height > 0 && video->width <= 0x8000
+                           && video->height <= 0x8000;
+                }
+                stream++;
+            }
+            position += 8 + size + (size & 1);
+        }
+        return false;
+    }
+
+    /*
+     * Makes the header list describe uncompressed frames instead.
+     */
+    void PatchHeaders(std::vector<unsigned char>& header_list, const VideoStream& video)
+    {
+        unsigned int frame_size = static_cast<unsigned int>(video.width) * video.height * 3;
+        PutU32(video.stream_header + 4, FourCC("DIB "));
+        PutU32(video.stream_header + 36, frame_size);
+        PutU32(video.format + 16, 0);
+        PutU32(video.format + 20, frame_size);
+        /* The main header's suggested buffer size, after the list type and the chunk header. */
+        const unsigned int suggested_buffer_size = 4 + 8 + 28;
+        if (header_list.size() >= 4 + 8 + 56 && GetU32(&header_list[4]) == FourCC("avih")
+            && GetU32(&header_list[suggested_buffer_size]) < frame_size)
+        {
+            PutU32(&header_list[suggested_buffer_size], frame_size);
+        }
+    }
+
+    class Converter
+    {
+    public:
+        Converter(FILE* input, FILE* output, bool raw) :
+            m_input(input),
+            m_output(output),
+            m_raw(raw),
+            m_video_prefix(0),
+            m_decoder(nullptr),
+            m_frames(0),
+            m_movi_position(0),
+            m_movi_size(0),
+            m_old_index_position(0),
+            m_written(0),
+            m_movi_output_position(0)
+        {
+        }
+
+        ~Converter()
+        {
+            delete m_decoder;
+        }
+
+        int Run()
+        {
+            unsigned int riff_size = 0;
+            unsigned int riff_type = 0;
+            unsigned int riff = 0;
+            if (!ReadU32(m_input, &riff) || riff != FourCC("RIFF") || !ReadU32(m_input, &riff_size)
+                || !ReadU32(m_input, &riff_type) || riff_type != FourCC("AVI "))
+            {
+                fprintf(stderr, "not an AVI file\n");
+                return 1;
+            }
+            if (!ReadTopLevel())
+            {
+                return 1;
+            }
+            if (m_raw)
+            {
+                fprintf(stderr, "%dx%d bgr24, bottom-up, %u/%u frames per second\n",
+                        m_video.width, m_video.height, m_video.rate, m_video.scale);
+            }
+            else if (!WriteHeaderChunks())
+            {
+                fprintf(stderr, "can't write the output\n");
+                return 1;
+            }
+            if (fseek(m_input, m_movi_position, SEEK_SET) != 0 || !ConvertList(m_movi_size - 4))
+            {
+                return 1;
+            }
+            if (!m_raw && !FinishOutput())
+            {
+                fprintf(stderr, "can't write the output\n");
+                return 1;
+            }
+            fprintf(stderr, "%u frames\n", m_frames);
+            return 0;
+        }
+
+    private:
+        /*
+         * Reads the headers and the old index, and finds the movie data.
+         */
+        bool ReadTopLevel()
+        {
+            bool found_movi = false;
+            unsigned int id = 0;
+            unsigned int size = 0;
+            while (ReadU32(m_input, &id) && ReadU32(m_input, &size))
+            {
+                long data_position = ftell(m_input);
+                unsigned int type = 0;
+                if (id == FourCC("LIST") && size >= 4 && ReadU32(m_input, &type) && type == FourCC("movi"))
+                {
+                    m_movi_position = data_position + 4;
+                    m_movi_size = size;
+                    found_movi = true;
+                }
+                else if (id == FourCC("idx1"))
+                {
+                    m_old_index.resize(size / 16);
+                    for (unsigned int i = 0; i < m_old_index.size(); i++)
+                    {
+                        IndexEntry& entry = m_old_index[i];
+                        if (!ReadU32(m_input, &entry.id) || !ReadU32(m_input, &entry.flags)
+                            || !ReadU32(m_input, &entry.offset) || !ReadU32(m_input, &entry.size))
+                        {
+                            m_old_index.resize(i);
+                            break;
+                        }
+                    }
+                }
+                else if (!found_movi && size <= MAX_HEADER_SIZE)
+                {
+                    /* Everything before the movie data is kept, the header list gets patched. */
+                    std::vector<unsigned char> chunk(8 + size);
+                    PutU32(&chunk[0], id);
+                    PutU32(&chunk[4], size);
+                    if (fseek(m_input, data_position, SEEK_SET) != 0
+                        || (size != 0 && fread(&chunk[8], size, 1, m_input) != 1))
+                    {
+                        break;
+                    }
+                    m_header_chunks.push_back(chunk);
+                }
+                if (fseek(m_input, data_position, SEEK_SET) != 0 || !SkipChunk(m_input, size))
+                {
+                    break;
+                }
+            }
+
+            for (unsigned int i = 0; i < m_header_chunks.size(); i++)
+            {
+                std::vector<unsigned char>& chunk = m_header_chunks[i];
+                if (GetU32(&chunk[0]) == FourCC("LIST") && chunk.size() >= 12 && GetU32(&chunk[8]) == FourCC("hdrl"))
+                {
+                    std::vector<unsigned char> header_list(chunk.begin() + 8, chunk.end());
+                    if (FindVideoStream(header_list, &m_video))
+                    {
+                        PatchHeaders(header_list, m_video);
+                        std::copy(header_list.begin(), header_list.end(), chunk.begin() + 8);
+                        m_decoder = new LosslessDecoder(m_video.width, m_video.height);
+                        m_pixels.resize(static_cast<size_t>(m_video.width) * m_video.height * 3);
+                        m_video_prefix = StreamPrefix(m_video.number);
+                        break;
+                    }
+                }
+            }
+            if (m_decoder == nullptr)
+            {
+                fprintf(stderr, "no video stream made with the lossless codec\n");
+                return false;
+            }
+            if (!found_movi)
+            {
+                fprintf(stderr, "no movie data\n");
+                return false;
+            }
+            return true;
+        }
+
+        bool WriteHeaderChunks()
+        {
+            bool ok = WriteU32(m_output, FourCC("RIFF")) && WriteU32(m_output, 0) && WriteU32(m_output, FourCC("AVI "));
+            m_written = 12;
+            for (unsigned int i = 0; ok && i < m_header_chunks.size(); i++)
+            {
+                const std::vector<unsigned char>& chunk = m_header_chunks[i];
+                ok = fwrite(&chunk[0], chunk.size(), 1, m_output) == 1
+                     && ((chunk.size() & 1) == 0 || fputc(0, m_output) != EOF);
+                m_written += chunk.size() + (chunk.size() & 1);
+            }
+            m_movi_output_position = static_cast<long>(m_written) + 4;
+            ok = ok && WriteU32(m_output, FourCC("LIST")) && WriteU32(m_output, 0) && WriteU32(m_output, FourCC("movi"));
+            m_written += 12;
+            return ok;
+        }
+
+        /*
+         * Converts the chunks of a list, including the ones in "rec " lists, which are flattened.
+         */
+        bool ConvertList(unsigned int size)
+        {
+            std::vector<unsigned char> data;
+            while (size >= 8)
+            {
+                unsigned int id = 0;
+                unsigned int chunk_size = 0;
+                if (!ReadU32(m_input, &id) || !ReadU32(m_input, &chunk_size) || chunk_size > size - 8)
+                {
+                    fprintf(stderr, "the movie data ends early or is damaged, stopped after %u frames\n", m_frames);
+                    return false;
+                }
+                size -= 8 + chunk_size;
+                unsigned int padding = (chunk_size & 1) != 0 && size > 0 ? 1 : 0;
+                size -= padding;
+                unsigned int list_type = 0;
+                if (id == FourCC("LIST"))
+                {
+                    if (chunk_size < 4 || !ReadU32(m_input, &list_type) || !ConvertList(chunk_size - 4)
+                        || (padding != 0 && fgetc(m_input) == EOF))
+                    {
+                        return false;
+                    }
+                    continue;
+                }
+
+                data.resize(chunk_size);
+                if ((chunk_size != 0 && fread(&data[0], chunk_size, 1, m_input) != 1)
+                    || (padding != 0 && fgetc(m_input) == EOF))
+                {
+                    fprintf(stderr, "the movie data ends early, stopped after %u frames\n", m_frames);
+                    return false;
+                }
+                unsigned int flags = NextOldIndexFlags(id);
+                if ((id & 0xFFFF) == m_video_prefix && ((id >> 16) == ('d' | ('c' << 8)) || (id >> 16) == ('d' | ('b' << 8))))
+                {
+                    if (!ConvertFrame(data))
+                    {
+                        return false;
+                    }
+                }
+                else if (!m_raw && !WriteChunk(id, flags, data.empty() ? nullptr : &data[0], chunk_size))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool ConvertFrame(const std::vector<unsigned char>& data)
+        {
+            if (!m_decoder->DecodeFrame(data.empty() ? nullptr : &data[0], static_cast<unsigned int>(data.size()), &m_pixels[0]))
+            {
+                fprintf(stderr, "frame %u can't be decoded\n", m_frames);
+                return false;
+            }
+            m_frames++;
+            if (m_raw)
+            {
+                if (fwrite(&m_pixels[0], m_pixels.size(), 1, m_output) != 1)
+                {
+                    fprintf(stderr, "can't write the output\n");
+                    return false;
+                }
+                return true;
+            }
+            /* An empty frame stays empty, players repeat the previous one. */
+            unsigned int id = m_video_prefix | (('d' | ('b' << 8)) << 16);
+            if (data.empty())
+            {
+                return WriteChunk(id, 0, nullptr, 0);
+            }
+            return WriteChunk(id, AVIIF_KEYFRAME, &m_pixels[0], static_cast<unsigned int>(m_pixels.size()));
+        }
+
+        /*
+         * The flags the old index has for the next chunk, in the order they're in the movie data.
+         */
+        unsigned int NextOldIndexFlags(unsigned int id)
+        {
+            while (m_old_index_position < m_old_index.size()
+                   && m_old_index[m_old_index_position].id == FourCC("rec "))
+            {
+                m_old_index_position++;
+            }
+            if (m_old_index_position < m_old_index.size() && m_old_index[m_old_index_position].id == id)
+            {
+                return m_old_index[m_old_index_position++].flags;
+            }
+            return AVIIF_KEYFRAME;
+        }
+
+        bool WriteChunk(unsigned int id, unsigned int flags, const unsigned char* data, unsigned int size)
+        {
+            if (m_written + 8 + size + 1 + 16 * (m_index.size() + 1) + 8 > MAX_RIFF_SIZE)
+            {
+                fprintf(stderr, "the output would be larger than 4 GB, convert it raw instead\n");
+                return false;
+            }
+            /* Offsets count from the "movi" list type. */
+            IndexEntry entry = { id, flags, static_cast<unsigned int>(m_written - m_movi_output_position - 4), size };
+            m_index.push_back(entry);
+            bool ok = WriteU32(m_output, id) && WriteU32(m_output, size)
+                      && (size == 0 || fwrite(data, size, 1, m_output) == 1)
+                      && ((size & 1) == 0 || fputc(0, m_output) != EOF);
+            m_written += 8 + size + (size & 1);
+            if (!ok)
+            {
+                fprintf(stderr, "can't write the output\n");
+            }
+            return ok;
+        }
+
+        bool FinishOutput()
+        {
+            unsigned long long movi_size = m_written - m_movi_output_position - 4;
+            bool ok = WriteU32(m_output, FourCC("idx1")) && WriteU32(m_output, static_cast<unsigned int>(m_index.size() * 16));
+            for (unsigned int i = 0; ok && i < m_index.size(); i++)
+            {
+                ok = WriteU32(m_output, m_index[i].id) && WriteU32(m_output, m_index[i].flags)
+                     && WriteU32(m_output, m_index[i].offset) && WriteU32(m_output, m_index[i].size);
+            }
+            m_written += 8 + m_index.size() * 16;
+            return ok
+                   && fseek(m_output, 4, SEEK_SET) == 0 && WriteU32(m_output, static_cast<unsigned int>(m_written - 8))
+                   && fseek(m_output, m_movi_output_position, SEEK_SET) == 0
+                   && WriteU32(m_output, static_cast<unsigned int>(movi_size));
+        }
+
+        FILE* m_input;
+        FILE* m_output;
+        bool m_raw;
+        VideoStream m_video;
+        unsigned int m_video_prefix;
+        LosslessDecoder* m_decoder;
+        std::vector<unsigned char> m_pixels;
+        unsigned int m_frames;
+
+        std::vector<std::vector<unsigned char> > m_header_chunks;
+        long m_movi_position;
+        unsigned int m_movi_size;
+        std::vector<IndexEntry> m_old_index;
+        unsigned int m_old_index_position;
+
+        unsigned long long m_written;
+        long m_movi_output_position;
+        std::vector<IndexEntry> m_index;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s capture.avi uncompressed.avi\n"
+                        "       %s capture.avi - > frames.bgr\n", argv[0], argv[0]);
+        return 2;
+    }
+    FILE* input = fopen(argv[1], "rb");
+    if (input == nullptr)
+    {
+        fprintf(stderr, "can't open %s\n", argv[1]);
+        return 1;
+    }
+    bool raw = strcmp(argv[2], "-") == 0;
+    FILE* output = raw ? stdout : fopen(argv[2], "wb");
+    if (output == nullptr)
+    {
+        fprintf(stderr, "can't create %s\n", argv[2]);
+        fclose(input);
+        return 1;
+    }
+#ifdef _WIN32
+    if (raw)
+    {
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+
+    int result = Converter(input, output, raw).Run();
+    fclose(input);
+    if (!raw && fclose(output) != 0)
+    {
+        result = 1;
+    }
+    return result;
+}
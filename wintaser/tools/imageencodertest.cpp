@@ -0,0 +1,812 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests for the image sequence encoder (imageencoder.h).
+ *
+ *     imageencodertest                   encodes generated frames and checks every file
+ *     imageencodertest bench [frames]    times encoding 640x480 frames in each format
+ *
+ * The PNG files are read back with the inflate in here, which shares nothing with the deflate
+ * in the encoder: the chunk CRCs, the zlib header and Adler-32 are checked, the rows are
+ * unfiltered and compared with the frame. BMP and TGA files are compared byte for byte with
+ * what their headers say. Build and run it with "make check" in this directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../imageencoder.h"
+
+namespace
+{
+    const int BENCH_WIDTH = 640;
+    const int BENCH_HEIGHT = 480;
+    const int BENCH_FRAMES = 60;
+
+    unsigned int s_random = 1;
+
+    unsigned int NextRandom()
+    {
+        s_random = s_random * 1103515245 + 12345;
+        return s_random >> 8;
+    }
+
+    enum FrameKind
+    {
+        FRAME_GAME,
+        FRAME_FLAT,
+        FRAME_GRADIENT,
+        FRAME_NOISE,
+        FRAME_KIND_COUNT,
+    };
+
+    const char* const FRAME_KIND_NAMES[FRAME_KIND_COUNT] = { "game", "flat", "gradient", "noise" };
+
+    /*
+     * A frame in the AVI layout, bottom up BGR. The game frame has flat areas, a checkerboard,
+     * a gradient and a noisy strip, so the deflate finds long and short matches and literals.
+     */
+    void MakeFrame(FrameKind kind, int width, int height, std::vector<unsigned char>* frame)
+    {
+        frame->resize(static_cast<size_t>(width) * height * 3);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                unsigned char* pixel = &(*frame)[(static_cast<size_t>(y) * width + x) * 3];
+                switch (kind)
+                {
+                case FRAME_GAME:
+                    if (x < width / 3)
+                    {
+                        pixel[0] = static_cast<unsigned char>(x);
+                        pixel[1] = static_cast<unsigned char>(y);
+                        pixel[2] = static_cast<unsigned char>(x ^ y);
+                    }
+                    else if (x < 2 * width / 3)
+                    {
+                        unsigned char value = ((x / 16 + y / 16) & 1) != 0 ? 200 : 30;
+                        pixel[0] = value;
+                        pixel[1] = value;
+                        pixel[2] = value;
+                    }
+                    else
+                    {
+                        pixel[0] = static_cast<unsigned char>(NextRandom());
+                        pixel[1] = static_cast<unsigned char>(NextRandom());
+                        pixel[2] = static_cast<unsigned char>(NextRandom());
+                    }
+                    break;
+                case FRAME_FLAT:
+                    pixel[0] = 40;
+                    pixel[1] = 90;
+                    pixel[2] = 160;
+                    break;
+                case FRAME_GRADIENT:
+                    pixel[0] = static_cast<unsigned char>(x * 255 / width);
+                    pixel[1] = static_cast<unsigned char>(y * 255 / height);
+                    pixel[2] = static_cast<unsigned char>((x + y) / 2);
+                    break;
+                default:
+                    pixel[0] = static_cast<unsigned char>(NextRandom());
+                    pixel[1] = static_cast<unsigned char>(NextRandom());
+                    pixel[2] = static_cast<unsigned char>(NextRandom());
+                    break;
+                }
+            }
+        }
+    }
+
+    unsigned int GetBE(const unsigned char* data)
+    {
+        return (static_cast<unsigned int>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    }
+
+    unsigned int GetLE(const unsigned char* data, int bytes)
+    {
+        unsigned int value = 0;
+        for (int i = bytes - 1; i >= 0; i--)
+        {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    unsigned int Crc32(const unsigned char* data, size_t size)
+    {
+        unsigned int crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc ^= data[i];
+            for (int k = 0; k < 8; k++)
+            {
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+        }
+        return ~crc;
+    }
+
+    unsigned int Adler32(const unsigned char* data, size_t size)
+    {
+        unsigned int a = 1;
+        unsigned int b = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            a = (a + data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    /*
+     * A plain inflate (RFC 1951) for checking the encoder's output. Huffman codes are decoded
+     * one bit at a time from the counts of each code length, slow but short.
+     */
+    class Inflater
+    {
+    public:
+        Inflater(const unsigned char* data, size_t size) :
+            m_data(data), m_size(size), m_position(0), m_bits(0), m_bit_count(0), m_failed(false),
+            m_stored_blocks(0), m_dynamic_blocks(0)
+        {
+        }
+
+        bool Inflate(std::vector<unsigned char>* out)
+        {
+            bool last = false;
+            while (!last && !m_failed)
+            {
+                last = GetBits(1) != 0;
+                switch (GetBits(2))
+                {
+                case 0:
+                    InflateStored(out);
+                    m_stored_blocks++;
+                    break;
+                case 1:
+                    InflateFixed(out);
+                    break;
+                case 2:
+                    InflateDynamic(out);
+                    m_dynamic_blocks++;
+                    break;
+                default:
+                    m_failed = true;
+                    break;
+                }
+            }
+            return !m_failed;
+        }
+
+        /*
+         * Where the bytes after the deflate stream start.
+         */
+        size_t GetEnd() const
+        {
+            return m_position;
+        }
+
+        int GetStoredBlocks() const
+        {
+            return m_stored_blocks;
+        }
+
+        int GetDynamicBlocks() const
+        {
+            return m_dynamic_blocks;
+        }
+
+    private:
+        struct Huffman
+        {
+            unsigned short counts[16];
+            unsigned short symbols[288];
+        };
+
+        unsigned int GetBits(int count)
+        {
+            while (m_bit_count < count)
+            {
+                if (m_position >= m_size)
+                {
+                    m_failed = true;
+                    return 0;
+                }
+                m_bits |= static_cast<unsigned int>(m_data[m_position++]) << m_bit_count;
+                m_bit_count += 8;
+            }
+            unsigned int value = m_bits & ((1u << count) - 1);
+            m_bits >>= count;
+            m_bit_count -= count;
+            return value;
+        }
+
+        /*
+         * Returns false if the lengths are over-subscribed. Incomplete codes are allowed, a
+         * code with only one symbol is one.
+         */
+        bool Build(const unsigned char* lengths, int count, Huffman* code)
+        {
+            memset(code->counts, 0, sizeof(code->counts));
+            for (int i = 0; i < count; i++)
+            {
+                code->counts[lengths[i]]++;
+            }
+            int left = 1;
+            for (int length = 1; length < 16; length++)
+            {
+                left = left * 2 - code->counts[length];
+                if (left < 0)
+                {
+                    return false;
+                }
+            }
+            unsigned short offsets[16];
+            offsets[1] = 0;
+            for (int length = 1; length < 15; length++)
+            {
+                offsets[length + 1] = offsets[length] + code->counts[length];
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (lengths[i] != 0)
+                {
+                    code->symbols[offsets[lengths[i]]++] = static_cast<unsigned short>(i);
+                }
+            }
+            return true;
+        }
+
+        int Decode(const Huffman& code)
+        {
+            int value = 0;
+            int first = 0;
+            int index = 0;
+            for (int length = 1; length < 16; length++)
+            {
+                value |= GetBits(1);
+                int count = code.counts[length];
+                if (value - first < count)
+                {
+                    return code.symbols[index + value - first];
+                }
+                index += count;
+                first = (first + count) << 1;
+                value <<= 1;
+            }
+            m_failed = true;
+            return 0;
+        }
+
+        void InflateStored(std::vector<unsigned char>* out)
+        {
+            m_bits = 0;
+            m_bit_count = 0;
+            if (m_position + 4 > m_size)
+            {
+                m_failed = true;
+                return;
+            }
+            unsigned int length = GetLE(m_data + m_position, 2);
+            unsigned int complement = GetLE(m_data + m_position + 2, 2);
+            m_position += 4;
+            if ((length ^ 0xFFFF) != complement || m_position + length > m_size)
+            {
+                m_failed = true;
+                return;
+            }
+            out->insert(out->end(), m_data + m_position, m_data + m_position + length);
+            m_position += length;
+        }
+
+        void InflateCodes(const Huffman& literals, const Huffman& distances, std::vector<unsigned char>* out)
+        {
+            static const unsigned short LENGTH_BASES[29] =
+            {
+                3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99,
+                115, 131, 163, 195, 227, 258,
+            };
+            static const unsigned short DISTANCE_BASES[30] =
+            {
+                1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+                1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+            };
+            while (!m_failed)
+            {
+                int symbol = Decode(literals);
+                if (symbol < 256)
+                {
+                    out->push_back(static_cast<unsigned char>(symbol));
+                    continue;
+                }
+                if (symbol == 256)
+                {
+                    return;
+                }
+                symbol -= 257;
+                if (symbol >= 29)
+                {
+                    m_failed = true;
+                    return;
+                }
+                int extra = (symbol < 8 || symbol == 28) ? 0 : (symbol - 4) / 4;
+                unsigned int length = LENGTH_BASES[symbol] + GetBits(extra);
+                int distance_symbol = Decode(distances);
+                if (distance_symbol >= 30)
+                {
+                    m_failed = true;
+                    return;
+                }
+                extra = distance_symbol < 4 ? 0 : (distance_symbol - 2) / 2;
+                unsigned int distance = DISTANCE_BASES[distance_symbol] + GetBits(extra);
+                if (distance > out->size() || distance > 32768)
+                {
+                    m_failed = true;
+                    return;
+                }
+                size_t from = out->size() - distance;
+                for (unsigned int i = 0; i < length; i++)
+                {
+                    out->push_back((*out)[from + i]);
+                }
+            }
+        }
+
+        void InflateFixed(std::vector<unsigned char>* out)
+        {
+            unsigned char lengths[288];
+            for (int i = 0; i < 288; i++)
+            {
+                lengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+            }
+            Huffman literals;
+            Huffman distances;
+            Build(lengths, 288, &literals);
+            memset(lengths, 5, 30);
+            Build(lengths, 30, &distances);
+            InflateCodes(literals, distances, out);
+        }
+
+        void InflateDynamic(std::vector<unsigned char>* out)
+        {
+            static const unsigned char ORDER[19] =
+            {
+                16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+            };
+            int literal_count = GetBits(5) + 257;
+            int distance_count = GetBits(5) + 1;
+            int length_count = GetBits(4) + 4;
+            if (literal_count > 286 || distance_count > 30)
+            {
+                m_failed = true;
+                return;
+            }
+            unsigned char lengths[286 + 30] = { 0 };
+            for (int i = 0; i < length_count; i++)
+            {
+                lengths[ORDER[i]] = static_cast<unsigned char>(GetBits(3));
+            }
+            Huffman length_code;
+            if (!Build(lengths, 19, &length_code))
+            {
+                m_failed = true;
+                return;
+            }
+            int total = literal_count + distance_count;
+            int index = 0;
+            while (index < total && !m_failed)
+            {
+                int symbol = Decode(length_code);
+                if (symbol < 16)
+                {
+                    lengths[index++] = static_cast<unsigned char>(symbol);
+                    continue;
+                }
+                unsigned char repeated = 0;
+                int repeat = 0;
+                if (symbol == 16)
+                {
+                    if (index == 0)
+                    {
+                        m_failed = true;
+                        return;
+                    }
+                    repeated = lengths[index - 1];
+                    repeat = 3 + GetBits(2);
+                }
+                else if (symbol == 17)
+                {
+                    repeat = 3 + GetBits(3);
+                }
+                else
+                {
+                    repeat = 11 + GetBits(7);
+                }
+                if (index + repeat > total)
+                {
+                    m_failed = true;
+                    return;
+                }
+                memset(lengths + index, repeated, repeat);
+                index += repeat;
+            }
+            Huffman literals;
+            Huffman distances;
+            if (m_failed || lengths[256] == 0 || !Build(lengths, literal_count, &literals)
+                || !Build(lengths + literal_count, distance_count, &distances))
+            {
+                m_failed = true;
+                return;
+            }
+            InflateCodes(literals, distances, out);
+        }
+
+        const unsigned char* m_data;
+        size_t m_size;
+        size_t m_position;
+        unsigned int m_bits;
+        int m_bit_count;
+        bool m_failed;
+        int m_stored_blocks;
+        int m_dynamic_blocks;
+    };
+
+    int Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        if (pa <= pb && pa <= pc)
+        {
+            return a;
+        }
+        return pb <= pc ? b : c;
+    }
+
+    /*
+     * Reads a PNG back and compares it with the frame. Returns what's wrong, or nullptr.
+     */
+    const char* CheckPNG(const std::vector<unsigned char>& file, const std::vector<unsigned char>& frame,
+                         int width, int height, int* stored_blocks, int* dynamic_blocks)
+    {
+        static const unsigned char SIGNATURE[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        if (file.size() < 8 || memcmp(&file[0], SIGNATURE, 8) != 0)
+        {
+            return "the PNG signature is wrong";
+        }
+        std::vector<unsigned char> compressed;
+        bool header = false;
+        bool end = false;
+        size_t position = 8;
+        while (!end)
+        {
+            if (position + 12 > file.size())
+            {
+                return "a PNG chunk is cut off";
+            }
+            unsigned int length = GetBE(&file[position]);
+            const unsigned char* type = &file[position + 4];
+            if (position + 12 + length > file.size())
+            {
+                return "a PNG chunk is cut off";
+            }
+            if (Crc32(type, length + 4) != GetBE(type + 4 + length))
+            {
+                return "a PNG chunk's CRC is wrong";
+            }
+            const unsigned char* data = type + 4;
+            if (memcmp(type, "IHDR", 4) == 0)
+            {
+                static const unsigned char RGB8[5] = { 8, 2, 0, 0, 0 };
+                if (length != 13 || static_cast<int>(GetBE(data)) != width || static_cast<int>(GetBE(data + 4)) != height
+                    || memcmp(data + 8, RGB8, 5) != 0)
+                {
+                    return "the PNG header is wrong";
+                }
+                header = true;
+            }
+            else if (memcmp(type, "IDAT", 4) == 0)
+            {
+                compressed.insert(compressed.end(), data, data + length);
+            }
+            else if (memcmp(type, "IEND", 4) == 0)
+            {
+                end = true;
+            }
+            position += 12 + length;
+        }
+        if (!header || position != file.size())
+        {
+            return "the PNG chunks are wrong";
+        }
+        if (compressed.size() < 6 || (compressed[0] & 0x0F) != 8 || ((compressed[0] << 8) | compressed[1]) % 31 != 0
+            || (compressed[1] & 0x20) != 0)
+        {
+            return "the zlib header is wrong";
+        }
+
+        std::vector<unsigned char> filtered;
+        Inflater inflater(&compressed[2], compressed.size() - 2);
+        if (!inflater.Inflate(&filtered))
+        {
+            return "the deflate stream doesn't decode";
+        }
+        *stored_blocks += inflater.GetStoredBlocks();
+        *dynamic_blocks += inflater.GetDynamicBlocks();
+        int row_size = width * 3;
+        if (filtered.size() != static_cast<size_t>(row_size + 1) * height)
+        {
+            return "the image data has the wrong size";
+        }
+
+        std::vector<unsigned char> previous(row_size, 0);
+        std::vector<unsigned char> row(row_size);
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char* line = &filtered[static_cast<size_t>(row_size + 1) * y];
+            int filter = line[0];
+            for (int i = 0; i < row_size; i++)
+            {
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = previous[i];
+                int c = i >= 3 ? previous[i - 3] : 0;
+                int prediction = 0;
+                switch (filter)
+                {
+                case 0:
+                    break;
+                case 1:
+                    prediction = a;
+                    break;
+                case 2:
+                    prediction = b;
+                    break;
+                case 3:
+                    prediction = (a + b) / 2;
+                    break;
+                case 4:
+                    prediction = Paeth(a, b, c);
+                    break;
+                default:
+                    return "a row has an unknown filter";
+                }
+                row[i] = static_cast<unsigned char>(line[i + 1] + prediction);
+            }
+            const unsigned char* source = &frame[static_cast<size_t>(height - 1 - y) * row_size];
+            for (int x = 0; x < row_size; x += 3)
+            {
+                if (row[x] != source[x + 2] || row[x + 1] != source[x + 1] || row[x + 2] != source[x])
+                {
+                    return "the PNG pixels don't match the frame";
+                }
+            }
+            previous.swap(row);
+        }
+        size_t adler = 2 + inflater.GetEnd();
+        if (adler + 4 != compressed.size() || GetBE(&compressed[adler]) != Adler32(&filtered[0], filtered.size()))
+        {
+            return "the Adler-32 is wrong";
+        }
+        return nullptr;
+    }
+
+    const char* CheckBMP(const std::vector<unsigned char>& file, const std::vector<unsigned char>& frame,
+                         int width, int height)
+    {
+        int row_size = width * 3;
+        int stride = (row_size + 3) & ~3;
+        size_t size = 54 + static_cast<size_t>(stride) * height;
+        if (file.size() != size || file[0] != 'B' || file[1] != 'M' || GetLE(&file[2], 4) != size
+            || GetLE(&file[10], 4) != 54 || GetLE(&file[14], 4) != 40
+            || static_cast<int>(GetLE(&file[18], 4)) != width || static_cast<int>(GetLE(&file[22], 4)) != height
+            || GetLE(&file[26], 2) != 1 || GetLE(&file[28], 2) != 24 || GetLE(&file[30], 4) != 0)
+        {
+            return "the BMP header is wrong";
+        }
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char* row = &file[54 + static_cast<size_t>(stride) * y];
+            if (memcmp(row, &frame[static_cast<size_t>(row_size) * y], row_size) != 0)
+            {
+                return "the BMP pixels don't match the frame";
+            }
+            for (int i = row_size; i < stride; i++)
+            {
+                if (row[i] != 0)
+                {
+                    return "the BMP row padding isn't zero";
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    const char* CheckTGA(const std::vector<unsigned char>& file, const std::vector<unsigned char>& frame,
+                         int width, int height)
+    {
+        static const char FOOTER[] = "TRUEVISION-XFILE.";
+        size_t image_size = frame.size();
+        if (file.size() != 18 + image_size + 8 + sizeof(FOOTER) || file[0] != 0 || file[1] != 0 || file[2] != 2
+            || static_cast<int>(GetLE(&file[12], 2)) != width || static_cast<int>(GetLE(&file[14], 2)) != height
+            || file[16] != 24 || file[17] != 0)
+        {
+            return "the TGA header is wrong";
+        }
+        if (memcmp(&file[18], &frame[0], image_size) != 0)
+        {
+            return "the TGA pixels don't match the frame";
+        }
+        if (GetLE(&file[18 + image_size], 4) != 0 || GetLE(&file[22 + image_size], 4) != 0
+            || memcmp(&file[26 + image_size], FOOTER, sizeof(FOOTER)) != 0)
+        {
+            return "the TGA footer is wrong";
+        }
+        return nullptr;
+    }
+
+    bool CheckFileNames()
+    {
+        struct NameCase
+        {
+            const char* name;
+            bool known;
+            ImageFormat format;
+        };
+        static const NameCase CASES[] =
+        {
+            { "capture.png", true, IMAGE_FORMAT_PNG },
+            { "C:\\movies\\run.v2.PNG", true, IMAGE_FORMAT_PNG },
+            { "frames.Bmp", true, IMAGE_FORMAT_BMP },
+            { "x.tga", true, IMAGE_FORMAT_TGA },
+            { "capture.avi", false, IMAGE_FORMAT_PNG },
+            { "capture.pngx", false, IMAGE_FORMAT_PNG },
+            { "capture.pn", false, IMAGE_FORMAT_PNG },
+            { "png", false, IMAGE_FORMAT_PNG },
+        };
+        bool ok = true;
+        for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+        {
+            ImageFormat format = IMAGE_FORMAT_PNG;
+            bool known = GetImageFormat(CASES[i].name, &format);
+            if (known != CASES[i].known || (known && format != CASES[i].format))
+            {
+                printf("%s: the image format is wrong\n", CASES[i].name);
+                ok = false;
+            }
+        }
+        if (strcmp(GetImageExtension(IMAGE_FORMAT_PNG), ".png") != 0 || strcmp(GetImageExtension(IMAGE_FORMAT_BMP), ".bmp") != 0
+            || strcmp(GetImageExtension(IMAGE_FORMAT_TGA), ".tga") != 0)
+        {
+            printf("the extensions are wrong\n");
+            ok = false;
+        }
+        return ok;
+    }
+
+    int RunChecks()
+    {
+        static const int SIZES[][2] =
+        {
+            { 1, 1 }, { 2, 3 }, { 3, 1 }, { 5, 7 }, { 31, 17 }, { 64, 64 }, { 161, 99 }, { 320, 240 }, { 641, 480 },
+        };
+        const int size_count = sizeof(SIZES) / sizeof(SIZES[0]);
+        /*
+         * The encoders are reused from one frame to the next, like the capture's workers do.
+         */
+        ImageEncoder png(IMAGE_FORMAT_PNG);
+        ImageEncoder bmp(IMAGE_FORMAT_BMP);
+        ImageEncoder tga(IMAGE_FORMAT_TGA);
+        std::vector<unsigned char> frame;
+        std::vector<unsigned char> file;
+        std::vector<unsigned char> again;
+        int passed = 0;
+        int count = 0;
+        int stored_blocks = 0;
+        int dynamic_blocks = 0;
+        for (int i = 0; i < size_count; i++)
+        {
+            int width = SIZES[i][0];
+            int height = SIZES[i][1];
+            for (int kind = 0; kind < FRAME_KIND_COUNT; kind++)
+            {
+                MakeFrame(static_cast<FrameKind>(kind), width, height, &frame);
+                count++;
+                png.Encode(&frame[0], width, height, &file);
+                const char* problem = CheckPNG(file, frame, width, height, &stored_blocks, &dynamic_blocks);
+                size_t png_size = file.size();
+                if (problem == nullptr)
+                {
+                    png.Encode(&frame[0], width, height, &again);
+                    if (again != file)
+                    {
+                        problem = "encoding the frame again gives a different PNG";
+                    }
+                }
+                if (problem == nullptr)
+                {
+                    bmp.Encode(&frame[0], width, height, &file);
+                    problem = CheckBMP(file, frame, width, height);
+                }
+                if (problem == nullptr)
+                {
+                    tga.Encode(&frame[0], width, height, &file);
+                    problem = CheckTGA(file, frame, width, height);
+                }
+                if (problem != nullptr)
+                {
+                    printf("%dx%d %s frame: %s\n", width, height, FRAME_KIND_NAMES[kind], problem);
+                    continue;
+                }
+                if (width == 320)
+                {
+                    printf("%dx%d %s frame: PNG is %.1f%% of the raw size\n", width, height, FRAME_KIND_NAMES[kind],
+                           100.0 * png_size / frame.size());
+                }
+                passed++;
+            }
+        }
+        /*
+         * Noise doesn't compress, so its blocks have to have been stored, and the rest compressed.
+         */
+        if (stored_blocks == 0 || dynamic_blocks == 0)
+        {
+            printf("%d stored and %d compressed deflate blocks, expected both\n", stored_blocks, dynamic_blocks);
+            passed--;
+        }
+        bool names = CheckFileNames();
+        printf("%d of %d frames encoded correctly, file names %s\n", passed, count, names ? "passed" : "FAILED");
+        return passed == count && names ? 0 : 1;
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    int RunBenchmark(int frames)
+    {
+        static const ImageFormat FORMATS[] = { IMAGE_FORMAT_PNG, IMAGE_FORMAT_BMP, IMAGE_FORMAT_TGA };
+        std::vector<unsigned char> frame;
+        std::vector<unsigned char> file;
+        for (int kind = 0; kind < FRAME_KIND_COUNT; kind++)
+        {
+            MakeFrame(static_cast<FrameKind>(kind), BENCH_WIDTH, BENCH_HEIGHT, &frame);
+            for (size_t i = 0; i < sizeof(FORMATS) / sizeof(FORMATS[0]); i++)
+            {
+                ImageEncoder encoder(FORMATS[i]);
+                size_t bytes = 0;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (int index = 0; index < frames; index++)
+                {
+                    encoder.Encode(&frame[0], BENCH_WIDTH, BENCH_HEIGHT, &file);
+                    bytes += file.size();
+                }
+                double seconds = Seconds(start);
+                printf("%dx%d %-8s %s: %7.1f frames/s, %5.1f%% of the raw size\n", BENCH_WIDTH, BENCH_HEIGHT,
+                       FRAME_KIND_NAMES[kind], GetImageExtension(FORMATS[i]) + 1, frames / seconds,
+                       100.0 * bytes / (static_cast<double>(frame.size()) * frames));
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        return RunChecks();
+    }
+    if (strcmp(argv[1], "bench") == 0 && argc <= 3)
+    {
+        int frames = argc == 3 ? atoi(argv[2]) : BENCH_FRAMES;
+        return RunBenchmark(frames > 0 ? frames : BENCH_FRAMES);
+    }
+    fprintf(stderr, "usage: %s [bench [frames]]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,560 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Round-trip tests for the built-in lossless codec (losslesscodec.h) and hglc2avi.
+ *
+ *     losslesstest                        encodes and decodes generated frames of many sizes
+ *     losslesstest avi capture.avi        writes generated frames as an HGLC AVI, with audio
+ *     losslesstest checkavi decoded.avi   checks what hglc2avi made of that file
+ *     losslesstest checkraw decoded.bgr   checks the raw frames hglc2avi wrote for that file
+ *
+ * The frames look like what games draw: flat colors, sprites moving over them, gradients, noise,
+ * and frames that don't change at all. Build and run it with "make check" in this directory.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../losslesscodec.h"
+
+namespace
+{
+    const int AVI_WIDTH = 200;
+    const int AVI_HEIGHT = 150;
+    const int AVI_FRAMES = 40;
+    const int AVI_KEYFRAME_INTERVAL = 15;
+    const unsigned int AUDIO_BYTES = 735 * 4;
+
+    unsigned int s_random = 1;
+
+    unsigned int NextRandom()
+    {
+        s_random = s_random * 1103515245 + 12345;
+        return s_random >> 8;
+    }
+
+    /*
+     * Changes frame into the next one, depending on what kind of frame index is.
+     */
+    void NextFrame(std::vector<unsigned char>* frame, int width, int height, int index)
+    {
+        unsigned char* pixels = &(*frame)[0];
+        size_t size = frame->size();
+        switch (index % 5)
+        {
+        case 0:
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    unsigned char* pixel = pixels + (y * width + x) * 3;
+                    unsigned int color = ((x / 8 + y / 8 + index) % 4) * 50;
+                    pixel[0] = static_cast<unsigned char>(color);
+                    pixel[1] = static_cast<unsigned char>(color / 2);
+                    pixel[2] = static_cast<unsigned char>(255 - color);
+                }
+            }
+            break;
+        case 1:
+        {
+            int left = NextRandom() % width;
+            int top = NextRandom() % height;
+            for (int y = top; y < height && y < top + 20; y++)
+            {
+                for (int x = left; x < width && x < left + 20; x++)
+                {
+                    pixels[(y * width + x) * 3 + NextRandom() % 3] ^= 0x55;
+                }
+            }
+            break;
+        }
+        case 2:
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    unsigned char* pixel = pixels + (y * width + x) * 3;
+                    pixel[0] = static_cast<unsigned char>(x * 255 / width);
+                    pixel[1] = static_cast<unsigned char>(y * 255 / height);
+                    pixel[2] = static_cast<unsigned char>(x + y + index);
+                }
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < size / 4; i++)
+            {
+                pixels[NextRandom() % size] = static_cast<unsigned char>(NextRandom());
+            }
+            break;
+        default:
+            /* Unchanged. */
+            break;
+        }
+    }
+
+    bool TestSize(int width, int height)
+    {
+        const int keyframe_interval = 7;
+        size_t size = static_cast<size_t>(width) * height * 3;
+        LosslessEncoder encoder(width, height, keyframe_interval);
+        LosslessEncoder tiled_encoder(width, height, keyframe_interval);
+        LosslessDecoder decoder(width, height);
+        std::vector<unsigned char> frame(size);
+        std::vector<unsigned char> decoded(size);
+        int frames = (width * height > 1000000) ? 10 : 30;
+        size_t total = 0;
+        for (int index = 0; index < frames; index++)
+        {
+            NextFrame(&frame, width, height, index);
+
+            unsigned int encoded_size = 0;
+            bool keyframe = false;
+            const unsigned char* encoded = encoder.EncodeFrame(&frame[0], &encoded_size, &keyframe);
+            std::vector<unsigned char> data(encoded, encoded + encoded_size);
+
+            /* Tiles encoded out of order have to give the same bytes. */
+            tiled_encoder.BeginFrame(&frame[0]);
+            for (int tile = tiled_encoder.GetTileCount() - 1; tile >= 0; tile--)
+            {
+                tiled_encoder.EncodeTile(tile);
+            }
+            unsigned int tiled_size = 0;
+            bool tiled_keyframe = false;
+            const unsigned char* tiled = tiled_encoder.FinishFrame(&tiled_size, &tiled_keyframe);
+            if (tiled_size != encoded_size || memcmp(tiled, &data[0], encoded_size) != 0
+                || tiled_keyframe != keyframe)
+            {
+                printf("%dx%d frame %d: encoding tile by tile gives different data\n", width, height, index);
+                return false;
+            }
+
+            if (keyframe != (index % keyframe_interval == 0))
+            {
+                printf("%dx%d frame %d: keyframe is %d\n", width, height, index, keyframe);
+                return false;
+            }
+            if (!decoder.DecodeFrame(&data[0], encoded_size, &decoded[0]) || decoded != frame)
+            {
+                printf("%dx%d frame %d: doesn't decode to the same pixels\n", width, height, index);
+                return false;
+            }
+            total += encoded_size;
+
+            if (index == 3)
+            {
+                /* Damaged or cut off data has to be refused or decoded to anything, without crashing. */
+                for (int i = 0; i < 50; i++)
+                {
+                    std::vector<unsigned char> damaged = data;
+                    damaged[NextRandom() % damaged.size()] ^= static_cast<unsigned char>(1 << (NextRandom() % 8));
+                    LosslessDecoder other(width, height);
+                    other.DecodeFrame(&damaged[0], static_cast<unsigned int>(damaged.size()), &decoded[0]);
+                }
+                for (size_t length = 0; length < data.size(); length += data.size() / 20 + 1)
+                {
+                    LosslessDecoder other(width, height);
+                    if (other.DecodeFrame(&data[0], static_cast<unsigned int>(length), &decoded[0]) && length != 0)
+                    {
+                        printf("%dx%d frame %d: decoded with only %u bytes\n", width, height, index,
+                               static_cast<unsigned int>(length));
+                        return false;
+                    }
+                }
+            }
+        }
+
+        /* An empty frame repeats the last one. */
+        if (!decoder.DecodeFrame(nullptr, 0, &decoded[0]) || decoded != frame)
+        {
+            printf("%dx%d: an empty frame doesn't repeat the last one\n", width, height);
+            return false;
+        }
+        printf("%dx%d: %.1f%% of the raw size\n", width, height, 100.0 * total / (static_cast<double>(size) * frames));
+        return true;
+    }
+
+    int TestCodec()
+    {
+        static const int sizes[][2] =
+        {
+            { 1, 1 }, { 3, 5 }, { 64, 64 }, { 65, 63 }, { 320, 240 }, { 257, 191 }, { 1920, 1080 },
+        };
+        int passed = 0;
+        int count = sizeof(sizes) / sizeof(sizes[0]);
+        for (int i = 0; i < count; i++)
+        {
+            passed += TestSize(sizes[i][0], sizes[i][1]) ? 1 : 0;
+        }
+
+        LosslessDecoder decoder(2, 2);
+        unsigned char pixels[12];
+        if (decoder.DecodeFrame(nullptr, 0, pixels))
+        {
+            printf("an empty first frame was decoded\n");
+            return 1;
+        }
+        printf("%d of %d frame sizes round-tripped\n", passed, count);
+        return passed == count ? 0 : 1;
+    }
+
+    /*
+     * The frames the AVI tests use, the same every time. Every sixth frame repeats the one before.
+     */
+    bool IsRepeat(int index)
+    {
+        return index % 6 == 5;
+    }
+
+    std::vector<std::vector<unsigned char> > GenerateAVIFrames()
+    {
+        s_random = 1;
+        std::vector<std::vector<unsigned char> > frames(AVI_FRAMES);
+        std::vector<unsigned char> frame(AVI_WIDTH * AVI_HEIGHT * 3);
+        for (int index = 0; index < AVI_FRAMES; index++)
+        {
+            if (!IsRepeat(index))
+            {
+                NextFrame(&frame, AVI_WIDTH, AVI_HEIGHT, index);
+            }
+            frames[index] = frame;
+        }
+        return frames;
+    }
+
+    std::vector<unsigned char> GenerateAudio(int index)
+    {
+        std::vector<unsigned char> audio(AUDIO_BYTES);
+        for (unsigned int i = 0; i < audio.size(); i++)
+        {
+            audio[i] = static_cast<unsigned char>(index * 7 + i);
+        }
+        return audio;
+    }
+
+    void Put(std::vector<unsigned char>* data, unsigned int value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            data->push_back(static_cast<unsigned char>(value >> (i * 8)));
+        }
+    }
+
+    void Put(std::vector<unsigned char>* data, const char* fourcc)
+    {
+        data->insert(data->end(), fourcc, fourcc + 4);
+    }
+
+    unsigned int Get(const std::vector<unsigned char>& data, size_t position)
+    {
+        return data[position] | (data[position + 1] << 8) | (data[position + 2] << 16)
+               | (static_cast<unsigned int>(data[position + 3]) << 24);
+    }
+
+    void PutChunk(std::vector<unsigned char>* data, const char* id, const std::vector<unsigned char>& contents)
+    {
+        Put(data, id);
+        Put(data, static_cast<unsigned int>(contents.size()));
+        data->insert(data->end(), contents.begin(), contents.end());
+        if (contents.size() & 1)
+        {
+            data->push_back(0);
+        }
+    }
+
+    void PutList(std::vector<unsigned char>* data, const char* type, const std::vector<unsigned char>& contents)
+    {
+        std::vector<unsigned char> list;
+        Put(&list, type);
+        list.insert(list.end(), contents.begin(), contents.end());
+        PutChunk(data, "LIST", list);
+    }
+
+    std::vector<unsigned char> StreamHeader(const char* type, const char* handler, unsigned int scale,
+                                            unsigned int rate, unsigned int length, unsigned int sample_size)
+    {
+        std::vector<unsigned char> header;
+        Put(&header, type);
+        Put(&header, handler);
+        Put(&header, 0u);
+        Put(&header, 0u);
+        Put(&header, 0u);
+        Put(&header, scale);
+        Put(&header, rate);
+        Put(&header, 0u);
+        Put(&header, length);
+        Put(&header, 0u);
+        Put(&header, 0xFFFFFFFFu);
+        Put(&header, sample_size);
+        Put(&header, 0u);
+        Put(&header, static_cast<unsigned int>(AVI_WIDTH | (AVI_HEIGHT << 16)));
+        return header;
+    }
+
+    /*
+     * Writes an AVI laid out like the ones AVIFile writes for the lossless codec.
+     */
+    int WriteAVI(const char* filename)
+    {
+        std::vector<std::vector<unsigned char> > frames = GenerateAVIFrames();
+
+        std::vector<unsigned char> main_header;
+        Put(&main_header, 1000000u / 60);
+        Put(&main_header, 0u);
+        Put(&main_header, 0u);
+        Put(&main_header, 0x10u);
+        Put(&main_header, static_cast<unsigned int>(AVI_FRAMES));
+        Put(&main_header, 0u);
+        Put(&main_header, 2u);
+        Put(&main_header, 0u);
+        Put(&main_header, static_cast<unsigned int>(AVI_WIDTH));
+        Put(&main_header, static_cast<unsigned int>(AVI_HEIGHT));
+        for (int i = 0; i < 4; i++)
+        {
+            Put(&main_header, 0u);
+        }
+
+        std::vector<unsigned char> video_format;
+        Put(&video_format, 40u);
+        Put(&video_format, static_cast<unsigned int>(AVI_WIDTH));
+        Put(&video_format, static_cast<unsigned int>(AVI_HEIGHT));
+        Put(&video_format, 1u | (24u << 16));
+        Put(&video_format, LosslessEncoder::FOURCC);
+        Put(&video_format, static_cast<unsigned int>(AVI_WIDTH * AVI_HEIGHT * 3));
+        for (int i = 0; i < 4; i++)
+        {
+            Put(&video_format, 0u);
+        }
+        std::vector<unsigned char> video_list;
+        PutChunk(&video_list, "strh", StreamHeader("vids", "HGLC", 1, 60, AVI_FRAMES, 0));
+        PutChunk(&video_list, "strf", video_format);
+
+        std::vector<unsigned char> audio_format;
+        Put(&audio_format, 1u | (2u << 16));
+        Put(&audio_format, 44100u);
+        Put(&audio_format, 44100u * 4);
+        Put(&audio_format, 4u | (16u << 16));
+        std::vector<unsigned char> audio_list;
+        PutChunk(&audio_list, "strh", StreamHeader("auds", "\0\0\0\0", 1, 44100, AVI_FRAMES * AUDIO_BYTES / 4, 4));
+        PutChunk(&audio_list, "strf", audio_format);
+
+        std::vector<unsigned char> header_list;
+        PutChunk(&header_list, "avih", main_header);
+        PutList(&header_list, "strl", video_list);
+        PutList(&header_list, "strl", audio_list);
+
+        std::vector<unsigned char> movie;
+        std::vector<unsigned char> index;
+        LosslessEncoder encoder(AVI_WIDTH, AVI_HEIGHT, AVI_KEYFRAME_INTERVAL);
+        for (int i = 0; i < AVI_FRAMES; i++)
+        {
+            std::vector<unsigned char> data;
+            bool keyframe = false;
+            if (!IsRepeat(i))
+            {
+                unsigned int size = 0;
+                const unsigned char* encoded = encoder.EncodeFrame(&frames[i][0], &size, &keyframe);
+                data.assign(encoded, encoded + size);
+            }
+            Put(&index, "00dc");
+            Put(&index, keyframe ? 0x10u : 0u);
+            Put(&index, static_cast<unsigned int>(movie.size() + 4));
+            Put(&index, static_cast<unsigned int>(data.size()));
+            PutChunk(&movie, "00dc", data);
+
+            /* Every other audio chunk goes in a "rec " list, hglc2avi has to flatten those. */
+            std::vector<unsigned char> audio = GenerateAudio(i);
+            Put(&index, "01wb");
+            Put(&index, 0x10u);
+            Put(&index, static_cast<unsigned int>(movie.size() + 4 + ((i & 1) ? 12 : 0)));
+            Put(&index, static_cast<unsigned int>(audio.size()));
+            if (i & 1)
+            {
+                std::vector<unsigned char> record;
+                PutChunk(&record, "01wb", audio);
+                PutList(&movie, "rec ", record);
+            }
+            else
+            {
+                PutChunk(&movie, "01wb", audio);
+            }
+        }
+
+        std::vector<unsigned char> riff;
+        PutList(&riff, "hdrl", header_list);
+        PutChunk(&riff, "JUNK", std::vector<unsigned char>(100));
+        PutList(&riff, "movi", movie);
+        PutChunk(&riff, "idx1", index);
+        std::vector<unsigned char> file;
+        Put(&file, "RIFF");
+        Put(&file, static_cast<unsigned int>(riff.size() + 4));
+        Put(&file, "AVI ");
+        file.insert(file.end(), riff.begin(), riff.end());
+
+        FILE* output = fopen(filename, "wb");
+        if (output == nullptr || fwrite(&file[0], file.size(), 1, output) != 1 || fclose(output) != 0)
+        {
+            printf("can't write %s\n", filename);
+            return 1;
+        }
+        return 0;
+    }
+
+    bool ReadFile(const char* filename, std::vector<unsigned char>* data)
+    {
+        FILE* input = fopen(filename, "rb");
+        if (input == nullptr)
+        {
+            printf("can't open %s\n", filename);
+            return false;
+        }
+        unsigned char buffer[65536];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), input)) > 0)
+        {
+            data->insert(data->end(), buffer, buffer + count);
+        }
+        fclose(input);
+        return true;
+    }
+
+    /*
+     * Returns the position of the data of the first chunk or list of the given kind, or 0.
+     */
+    size_t FindChunk(const std::vector<unsigned char>& data, size_t start, size_t end, const char* id,
+                     const char* list_type)
+    {
+        for (size_t position = start; position + 8 <= end;)
+        {
+            unsigned int size = Get(data, position + 4);
+            if (memcmp(&data[position], id, 4) == 0
+                && (list_type == nullptr || (size >= 4 && memcmp(&data[position + 8], list_type, 4) == 0)))
+            {
+                return position + 8;
+            }
+            position += 8 + size + (size & 1);
+        }
+        return 0;
+    }
+
+    int CheckAVI(const char* filename)
+    {
+        std::vector<unsigned char> data;
+        if (!ReadFile(filename, &data))
+        {
+            return 1;
+        }
+        if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0 || Get(data, 4) != data.size() - 8
+            || memcmp(&data[8], "AVI ", 4) != 0)
+        {
+            printf("%s: the RIFF header is wrong\n", filename);
+            return 1;
+        }
+        size_t header_list = FindChunk(data, 12, data.size(), "LIST", "hdrl");
+        size_t movie = FindChunk(data, 12, data.size(), "LIST", "movi");
+        size_t index = FindChunk(data, 12, data.size(), "idx1", nullptr);
+        if (header_list == 0 || movie == 0 || index == 0 || FindChunk(data, 12, data.size(), "JUNK", nullptr) == 0)
+        {
+            printf("%s: a top-level chunk is missing\n", filename);
+            return 1;
+        }
+        size_t video_list = FindChunk(data, header_list + 4, header_list + Get(data, header_list - 4), "LIST", "strl");
+        size_t stream_header = video_list + 4 + 8;
+        size_t format = FindChunk(data, video_list + 4, video_list + Get(data, video_list - 4), "strf", nullptr);
+        if (memcmp(&data[stream_header + 4], "DIB ", 4) != 0 || Get(data, format + 16) != 0
+            || Get(data, format + 20) != AVI_WIDTH * AVI_HEIGHT * 3)
+        {
+            printf("%s: the video stream isn't uncompressed\n", filename);
+            return 1;
+        }
+
+        std::vector<std::vector<unsigned char> > frames = GenerateAVIFrames();
+        unsigned int index_size = Get(data, index - 4);
+        if (index_size != AVI_FRAMES * 2 * 16)
+        {
+            printf("%s: the index has %u entries\n", filename, index_size / 16);
+            return 1;
+        }
+        for (int i = 0; i < AVI_FRAMES * 2; i++)
+        {
+            size_t entry = index + i * 16;
+            size_t chunk = movie + Get(data, entry + 8);
+            unsigned int size = Get(data, entry + 12);
+            bool video = (i % 2) == 0;
+            int frame = i / 2;
+            if (chunk + 8 + size > data.size() || memcmp(&data[chunk], &data[entry], 4) != 0
+                || Get(data, chunk + 4) != size || memcmp(&data[entry], video ? "00db" : "01wb", 4) != 0)
+            {
+                printf("%s: index entry %d doesn't match its chunk\n", filename, i);
+                return 1;
+            }
+            std::vector<unsigned char> contents(data.begin() + chunk + 8, data.begin() + chunk + 8 + size);
+            bool matches;
+            if (!video)
+            {
+                matches = contents == GenerateAudio(frame);
+            }
+            else if (IsRepeat(frame))
+            {
+                /* Repeats stay empty frames. */
+                matches = contents.empty() && Get(data, entry + 4) == 0;
+            }
+            else
+            {
+                matches = contents == frames[frame] && Get(data, entry + 4) == 0x10;
+            }
+            if (!matches)
+            {
+                printf("%s: %s chunk %d is wrong\n", filename, video ? "video" : "audio", frame);
+                return 1;
+            }
+        }
+        printf("%s: %d frames and their audio match\n", filename, AVI_FRAMES);
+        return 0;
+    }
+
+    int CheckRaw(const char* filename)
+    {
+        std::vector<unsigned char> data;
+        if (!ReadFile(filename, &data))
+        {
+            return 1;
+        }
+        std::vector<std::vector<unsigned char> > frames = GenerateAVIFrames();
+        std::vector<unsigned char> expected;
+        for (int i = 0; i < AVI_FRAMES; i++)
+        {
+            expected.insert(expected.end(), frames[i].begin(), frames[i].end());
+        }
+        if (data != expected)
+        {
+            printf("%s: the raw frames don't match\n", filename);
+            return 1;
+        }
+        printf("%s: %d raw frames match\n", filename, AVI_FRAMES);
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        return TestCodec();
+    }
+    if (argc == 3 && strcmp(argv[1], "avi") == 0)
+    {
+        return WriteAVI(argv[2]);
+    }
+    if (argc == 3 && strcmp(argv[1], "checkavi") == 0)
+    {
+        return CheckAVI(argv[2]);
+    }
+    if (argc == 3 && strcmp(argv[1], "checkraw") == 0)
+    {
+        return CheckRaw(argv[2]);
+    }
+    fprintf(stderr, "usage: %s [avi capture.avi | checkavi decoded.avi | checkraw decoded.bgr]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,514 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests for PcmConverter (pcmconvert.h), and a WAV converter built on it.
+ *
+ *     pcmconverttest [directory]            runs the tests, the WAV fixtures go in directory
+ *     pcmconverttest convert in.wav out.wav rate channels bits
+ *
+ * The tests write a few fixtures as WAV files (tones, a sweep and noise, in different sample
+ * sizes, channel counts and rates), read them back, convert each one to a set of formats and
+ * write the results as WAV files too, which can be listened to. Every result has to:
+ *  - hash to the golden value below, so any change to the output is noticed,
+ *  - be the same with the SSE2 and plain resamplers, and however the input is split up.
+ * A 1 kHz tone also has to come through every pair of common rates at 60 dB SNR or better, and
+ * a tone above the new Nyquist frequency has to be filtered out.
+ *
+ * If the output changes on purpose, the new hashes are printed and go in GOLDEN_HASHES. Build
+ * and run it with "make check" in this directory.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../pcmconvert.h"
+
+namespace
+{
+    const double PI = 3.14159265358979323846;
+
+    struct Fixture
+    {
+        const char* name;
+        PcmFormat format;
+    };
+
+    const Fixture FIXTURES[] =
+    {
+        { "tone-44100-2-16", { 2, 44100, 16 } },
+        { "sweep-48000-1-16", { 1, 48000, 16 } },
+        { "noise-22050-1-8", { 1, 22050, 8 } },
+        { "tone-96000-2-24", { 2, 96000, 24 } },
+        { "sweep-32000-2-32", { 2, 32000, 32 } },
+    };
+    const int FIXTURE_COUNT = sizeof(FIXTURES) / sizeof(FIXTURES[0]);
+
+    const PcmFormat TARGETS[] =
+    {
+        { 2, 44100, 16 },
+        { 2, 48000, 16 },
+        { 1, 22050, 16 },
+        { 1, 32000, 8 },
+        { 2, 96000, 24 },
+        { 1, 8000, 16 },
+    };
+    const int TARGET_COUNT = sizeof(TARGETS) / sizeof(TARGETS[0]);
+
+    /*
+     * FNV-1a of each converted WAV file, fixtures in order, each with all the targets in order.
+     */
+    const unsigned long long GOLDEN_HASHES[FIXTURE_COUNT * TARGET_COUNT] =
+    {
+        0x765B8D09D72F58C6ull, 0x004DE7F14FDCD056ull, 0xBB16BAB0C7FA37BFull, 0xB7202235F950BD18ull, 0x8397469FEF8C1A02ull, 0x6492DA03EB061C2Full,
+        0x6B04B2ADD6C6A37Aull, 0x4006E553F9DD3326ull, 0x3382BBCA14B3F755ull, 0xF7D5D2C7CF82E26Dull, 0x6C7D672B2D044777ull, 0x955E7985F342F2A0ull,
+        0x425518D53534FDD2ull, 0x676B5B5E37F8E2C6ull, 0xD9953F0D0491D57Dull, 0x3665AD9E4C28BD1Bull, 0xCB435BECF513A8E5ull, 0x5968D4B88D14F12Bull,
+        0x6A6EEB046B9B1F8Bull, 0xB883BE5687488CDFull, 0x83E92DEA69E76CB4ull, 0x767531565F478F4Aull, 0x4494B3BBBE0E1CA3ull, 0x64022964D114E969ull,
+        0xDDC0425152E56553ull, 0x6787DB9180217807ull, 0x6F7B47197ED2C5ADull, 0xB3A24A3A73D1E622ull, 0x143DF6FE08B308B0ull, 0x2391227D7003D44Dull,
+    };
+
+    unsigned long long Hash(const std::vector<unsigned char>& data)
+    {
+        unsigned long long hash = 0xCBF29CE484222325ull;
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            hash = (hash ^ data[i]) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    int FrameSize(const PcmFormat& format)
+    {
+        return format.channels * format.bits_per_sample / 8;
+    }
+
+    /*
+     * Stores a sample in [-1, 1] in the format's sample size.
+     */
+    void PutSample(double value, int bits, std::vector<unsigned char>* data)
+    {
+        if (bits == 8)
+        {
+            data->push_back(static_cast<unsigned char>(128 + static_cast<int>(floor(value * 127 + 0.5))));
+            return;
+        }
+        long long scaled = static_cast<long long>(floor(value * ((1ll << (bits - 1)) - 1) + 0.5));
+        for (int i = 0; i < bits / 8; i++)
+        {
+            data->push_back(static_cast<unsigned char>(scaled >> (i * 8)));
+        }
+    }
+
+    int GetSample16(const std::vector<unsigned char>& data, size_t frame, int channels, int channel)
+    {
+        size_t position = (frame * channels + channel) * 2;
+        return static_cast<short>(data[position] | (data[position + 1] << 8));
+    }
+
+    /*
+     * One second of the fixture's signal.
+     */
+    std::vector<unsigned char> GenerateFixture(const Fixture& fixture)
+    {
+        const PcmFormat& format = fixture.format;
+        std::vector<unsigned char> data;
+        unsigned int random = 1;
+        for (int i = 0; i < format.samples_per_second; i++)
+        {
+            double t = static_cast<double>(i) / format.samples_per_second;
+            for (int channel = 0; channel < format.channels; channel++)
+            {
+                double value;
+                if (strncmp(fixture.name, "tone", 4) == 0)
+                {
+                    value = 0.5 * sin(2 * PI * (channel == 0 ? 1000 : 440) * t);
+                }
+                else if (strncmp(fixture.name, "sweep", 5) == 0)
+                {
+                    /* Exponential from 20 Hz to 20 kHz, or as high as the rate allows. */
+                    double top = format.samples_per_second / 2.0 < 20000 ? format.samples_per_second / 2.0 : 20000;
+                    double rate = log(top / 20);
+                    value = 0.5 * sin(2 * PI * 20 * (exp(rate * t) - 1) / rate + channel);
+                }
+                else
+                {
+                    random = random * 1103515245 + 12345;
+                    value = ((random >> 8) & 0xFFFF) / 32768.0 - 1;
+                    value *= 0.5;
+                }
+                PutSample(value, format.bits_per_sample, &data);
+            }
+        }
+        return data;
+    }
+
+    void PutLE(unsigned int value, int bytes, std::vector<unsigned char>* data)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            data->push_back(static_cast<unsigned char>(value >> (i * 8)));
+        }
+    }
+
+    void PutTag(const char* tag, std::vector<unsigned char>* data)
+    {
+        for (const char* c = tag; *c != '\0'; c++)
+        {
+            data->push_back(static_cast<unsigned char>(*c));
+        }
+    }
+
+    unsigned int GetLE(const unsigned char* data, int bytes)
+    {
+        unsigned int value = 0;
+        for (int i = 0; i < bytes; i++)
+        {
+            value |= static_cast<unsigned int>(data[i]) << (i * 8);
+        }
+        return value;
+    }
+
+    std::vector<unsigned char> MakeWav(const PcmFormat& format, const std::vector<unsigned char>& samples)
+    {
+        std::vector<unsigned char> wav;
+        PutTag("RIFF", &wav);
+        PutLE(static_cast<unsigned int>(36 + samples.size()), 4, &wav);
+        PutTag("WAVEfmt ", &wav);
+        PutLE(16, 4, &wav);
+        PutLE(1, 2, &wav);
+        PutLE(format.channels, 2, &wav);
+        PutLE(format.samples_per_second, 4, &wav);
+        PutLE(format.samples_per_second * FrameSize(format), 4, &wav);
+        PutLE(FrameSize(format), 2, &wav);
+        PutLE(format.bits_per_sample, 2, &wav);
+        PutTag("data", &wav);
+        PutLE(static_cast<unsigned int>(samples.size()), 4, &wav);
+        wav.insert(wav.end(), samples.begin(), samples.end());
+        return wav;
+    }
+
+    bool WriteFile(const std::string& filename, const std::vector<unsigned char>& data)
+    {
+        FILE* file = fopen(filename.c_str(), "wb");
+        bool ok = file != nullptr && (data.empty() || fwrite(&data[0], data.size(), 1, file) == 1);
+        if (file != nullptr && fclose(file) != 0)
+        {
+            ok = false;
+        }
+        if (!ok)
+        {
+            printf("can't write %s\n", filename.c_str());
+        }
+        return ok;
+    }
+
+    /*
+     * Reads a PCM WAV file, skipping any chunks other than the format and the data.
+     */
+    bool ReadWav(const std::string& filename, PcmFormat* format, std::vector<unsigned char>* samples)
+    {
+        std::vector<unsigned char> data;
+        FILE* file = fopen(filename.c_str(), "rb");
+        if (file == nullptr)
+        {
+            printf("can't open %s\n", filename.c_str());
+            return false;
+        }
+        unsigned char buffer[65536];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            data.insert(data.end(), buffer, buffer + count);
+        }
+        fclose(file);
+
+        bool has_format = false;
+        if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0 || memcmp(&data[8], "WAVE", 4) != 0)
+        {
+            printf("%s isn't a WAV file\n", filename.c_str());
+            return false;
+        }
+        for (size_t position = 12; position + 8 <= data.size();)
+        {
+            unsigned int size = GetLE(&data[position + 4], 4);
+            if (size > data.size() - position - 8)
+            {
+                size = static_cast<unsigned int>(data.size() - position - 8);
+            }
+            const unsigned char* contents = &data[position + 8];
+            if (memcmp(&data[position], "fmt ", 4) == 0 && size >= 16 && GetLE(contents, 2) == 1)
+            {
+                format->channels = GetLE(contents + 2, 2);
+                format->samples_per_second = GetLE(contents + 4, 4);
+                format->bits_per_sample = GetLE(contents + 14, 2);
+                has_format = PcmConverter::IsSupported(*format);
+            }
+            else if (memcmp(&data[position], "data", 4) == 0 && has_format)
+            {
+                samples->assign(contents, contents + size / FrameSize(*format) * FrameSize(*format));
+                return true;
+            }
+            position += 8 + size + (size & 1);
+        }
+        printf("%s isn't a PCM WAV file in a supported format\n", filename.c_str());
+        return false;
+    }
+
+    /*
+     * Converts all of input, split in random pieces of up to max_piece frames, or in one if 0.
+     */
+    std::vector<unsigned char> Convert(const PcmFormat& from, const PcmFormat& to, bool use_sse2,
+                                       const std::vector<unsigned char>& input, unsigned int max_piece)
+    {
+        PcmConverter converter(from, to, use_sse2);
+        std::vector<unsigned char> output;
+        unsigned int frame_size = FrameSize(from);
+        unsigned int random = max_piece;
+        for (size_t position = 0; position < input.size();)
+        {
+            size_t size = input.size() - position;
+            if (max_piece != 0)
+            {
+                random = random * 1103515245 + 12345;
+                size_t piece = ((random >> 8) % max_piece + 1) * frame_size;
+                if (piece < size)
+                {
+                    size = piece;
+                }
+            }
+            unsigned int out_size = 0;
+            const unsigned char* out = converter.Convert(&input[position], static_cast<unsigned int>(size), &out_size);
+            if (out_size != 0)
+            {
+                output.insert(output.end(), out, out + out_size);
+            }
+            position += size;
+        }
+        return output;
+    }
+
+    std::string FormatName(const PcmFormat& format)
+    {
+        char name[64];
+        sprintf(name, "%d-%d-%d", format.samples_per_second, format.channels, format.bits_per_sample);
+        return name;
+    }
+
+    int TestFixtures(const std::string& directory)
+    {
+        int failed = 0;
+        bool golden_missing = GOLDEN_HASHES[0] == 0;
+        std::vector<unsigned long long> hashes;
+        for (int i = 0; i < FIXTURE_COUNT; i++)
+        {
+            std::string input_name = directory + "/" + FIXTURES[i].name + ".wav";
+            PcmFormat format;
+            std::vector<unsigned char> input;
+            if (!WriteFile(input_name, MakeWav(FIXTURES[i].format, GenerateFixture(FIXTURES[i])))
+                || !ReadWav(input_name, &format, &input))
+            {
+                return 1;
+            }
+            for (int j = 0; j < TARGET_COUNT; j++)
+            {
+                const PcmFormat& target = TARGETS[j];
+                std::vector<unsigned char> output = Convert(format, target, true, input, 0);
+                std::vector<unsigned char> wav = MakeWav(target, output);
+                std::string output_name = directory + "/" + FIXTURES[i].name + "-to-" + FormatName(target) + ".wav";
+                if (!WriteFile(output_name, wav))
+                {
+                    return 1;
+                }
+                unsigned long long hash = Hash(wav);
+                hashes.push_back(hash);
+
+                const char* problem = nullptr;
+                if (Convert(format, target, false, input, 0) != output)
+                {
+                    problem = "the SSE2 and plain resamplers differ";
+                }
+                else if (Convert(format, target, true, input, 997) != output
+                         || Convert(format, target, false, input, 1) != output)
+                {
+                    problem = "the output depends on how the input is split";
+                }
+                else if (!golden_missing && hash != GOLDEN_HASHES[i * TARGET_COUNT + j])
+                {
+                    problem = "the output doesn't match the golden hash";
+                }
+                if (problem != nullptr)
+                {
+                    printf("%s: %s\n", output_name.c_str(), problem);
+                    failed++;
+                }
+            }
+        }
+        if (golden_missing || failed != 0)
+        {
+            printf("hashes of this build:\n");
+            for (size_t i = 0; i < hashes.size(); i++)
+            {
+                printf("%s0x%016llXull,%s", (i % TARGET_COUNT == 0) ? "        " : " ", hashes[i],
+                       (i % TARGET_COUNT == TARGET_COUNT - 1) ? "\n" : "");
+            }
+        }
+        printf("%d of %d fixture conversions matched\n", FIXTURE_COUNT * TARGET_COUNT - failed,
+               FIXTURE_COUNT * TARGET_COUNT);
+        return (failed == 0 && !golden_missing) ? 0 : 1;
+    }
+
+    /*
+     * Fits a sine of the given frequency to the middle of a mono 16-bit signal, returns the SNR in dB.
+     */
+    double MeasureTone(const std::vector<unsigned char>& samples, int rate, double frequency, double* amplitude)
+    {
+        size_t frames = samples.size() / 2;
+        size_t low = frames / 4;
+        size_t high = frames * 3 / 4;
+        double sine = 0;
+        double cosine = 0;
+        for (size_t i = low; i < high; i++)
+        {
+            int value = GetSample16(samples, i, 1, 0);
+            sine += value * sin(2 * PI * frequency * i / rate);
+            cosine += value * cos(2 * PI * frequency * i / rate);
+        }
+        double count = static_cast<double>(high - low);
+        *amplitude = 2 * sqrt(sine * sine + cosine * cosine) / count;
+        double phase = atan2(cosine, sine);
+        double error = 0;
+        for (size_t i = low; i < high; i++)
+        {
+            double difference = GetSample16(samples, i, 1, 0) - *amplitude * sin(2 * PI * frequency * i / rate + phase);
+            error += difference * difference;
+        }
+        return 10 * log10(*amplitude * *amplitude / 2 / (error / count));
+    }
+
+    std::vector<unsigned char> MonoTone(int rate, double frequency)
+    {
+        std::vector<unsigned char> samples;
+        for (int i = 0; i < rate; i++)
+        {
+            PutSample(0.5 * sin(2 * PI * frequency * i / rate), 16, &samples);
+        }
+        return samples;
+    }
+
+    int TestRates()
+    {
+        static const int rates[] = { 8000, 11025, 22050, 32000, 44100, 48000, 96000 };
+        const int count = sizeof(rates) / sizeof(rates[0]);
+        int failed = 0;
+        for (int i = 0; i < count; i++)
+        {
+            for (int j = 0; j < count; j++)
+            {
+                PcmFormat from = { 1, rates[i], 16 };
+                PcmFormat to = { 1, rates[j], 16 };
+                std::vector<unsigned char> output = Convert(from, to, true, MonoTone(rates[i], 1000), 0);
+                double amplitude = 0;
+                double snr = MeasureTone(output, rates[j], 1000, &amplitude);
+                /* A second in, a second out, less what the filter holds back. */
+                long long missing = rates[j] - static_cast<long long>(output.size() / 2);
+                if (snr < 60 || fabs(amplitude - 16383) > 200 || missing < 0 || missing > rates[j] / 100)
+                {
+                    printf("1 kHz from %d to %d Hz: %.1f dB SNR, amplitude %.0f, %lld samples short\n",
+                           rates[i], rates[j], snr, amplitude, missing);
+                    failed++;
+                }
+            }
+        }
+
+        /* 20 kHz is above 22050 Hz's Nyquist frequency and has to be filtered out, not folded back. */
+        PcmFormat from = { 1, 48000, 16 };
+        PcmFormat to = { 1, 22050, 16 };
+        std::vector<unsigned char> output = Convert(from, to, true, MonoTone(48000, 20000), 0);
+        double energy = 0;
+        size_t frames = output.size() / 2;
+        for (size_t i = frames / 4; i < frames * 3 / 4; i++)
+        {
+            double value = GetSample16(output, i, 1, 0);
+            energy += value * value;
+        }
+        double rms = sqrt(energy / (frames / 2));
+        if (rms > 16383 / sqrt(2.0) / 1000)
+        {
+            printf("20 kHz from 48000 to 22050 Hz: rms %.1f, not filtered out\n", rms);
+            failed++;
+        }
+        printf("%d of %d rate checks passed\n", count * count + 1 - failed, count * count + 1);
+        return failed == 0 ? 0 : 1;
+    }
+
+    /*
+     * Sample sizes and channel counts without resampling have exact results.
+     */
+    int TestSampleFormats()
+    {
+        static const unsigned char eight_bit[] = { 0x00, 0x80, 0xFF };
+        PcmFormat mono8 = { 1, 44100, 8 };
+        PcmFormat stereo24 = { 2, 44100, 24 };
+        PcmFormat mono16 = { 1, 44100, 16 };
+        std::vector<unsigned char> input(eight_bit, eight_bit + sizeof(eight_bit));
+        std::vector<unsigned char> wide = Convert(mono8, stereo24, true, input, 0);
+        static const unsigned char expected_wide[] =
+        {
+            0x00, 0x00, 0x80, 0x00, 0x00, 0x80,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x7F, 0x00, 0x00, 0x7F,
+        };
+        std::vector<unsigned char> back = Convert(stereo24, mono8, false, wide, 0);
+        std::vector<unsigned char> sixteen = Convert(stereo24, mono16, true, wide, 0);
+        static const unsigned char expected_sixteen[] = { 0x00, 0x80, 0x00, 0x00, 0x00, 0x7F };
+        bool ok = wide == std::vector<unsigned char>(expected_wide, expected_wide + sizeof(expected_wide))
+                  && back == input
+                  && sixteen == std::vector<unsigned char>(expected_sixteen, expected_sixteen + sizeof(expected_sixteen));
+        if (!ok)
+        {
+            printf("8-bit mono to 24-bit stereo and back isn't exact\n");
+        }
+        printf("sample formats %s\n", ok ? "exact" : "wrong");
+        return ok ? 0 : 1;
+    }
+
+    int ConvertFile(const char* input_name, const char* output_name, const PcmFormat& to)
+    {
+        PcmFormat from;
+        std::vector<unsigned char> input;
+        if (!PcmConverter::IsSupported(to))
+        {
+            printf("can't convert to that format\n");
+            return 1;
+        }
+        if (!ReadWav(input_name, &from, &input))
+        {
+            return 1;
+        }
+        return WriteFile(output_name, MakeWav(to, Convert(from, to, true, input, 0))) ? 0 : 1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 7 && strcmp(argv[1], "convert") == 0)
+    {
+        PcmFormat to = { atoi(argv[5]), atoi(argv[4]), atoi(argv[6]) };
+        return ConvertFile(argv[2], argv[3], to);
+    }
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [fixture directory]\n"
+                        "       %s convert in.wav out.wav rate channels bits\n", argv[0], argv[0]);
+        return 2;
+    }
+    std::string directory = (argc == 2) ? argv[1] : ".";
+    int failed = TestSampleFormats();
+    failed += TestRates();
+    failed += TestFixtures(directory);
+    return failed == 0 ? 0 : 1;
+}
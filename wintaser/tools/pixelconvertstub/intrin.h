@@ -0,0 +1,9 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Stands in for MSVC's intrin.h when wintaser/pixelconvert.cpp is built on its own with GCC or
+ * Clang, which have the intrinsics it uses in the <*mmintrin.h> headers it includes itself.
+ */
+
+#pragma once
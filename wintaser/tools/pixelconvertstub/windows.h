@@ -0,0 +1,20 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Stands in for windows.h when wintaser/pixelconvert.cpp is built on its own, with just the
+ * types the pixel conversion uses.
+ */
+
+#pragma once
+
+typedef unsigned short WORD;
+typedef unsigned char BYTE;
+
+struct PALETTEENTRY
+{
+    BYTE peRed;
+    BYTE peGreen;
+    BYTE peBlue;
+    BYTE peFlags;
+};
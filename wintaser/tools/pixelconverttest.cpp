@@ -0,0 +1,397 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests and times the AVI capture's pixel conversion (wintaser/pixelconvert.cpp) without
+ * Windows. The file is built right into this one, with the stand-ins in pixelconvertstub for the
+ * Windows headers, and the CPU checks it makes are answered here, so that the converter can be
+ * made to use each level of kernels in turn.
+ *
+ *     pixelconverttest          runs the tests
+ *     pixelconverttest bench    times converting 1280x720 and 1920x1080 frames in every format,
+ *                               with and without the gamma ramp, at every level
+ *
+ * The tests check, for 32-bit BGRX, 16-bit 565 and 555 and 8-bit palettized pixels, with and
+ * without a gamma ramp, that:
+ *  - a row of one known pixel converts to the right BGR triplets at every level,
+ *  - the SSSE3 and AVX2 kernels give exactly what the plain ones do for rows of every width up
+ *    to MAX_WIDTH, so the pixels left over at the end of a row are covered too, and write
+ *    nothing past the end of the row.
+ *
+ * The AVX2 kernels are only in the build of this made with -mavx2, pixelconverttest-avx2. Build
+ * and run them with "make check" in this directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../pixelconvert.cpp"
+
+namespace
+{
+    enum
+    {
+        CPU_PLAIN,
+        CPU_SSSE3,
+        CPU_AVX2,
+    };
+
+    int s_cpu_level = CPU_PLAIN;
+}
+
+/*
+ * What PixelConverter asks when it's made, see MakeConverter.
+ */
+bool CPUHasSSSE3()
+{
+    return s_cpu_level >= CPU_SSSE3;
+}
+
+bool CPUHasAVX2()
+{
+    return s_cpu_level >= CPU_AVX2;
+}
+
+namespace
+{
+    const int MAX_WIDTH = 200;
+    const int GUARD_BYTES = 64;
+    const int BENCH_REPEATS = 10;
+
+    struct Level
+    {
+        const char* name;
+        int cpu_level;
+    };
+
+    const Level LEVELS[] = { { "plain", CPU_PLAIN }, { "SSSE3", CPU_SSSE3 }, { "AVX2", CPU_AVX2 } };
+    const int LEVEL_COUNT = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+    struct Format
+    {
+        const char* name;
+        int bpp;
+        unsigned int rmask;
+        unsigned int gmask;
+        unsigned int bmask;
+    };
+
+    const Format FORMATS[] =
+    {
+        { "32-bit BGRX", 32, 0x00FF0000, 0x0000FF00, 0x000000FF },
+        { "16-bit 565", 16, 0xF800, 0x07E0, 0x001F },
+        { "16-bit 555", 16, 0x7C00, 0x03E0, 0x001F },
+        { "8-bit palette", 8, 0, 0, 0 },
+    };
+    const int FORMAT_COUNT = sizeof(FORMATS) / sizeof(FORMATS[0]);
+
+    /*
+     * One pixel in each format and the BGR it converts to without a gamma ramp.
+     */
+    struct KnownPixel
+    {
+        int format;
+        unsigned int pixel;
+        unsigned char bgr[3];
+    };
+
+    const KnownPixel KNOWN_PIXELS[] =
+    {
+        { 0, 0x80123456, { 0x56, 0x34, 0x12 } },
+        { 0, 0x00FFFFFF, { 0xFF, 0xFF, 0xFF } },
+        { 1, 0xF800, { 0x00, 0x00, 0xF8 } },
+        { 1, 0x07E0, { 0x00, 0xFC, 0x00 } },
+        { 1, 0x001F, { 0xF8, 0x00, 0x00 } },
+        { 2, 0x7C00, { 0x00, 0x00, 0xF8 } },
+        { 2, 0x03E0, { 0x00, 0xF8, 0x00 } },
+        { 2, 0x801F, { 0xF8, 0x00, 0x00 } },
+        { 3, 0x05, { 0x03, 0x02, 0x01 } },
+        { 3, 0xFF, { 0xAA, 0x55, 0xFE } },
+    };
+    const int KNOWN_PIXEL_COUNT = sizeof(KNOWN_PIXELS) / sizeof(KNOWN_PIXELS[0]);
+
+    unsigned int s_random = 1;
+
+    unsigned int NextRandom()
+    {
+        s_random = s_random * 1103515245 + 12345;
+        return s_random >> 8;
+    }
+
+    bool LevelAvailable(const Level& level)
+    {
+        switch (level.cpu_level)
+        {
+        case CPU_SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case CPU_AVX2:
+            return PIXELCONVERT_HAS_AVX2 && __builtin_cpu_supports("avx2");
+        default:
+            return true;
+        }
+    }
+
+    /*
+     * A palette with entries 5 and 255 set to what KNOWN_PIXELS expects, the rest random.
+     */
+    void MakePalette(PALETTEENTRY* palette)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            palette[i].peRed = static_cast<BYTE>(NextRandom());
+            palette[i].peGreen = static_cast<BYTE>(NextRandom());
+            palette[i].peBlue = static_cast<BYTE>(NextRandom());
+            palette[i].peFlags = static_cast<BYTE>(NextRandom());
+        }
+        palette[5].peRed = 0x01;
+        palette[5].peGreen = 0x02;
+        palette[5].peBlue = 0x03;
+        palette[255].peRed = 0xFE;
+        palette[255].peGreen = 0x55;
+        palette[255].peBlue = 0xAA;
+    }
+
+    /*
+     * Different curves for each channel, with junk in the low bytes that the converter ignores.
+     */
+    void MakeGammaRamp(WORD* red, WORD* green, WORD* blue)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            red[i] = static_cast<WORD>(((255 - i) << 8) | (NextRandom() & 0xFF));
+            green[i] = static_cast<WORD>(((i * i / 255) << 8) | (NextRandom() & 0xFF));
+            blue[i] = static_cast<WORD>(((i < 128 ? i * 2 : 255) << 8) | (NextRandom() & 0xFF));
+        }
+    }
+
+    struct Setup
+    {
+        PALETTEENTRY palette[256];
+        WORD gamma[3][256];
+    };
+
+    /*
+     * PixelConverter picks the fastest kernels it can when it's made, so it's made pretending
+     * the CPU has no more than the level asked for.
+     */
+    void MakeConverter(const Level& level, const Format& format, const Setup& setup, bool gamma,
+                       PixelConverter* converter)
+    {
+        s_cpu_level = level.cpu_level;
+        *converter = PixelConverter();
+        converter->SetFormat(format.bpp, format.rmask, format.gmask, format.bmask);
+        converter->SetPalette(setup.palette);
+        if (gamma)
+        {
+            converter->SetGammaRamp(setup.gamma[0], setup.gamma[1], setup.gamma[2]);
+        }
+    }
+
+    void WritePixel(unsigned char* out, unsigned int pixel, int bytes_per_pixel)
+    {
+        for (int i = 0; i < bytes_per_pixel; i++)
+        {
+            out[i] = static_cast<unsigned char>(pixel >> (i * 8));
+        }
+    }
+
+    bool CheckKnownPixels(const Setup& setup)
+    {
+        const int width = 40;
+        int checked = 0;
+        int passed = 0;
+        for (int l = 0; l < LEVEL_COUNT; l++)
+        {
+            if (!LevelAvailable(LEVELS[l]))
+            {
+                continue;
+            }
+            for (int k = 0; k < KNOWN_PIXEL_COUNT; k++)
+            {
+                const KnownPixel& known = KNOWN_PIXELS[k];
+                const Format& format = FORMATS[known.format];
+                int bytes_per_pixel = format.bpp / 8;
+                std::vector<unsigned char> in(width * bytes_per_pixel);
+                for (int x = 0; x < width; x++)
+                {
+                    WritePixel(&in[x * bytes_per_pixel], known.pixel, bytes_per_pixel);
+                }
+                for (int gamma = 0; gamma < 2; gamma++)
+                {
+                    PixelConverter converter;
+                    MakeConverter(LEVELS[l], format, setup, gamma != 0, &converter);
+                    std::vector<unsigned char> out(width * 3);
+                    converter.ConvertRow(&in[0], &out[0], width);
+                    unsigned char expected[3];
+                    for (int channel = 0; channel < 3; channel++)
+                    {
+                        /* The ramps are red, green, blue, the output blue, green, red. */
+                        expected[channel] = gamma ? static_cast<unsigned char>(setup.gamma[2 - channel][known.bgr[channel]] >> 8)
+                                                  : known.bgr[channel];
+                    }
+                    bool matched = true;
+                    for (int x = 0; x < width; x++)
+                    {
+                        matched = matched && memcmp(&out[x * 3], expected, 3) == 0;
+                    }
+                    if (!matched)
+                    {
+                        printf("%s, %s pixel 0x%X%s: converted to %02X %02X %02X, not %02X %02X %02X\n",
+                               LEVELS[l].name, format.name, known.pixel, gamma ? " with gamma" : "",
+                               out[0], out[1], out[2], expected[0], expected[1], expected[2]);
+                    }
+                    checked++;
+                    passed += matched ? 1 : 0;
+                }
+            }
+        }
+        printf("%d of %d known pixels converted right\n", passed, checked);
+        return passed == checked;
+    }
+
+    bool CheckKernels(const Setup& setup)
+    {
+        int checked = 0;
+        int passed = 0;
+        bool has_avx2 = false;
+        for (int f = 0; f < FORMAT_COUNT; f++)
+        {
+            const Format& format = FORMATS[f];
+            int bytes_per_pixel = format.bpp / 8;
+            for (int gamma = 0; gamma < 2; gamma++)
+            {
+                PixelConverter plain;
+                MakeConverter(LEVELS[0], format, setup, gamma != 0, &plain);
+                for (int l = 1; l < LEVEL_COUNT; l++)
+                {
+                    if (!LevelAvailable(LEVELS[l]))
+                    {
+                        continue;
+                    }
+                    has_avx2 = has_avx2 || LEVELS[l].cpu_level == CPU_AVX2;
+                    PixelConverter converter;
+                    MakeConverter(LEVELS[l], format, setup, gamma != 0, &converter);
+                    int failed_width = 0;
+                    for (int width = 1; width <= MAX_WIDTH && failed_width == 0; width++)
+                    {
+                        /* Starting at a different offset each time, the loads don't have to be aligned. */
+                        int offset = width % 4;
+                        std::vector<unsigned char> in(offset + width * bytes_per_pixel);
+                        for (size_t i = 0; i < in.size(); i++)
+                        {
+                            in[i] = static_cast<unsigned char>(NextRandom());
+                        }
+                        std::vector<unsigned char> expected(width * 3 + GUARD_BYTES, 0xCD);
+                        std::vector<unsigned char> out(width * 3 + GUARD_BYTES, 0xCD);
+                        plain.ConvertRow(&in[offset], &expected[0], width);
+                        converter.ConvertRow(&in[offset], &out[0], width);
+                        if (out != expected)
+                        {
+                            failed_width = width;
+                        }
+                    }
+                    if (failed_width != 0)
+                    {
+                        printf("%s, %s%s: a row %d pixels wide converted differently than with the plain kernels\n",
+                               LEVELS[l].name, format.name, gamma ? " with gamma" : "", failed_width);
+                    }
+                    checked++;
+                    passed += failed_width == 0 ? 1 : 0;
+                }
+            }
+        }
+        printf("%d of %d formats converted rows of 1 to %d pixels the same with SSSE3%s\n", passed, checked,
+               MAX_WIDTH, has_avx2 ? " and AVX2" : (PIXELCONVERT_HAS_AVX2 ? " (this CPU has no AVX2)" : " (built without AVX2)"));
+        return checked != 0 && passed == checked;
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /*
+     * Milliseconds per frame, best of BENCH_REPEATS.
+     */
+    double TimeFrame(const PixelConverter& converter, const std::vector<unsigned char>& in, int in_pitch,
+                     std::vector<unsigned char>* out, int width, int height)
+    {
+        double best = 0;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int y = 0; y < height; y++)
+            {
+                converter.ConvertRow(&in[y * in_pitch], &(*out)[y * width * 3], width);
+            }
+            double milliseconds = Seconds(start) * 1e3;
+            best = (repeat == 0 || milliseconds < best) ? milliseconds : best;
+        }
+        return best;
+    }
+
+    void RunBenchmark(const Setup& setup)
+    {
+        static const int SIZES[][2] = { { 1280, 720 }, { 1920, 1080 } };
+        for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++)
+        {
+            int width = SIZES[s][0];
+            int height = SIZES[s][1];
+            printf("%dx%d, milliseconds per frame, best of %d:\n", width, height, BENCH_REPEATS);
+            printf("%-26s", "");
+            for (int l = 0; l < LEVEL_COUNT; l++)
+            {
+                printf(" %8s", LevelAvailable(LEVELS[l]) ? LEVELS[l].name : "");
+            }
+            printf("\n");
+            std::vector<unsigned char> out(width * height * 3);
+            for (int f = 0; f < FORMAT_COUNT; f++)
+            {
+                const Format& format = FORMATS[f];
+                int in_pitch = width * format.bpp / 8;
+                std::vector<unsigned char> in(in_pitch * height);
+                for (size_t i = 0; i < in.size(); i++)
+                {
+                    in[i] = static_cast<unsigned char>(NextRandom());
+                }
+                for (int gamma = 0; gamma < 2; gamma++)
+                {
+                    printf("%-26s", (std::string(format.name) + (gamma ? ", gamma" : "")).c_str());
+                    for (int l = 0; l < LEVEL_COUNT; l++)
+                    {
+                        if (LevelAvailable(LEVELS[l]))
+                        {
+                            PixelConverter converter;
+                            MakeConverter(LEVELS[l], format, setup, gamma != 0, &converter);
+                            printf(" %8.3f", TimeFrame(converter, in, in_pitch, &out, width, height));
+                        }
+                    }
+                    printf("\n");
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Setup setup;
+    MakePalette(setup.palette);
+    MakeGammaRamp(setup.gamma[0], setup.gamma[1], setup.gamma[2]);
+    if (argc == 1)
+    {
+        bool known = CheckKnownPixels(setup);
+        bool kernels = CheckKernels(setup);
+        return known && kernels ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "bench") == 0)
+    {
+        RunBenchmark(setup);
+        return 0;
+    }
+    fprintf(stderr, "usage: %s [bench]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,524 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests and times the RAM search engine (ramsearchengine.h) without Windows or a game, by
+ * replaying memory dumps like the ones the RAM Search dialog saves.
+ *
+ *     ramsearchtest                      checks the searches against a simple reference
+ *     ramsearchtest bench [megabytes]    times frame updates and searches on generated dumps
+ *     ramsearchtest dump1 dump2 ...      times frame updates and searches on recorded dumps
+ *
+ * The tests write a short sequence of generated dumps, load them one frame at a time, run a
+ * series of searches for every data size and type, and compare the results with a brute-force
+ * search over the same memory. Build it with the makefile in this directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../memorydump.h"
+#include "../ramsearchengine.h"
+
+namespace
+{
+    struct GeneratedRegion
+    {
+        WritableMemoryRegion info;
+        std::vector<unsigned char> data;
+    };
+
+    /*
+     * One frame of generated memory, and the memory source that reads it.
+     */
+    struct GeneratedFrame
+    {
+        std::vector<GeneratedRegion> regions;
+    };
+
+    unsigned int s_random = 12345;
+
+    unsigned int NextRandom()
+    {
+        s_random = s_random * 1103515245 + 12345;
+        return s_random >> 8;
+    }
+
+    GeneratedRegion* FindGeneratedRegion(GeneratedFrame* frame, HWAddressType address)
+    {
+        for (unsigned int i = 0; i < frame->regions.size(); i++)
+        {
+            GeneratedRegion& region = frame->regions[i];
+            if (address >= region.info.address && address - region.info.address < region.info.size)
+            {
+                return &region;
+            }
+        }
+        return nullptr;
+    }
+
+    void EnumerateGenerated(WritableMemoryRegionCallback callback, void* callback_context,
+                            void* context)
+    {
+        GeneratedFrame* frame = static_cast<GeneratedFrame*>(context);
+        for (unsigned int i = 0; i < frame->regions.size(); i++)
+        {
+            callback(frame->regions[i].info, callback_context);
+        }
+    }
+
+    bool ReadGenerated(HWAddressType address, void* buffer, unsigned int size, void* context)
+    {
+        GeneratedRegion* region = FindGeneratedRegion(static_cast<GeneratedFrame*>(context), address);
+        if (region == nullptr || size > region->info.size - (address - region->info.address))
+        {
+            return false;
+        }
+        memcpy(buffer, &region->data[address - region->info.address], size);
+        return true;
+    }
+
+    bool WriteGenerated(HWAddressType address, const void* buffer, unsigned int size, void* context)
+    {
+        return false;
+    }
+
+    /*
+     * Builds the first frame: a few searched regions, two of them next to each other, and one
+     * region the search has to leave out because it isn't in one of the game's modules.
+     * Like the game's, the regions are whole pages.
+     */
+    GeneratedFrame MakeFirstFrame(unsigned int scale)
+    {
+        static const struct
+        {
+            unsigned int size;
+            bool trusted;
+            bool adjacent;
+        } layout[] = {
+            { 0x4000, true, false },
+            { 0x1000, true, false },
+            { 0x2000, true, true },
+            { 0x3000, false, false },
+            { 0x1000, true, false },
+        };
+        GeneratedFrame frame;
+        HWAddressType next_address = 0x00410000;
+        for (unsigned int i = 0; i < sizeof(layout) / sizeof(layout[0]); i++)
+        {
+            GeneratedRegion region;
+            region.info.address = next_address + (layout[i].adjacent ? 0 : 0x10000);
+            region.info.size = layout[i].size * scale;
+            next_address = region.info.address + region.info.size;
+            region.info.trusted = layout[i].trusted;
+            region.info.image = true;
+            region.data.resize(region.info.size);
+            for (unsigned int j = 0; j < region.data.size(); j++)
+            {
+                /* mostly small values, like real memory, so the searches have something to find */
+                region.data[j] = (NextRandom() % 4 == 0) ? static_cast<unsigned char>(NextRandom()) : 0;
+            }
+            frame.regions.push_back(region);
+        }
+        return frame;
+    }
+
+    /*
+     * The next frame changes a few random bytes, and counts up a band of 32-bit values at the
+     * start of each region, some every frame and some every other frame.
+     */
+    GeneratedFrame MakeNextFrame(const GeneratedFrame& previous, unsigned int frame_number)
+    {
+        GeneratedFrame frame = previous;
+        for (unsigned int i = 0; i < frame.regions.size(); i++)
+        {
+            std::vector<unsigned char>& data = frame.regions[i].data;
+            for (unsigned int j = 0; j < data.size() / 64; j++)
+            {
+                data[NextRandom() % data.size()] = static_cast<unsigned char>(NextRandom());
+            }
+            for (unsigned int j = 0; j < 64 && j * 4 + 4 <= data.size(); j++)
+            {
+                if (j % 2 == 0 || frame_number % 2 == 0)
+                {
+                    unsigned int value;
+                    memcpy(&value, &data[j * 4], sizeof(value));
+                    value += j + 1;
+                    memcpy(&data[j * 4], &value, sizeof(value));
+                }
+            }
+        }
+        return frame;
+    }
+
+    std::string DumpPath(const char* name, unsigned int index)
+    {
+        const char* directory = getenv("TMPDIR");
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/ramsearchtest-%s-%u.hgmd", directory ? directory : "/tmp", name, index);
+        return path;
+    }
+
+    /*
+     * Saves every frame through the dump code, the way the dialog would with a game running.
+     */
+    std::vector<std::string> SaveFrames(std::vector<GeneratedFrame>& frames, const char* name)
+    {
+        std::vector<std::string> paths;
+        for (unsigned int i = 0; i < frames.size(); i++)
+        {
+            MemorySource source = { EnumerateGenerated, ReadGenerated, WriteGenerated, &frames[i] };
+            SetMemorySource(&source);
+            paths.push_back(DumpPath(name, i));
+            if (!SaveMemoryDump(paths.back().c_str()))
+            {
+                fprintf(stderr, "couldn't write %s\n", paths.back().c_str());
+                exit(1);
+            }
+            SetMemorySource(nullptr);
+        }
+        return paths;
+    }
+
+    void RemoveFiles(const std::vector<std::string>& paths)
+    {
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            remove(paths[i].c_str());
+        }
+    }
+
+    void LoadFrame(const std::string& path)
+    {
+        if (!LoadMemoryDump(path.c_str()))
+        {
+            fprintf(stderr, "couldn't load %s\n", path.c_str());
+            exit(1);
+        }
+    }
+
+    /*
+     * Starts a search over the loaded dump the same way the dialog's reset does.
+     */
+    void ResetSearch(char size, char type, bool aligned)
+    {
+        s_prevValuesNeedUpdate = false;
+        ResetSearchRegions();
+        UpdateSearchRegions(size, type, aligned);
+        s_prevValuesNeedUpdate = true;
+        UpdateSearchRegions(size, type, aligned);
+        memset(s_numChanges, 0, sizeof(*s_numChanges) * MAX_RAM_SIZE);
+        CalculateItemIndices(aligned ? sizeTypeIDToSize(size) : 1);
+    }
+
+    struct Search
+    {
+        char c;
+        char o;
+        long long value;
+        long long param;
+    };
+
+    template<typename T>
+    T ReadReference(const GeneratedFrame& frame, HWAddressType address)
+    {
+        T value;
+        GeneratedFrame& mutable_frame = const_cast<GeneratedFrame&>(frame);
+        ReadGenerated(address, &value, sizeof(value), &mutable_frame);
+        return value;
+    }
+
+    template<typename T>
+    bool Compare(char o, T x, T y, T p)
+    {
+        switch (o)
+        {
+        case '<': return LessCmp(x, y, p);
+        case '>': return MoreCmp(x, y, p);
+        case 'l': return LessEqualCmp(x, y, p);
+        case 'm': return MoreEqualCmp(x, y, p);
+        case '=': return EqualCmp(x, y, p);
+        case '!': return UnequalCmp(x, y, p);
+        case 'd': return DiffByCmp(x, y, p);
+        case '%': return ModIsCmp(x, y, p);
+        }
+        return false;
+    }
+
+    /*
+     * The brute-force version of the engine: a list of item addresses, the frame the previous
+     * values were taken from, and how many times each item changed since the reset.
+     */
+    template<typename stepType, typename T>
+    class ReferenceSearch
+    {
+    public:
+        ReferenceSearch(const std::vector<GeneratedFrame>& frames) :
+            m_frames(frames),
+            m_previous_frame(0)
+        {
+            const GeneratedFrame& first = frames[0];
+            for (unsigned int i = 0; i < first.regions.size(); i++)
+            {
+                const WritableMemoryRegion& info = first.regions[i].info;
+                if (!info.trusted)
+                {
+                    continue;
+                }
+                for (unsigned int offset = 0; offset + sizeof(T) <= info.size; offset += sizeof(stepType))
+                {
+                    m_items.push_back(info.address + offset);
+                    m_changes.push_back(0);
+                }
+            }
+        }
+
+        void Update(unsigned int frame)
+        {
+            for (unsigned int i = 0; i < m_items.size(); i++)
+            {
+                T before = ReadReference<T>(m_frames[frame - 1], m_items[i]);
+                T after = ReadReference<T>(m_frames[frame], m_items[i]);
+                if (memcmp(&before, &after, sizeof(T)) != 0)
+                {
+                    m_changes[i]++;
+                }
+            }
+        }
+
+        void Run(const Search& search, unsigned int frame)
+        {
+            std::vector<HWAddressType> items;
+            std::vector<unsigned short> changes;
+            for (unsigned int i = 0; i < m_items.size(); i++)
+            {
+                if (Matches(search, frame, i))
+                {
+                    items.push_back(m_items[i]);
+                    changes.push_back(m_changes[i]);
+                }
+            }
+            m_items.swap(items);
+            m_changes.swap(changes);
+            m_previous_frame = frame;
+        }
+
+        const std::vector<HWAddressType>& GetItems() const
+        {
+            return m_items;
+        }
+
+    private:
+        bool Matches(const Search& search, unsigned int frame, unsigned int i)
+        {
+            T current = ReadReference<T>(m_frames[frame], m_items[i]);
+            switch (search.c)
+            {
+            case 'r':
+                return Compare<T>(search.o, current, ReadReference<T>(m_frames[m_previous_frame], m_items[i]),
+                                  RSVal(search.param));
+            case 's':
+                return Compare<T>(search.o, current, RSVal(search.value), RSVal(search.param));
+            case 'a':
+                return Compare<unsigned int>(search.o, m_items[i], RSVal(search.value), RSVal(search.param));
+            case 'n':
+                return Compare<unsigned short>(search.o, m_changes[i], RSVal(search.value), RSVal(search.param));
+            }
+            return false;
+        }
+
+        const std::vector<GeneratedFrame>& m_frames;
+        std::vector<HWAddressType> m_items;
+        std::vector<unsigned short> m_changes;
+        unsigned int m_previous_frame;
+    };
+
+    template<typename stepType, typename T>
+    std::vector<HWAddressType> GetEngineItems(char size, char type, bool aligned)
+    {
+        std::vector<HWAddressType> items;
+        CalculateItemIndices(aligned ? sizeTypeIDToSize(size) : 1);
+        int count = CountSearchItems(size, type, aligned);
+        for (int i = 0; i < count; i++)
+        {
+            items.push_back(GetHardwareAddressFromItemIndex<stepType, T>(i));
+        }
+        return items;
+    }
+
+    /*
+     * Runs the searches one frame apart on both the engine and the reference, returns the number
+     * of searches whose results differ.
+     */
+    template<typename stepType, typename T>
+    int CheckSearches(const std::vector<GeneratedFrame>& frames, const std::vector<std::string>& paths,
+                      const Search* searches, unsigned int count, char size, char type)
+    {
+        LoadFrame(paths[0]);
+        ResetSearch(size, type, true);
+        ReferenceSearch<stepType, T> reference(frames);
+
+        int failures = 0;
+        for (unsigned int i = 0; i < count && i + 1 < paths.size() && !failures; i++)
+        {
+            unsigned int frame = i + 1;
+            LoadFrame(paths[frame]);
+            UpdateSearchRegions(size, type, true);
+            reference.Update(frame);
+
+            const Search& search = searches[i];
+            SearchRegions(search.c, search.o, type, RSVal(search.value), RSVal(search.param), size, true);
+            reference.Run(search, frame);
+
+            std::vector<HWAddressType> expected = reference.GetItems();
+            std::vector<HWAddressType> actual = GetEngineItems<stepType, T>(size, type, true);
+            if (actual != expected)
+            {
+                printf("FAIL size %c type %c, search %u (%c %c %lld): %u results, expected %u\n", size, type, i,
+                       search.c, search.o, search.value, static_cast<unsigned int>(actual.size()),
+                       static_cast<unsigned int>(expected.size()));
+                failures++;
+            }
+        }
+        UnloadMemoryDump();
+        return failures ? 1 : 0;
+    }
+
+    int RunTests()
+    {
+        std::vector<GeneratedFrame> frames;
+        frames.push_back(MakeFirstFrame(1));
+        for (unsigned int i = 1; i < 8; i++)
+        {
+            frames.push_back(MakeNextFrame(frames.back(), i));
+        }
+        std::vector<std::string> paths = SaveFrames(frames, "test");
+
+        /* the address search keeps the items before the middle of the two adjacent regions */
+        HWAddressType middle = frames[0].regions[2].info.address;
+        Search searches[] = {
+            { 'r', '!', 0, 0 },
+            { 'n', 'm', 1, 0 },
+            { 'r', '>', 0, 0 },
+            { 'a', '<', 0, 0 },
+            { 'r', 'd', 0, 1 },
+            { 'n', '=', 6, 0 },
+            { 's', '%', 1, 2 },
+        };
+        searches[3].value = middle;
+        static const unsigned int count = sizeof(searches) / sizeof(searches[0]);
+        static const char sizes[] = { 'b', 'w', 'd', 'l' };
+        static const char types[] = { 's', 'u', 'f' };
+
+        int failures = 0;
+        int runs = 0;
+        for (unsigned int s = 0; s < sizeof(sizes); s++)
+        {
+            for (unsigned int t = 0; t < sizeof(types); t++)
+            {
+                char size = sizes[s];
+                char type = types[t];
+                if (type == 'f' && (size == 'b' || size == 'w'))
+                {
+                    continue;
+                }
+                failures += CALL_WITH_T_SIZE_TYPES(CheckSearches, size, type, true,
+                                                   frames, paths, searches, count, size, type);
+                runs++;
+            }
+        }
+
+        RemoveFiles(paths);
+        printf("%d of %d search sequences matched the reference\n", runs - failures, runs);
+        return failures ? 1 : 0;
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /*
+     * Replays the dumps one frame at a time, timing the frame updates and a search that
+     * eliminates nothing and then one that eliminates about half of what's left.
+     */
+    int RunBenchmark(const std::vector<std::string>& paths, char size, char type)
+    {
+        LoadFrame(paths[0]);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ResetSearch(size, type, true);
+        double reset_time = Seconds(start);
+        int items = CountSearchItems(size, type, true);
+
+        double load_time = 0;
+        double update_time = 0;
+        for (unsigned int i = 1; i < paths.size(); i++)
+        {
+            start = std::chrono::steady_clock::now();
+            LoadFrame(paths[i]);
+            load_time += Seconds(start);
+            start = std::chrono::steady_clock::now();
+            UpdateSearchRegions(size, type, true);
+            update_time += Seconds(start);
+        }
+
+        start = std::chrono::steady_clock::now();
+        SearchRegions('n', 'm', type, RSVal(0), RSVal(0), size, true);
+        CalculateItemIndices(sizeTypeIDToSize(size));
+        double keep_time = Seconds(start);
+
+        start = std::chrono::steady_clock::now();
+        SearchRegions('r', '=', type, RSVal(0), RSVal(0), size, true);
+        CalculateItemIndices(sizeTypeIDToSize(size));
+        double search_time = Seconds(start);
+        int remaining = CountSearchItems(size, type, true);
+
+        unsigned int frames = paths.size() > 1 ? static_cast<unsigned int>(paths.size()) - 1 : 1;
+        printf("size %c: %d items, reset %.1f ms, update %.2f ms/frame (loading %.2f ms/frame), "
+               "search keeping all %.1f ms, search keeping %d %.1f ms\n", size, items, reset_time * 1000,
+               update_time * 1000 / frames, load_time * 1000 / frames, keep_time * 1000, remaining,
+               search_time * 1000);
+        UnloadMemoryDump();
+        return 0;
+    }
+
+    int RunBenchmarks(const std::vector<std::string>& paths)
+    {
+        static const char sizes[] = { 'b', 'w', 'd', 'l' };
+        for (unsigned int s = 0; s < sizeof(sizes); s++)
+        {
+            RunBenchmark(paths, sizes[s], 'u');
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        return RunTests();
+    }
+    if (strcmp(argv[1], "bench") == 0)
+    {
+        unsigned int megabytes = argc > 2 ? static_cast<unsigned int>(atoi(argv[2])) : 64;
+        /* the generated layout has 32 KB of searched memory at scale 1 */
+        unsigned int scale = megabytes ? megabytes * 1024 / 32 : 1;
+        std::vector<GeneratedFrame> frames;
+        frames.push_back(MakeFirstFrame(scale));
+        for (unsigned int i = 1; i < 4; i++)
+        {
+            frames.push_back(MakeNextFrame(frames.back(), i));
+        }
+        std::vector<std::string> paths = SaveFrames(frames, "bench");
+        frames.clear();
+        int result = RunBenchmarks(paths);
+        RemoveFiles(paths);
+        return result;
+    }
+    return RunBenchmarks(std::vector<std::string>(argv + 1, argv + argc));
+}
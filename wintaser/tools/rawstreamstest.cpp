@@ -0,0 +1,390 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests for the streams captures are piped to an external encoder in (rawstreams.h).
+ *
+ * The framing and the color conversion are checked in memory. Then the streams are written to a
+ * dummy encoder, a child process that reads a video frame and then that frame's audio from two
+ * pipes, the way an encoder muxing both streams does. Like in AVIDumper, video and audio are
+ * written from two threads. Frames are larger than a pipe buffer, so if a stream held data back
+ * the encoder would wait for it while the other thread waits for the encoder; that fails after a
+ * timeout instead of hanging. Needs POSIX, build and run it with "make check" in this directory.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../rawstreams.h"
+
+namespace
+{
+    const int PIPE_WIDTH = 320;
+    const int PIPE_HEIGHT = 240;
+    const int PIPE_FRAMES = 60;
+    const int PIPE_FPS = 60;
+    const unsigned int AUDIO_FRAME_BYTES = 735 * 4;
+    const unsigned int PIPE_TIMEOUT_SECONDS = 30;
+
+    /*
+     * Keeps every write separately.
+     */
+    class MemorySink : public StreamSink
+    {
+    public:
+        virtual bool Write(const void* data, unsigned int size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            writes.push_back(std::vector<unsigned char>(bytes, bytes + size));
+            return true;
+        }
+
+        std::vector<std::vector<unsigned char> > writes;
+    };
+
+    class PipeSink : public StreamSink
+    {
+    public:
+        explicit PipeSink(int fd) : m_fd(fd) {}
+
+        virtual bool Write(const void* data, unsigned int size)
+        {
+            const char* bytes = static_cast<const char*>(data);
+            while (size > 0)
+            {
+                ssize_t written = write(m_fd, bytes, size);
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written <= 0)
+                {
+                    return false;
+                }
+                bytes += written;
+                size -= static_cast<unsigned int>(written);
+            }
+            return true;
+        }
+
+    private:
+        int m_fd;
+    };
+
+    unsigned int GetLE(const unsigned char* data, unsigned int bytes)
+    {
+        unsigned int value = 0;
+        for (unsigned int i = 0; i < bytes; i++)
+        {
+            value |= static_cast<unsigned int>(data[i]) << (i * 8);
+        }
+        return value;
+    }
+
+    /*
+     * BT.601 limited range in floating point, what the fixed point conversion has to be within 1 of.
+     */
+    bool CloseToBT601(int r, int g, int b, int y, int cb, int cr)
+    {
+        double expected_y = 16 + (65.481 * r + 128.553 * g + 24.966 * b) / 255;
+        double expected_cb = 128 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255;
+        double expected_cr = 128 + (112.0 * r - 93.786 * g - 18.214 * b) / 255;
+        return fabs(y - expected_y) <= 1 && fabs(cb - expected_cb) <= 1 && fabs(cr - expected_cr) <= 1;
+    }
+
+    /*
+     * The generated BGR frame the pipe test sends, bottom-up like the AVI frames.
+     */
+    void GenerateFrame(int index, std::vector<unsigned char>* pixels)
+    {
+        pixels->resize(PIPE_WIDTH * PIPE_HEIGHT * 3);
+        for (size_t i = 0; i < pixels->size(); i++)
+        {
+            (*pixels)[i] = static_cast<unsigned char>(i * 7 + index * 13);
+        }
+    }
+
+    void GenerateAudio(int index, std::vector<unsigned char>* samples)
+    {
+        samples->resize(AUDIO_FRAME_BYTES);
+        for (size_t i = 0; i < samples->size(); i++)
+        {
+            (*samples)[i] = static_cast<unsigned char>(i + index * 3);
+        }
+    }
+
+    bool Check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            printf("FAILED: %s\n", what);
+        }
+        return condition;
+    }
+
+    bool TestY4M()
+    {
+        /* Every combination of every 5th value of each channel, in one frame of 52 x 2704 pixels. */
+        const int steps = 52;
+        const int width = steps;
+        const int height = steps * steps;
+        std::vector<unsigned char> pixels(width * height * 3);
+        for (int i = 0; i < width * height; i++)
+        {
+            pixels[i * 3 + 0] = static_cast<unsigned char>(i % steps * 5);
+            pixels[i * 3 + 1] = static_cast<unsigned char>(i / steps % steps * 5);
+            pixels[i * 3 + 2] = static_cast<unsigned char>(i / (steps * steps) * 5);
+        }
+
+        MemorySink sink;
+        Y4MStream stream(&sink);
+        stream.SetFormat(width, height, 30);
+        bool ok = Check(!stream.RepeatFrame() && sink.writes.empty(), "repeating before the first frame")
+                  && Check(stream.WriteFrame(&pixels[0]) && sink.writes.size() == 1, "one write for the first frame");
+        if (!ok)
+        {
+            return false;
+        }
+
+        const std::vector<unsigned char>& first = sink.writes[0];
+        std::string header = "YUV4MPEG2 W52 H2704 F30:1 Ip A1:1 C444\nFRAME\n";
+        size_t plane = static_cast<size_t>(width) * height;
+        ok = Check(first.size() == header.size() + plane * 3, "size of the first frame")
+             && Check(memcmp(&first[0], header.c_str(), header.size()) == 0, "stream header");
+        if (!ok)
+        {
+            return false;
+        }
+
+        const unsigned char* y_plane = &first[header.size()];
+        int wrong = 0;
+        for (int row = 0; row < height; row++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                /* The stream is top-down, the pixels bottom-up. */
+                const unsigned char* in = &pixels[((height - 1 - row) * width + x) * 3];
+                size_t out = static_cast<size_t>(row) * width + x;
+                if (!CloseToBT601(in[2], in[1], in[0], y_plane[out], y_plane[plane + out], y_plane[plane * 2 + out]))
+                {
+                    wrong++;
+                }
+            }
+        }
+        ok = Check(wrong == 0, "colors within 1 of BT.601");
+
+        std::vector<unsigned char> second_pixels(pixels.rbegin(), pixels.rend());
+        ok = ok && Check(stream.WriteFrame(&second_pixels[0]) && sink.writes.size() == 2, "one write for the second frame")
+             && Check(sink.writes[1].size() == 6 + plane * 3 && memcmp(&sink.writes[1][0], "FRAME\n", 6) == 0,
+                      "no stream header on the second frame")
+             && Check(stream.RepeatFrame() && sink.writes.size() == 3 && sink.writes[2] == sink.writes[1],
+                      "a repeat is the last frame again")
+             && Check(stream.GetFrameCount() == 3, "frame count");
+        return ok;
+    }
+
+    bool TestWav()
+    {
+        MemorySink sink;
+        WavStream stream(&sink);
+        bool ok = Check(!stream.HasFormat(), "no format before SetFormat");
+        stream.SetFormat(2, 44100, 16);
+        unsigned char samples[100];
+        for (unsigned int i = 0; i < sizeof(samples); i++)
+        {
+            samples[i] = static_cast<unsigned char>(i);
+        }
+        ok = ok && Check(stream.HasFormat(), "format after SetFormat")
+             && Check(stream.Write(samples, 0) && sink.writes.empty(), "nothing written for no samples")
+             && Check(stream.Write(samples, 40) && sink.writes.size() == 1, "one write for the first samples")
+             && Check(stream.Write(samples + 40, 60) && sink.writes.size() == 2, "one write for later samples");
+        if (!ok)
+        {
+            return false;
+        }
+
+        const std::vector<unsigned char>& first = sink.writes[0];
+        return Check(first.size() == WavStream::HEADER_SIZE + 40, "size of the first write")
+               && Check(memcmp(&first[0], "RIFF", 4) == 0 && memcmp(&first[8], "WAVEfmt ", 8) == 0
+                        && memcmp(&first[36], "data", 4) == 0, "chunk IDs")
+               && Check(GetLE(&first[WavStream::RIFF_SIZE_OFFSET], 4) == 0xFFFFFFFF
+                        && GetLE(&first[WavStream::DATA_SIZE_OFFSET], 4) == 0xFFFFFFFF, "unknown sizes")
+               && Check(GetLE(&first[16], 4) == 16 && GetLE(&first[20], 2) == 1 && GetLE(&first[22], 2) == 2
+                        && GetLE(&first[24], 4) == 44100 && GetLE(&first[28], 4) == 44100 * 4
+                        && GetLE(&first[32], 2) == 4 && GetLE(&first[34], 2) == 16, "format chunk")
+               && Check(memcmp(&first[WavStream::HEADER_SIZE], samples, 40) == 0
+                        && memcmp(&sink.writes[1][0], samples + 40, 60) == 0, "samples")
+               && Check(stream.GetSampleBytes() == 100, "sample byte count");
+    }
+
+    bool ReadAll(int fd, unsigned char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t count = read(fd, data, size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            data += count;
+            size -= static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    /*
+     * The dummy encoder, returns its exit code.
+     */
+    int Consume(int video_fd, int audio_fd)
+    {
+        std::string header;
+        unsigned char c = 0;
+        while (header.size() < 200 && ReadAll(video_fd, &c, 1) && c != '\n')
+        {
+            header += static_cast<char>(c);
+        }
+        char expected_header[128];
+        sprintf(expected_header, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444", PIPE_WIDTH, PIPE_HEIGHT, PIPE_FPS);
+        if (header != expected_header)
+        {
+            fprintf(stderr, "consumer: wrong video header \"%s\"\n", header.c_str());
+            return 1;
+        }
+        unsigned char wav_header[WavStream::HEADER_SIZE];
+        if (!ReadAll(audio_fd, wav_header, sizeof(wav_header)) || memcmp(wav_header, "RIFF", 4) != 0)
+        {
+            fprintf(stderr, "consumer: wrong audio header\n");
+            return 1;
+        }
+
+        size_t plane = PIPE_WIDTH * PIPE_HEIGHT;
+        std::vector<unsigned char> frame(6 + plane * 3);
+        std::vector<unsigned char> pixels;
+        std::vector<unsigned char> audio(AUDIO_FRAME_BYTES);
+        std::vector<unsigned char> expected_audio;
+        for (int index = 0; index < PIPE_FRAMES; index++)
+        {
+            if (!ReadAll(video_fd, &frame[0], frame.size()) || memcmp(&frame[0], "FRAME\n", 6) != 0)
+            {
+                fprintf(stderr, "consumer: video frame %d is missing or damaged\n", index);
+                return 1;
+            }
+            GenerateFrame(index, &pixels);
+            for (size_t i = 0; i < plane; i += 97)
+            {
+                const unsigned char* in = &pixels[((PIPE_HEIGHT - 1 - i / PIPE_WIDTH) * PIPE_WIDTH + i % PIPE_WIDTH) * 3];
+                if (!CloseToBT601(in[2], in[1], in[0], frame[6 + i], frame[6 + plane + i], frame[6 + plane * 2 + i]))
+                {
+                    fprintf(stderr, "consumer: video frame %d has the wrong colors\n", index);
+                    return 1;
+                }
+            }
+            GenerateAudio(index, &expected_audio);
+            if (!ReadAll(audio_fd, &audio[0], audio.size()) || audio != expected_audio)
+            {
+                fprintf(stderr, "consumer: the audio of frame %d is missing or wrong\n", index);
+                return 1;
+            }
+        }
+        if (read(video_fd, &c, 1) != 0 || read(audio_fd, &c, 1) != 0)
+        {
+            fprintf(stderr, "consumer: more data than was written\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    void TimedOut(int)
+    {
+        static const char message[] = "FAILED: the capture and the encoder are waiting on each other\n";
+        ssize_t ignored = write(STDOUT_FILENO, message, sizeof(message) - 1);
+        (void)ignored;
+        _exit(1);
+    }
+
+    bool TestPipes()
+    {
+        int video_pipe[2];
+        int audio_pipe[2];
+        if (pipe(video_pipe) != 0 || pipe(audio_pipe) != 0)
+        {
+            printf("FAILED: can't create pipes\n");
+            return false;
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child < 0)
+        {
+            printf("FAILED: can't start the dummy encoder\n");
+            return false;
+        }
+        if (child == 0)
+        {
+            close(video_pipe[1]);
+            close(audio_pipe[1]);
+            _exit(Consume(video_pipe[0], audio_pipe[0]));
+        }
+        close(video_pipe[0]);
+        close(audio_pipe[0]);
+
+        signal(SIGALRM, TimedOut);
+        alarm(PIPE_TIMEOUT_SECONDS);
+        PipeSink video_sink(video_pipe[1]);
+        PipeSink audio_sink(audio_pipe[1]);
+        Y4MStream video(&video_sink);
+        WavStream audio(&audio_sink);
+        video.SetFormat(PIPE_WIDTH, PIPE_HEIGHT, PIPE_FPS);
+        audio.SetFormat(2, 44100, 16);
+        bool audio_ok = true;
+        std::thread audio_thread([&]()
+        {
+            std::vector<unsigned char> samples;
+            for (int index = 0; audio_ok && index < PIPE_FRAMES; index++)
+            {
+                GenerateAudio(index, &samples);
+                audio_ok = audio.Write(&samples[0], static_cast<unsigned int>(samples.size()));
+            }
+            close(audio_pipe[1]);
+        });
+        std::vector<unsigned char> pixels;
+        bool video_ok = true;
+        for (int index = 0; video_ok && index < PIPE_FRAMES; index++)
+        {
+            GenerateFrame(index, &pixels);
+            video_ok = video.WriteFrame(&pixels[0]);
+        }
+        close(video_pipe[1]);
+        audio_thread.join();
+        bool ok = video_ok && audio_ok;
+        int status = 0;
+        waitpid(child, &status, 0);
+        alarm(0);
+        return Check(ok, "writing to the dummy encoder")
+               && Check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the dummy encoder got every frame and its audio");
+    }
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    int failed = 0;
+    failed += TestY4M() ? 0 : 1;
+    failed += TestWav() ? 0 : 1;
+    failed += TestPipes() ? 0 : 1;
+    printf("%d of 3 stream tests passed\n", 3 - failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests the shared frame ring (shared/sharedframes.h) between two processes, like the game and
+ * Hourglass use it. The parent is the reader and the forked child the writer, the ring is in
+ * shared memory and a pipe stands in for the FRAME message: the writer sends the sequence
+ * number of each frame, or that it fell back to handing the frame over the old way.
+ *
+ * Two runs go through the ring:
+ *  - in lock step, the writer waiting for each frame to be handled as the game does, with frames
+ *    too large for a slot and frames that are written but never announced mixed in,
+ *  - free running, the writer only waiting for a free slot, so frames are written into the ring
+ *    while the reader is reading the others.
+ * Every frame that went through the ring has to arrive whole and in order. Needs POSIX, build
+ * and run it with "make check" in this directory.
+ */
+
+#include <csignal>
+#include <cstdio>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <shared/sharedframes.h>
+
+namespace
+{
+    const unsigned int SLOT_COUNT = 3;
+    const unsigned int SLOT_SIZE = 64 * 1024;
+    const int LOCK_STEP_FRAMES = 20000;
+    const int FREE_RUNNING_FRAMES = 30000;
+    const long long FELL_BACK = -1;
+
+    unsigned char PixelValue(int frame, unsigned int index)
+    {
+        return static_cast<unsigned char>(frame * 31 + index * 7 + (index >> 8));
+    }
+
+    unsigned int FrameSize(int frame)
+    {
+        if (frame % 97 == 0)
+        {
+            return SLOT_SIZE + 1;
+        }
+        return 1 + (frame * 7919u) % SLOT_SIZE;
+    }
+
+    bool WriteAll(int fd, const void* data, size_t size)
+    {
+        return write(fd, data, size) == static_cast<ssize_t>(size);
+    }
+
+    bool ReadAll(int fd, void* data, size_t size)
+    {
+        unsigned char* bytes = static_cast<unsigned char*>(data);
+        while (size > 0)
+        {
+            ssize_t count = read(fd, bytes, size);
+            if (count <= 0)
+            {
+                return false;
+            }
+            bytes += count;
+            size -= static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    /*
+     * The game's side, returns the exit code.
+     */
+    int RunWriter(void* memory, unsigned int memory_size, int frames, bool lock_step, int message_fd, int ack_fd)
+    {
+        SharedFrameRing ring;
+        if (!ring.Attach(memory, memory_size))
+        {
+            return 2;
+        }
+        for (int frame = 0; frame < frames; frame++)
+        {
+            unsigned int size = FrameSize(frame);
+            unsigned char* pixels = nullptr;
+            SharedFrameInfo* info = ring.BeginWrite(size, &pixels);
+            while (!lock_step && info == nullptr && size <= ring.GetSlotSize())
+            {
+                /* The reader is still busy with every slot. */
+                sched_yield();
+                info = ring.BeginWrite(size, &pixels);
+            }
+            long long message = FELL_BACK;
+            if (info != nullptr)
+            {
+                info->width = frame;
+                info->height = static_cast<int>(size);
+                for (unsigned int i = 0; i < size; i++)
+                {
+                    pixels[i] = PixelValue(frame, i);
+                }
+                message = ring.EndWrite();
+            }
+            if (lock_step && frame % 50 == 0)
+            {
+                /* A frame written and never announced, the reader has to skip it. */
+                unsigned char* unused = nullptr;
+                SharedFrameInfo* unannounced = ring.BeginWrite(10, &unused);
+                if (unannounced != nullptr)
+                {
+                    unannounced->width = -1;
+                    ring.EndWrite();
+                }
+            }
+            char ack = 0;
+            if (!WriteAll(message_fd, &message, sizeof(message)) || (lock_step && !ReadAll(ack_fd, &ack, 1)))
+            {
+                return 3;
+            }
+        }
+        return 0;
+    }
+
+    bool RunRing(const char* name, int frames, bool lock_step)
+    {
+        unsigned int memory_size = SharedFrameRing::GetMemorySize(SLOT_COUNT, SLOT_SIZE);
+        void* memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        SharedFrameRing ring;
+        if (memory == MAP_FAILED || ring.Create(memory, memory_size - 1, SLOT_COUNT, SLOT_SIZE)
+            || !ring.Create(memory, memory_size, SLOT_COUNT, SLOT_SIZE))
+        {
+            printf("%s: the ring can't be created in exactly GetMemorySize bytes\n", name);
+            return false;
+        }
+        ring.SetEnabled(true);
+
+        int messages[2];
+        int acks[2];
+        if (pipe(messages) != 0 || pipe(acks) != 0)
+        {
+            printf("%s: can't create pipes\n", name);
+            return false;
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            close(messages[0]);
+            close(acks[1]);
+            _exit(RunWriter(memory, memory_size, frames, lock_step, messages[1], acks[0]));
+        }
+        close(messages[1]);
+        close(acks[0]);
+
+        int received = 0;
+        int fell_back = 0;
+        int last_frame = -1;
+        const char* problem = nullptr;
+        for (int frame = 0; frame < frames && problem == nullptr; frame++)
+        {
+            long long message = 0;
+            if (!ReadAll(messages[0], &message, sizeof(message)))
+            {
+                problem = "the writer stopped early";
+                break;
+            }
+            if (message == FELL_BACK)
+            {
+                /*
+                 * What Hourglass does when a frame comes the old way. Free running, the frames
+                 * after it may already be in the ring, so there's nothing stale to drop.
+                 */
+                if (lock_step)
+                {
+                    ring.DropFrames();
+                }
+                fell_back++;
+            }
+            else
+            {
+                const unsigned char* pixels = nullptr;
+                unsigned int sequence = static_cast<unsigned int>(message);
+                const SharedFrameInfo* info = ring.BeginRead(sequence, &pixels);
+                if (info == nullptr || info->width != frame || info->width <= last_frame
+                    || info->height != static_cast<int>(FrameSize(frame)))
+                {
+                    problem = "an announced frame isn't in the ring";
+                    break;
+                }
+                for (int i = 0; i < info->height; i++)
+                {
+                    if (pixels[i] != PixelValue(frame, i))
+                    {
+                        problem = "a frame's pixels were changed while it was read";
+                        break;
+                    }
+                }
+                ring.EndRead();
+                last_frame = frame;
+                received++;
+                if (ring.BeginRead(sequence, &pixels) != nullptr || ring.BeginRead(sequence + 5, &pixels) != nullptr)
+                {
+                    problem = "a frame that was already read, or isn't written yet, was returned";
+                }
+            }
+            if (lock_step && !WriteAll(acks[1], "k", 1))
+            {
+                problem = "the writer stopped early";
+            }
+        }
+        close(messages[0]);
+        close(acks[1]);
+        if (problem != nullptr)
+        {
+            /* The writer may be waiting for a slot that is never given back. */
+            kill(child, SIGKILL);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (problem == nullptr && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+        {
+            problem = "the writer failed";
+        }
+        if (problem == nullptr && fell_back != (frames + 96) / 97)
+        {
+            problem = "the wrong frames fell back";
+        }
+
+        if (problem == nullptr)
+        {
+            /* A disabled ring refuses frames, and there's no ring in memory that wasn't set up. */
+            ring.SetEnabled(false);
+            SharedFrameRing writer;
+            unsigned char* pixels = nullptr;
+            unsigned char junk[256] = { 0 };
+            if (!writer.Attach(memory, memory_size) || writer.BeginWrite(1, &pixels) != nullptr)
+            {
+                problem = "a disabled ring took a frame";
+            }
+            else if (writer.Attach(junk, sizeof(junk)))
+            {
+                problem = "attached to memory without a ring";
+            }
+        }
+        munmap(memory, memory_size);
+
+        if (problem != nullptr)
+        {
+            printf("%s: FAILED, %s\n", name, problem);
+            return false;
+        }
+        printf("%s: %d frames through the ring, %d fell back\n", name, received, fell_back);
+        return true;
+    }
+}
+
+int main()
+{
+    int failed = 0;
+    failed += RunRing("lock step", LOCK_STEP_FRAMES, true) ? 0 : 1;
+    failed += RunRing("free running", FREE_RUNNING_FRAMES, false) ? 0 : 1;
+    if (SharedFrameRing::GetName(1234) != "Hourglass-SharedFrames-1234")
+    {
+        printf("the mapping name is %s\n", SharedFrameRing::GetName(1234).c_str());
+        failed++;
+    }
+    printf("%d of 3 shared frame ring tests passed\n", 3 - failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Stands in for wintasee's global.h when wintasee/soundmixing.cpp and soundmixthreads.cpp are
+ * built on its own, with just the Windows types and calls the mixing uses. The structures are
+ * copies of the ones in wintasee/tramps/soundtramps.h and have to be kept the same.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef unsigned int DWORD;
+typedef unsigned short WORD;
+typedef int BOOL;
+typedef void* PVOID;
+typedef void* LPVOID;
+
+#define FALSE 0
+#define TRUE 1
+#define INFINITE 0xFFFFFFFF
+#define WINAPI
+
+/* After the standard headers, which can't have these defined. */
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile* destination, PVOID exchange, PVOID comparand)
+{
+    return __sync_val_compare_and_swap(destination, comparand, exchange);
+}
+
+/*
+ * Events and threads are all the mixing threads use. Events reset when a wait returns, like the
+ * ones CreateEvent makes with bManualReset FALSE.
+ */
+struct StubHandle
+{
+    std::mutex mutex;
+    std::condition_variable signaled_changed;
+    bool signaled;
+};
+typedef StubHandle* HANDLE;
+typedef DWORD (WINAPI* LPTHREAD_START_ROUTINE)(LPVOID);
+
+inline HANDLE CreateEvent(void*, BOOL, BOOL initially_signaled, const char*)
+{
+    HANDLE event = new StubHandle;
+    event->signaled = initially_signaled != FALSE;
+    return event;
+}
+
+inline BOOL SetEvent(HANDLE event)
+{
+    std::lock_guard<std::mutex> lock(event->mutex);
+    event->signaled = true;
+    event->signaled_changed.notify_one();
+    return TRUE;
+}
+
+inline DWORD WaitForSingleObject(HANDLE event, DWORD)
+{
+    std::unique_lock<std::mutex> lock(event->mutex);
+    while (!event->signaled)
+    {
+        event->signaled_changed.wait(lock);
+    }
+    event->signaled = false;
+    return 0;
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+    delete handle;
+    return TRUE;
+}
+
+/*
+ * The mixing threads never exit, so their handles are never waited on.
+ */
+inline HANDLE CreateThread(void*, size_t, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD, DWORD* thread_id)
+{
+    std::thread(start, parameter).detach();
+    *thread_id = 0;
+    return new StubHandle;
+}
+
+inline HANDLE GetCurrentThread()
+{
+    return nullptr;
+}
+
+inline int GetThreadPriority(HANDLE)
+{
+    return 0;
+}
+
+inline BOOL SetThreadPriority(HANDLE, int)
+{
+    return TRUE;
+}
+
+/*
+ * As many processors as it takes for every mixing thread to be started, however many there
+ * really are, so that mixing on them is always tested.
+ */
+struct SYSTEM_INFO
+{
+    DWORD dwNumberOfProcessors;
+};
+
+inline void GetSystemInfo(SYSTEM_INFO* info)
+{
+    info->dwNumberOfProcessors = 4;
+}
+
+struct CachedVolumeAndPan
+{
+    DWORD leftVolumeAsScale; /* out of 65536 */
+    DWORD rightVolumeAsScale; /* out of 65536 */
+};
+
+struct SoundMixJob
+{
+    DWORD pos1, pos2, outPos1, outPos2;
+    bool pos2IsLastSample;
+    DWORD outSamplesPerSec;
+    WORD myBitsPerSample, outBitsPerSample, myChannels, outChannels, myBlockSize, outBlockSize;
+    unsigned char* buffer;
+    DWORD bufferBytes;
+    bool highQuality;
+    CachedVolumeAndPan volumes;
+};
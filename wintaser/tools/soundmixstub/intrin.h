@@ -0,0 +1,25 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Stands in for MSVC's intrin.h when wintasee/soundmixing.cpp is built on its own with GCC or
+ * Clang: the CPUID intrinsics, in the form MSVC has them. _xgetbv comes from immintrin.h, which
+ * has it when building with -mxsave.
+ */
+
+#pragma once
+
+#include <cpuid.h>
+
+/*
+ * Newer cpuid.h have a __cpuidex of their own and __cpuid is a macro there, so both are pointed
+ * at this one.
+ */
+inline void SoundMixCpuid(int registers[4], int leaf, int subleaf)
+{
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+}
+
+#undef __cpuid
+#define __cpuid(registers, leaf) SoundMixCpuid(registers, leaf, 0)
+#define __cpuidex SoundMixCpuid
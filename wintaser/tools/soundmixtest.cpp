@@ -0,0 +1,615 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Tests and times wintasee's sound mixing (wintasee/soundmixing.cpp and soundmixthreads.cpp)
+ * without Windows or a game. The files are built right into this one, with the stand-ins in
+ * soundmixstub for the Windows headers, so that the mixing kernels can be called one by one.
+ *
+ *     soundmixtest          runs the tests
+ *     soundmixtest bench    times every kernel for each of the 16 format combinations and a
+ *                           few rates, then mixing frames with more and more sound buffers
+ *
+ * The tests check that:
+ *  - the SIMD kernels give exactly what the plain one does, for all 16 format combinations,
+ *  - mixing a few frames of generated sound buffers hashes to the golden value below, for every
+ *    output format, buffer format, buffer rate, number of buffers and resampling quality, and
+ *    comes out the same with and without the mixing threads.
+ * If the output changes on purpose, the new hashes are printed and go in GOLDEN_HASHES.
+ *
+ * The AVX2 kernels are only in the build of this made with -mavx2, soundmixtest-avx2, which has
+ * to hash to the same values. Build and run them with "make check" in this directory.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../../wintasee/soundmixing.cpp"
+#include "../../wintasee/soundmixthreads.cpp"
+
+/*
+ * wintasee names its threads for debuggers, there's nothing to do here.
+ */
+void SetThreadName(DWORD dwThreadID, char* threadName)
+{
+}
+
+namespace
+{
+    const int CHECK_RUNS = 400;
+    const DWORD BENCH_OUTPUT_FRAMES = 44100;
+    const int BENCH_REPEATS = 20;
+    /*
+     * A second of sound at each of these rates is mixed into a second at 44100 Hz.
+     */
+    const DWORD BENCH_INPUT_RATES[] = { 11025, 22050, 44100, 48000 };
+    const int BENCH_VOICE_COUNTS[] = { 1, 8, 16, 32, 64 };
+    const int BENCH_VIDEO_FRAMES = 600;
+
+    /*
+     * The sound is mixed a frame of video at a time, 60 frames per second, into a 44100 Hz
+     * buffer.
+     */
+    const DWORD OUTPUT_RATE = 44100;
+    const DWORD VIDEO_RATE = 60;
+    const int GOLDEN_VIDEO_FRAMES = 4;
+
+    struct SoundFormat
+    {
+        WORD bits;
+        WORD channels;
+    };
+
+    const SoundFormat FORMATS[] = { { 8, 1 }, { 8, 2 }, { 16, 1 }, { 16, 2 } };
+    const int FORMAT_COUNT = sizeof(FORMATS) / sizeof(FORMATS[0]);
+    const DWORD SOURCE_RATES[] = { 11025, 22050, 44100, 48000 };
+    const int RATE_COUNT = sizeof(SOURCE_RATES) / sizeof(SOURCE_RATES[0]);
+    /*
+     * 16 and more are split between the mixing threads.
+     */
+    const int VOICE_COUNTS[] = { 1, 4, 16, 40 };
+    const int VOICE_COUNT_COUNT = sizeof(VOICE_COUNTS) / sizeof(VOICE_COUNTS[0]);
+    const int GOLDEN_COLUMNS = VOICE_COUNT_COUNT * 2;
+    const int GOLDEN_COUNT = FORMAT_COUNT * FORMAT_COUNT * RATE_COUNT * GOLDEN_COLUMNS;
+
+    /*
+     * FNV-1a of the mixed output. One row for each output format, each with a row for each buffer
+     * format, each with a row for each buffer rate. In a row, each number of buffers mixed with
+     * linear interpolation and then with the sinc filter.
+     */
+    const unsigned int GOLDEN_HASHES[GOLDEN_COUNT] =
+    {
+        0x1EC4934C, 0x060FE533, 0xD82AEFD8, 0xDE7BA524, 0x4F5F1332, 0xD4A03827, 0x08981A80, 0x53908C17,
+        0xAB87D66D, 0x6160D962, 0xECB36934, 0xBFB8E648, 0x503380D1, 0x42352D9F, 0xA0DBF2CB, 0x4A0D05E1,
+        0xA771BF02, 0x674828CF, 0x76CFD5C3, 0xEFBB3A7F, 0xD1FE984D, 0xF944B807, 0x632D31DF, 0x154D2FEE,
+        0x2A1B3D90, 0x1FA5BD71, 0xE810BC9E, 0x4FA857BB, 0xC024FDF6, 0x92FEBF8F, 0x0D7F8ABF, 0xB1B6A462,
+        0xE719C24A, 0xCAA9BB2A, 0x2F037C73, 0x38C3F76B, 0x37B38539, 0xC2FBE217, 0x192F706C, 0x73EEF732,
+        0xB10AF413, 0x899503C1, 0xF56CF2D4, 0x898075B5, 0x0145F32B, 0xC415D9F3, 0xED0F06BB, 0x5B583079,
+        0x1C264EEA, 0x9138750B, 0xDE5FDF5C, 0xD762E787, 0xD813C5E9, 0xB82DC7A0, 0x1ED92E78, 0x1AB1F807,
+        0xEE1361D3, 0xD152B3E7, 0x126A42D7, 0xC69546FA, 0x50239799, 0x685EA01C, 0xA9812D8A, 0x7F60FE2F,
+        0xFB127B5E, 0x35C07E2E, 0x038AEB88, 0xE243B5A0, 0x303BDF75, 0x83992FC7, 0x7838DD28, 0xAACD681F,
+        0x930926F3, 0xBE4EAD77, 0x118B2021, 0x2D8398B3, 0xD92285B0, 0x58B62B99, 0x4D5BE287, 0x45E34C65,
+        0xE3D22D68, 0x97CEA877, 0xA174DE55, 0x86319652, 0x110A2977, 0x95F87D0B, 0xFBD26AF2, 0x8B7AB20F,
+        0x7D2CDA7C, 0x26C28C0E, 0xAD60DCFB, 0x06ED3DCE, 0x84DBF4E7, 0x6BFBA78F, 0x0C11C7C6, 0x6CFF1354,
+        0xF9626152, 0x49378EB8, 0xAA572E59, 0x046492BC, 0x4C5C7203, 0x2A1BDA8B, 0x32781EBE, 0x835BBE79,
+        0xF8E3E689, 0x7A539597, 0x179CF72A, 0xBB7DFDA6, 0x695E2300, 0x13CA5E7F, 0xE1F4A9C5, 0xAF2405B3,
+        0x5CED16B5, 0xAE4F9653, 0x23E25B55, 0x631CF4B6, 0xD355779E, 0x2CD943DC, 0x7F7329D4, 0x60587BEA,
+        0xB4711345, 0x4385982D, 0x5621C7F5, 0x3DE15855, 0x13E12F60, 0x273DDFFC, 0x98B3BB9E, 0x143D53A7,
+        0xF4D9FA8D, 0xCD60602E, 0x65B2A6E3, 0x217E8F0D, 0x39123BC9, 0xB748E9EA, 0x590B862F, 0xAC9EBEAD,
+        0xF034C96E, 0x1975D577, 0xFADBDDA7, 0xB96BCC80, 0x8EE0C752, 0xD2F71463, 0x0F949E8A, 0x2F1DEE5B,
+        0xB91B06F9, 0x774356B9, 0x9ADEADBC, 0x86F25993, 0xC1D7AED3, 0xB263BA1C, 0xBA732F0B, 0x8F89BB74,
+        0xE1DC8509, 0x97728C12, 0xB415C628, 0xCA08B8BC, 0x2F019118, 0x33B18CEB, 0x9E1F2985, 0xAD1CAF24,
+        0x6AA589CE, 0x70789B67, 0xE6191969, 0x0B10F231, 0x2DA5462A, 0x013F11DE, 0x44F39396, 0xDC4F3039,
+        0xF27EFA5F, 0x3982F9C7, 0xE899CF72, 0xC358C910, 0x2EA688E3, 0xCE122FEF, 0x82CEDC5F, 0x50E19823,
+        0x8178A811, 0x92F0F52A, 0xE4A23DF3, 0x3B9BBC8C, 0xAEDEE2FC, 0x21727433, 0xDB0F6517, 0x5D485E48,
+        0x70501C4C, 0x0F3D5218, 0x2719DEA0, 0x25407EAC, 0x3397005C, 0x58EBD9AF, 0xF6347F10, 0xE9E98248,
+        0xC10AD427, 0x99B9DC79, 0xDB10E76F, 0xF1C3CDEA, 0xC1F4A922, 0x3515E3CF, 0x1865F712, 0xF1520336,
+        0xDA7968B3, 0x5CE84048, 0x145F1B4C, 0x180B2602, 0xFB1E824A, 0xBC871108, 0x948C8B67, 0x5A6082C6,
+        0xF2E50724, 0xB47975C9, 0x491398B6, 0xE32FB16F, 0xD572604D, 0x32548993, 0xA7042657, 0x8B303EED,
+        0x42377C8C, 0xF5870E07, 0xB2F8D071, 0x817BA14A, 0xFBB2BF7C, 0x55054B04, 0xD0EC7BA4, 0xF0C35AA2,
+        0x9DF19BC4, 0x9BFC97D2, 0x860F4F62, 0x142195A5, 0xC6E1FE0C, 0x2E2425CF, 0x7546F3A7, 0xBBA41247,
+        0x7A41A4D7, 0xAC0BD29D, 0x217F8B60, 0x1FAB485C, 0x4D4AD532, 0x8232CDEB, 0x49EDC42D, 0x41944C02,
+        0xE403BAD4, 0xB5A302B5, 0x1C995D1D, 0xB1872B8E, 0xE5454B77, 0x873EB12F, 0x6410FB81, 0x9FD59A9D,
+        0xE41F1F59, 0x262693BB, 0x4775F1D8, 0x1A16333B, 0x1598EEC2, 0x44CA7D99, 0x52DBA4BE, 0xC7E9837A,
+        0x17930DFC, 0x9C0F2292, 0xDF9A96DA, 0x5E0ABC29, 0x0C81911E, 0x5702E949, 0xFB72D595, 0x78B61403,
+        0xEC93E4BB, 0x730A5688, 0x68C13318, 0x6CD2C74C, 0xD046951C, 0x791B81D6, 0x1EF95306, 0x3E3CD9B0,
+        0x1201EC0C, 0x6E5A5F82, 0x0611D014, 0xEA3BE323, 0xE509EF68, 0x62CC8783, 0x495778DB, 0x2D6A5596,
+        0xD36BD6D2, 0x9E46FD91, 0xAF6220DE, 0xD112775D, 0xA82FECA7, 0x66DF6577, 0x92BD8D02, 0x0A39F0C5,
+        0x8F52213F, 0x366E8ECE, 0xFF43DDA0, 0x985239DF, 0x66BCD9E7, 0xF9621DF6, 0x14BE2DF2, 0x58CF4DEC,
+        0xAA5CA977, 0x8BB93BA3, 0x88930B53, 0x5594BA2B, 0x2E6892A6, 0x9DF09E82, 0xBDF2EC4A, 0xD700C706,
+        0xBA89DB53, 0x8BB1E418, 0x7360D37B, 0xBC8011F2, 0x344D3DFE, 0xCF6BFB35, 0x078008EB, 0x88429EEB,
+        0xD93E2EF7, 0x8272E4C9, 0xF07F8AC2, 0x94562029, 0x309A1ED9, 0x20A452F4, 0x29DA978E, 0xA5284AA3,
+        0x412DCE24, 0xD9CFD305, 0x8FE5463C, 0xF727ED46, 0x43B58380, 0xC7817AFF, 0x2BA52D74, 0xAC633F9A,
+        0x2B4E5306, 0x1126F46A, 0x636BE99E, 0xFDCD8000, 0x868F75D6, 0x5E6EF312, 0x906C822D, 0x0DA0BEAF,
+        0xBBE1A301, 0xA81499E3, 0x89A17887, 0x74152991, 0xE639EF91, 0x3B17A842, 0x6D8F5185, 0x844A775B,
+        0x7463D8ED, 0x0B08E373, 0x1A579F21, 0x303787ED, 0x3F4618DB, 0xE0C11E5F, 0xA7C58AF7, 0x143A0910,
+        0x0445FAA7, 0xFEA1CABC, 0xE5339127, 0x853DCB67, 0x9E1B663B, 0xA9FF7D1A, 0x2EEDD2BE, 0x0E441867,
+        0x07F35D53, 0xFC2EF91A, 0xA9F37C97, 0xF9F068BC, 0x1A1FFC2D, 0x5333175E, 0x55A45F36, 0x777B3B95,
+        0x91865294, 0x2D0BE37B, 0xC0D7F4BD, 0x462CBD1D, 0xCF27ED61, 0xB714D8F9, 0xBCE90E0D, 0x458C0923,
+        0xAB51038B, 0x1D4893D3, 0x92FC8E72, 0x98FC08AE, 0x89CE6EAC, 0x6AF8E0EE, 0x0F94258F, 0xDD9D24C2,
+        0x8CD463FC, 0x2E62D862, 0xA5649461, 0x799BA323, 0x3AF64CE5, 0xC35E78D4, 0x9EDB722C, 0xB11F3B38,
+        0x7490A36D, 0xBD855730, 0x0AFD46C1, 0x69856D96, 0xA43C03BF, 0xE9F094A8, 0xABA46B52, 0xACB9AE85,
+        0xB251CAF0, 0xEA8DDD6D, 0x4B802932, 0x046DAB55, 0x1982F237, 0x92B16030, 0x559F66A4, 0xCF2AE776,
+        0x29618AC4, 0x18E56B6F, 0x36A1EEB3, 0x01795FE4, 0x49179AA9, 0x3B79E7A7, 0x693C6BE8, 0xDD16F63D,
+        0x4D40EC84, 0x3FF54131, 0x4C4B22A2, 0xBBB34E97, 0x93AA0DFB, 0xFDDD96BC, 0xDC903D3B, 0xA6621C2F,
+        0x47A038DE, 0x0CB7D5B6, 0xC68E1D53, 0x1009F704, 0xEB25E2F8, 0xA9C03A94, 0x3E140954, 0x821377C3,
+        0x4A97F615, 0x72063A2C, 0xC14F3AD5, 0x4623DFAC, 0xD20E925E, 0x4C33003B, 0x7DB0D403, 0x3A06B6E3,
+        0xFAC7B08D, 0x34B16B7A, 0xD1C37288, 0xB92F016F, 0x13296E16, 0xA7C7E7B7, 0x5D6F08A3, 0xF9FC7F7E,
+        0xD659A96E, 0x1D69B6AF, 0x32CAD41D, 0xC1E641BA, 0xE5E3C10E, 0xB3668506, 0x4E03F8E6, 0x23F51EFC,
+        0x489A5C0D, 0x193767B8, 0x57B3E538, 0x083C34A3, 0xE1118B17, 0xD9A99B88, 0x50E318EC, 0x9589EE74,
+        0x3BDD1125, 0x1A94B5E2, 0x08CF7E93, 0x689CAB89, 0xC03E342D, 0x941672B5, 0xED7677CF, 0x778E2CC7,
+        0x44248D6D, 0x578C264B, 0xDAE7A9B9, 0x86E513EB, 0x3DDAA768, 0x74C14B3C, 0xA62FD276, 0xD8C907D1,
+        0x3D5E40DE, 0x34C56549, 0x6759E4BF, 0x0D500B52, 0xB94FFFD7, 0xFE2F92B0, 0xB0BBF9B5, 0xE1E3E2FF,
+        0x658EC6DB, 0x71653740, 0x2786004A, 0x01716A3B, 0x806E563F, 0x4EE976FD, 0x762CBA66, 0xC67D400B,
+        0xC70BCE0C, 0x9F5DEBAE, 0xA56D5E9D, 0xB92A8F79, 0x61F282F3, 0x440C3A8E, 0x8B7C572C, 0xC0BF0313,
+        0x742BCDCF, 0x1E846CEC, 0xFF541BFA, 0xC0EF563E, 0x715CC98A, 0xAF832A4D, 0xEB15EF5D, 0x2757DB30,
+    };
+
+    unsigned int s_random = 1;
+
+    unsigned int NextRandom()
+    {
+        s_random = s_random * 1103515245 + 12345;
+        return s_random >> 8;
+    }
+
+    typedef void (*MixFunction)(const unsigned char* buf, int* bus, DWORD size, DWORD outSize, bool sizeReachesBufferEnd,
+                                CachedVolumeAndPan& volumes);
+
+    /*
+     * The kernels for one combination of formats, at each level Mix can run at.
+     */
+    struct MixKernels
+    {
+        char name[32];
+        int from_frame_size;
+        int to_frame_size;
+        int to_channels;
+        MixFunction scalar;
+        MixFunction sse2;
+        MixFunction avx2;
+    };
+
+    template<typename fromtype, typename totype, int fromchannels, int tochannels>
+    MixKernels MakeKernels()
+    {
+        MixKernels kernels;
+        sprintf(kernels.name, "%s %s to %s %s", sizeof(fromtype) == 1 ? "8-bit" : "16-bit",
+                fromchannels == 1 ? "mono" : "stereo", sizeof(totype) == 1 ? "8-bit" : "16-bit",
+                tochannels == 1 ? "mono" : "stereo");
+        kernels.from_frame_size = sizeof(fromtype) * fromchannels;
+        kernels.to_frame_size = sizeof(totype) * tochannels;
+        kernels.to_channels = tochannels;
+        kernels.scalar = Mix<fromtype, totype, fromchannels, tochannels>;
+        kernels.sse2 = MixBatched<fromtype, totype, fromchannels, tochannels, MIX_SSE2>;
+#if MIX_HAS_AVX2
+        kernels.avx2 = MixBatched<fromtype, totype, fromchannels, tochannels, MIX_AVX2>;
+#else
+        kernels.avx2 = nullptr;
+#endif
+        return kernels;
+    }
+
+    template<typename fromtype, typename totype>
+    void AddKernels(std::vector<MixKernels>* kernels)
+    {
+        kernels->push_back(MakeKernels<fromtype, totype, 1, 1>());
+        kernels->push_back(MakeKernels<fromtype, totype, 1, 2>());
+        kernels->push_back(MakeKernels<fromtype, totype, 2, 1>());
+        kernels->push_back(MakeKernels<fromtype, totype, 2, 2>());
+    }
+
+    /*
+     * All 16: 8-bit unsigned and 16-bit signed, in and out, mono and stereo, in and out.
+     */
+    std::vector<MixKernels> GetAllKernels()
+    {
+        std::vector<MixKernels> kernels;
+        AddKernels<unsigned char, unsigned char>(&kernels);
+        AddKernels<unsigned char, signed short>(&kernels);
+        AddKernels<signed short, unsigned char>(&kernels);
+        AddKernels<signed short, signed short>(&kernels);
+        return kernels;
+    }
+
+    /*
+     * Mostly anything, with some runs of the loudest and quietest samples.
+     */
+    void FillInput(std::vector<unsigned char>* input)
+    {
+        for (size_t i = 0; i < input->size(); i++)
+        {
+            (*input)[i] = static_cast<unsigned char>(NextRandom());
+        }
+        size_t run = NextRandom() % (input->size() / 2);
+        memset(&(*input)[run], (NextRandom() & 1) ? 0xFF : 0x00, NextRandom() % (input->size() - run));
+    }
+
+    DWORD RandomVolume()
+    {
+        static const DWORD EDGES[] = { 0, 1, 255, 256, 32767, 32768, 32769, 65535, 65536 };
+        if (NextRandom() % 3 == 0)
+        {
+            return EDGES[NextRandom() % (sizeof(EDGES) / sizeof(EDGES[0]))];
+        }
+        return NextRandom() % 65537;
+    }
+
+    bool CheckKernels()
+    {
+        std::vector<MixKernels> kernels = GetAllKernels();
+        bool avx2 = MIX_HAS_AVX2 && DetectMixLevel() == MIX_AVX2;
+        int levels = avx2 ? 2 : 1;
+        int passed = 0;
+        for (size_t k = 0; k < kernels.size(); k++)
+        {
+            const MixKernels& kernel = kernels[k];
+            const char* problem = nullptr;
+            for (int run = 0; run < CHECK_RUNS && problem == nullptr; run++)
+            {
+                /*
+                 * Anywhere from a lot slower to a lot faster than the output, sometimes exactly
+                 * the same, and down to a single frame.
+                 */
+                DWORD in_frames = 1 + NextRandom() % 3000;
+                DWORD out_frames = (run % 8 == 0) ? in_frames : 1 + NextRandom() % 3000;
+                if (run % 50 == 1)
+                {
+                    out_frames = 1 + NextRandom() % 9;
+                }
+                DWORD size = in_frames * kernel.from_frame_size;
+                DWORD out_size = out_frames * kernel.to_frame_size;
+                bool reaches_end = (NextRandom() & 1) != 0;
+                CachedVolumeAndPan volumes;
+                volumes.leftVolumeAsScale = RandomVolume();
+                volumes.rightVolumeAsScale = RandomVolume();
+
+                /* Mix reads the frame after the range too, when it isn't the end of the buffer. */
+                std::vector<unsigned char> input(size + 2 * kernel.from_frame_size);
+                FillInput(&input);
+                std::vector<int> expected(out_frames * kernel.to_channels);
+                for (size_t i = 0; i < expected.size(); i++)
+                {
+                    expected[i] = static_cast<int>(NextRandom() % 65536) - 32768;
+                }
+                std::vector<int> bus = expected;
+                kernel.scalar(&input[0], &expected[0], size, out_size, reaches_end, volumes);
+
+                for (int level = 0; level < levels && problem == nullptr; level++)
+                {
+                    std::vector<int> result = bus;
+                    (level == 0 ? kernel.sse2 : kernel.avx2)(&input[0], &result[0], size, out_size, reaches_end, volumes);
+                    if (result != expected)
+                    {
+                        printf("%s, %u to %u frames, volumes %u and %u: ", kernel.name, in_frames, out_frames,
+                               volumes.leftVolumeAsScale, volumes.rightVolumeAsScale);
+                        problem = level == 0 ? "SSE2 differs" : "AVX2 differs";
+                        printf("%s\n", problem);
+                    }
+                }
+            }
+            if (problem == nullptr)
+            {
+                passed++;
+            }
+        }
+        printf("%d of %d format combinations mixed the same with SSE2%s\n", passed, static_cast<int>(kernels.size()),
+               avx2 ? " and AVX2" : (MIX_HAS_AVX2 ? " (this CPU has no AVX2)" : " (built without AVX2)"));
+        return passed == static_cast<int>(kernels.size());
+    }
+
+    /*
+     * A sound buffer being played: a second of sound in one format, and where it is for each frame.
+     */
+    struct Voice
+    {
+        SoundFormat format;
+        DWORD rate;
+        std::vector<unsigned char> buffer;
+        DWORD start_frame;
+        bool ends;
+        CachedVolumeAndPan volumes;
+    };
+
+    /*
+     * A square, a saw or a triangle wave with some noise in it, made without floating point so
+     * it's the same everywhere. Some buffers are louder than 65536 and get mixed by the plain
+     * kernel.
+     */
+    void MakeVoice(const SoundFormat& format, DWORD rate, int index, int voice_count, Voice* voice)
+    {
+        voice->format = format;
+        voice->rate = rate;
+        voice->start_frame = (index * 997u) % (rate / 4);
+        voice->ends = index % 3 == 2;
+        DWORD loudest = 2 * 65536 / voice_count + 8192;
+        voice->volumes.leftVolumeAsScale = (index % 5 == 3) ? 70000 : (index * 7919u + 4000) % loudest;
+        voice->volumes.rightVolumeAsScale = (index % 5 == 3) ? 66000 : (index * 3571u + 9000) % loudest;
+
+        DWORD frames = rate;
+        int sample_size = format.bits / 8;
+        voice->buffer.resize(frames * sample_size * format.channels);
+        int period = 20 + index * 13 % 180;
+        unsigned int noise = 12345 + index;
+        for (DWORD frame = 0; frame < frames; frame++)
+        {
+            for (int channel = 0; channel < format.channels; channel++)
+            {
+                int phase = static_cast<int>((frame + channel * period / 4) % period);
+                int value;
+                switch (index % 3)
+                {
+                case 0:
+                    value = phase < period / 2 ? 20000 : -20000;
+                    break;
+                case 1:
+                    value = phase * 60000 / period - 30000;
+                    break;
+                default:
+                    value = (phase < period / 2 ? phase : period - phase) * 120000 / period - 30000;
+                    break;
+                }
+                noise = noise * 1103515245 + 12345;
+                value += static_cast<int>((noise >> 16) % 4096) - 2048;
+                size_t offset = (frame * format.channels + channel) * sample_size;
+                if (sample_size == 1)
+                {
+                    voice->buffer[offset] = static_cast<unsigned char>((value >> 8) + 128);
+                }
+                else
+                {
+                    voice->buffer[offset] = static_cast<unsigned char>(value);
+                    voice->buffer[offset + 1] = static_cast<unsigned char>(value >> 8);
+                }
+            }
+        }
+    }
+
+    /*
+     * The jobs for mixing one frame of video, the way the sound buffers set them up.
+     */
+    void MakeJobs(std::vector<Voice>& voices, const SoundFormat& output, int video_frame, bool high_quality,
+                  std::vector<SoundMixJob>* jobs)
+    {
+        DWORD out_block = output.bits / 8 * output.channels;
+        DWORD out_frames = OUTPUT_RATE / VIDEO_RATE;
+        jobs->resize(voices.size());
+        for (size_t i = 0; i < voices.size(); i++)
+        {
+            Voice& voice = voices[i];
+            DWORD block = voice.format.bits / 8 * voice.format.channels;
+            DWORD first = voice.start_frame + voice.rate * video_frame / VIDEO_RATE;
+            DWORD last = voice.start_frame + voice.rate * (video_frame + 1) / VIDEO_RATE;
+            SoundMixJob& job = (*jobs)[i];
+            job.pos1 = first * block;
+            job.pos2 = last * block;
+            job.outPos1 = 0;
+            job.outPos2 = out_frames * out_block;
+            job.pos2IsLastSample = voice.ends && video_frame == GOLDEN_VIDEO_FRAMES - 1;
+            job.outSamplesPerSec = OUTPUT_RATE;
+            job.myBitsPerSample = voice.format.bits;
+            job.outBitsPerSample = output.bits;
+            job.myChannels = voice.format.channels;
+            job.outChannels = output.channels;
+            job.myBlockSize = static_cast<WORD>(block);
+            job.outBlockSize = static_cast<WORD>(out_block);
+            job.buffer = &voice.buffer[0];
+            job.bufferBytes = static_cast<DWORD>(voice.buffer.size());
+            job.highQuality = high_quality;
+            job.volumes = voice.volumes;
+        }
+    }
+
+    void AddToHash(unsigned int* hash, const std::vector<unsigned char>& data)
+    {
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            *hash = (*hash ^ data[i]) * 16777619u;
+        }
+    }
+
+    /*
+     * Mixes a few frames of the voices and returns the hash of the output, or 0 if mixing them
+     * on the threads comes out different.
+     */
+    unsigned int MixFrames(std::vector<Voice>& voices, const SoundFormat& output, bool high_quality)
+    {
+        DWORD out_size = OUTPUT_RATE / VIDEO_RATE * (output.bits / 8) * output.channels;
+        DWORD bus_samples = out_size / (output.bits / 8);
+        std::vector<SoundMixJob> jobs;
+        std::vector<int> bus(bus_samples);
+        std::vector<int> one_by_one(bus_samples);
+        std::vector<short> sinc_inputs;
+        std::vector<unsigned char> out(out_size);
+        unsigned int hash = 2166136261u;
+        for (int frame = 0; frame < GOLDEN_VIDEO_FRAMES; frame++)
+        {
+            MakeJobs(voices, output, frame, high_quality, &jobs);
+            std::fill(bus.begin(), bus.end(), 0);
+            std::fill(one_by_one.begin(), one_by_one.end(), 0);
+            MixAllInternal(&jobs[0], static_cast<int>(jobs.size()), &bus[0], bus_samples);
+            for (size_t i = 0; i < jobs.size(); i++)
+            {
+                MixFromToInternal(jobs[i], &one_by_one[0], sinc_inputs);
+            }
+            if (bus != one_by_one)
+            {
+                return 0;
+            }
+            MixBusToOutput(&bus[0], &out[0], out_size, output.bits);
+            AddToHash(&hash, out);
+        }
+        return hash;
+    }
+
+    bool CheckGoldenHashes()
+    {
+        bool golden_missing = GOLDEN_HASHES[0] == 0;
+        std::vector<unsigned int> hashes;
+        int failed = 0;
+        for (int o = 0; o < FORMAT_COUNT; o++)
+        {
+            for (int f = 0; f < FORMAT_COUNT; f++)
+            {
+                for (int r = 0; r < RATE_COUNT; r++)
+                {
+                    for (int v = 0; v < VOICE_COUNT_COUNT; v++)
+                    {
+                        std::vector<Voice> voices(VOICE_COUNTS[v]);
+                        for (int i = 0; i < VOICE_COUNTS[v]; i++)
+                        {
+                            MakeVoice(FORMATS[f], SOURCE_RATES[r], i, VOICE_COUNTS[v], &voices[i]);
+                        }
+                        for (int quality = 0; quality < 2; quality++)
+                        {
+                            unsigned int hash = MixFrames(voices, FORMATS[o], quality != 0);
+                            const char* problem = nullptr;
+                            if (hash == 0)
+                            {
+                                problem = "mixing on the threads gives something else";
+                            }
+                            else if (!golden_missing && hash != GOLDEN_HASHES[hashes.size()])
+                            {
+                                problem = "the output doesn't match the golden hash";
+                            }
+                            if (problem != nullptr)
+                            {
+                                printf("%d-bit %s at %u Hz, %d buffers, into %d-bit %s, %s: %s\n", FORMATS[f].bits,
+                                       FORMATS[f].channels == 1 ? "mono" : "stereo", SOURCE_RATES[r], VOICE_COUNTS[v],
+                                       FORMATS[o].bits, FORMATS[o].channels == 1 ? "mono" : "stereo",
+                                       quality != 0 ? "sinc" : "linear", problem);
+                                failed++;
+                            }
+                            hashes.push_back(hash);
+                        }
+                    }
+                }
+            }
+        }
+        if (golden_missing || failed != 0)
+        {
+            printf("hashes of this build:\n");
+            for (size_t i = 0; i < hashes.size(); i++)
+            {
+                printf("%s0x%08X,%s", (i % GOLDEN_COLUMNS == 0) ? "        " : " ", hashes[i],
+                       (i % GOLDEN_COLUMNS == GOLDEN_COLUMNS - 1) ? "\n" : "");
+            }
+        }
+        printf("%d of %d mixes matched\n", GOLDEN_COUNT - failed, GOLDEN_COUNT);
+        return failed == 0 && !golden_missing;
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /*
+     * Output frames per second, in millions.
+     */
+    double TimeKernel(MixFunction mix, const MixKernels& kernel, const std::vector<unsigned char>& input, DWORD in_frames)
+    {
+        std::vector<int> bus(BENCH_OUTPUT_FRAMES * kernel.to_channels);
+        CachedVolumeAndPan volumes;
+        volumes.leftVolumeAsScale = 40000;
+        volumes.rightVolumeAsScale = 20000;
+        double best = 0;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            mix(&input[0], &bus[0], in_frames * kernel.from_frame_size,
+                BENCH_OUTPUT_FRAMES * kernel.to_frame_size, true, volumes);
+            double rate = BENCH_OUTPUT_FRAMES / Seconds(start) / 1e6;
+            best = rate > best ? rate : best;
+        }
+        return best;
+    }
+
+    /*
+     * Mixes a lot of frames of video with the buffers in every format and at every rate, into
+     * 16-bit stereo.
+     */
+    void RunVoiceBenchmark()
+    {
+        const SoundFormat output = { 16, 2 };
+        DWORD out_size = OUTPUT_RATE / VIDEO_RATE * 4;
+        std::vector<int> bus(out_size / 2);
+        std::vector<unsigned char> out(out_size);
+        std::vector<SoundMixJob> jobs;
+        printf("mixing %d frames of video, microseconds per frame, with %d mixing threads besides this one:\n",
+               BENCH_VIDEO_FRAMES, GetNumMixWorkers());
+        printf("%-10s %8s %8s\n", "buffers", "linear", "sinc");
+        for (size_t c = 0; c < sizeof(BENCH_VOICE_COUNTS) / sizeof(BENCH_VOICE_COUNTS[0]); c++)
+        {
+            int count = BENCH_VOICE_COUNTS[c];
+            std::vector<Voice> voices(count);
+            for (int i = 0; i < count; i++)
+            {
+                MakeVoice(FORMATS[i % FORMAT_COUNT], SOURCE_RATES[i / FORMAT_COUNT % RATE_COUNT], i, count, &voices[i]);
+            }
+            printf("%-10d", count);
+            for (int quality = 0; quality < 2; quality++)
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (int frame = 0; frame < BENCH_VIDEO_FRAMES; frame++)
+                {
+                    /* Stays in the one second of sound the buffers have. */
+                    MakeJobs(voices, output, frame % (VIDEO_RATE / 2), quality != 0, &jobs);
+                    std::fill(bus.begin(), bus.end(), 0);
+                    MixAllInternal(&jobs[0], count, &bus[0], static_cast<DWORD>(bus.size()));
+                    MixBusToOutput(&bus[0], &out[0], out_size, output.bits);
+                }
+                printf(" %8.1f", Seconds(start) * 1e6 / BENCH_VIDEO_FRAMES);
+            }
+            printf("\n");
+        }
+    }
+
+    void RunBenchmark()
+    {
+        std::vector<MixKernels> kernels = GetAllKernels();
+        bool avx2 = MIX_HAS_AVX2 && DetectMixLevel() == MIX_AVX2;
+        for (size_t r = 0; r < sizeof(BENCH_INPUT_RATES) / sizeof(BENCH_INPUT_RATES[0]); r++)
+        {
+            DWORD in_frames = BENCH_INPUT_RATES[r];
+            printf("%u Hz to %u Hz, millions of output frames per second, best of %d:\n", in_frames,
+                   BENCH_OUTPUT_FRAMES, BENCH_REPEATS);
+            printf("%-34s %8s %8s %8s\n", "", "plain", "SSE2", avx2 ? "AVX2" : "");
+            for (size_t k = 0; k < kernels.size(); k++)
+            {
+                const MixKernels& kernel = kernels[k];
+                std::vector<unsigned char> input(in_frames * kernel.from_frame_size);
+                FillInput(&input);
+                printf("%-34s %8.1f %8.1f", kernel.name, TimeKernel(kernel.scalar, kernel, input, in_frames),
+                       TimeKernel(kernel.sse2, kernel, input, in_frames));
+                if (avx2)
+                {
+                    printf(" %8.1f", TimeKernel(kernel.avx2, kernel, input, in_frames));
+                }
+                printf("\n");
+            }
+        }
+        RunVoiceBenchmark();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        bool kernels = CheckKernels();
+        bool golden = CheckGoldenHashes();
+        return kernels && golden ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "bench") == 0)
+    {
+        RunBenchmark();
+        return 0;
+    }
+    fprintf(stderr, "usage: %s [bench]\n", argv[0]);
+    return 2;
+}
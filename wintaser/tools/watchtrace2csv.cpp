@@ -0,0 +1,202 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Converts a RAM watch trace to CSV, one row per recorded frame and one column per watch.
+ *
+ *     watchtrace2csv trace.hgwt [first frame [last frame]] > trace.csv
+ *
+ * Only samples whose frame number is in the range are written. Frames recorded more than once,
+ * after loading a savestate, show up once per time they were recorded. Blocks whose frame range
+ * (from the block header) is outside the range are seeked over without being read or unpacked.
+ *
+ * This is not part of the Visual Studio solution, it only needs a C++ compiler and the standard
+ * library, for example: g++ -O2 -o watchtrace2csv watchtrace2csv.cpp
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../watchtraceformat.h"
+
+namespace
+{
+    void PrintValue(unsigned long long raw, const WatchTrace::Watch& watch)
+    {
+        unsigned int bytes = WatchTrace::SizeIDToBytes(watch.size);
+        if (bytes < 8)
+        {
+            raw &= (1ull << (bytes * 8)) - 1;
+        }
+        switch (watch.type)
+        {
+        case 'f':
+            if (bytes == 8)
+            {
+                double value = 0;
+                memcpy(&value, &raw, sizeof(value));
+                printf("%.17g", value);
+            }
+            else
+            {
+                float value = 0;
+                unsigned int bits = static_cast<unsigned int>(raw);
+                memcpy(&value, &bits, sizeof(value));
+                printf("%.9g", static_cast<double>(value));
+            }
+            break;
+        case 's':
+        {
+            /* Sign-extend from the watch's size. */
+            unsigned int shift = 64 - bytes * 8;
+            long long value = static_cast<long long>(raw << shift) >> shift;
+            printf("%lld", value);
+            break;
+        }
+        case 'h':
+            printf("0x%0*llX", static_cast<int>(bytes * 2), raw);
+            break;
+        default:
+            printf("%llu", raw);
+            break;
+        }
+    }
+
+    /*
+     * Writes text as a CSV field, quoted if it has to be.
+     */
+    void PrintField(const std::string& text)
+    {
+        if (text.find_first_of(",\"\r\n") == std::string::npos)
+        {
+            fputs(text.c_str(), stdout);
+            return;
+        }
+        putchar('"');
+        for (unsigned int i = 0; i < text.size(); i++)
+        {
+            if (text[i] == '"')
+            {
+                putchar('"');
+            }
+            putchar(text[i]);
+        }
+        putchar('"');
+    }
+
+    void PrintHeaderRow(const std::vector<WatchTrace::Watch>& watches)
+    {
+        fputs("frame", stdout);
+        for (unsigned int i = 0; i < watches.size(); i++)
+        {
+            char address[16];
+            sprintf(address, "%08X", watches[i].address);
+            putchar(',');
+            PrintField(watches[i].name.empty() ? std::string(address)
+                                               : std::string(address) + " " + watches[i].name);
+        }
+        putchar('\n');
+    }
+
+    /*
+     * Returns false if the block is corrupt.
+     */
+    bool PrintBlock(const std::vector<unsigned char>& unpacked, unsigned int samples,
+                    const std::vector<WatchTrace::Watch>& watches, long long first, long long last)
+    {
+        unsigned int columns = static_cast<unsigned int>(watches.size()) + 1;
+        std::vector<unsigned long long> values(static_cast<size_t>(columns) * samples);
+        unsigned int position = 0;
+        for (unsigned int column = 0; column < columns; column++)
+        {
+            if (!WatchTrace::DecodeColumn(unpacked.empty() ? nullptr : &unpacked[0],
+                                          static_cast<unsigned int>(unpacked.size()), &position,
+                                          samples, &values[column * samples]))
+            {
+                return false;
+            }
+        }
+        for (unsigned int sample = 0; sample < samples; sample++)
+        {
+            long long frame = static_cast<int>(static_cast<unsigned int>(values[sample]));
+            if (frame >= first && frame <= last)
+            {
+                printf("%lld", frame);
+                for (unsigned int i = 0; i < watches.size(); i++)
+                {
+                    putchar(',');
+                    PrintValue(values[(i + 1) * samples + sample], watches[i]);
+                }
+                putchar('\n');
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "usage: %s trace.hgwt [first frame [last frame]]\n", argv[0]);
+        return 2;
+    }
+    long long first = (argc > 2) ? strtoll(argv[2], nullptr, 10) : -0x80000000ll;
+    long long last = (argc > 3) ? strtoll(argv[3], nullptr, 10) : 0x7FFFFFFFll;
+
+    FILE* file = fopen(argv[1], "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "can't open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<WatchTrace::Watch> watches;
+    unsigned int block_frames = 0;
+    if (!WatchTrace::ReadHeader(file, &watches, &block_frames))
+    {
+        fprintf(stderr, "%s is not a RAM watch trace\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+    PrintHeaderRow(watches);
+
+    int result = 0;
+    std::vector<unsigned char> packed;
+    std::vector<unsigned char> unpacked;
+    unsigned int samples = 0;
+    while (WatchTrace::ReadWord(file, &samples))
+    {
+        unsigned int lowest = 0;
+        unsigned int highest = 0;
+        unsigned int unpacked_size = 0;
+        unsigned int packed_size = 0;
+        bool ok = samples <= block_frames
+                  && WatchTrace::ReadWord(file, &lowest)
+                  && WatchTrace::ReadWord(file, &highest)
+                  && WatchTrace::ReadWord(file, &unpacked_size)
+                  && WatchTrace::ReadWord(file, &packed_size);
+        if (ok && (static_cast<int>(highest) < first || static_cast<int>(lowest) > last))
+        {
+            ok = fseek(file, packed_size, SEEK_CUR) == 0;
+        }
+        else if (ok)
+        {
+            packed.resize(packed_size);
+            ok = (packed_size == 0 || fread(&packed[0], packed_size, 1, file) == 1)
+                 && WatchTrace::UnpackBlock(packed, unpacked_size, &unpacked)
+                 && PrintBlock(unpacked, samples, watches, first, last);
+        }
+        if (!ok)
+        {
+            /* A trace cut short by a crash still converts up to the last complete block. */
+            fprintf(stderr, "%s: stopped at a truncated or corrupt block\n", argv[1]);
+            result = 1;
+            break;
+        }
+    }
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,184 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Records the value of every RAM watch on every frame, for looking at how they evolved over a
+ * whole run afterwards.
+ *
+ * Samples are collected in memory and written a block at a time, so a frame only costs the
+ * reads of the watched values, which mostly come out of the page cache RAM search and RAM watch
+ * already filled. Recording works the same during fast-forward, when the windows skip updates.
+ */
+
+#include <windows.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <shared/winutil.h>
+
+#include "ramsearch.h"
+#include "ramwatch.h"
+#include "remotememory.h"
+#include "watchtrace.h"
+#include "watchtraceformat.h"
+
+namespace
+{
+    CRITICAL_SECTION s_trace_cs;
+    FILE* s_trace_file = nullptr;
+    std::vector<WatchTrace::Watch> s_watches;
+    std::vector<RemoteMemoryRange> s_ranges;
+    /* One row per sample: the frame number, then the value of each watch. */
+    std::vector<unsigned long long> s_samples;
+    unsigned int s_sample_count = 0;
+    std::vector<unsigned char> s_unpacked;
+    std::vector<unsigned char> s_packed;
+
+    void CloseTrace()
+    {
+        if (s_trace_file != nullptr)
+        {
+            fclose(s_trace_file);
+            s_trace_file = nullptr;
+        }
+        std::vector<WatchTrace::Watch>().swap(s_watches);
+        std::vector<RemoteMemoryRange>().swap(s_ranges);
+        std::vector<unsigned long long>().swap(s_samples);
+        std::vector<unsigned char>().swap(s_unpacked);
+        std::vector<unsigned char>().swap(s_packed);
+        s_sample_count = 0;
+    }
+
+    /*
+     * Returns false if the block couldn't be written.
+     */
+    bool WriteBlock()
+    {
+        if (s_sample_count == 0)
+        {
+            return true;
+        }
+        unsigned int columns = static_cast<unsigned int>(s_watches.size()) + 1;
+        s_unpacked.clear();
+        for (unsigned int column = 0; column < columns; column++)
+        {
+            WatchTrace::EncodeColumn(&s_samples[column], s_sample_count, columns, &s_unpacked);
+        }
+        WatchTrace::PackBlock(s_unpacked, &s_packed);
+
+        int lowest = static_cast<int>(static_cast<unsigned int>(s_samples[0]));
+        int highest = lowest;
+        for (unsigned int i = 1; i < s_sample_count; i++)
+        {
+            int frame = static_cast<int>(static_cast<unsigned int>(s_samples[i * columns]));
+            if (frame < lowest)
+            {
+                lowest = frame;
+            }
+            if (frame > highest)
+            {
+                highest = frame;
+            }
+        }
+
+        bool ok = WatchTrace::WriteWord(s_trace_file, s_sample_count)
+                  && WatchTrace::WriteWord(s_trace_file, static_cast<unsigned int>(lowest))
+                  && WatchTrace::WriteWord(s_trace_file, static_cast<unsigned int>(highest))
+                  && WatchTrace::WriteWord(s_trace_file, static_cast<unsigned int>(s_unpacked.size()))
+                  && WatchTrace::WriteWord(s_trace_file, static_cast<unsigned int>(s_packed.size()))
+                  && (s_packed.empty() || fwrite(&s_packed[0], s_packed.size(), 1, s_trace_file) == 1);
+        s_sample_count = 0;
+        return ok;
+    }
+}
+
+void InitWatchTrace()
+{
+    InitializeCriticalSection(&s_trace_cs);
+}
+
+bool StartWatchTrace(const char* filename)
+{
+    AutoCritSect cs(&s_trace_cs);
+    StopWatchTrace();
+    if (WatchCount == 0)
+    {
+        return false;
+    }
+
+    s_trace_file = fopen(filename, "wb");
+    if (s_trace_file == nullptr)
+    {
+        return false;
+    }
+    for (int i = 0; i < WatchCount; i++)
+    {
+        WatchTrace::Watch watch;
+        watch.address = rswatches[i].Address;
+        watch.size = rswatches[i].Size;
+        watch.type = rswatches[i].Type;
+        if (rswatches[i].comment != nullptr)
+        {
+            watch.name = rswatches[i].comment;
+        }
+        s_watches.push_back(watch);
+        RemoteMemoryRange range = { watch.address, WatchTrace::SizeIDToBytes(watch.size) };
+        s_ranges.push_back(range);
+    }
+    if (!WatchTrace::WriteHeader(s_trace_file, s_watches))
+    {
+        CloseTrace();
+        return false;
+    }
+    s_samples.resize(WatchTrace::BLOCK_FRAMES * (s_watches.size() + 1));
+    s_sample_count = 0;
+    return true;
+}
+
+void StopWatchTrace()
+{
+    AutoCritSect cs(&s_trace_cs);
+    if (s_trace_file != nullptr)
+    {
+        WriteBlock();
+    }
+    CloseTrace();
+}
+
+bool IsWatchTraceRecording()
+{
+    AutoCritSect cs(&s_trace_cs);
+    return s_trace_file != nullptr;
+}
+
+void RecordWatchTraceFrame(int frame)
+{
+    AutoCritSect cs(&s_trace_cs);
+    if (s_trace_file == nullptr)
+    {
+        return;
+    }
+
+    PrefetchRemoteMemory(s_ranges);
+    unsigned long long* row = &s_samples[s_sample_count * (s_watches.size() + 1)];
+    row[0] = static_cast<unsigned long long>(static_cast<unsigned int>(frame));
+    for (unsigned int i = 0; i < s_ranges.size(); i++)
+    {
+        /* Little-endian, so the value ends up in the low bytes. Unreadable values read as 0. */
+        unsigned long long value = 0;
+        if (!ReadRemoteMemoryCached(s_ranges[i].address, &value, s_ranges[i].size))
+        {
+            value = 0;
+        }
+        row[i + 1] = value;
+    }
+
+    s_sample_count++;
+    if (s_sample_count == WatchTrace::BLOCK_FRAMES && !WriteBlock())
+    {
+        /* Most likely out of disk space, keep what was written so far. */
+        CloseTrace();
+    }
+}
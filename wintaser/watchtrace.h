@@ -0,0 +1,22 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+void InitWatchTrace();
+/*
+ * Starts recording the current RAM watches to a trace file (see watchtraceformat.h), replacing
+ * any recording in progress. Watches added or removed later don't change what gets recorded.
+ * Returns false if there are no watches or the file can't be created.
+ */
+bool StartWatchTrace(const char* filename);
+/*
+ * Writes out the samples that haven't been written yet and closes the trace.
+ */
+void StopWatchTrace();
+bool IsWatchTraceRecording();
+/*
+ * Records one sample of every traced watch. Must be called once per frame, after the memory
+ * cache has been invalidated for that frame.
+ */
+void RecordWatchTraceFrame(int frame);
@@ -0,0 +1,306 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+/*
+ * The RAM watch trace file format, shared by the recorder and the tools that read traces.
+ * Only the C++ standard library is used here, so the tools build anywhere.
+ *
+ * A trace starts with a header:
+ *     "HGWT", version, watch count, frames per block
+ *     for each watch: address, size ID (1 byte), type ID (1 byte), name length (2 bytes), name
+ * followed by blocks, each holding up to "frames per block" consecutive samples:
+ *     sample count, lowest frame, highest frame, unpacked size, packed size, packed bytes
+ * Numbers are little-endian and 32-bit unless noted otherwise, frames are signed. The frame
+ * range lets a reader skip a block without unpacking or even reading its packed bytes.
+ *
+ * An unpacked block is one column per watch, preceded by a column of frame numbers (the frame
+ * number can go backwards when a savestate is loaded). A column is the samples of one value,
+ * each stored as the zig-zag varint of its difference to the previous sample, starting from 0
+ * in every block so that blocks can be decoded on their own. Values that don't change are a
+ * column of zero bytes, and counters a column of identical bytes, which is what the packing
+ * removes. "Block-compressed" means only this byte run-length coding, each block on its own,
+ * there is no general-purpose compressor (zlib isn't in the tree). A packed block is a sequence of
+ *     0x00-0x7F: (n + 1) literal bytes follow
+ *     0x80-0xFF: a run of ((n & 0x7F) + MIN_RUN) copies of the byte that follows, if
+ *                (n & 0x7F) is 0x7F a varint with the extra length comes before that byte
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace WatchTrace
+{
+    static const char MAGIC[4] = { 'H', 'G', 'W', 'T' };
+    static const unsigned int VERSION = 2;
+    static const unsigned int BLOCK_FRAMES = 4096;
+    static const unsigned int MAX_WATCHES = 4096;
+    static const unsigned int MIN_RUN = 3;
+    static const unsigned int MAX_LITERALS = 0x80;
+
+    struct Watch
+    {
+        unsigned int address;
+        char size;
+        char type;
+        std::string name;
+    };
+
+    inline unsigned int SizeIDToBytes(char size)
+    {
+        switch (size)
+        {
+        case 'w':
+            return 2;
+        case 'd':
+            return 4;
+        case 'l':
+            return 8;
+        default:
+            return 1;
+        }
+    }
+
+    inline void AppendVarint(unsigned long long value, std::vector<unsigned char>* output)
+    {
+        while (value >= 0x80)
+        {
+            output->push_back(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+        output->push_back(static_cast<unsigned char>(value));
+    }
+
+    /*
+     * Returns false if the input ends in the middle of the varint.
+     */
+    inline bool ReadVarint(const unsigned char* input, unsigned int size, unsigned int* position,
+                           unsigned long long* value)
+    {
+        *value = 0;
+        for (unsigned int shift = 0; *position < size && shift < 64; shift += 7)
+        {
+            unsigned char byte = input[(*position)++];
+            *value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Appends the delta-encoded column of count values, spaced stride apart in values.
+     */
+    inline void EncodeColumn(const unsigned long long* values, unsigned int count, unsigned int stride,
+                             std::vector<unsigned char>* output)
+    {
+        unsigned long long previous = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned long long value = values[i * stride];
+            long long delta = static_cast<long long>(value - previous);
+            AppendVarint((static_cast<unsigned long long>(delta) << 1) ^ static_cast<unsigned long long>(delta >> 63),
+                         output);
+            previous = value;
+        }
+    }
+
+    inline bool DecodeColumn(const unsigned char* input, unsigned int size, unsigned int* position,
+                             unsigned int count, unsigned long long* values)
+    {
+        unsigned long long previous = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned long long zigzag = 0;
+            if (!ReadVarint(input, size, position, &zigzag))
+            {
+                return false;
+            }
+            previous += (zigzag >> 1) ^ (0 - (zigzag & 1));
+            values[i] = previous;
+        }
+        return true;
+    }
+
+    inline void FlushLiterals(const unsigned char* input, unsigned int start, unsigned int end,
+                              std::vector<unsigned char>* output)
+    {
+        while (start < end)
+        {
+            unsigned int count = end - start;
+            if (count > MAX_LITERALS)
+            {
+                count = MAX_LITERALS;
+            }
+            output->push_back(static_cast<unsigned char>(count - 1));
+            output->insert(output->end(), input + start, input + start + count);
+            start += count;
+        }
+    }
+
+    inline void PackBlock(const std::vector<unsigned char>& input, std::vector<unsigned char>* output)
+    {
+        output->clear();
+        unsigned int literal_start = 0;
+        unsigned int position = 0;
+        while (position < input.size())
+        {
+            unsigned int run_end = position + 1;
+            while (run_end < input.size() && input[run_end] == input[position])
+            {
+                run_end++;
+            }
+            unsigned int run = run_end - position;
+            if (run >= MIN_RUN)
+            {
+                FlushLiterals(&input[0], literal_start, position, output);
+                unsigned int length = run - MIN_RUN;
+                if (length >= 0x7F)
+                {
+                    output->push_back(0xFF);
+                    AppendVarint(length - 0x7F, output);
+                }
+                else
+                {
+                    output->push_back(static_cast<unsigned char>(0x80 | length));
+                }
+                output->push_back(input[position]);
+                literal_start = run_end;
+            }
+            position = run_end;
+        }
+        if (!input.empty())
+        {
+            FlushLiterals(&input[0], literal_start, input.size(), output);
+        }
+    }
+
+    /*
+     * Returns false if the packed data is corrupt or doesn't unpack to exactly size bytes.
+     */
+    inline bool UnpackBlock(const std::vector<unsigned char>& input, unsigned int size,
+                            std::vector<unsigned char>* output)
+    {
+        output->clear();
+        output->reserve(size);
+        unsigned int position = 0;
+        while (position < input.size())
+        {
+            unsigned char token = input[position++];
+            if (token < 0x80)
+            {
+                unsigned int count = token + 1u;
+                if (input.size() - position < count || output->size() + count > size)
+                {
+                    return false;
+                }
+                output->insert(output->end(), input.begin() + position, input.begin() + position + count);
+                position += count;
+            }
+            else
+            {
+                unsigned long long length = (token & 0x7F) + MIN_RUN;
+                if ((token & 0x7F) == 0x7F)
+                {
+                    unsigned long long extra = 0;
+                    if (!ReadVarint(&input[0], input.size(), &position, &extra))
+                    {
+                        return false;
+                    }
+                    length += extra;
+                }
+                if (position >= input.size() || output->size() + length > size)
+                {
+                    return false;
+                }
+                output->insert(output->end(), static_cast<unsigned int>(length), input[position++]);
+            }
+        }
+        return output->size() == size;
+    }
+
+    inline bool WriteWord(FILE* file, unsigned int value)
+    {
+        unsigned char bytes[4] =
+        {
+            static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8),
+            static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)
+        };
+        return fwrite(bytes, sizeof(bytes), 1, file) == 1;
+    }
+
+    inline bool ReadWord(FILE* file, unsigned int* value)
+    {
+        unsigned char bytes[4];
+        if (fread(bytes, sizeof(bytes), 1, file) != 1)
+        {
+            return false;
+        }
+        *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<unsigned int>(bytes[3]) << 24);
+        return true;
+    }
+
+    inline bool WriteHeader(FILE* file, const std::vector<Watch>& watches)
+    {
+        bool ok = fwrite(MAGIC, sizeof(MAGIC), 1, file) == 1
+                  && WriteWord(file, VERSION)
+                  && WriteWord(file, static_cast<unsigned int>(watches.size()))
+                  && WriteWord(file, BLOCK_FRAMES);
+        for (unsigned int i = 0; ok && i < watches.size(); i++)
+        {
+            const Watch& watch = watches[i];
+            unsigned int name_length = static_cast<unsigned int>(watch.name.size());
+            if (name_length > 0xFFFF)
+            {
+                name_length = 0xFFFF;
+            }
+            unsigned char info[4] =
+            {
+                static_cast<unsigned char>(watch.size), static_cast<unsigned char>(watch.type),
+                static_cast<unsigned char>(name_length), static_cast<unsigned char>(name_length >> 8)
+            };
+            ok = WriteWord(file, watch.address)
+                 && fwrite(info, sizeof(info), 1, file) == 1
+                 && (name_length == 0 || fwrite(watch.name.c_str(), name_length, 1, file) == 1);
+        }
+        return ok;
+    }
+
+    inline bool ReadHeader(FILE* file, std::vector<Watch>* watches, unsigned int* block_frames)
+    {
+        char magic[4];
+        unsigned int version = 0;
+        unsigned int count = 0;
+        if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, MAGIC, sizeof(magic)) != 0
+            || !ReadWord(file, &version) || version != VERSION
+            || !ReadWord(file, &count) || count > MAX_WATCHES
+            || !ReadWord(file, block_frames) || *block_frames == 0)
+        {
+            return false;
+        }
+        watches->resize(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            Watch& watch = (*watches)[i];
+            unsigned char info[4];
+            if (!ReadWord(file, &watch.address) || fread(info, sizeof(info), 1, file) != 1)
+            {
+                return false;
+            }
+            watch.size = static_cast<char>(info[0]);
+            watch.type = static_cast<char>(info[1]);
+            unsigned int name_length = info[2] | (info[3] << 8);
+            watch.name.resize(name_length);
+            if (name_length != 0 && fread(&watch.name[0], name_length, 1, file) != 1)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,808 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+/*
+ * Watch triggers, conditions on RAM watch values that pause the game on the frame they become
+ * true, so getting to an event is a matter of fast-forwarding until the game stops by itself.
+ *
+ * A condition is an expression like "w1 == 0", "crosses(w2, 100)" or "changed(w3) && w1 > 5",
+ * where wN is the Nth RAM watch. It is compiled once into a short list of stack instructions,
+ * and every frame the triggers only read their watches, which come out of the page cache in as
+ * few reads as possible, and run those instructions.
+ *
+ * Supported, from lowest to highest precedence:
+ *     ||   &&   == != < <= > >=   + -   * / % &   unary ! -
+ *     numbers (decimal, 0x hexadecimal, or with a fraction), wN, prev(wN), changed(wN),
+ *     crosses(wN, value), parentheses
+ * prev(wN) is the watch's value on the previous frame, crosses(wN, value) is true on the frame
+ * the watch reaches or passes value from either side.
+ */
+
+#include <windows.h>
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <shared/winutil.h>
+
+#include "ramsearch.h"
+#include "ramwatch.h"
+#include "remotememory.h"
+#include "resource.h"
+#include "watchtrigger.h"
+
+namespace
+{
+    static const unsigned int MAX_STACK = 64;
+
+    enum OpCode
+    {
+        OP_CONSTANT,
+        OP_CURRENT,
+        OP_PREVIOUS,
+        OP_CHANGED,
+        OP_CROSSES,
+        OP_NEGATE,
+        OP_NOT,
+        OP_ADD,
+        OP_SUBTRACT,
+        OP_MULTIPLY,
+        OP_DIVIDE,
+        OP_MODULO,
+        OP_BITWISE_AND,
+        OP_EQUAL,
+        OP_NOT_EQUAL,
+        OP_LESS,
+        OP_LESS_EQUAL,
+        OP_GREATER,
+        OP_GREATER_EQUAL,
+        OP_AND,
+        OP_OR,
+    };
+
+    struct Instruction
+    {
+        OpCode op;
+        unsigned int slot;
+        double constant;
+    };
+
+    /* A watch a trigger reads, with its values on this frame and the previous one. */
+    struct WatchSlot
+    {
+        HWAddressType address;
+        char size;
+        char type;
+        double current;
+        double previous;
+    };
+
+    struct Trigger
+    {
+        std::string text;
+        std::vector<Instruction> code;
+        std::vector<WatchSlot> slots;
+        bool primed;
+        bool was_true;
+    };
+
+    CRITICAL_SECTION s_triggers_cs;
+    std::vector<Trigger> s_triggers;
+    std::vector<RemoteMemoryRange> s_ranges;
+    HWND s_triggers_hwnd = nullptr;
+    /*
+     * The condition that fired last, for the dialog to show. CheckWatchTriggers runs on the
+     * debugger thread, so it posts WM_TRIGGER_FIRED instead of waiting on the UI thread, which
+     * may itself be waiting for s_triggers_cs.
+     */
+    std::string s_fired_text;
+    const UINT WM_TRIGGER_FIRED = WM_APP + 1;
+
+    class ConditionCompiler
+    {
+    public:
+        ConditionCompiler(const char* text, Trigger* trigger) :
+            m_text(text),
+            m_position(0),
+            m_depth(0),
+            m_trigger(trigger)
+        {
+        }
+
+        bool Compile(std::string* error)
+        {
+            bool ok = ParseOr();
+            SkipSpaces();
+            if (ok && m_text[m_position] != '\0')
+            {
+                ok = Fail("unexpected text");
+            }
+            if (!ok)
+            {
+                *error = m_error;
+            }
+            return ok;
+        }
+
+    private:
+        bool Fail(const char* message)
+        {
+            if (m_error.empty())
+            {
+                char position[32];
+                _snprintf_s(position, sizeof(position), _TRUNCATE, " at character %u",
+                            m_position + 1);
+                m_error = std::string(message) + position;
+            }
+            return false;
+        }
+
+        void SkipSpaces()
+        {
+            while (isspace(static_cast<unsigned char>(m_text[m_position])))
+            {
+                m_position++;
+            }
+        }
+
+        /*
+         * Consumes token if it comes next. Doesn't match the start of a longer operator,
+         * so that "&" doesn't accept "&&" and "<" doesn't accept "<=".
+         */
+        bool Accept(const char* token)
+        {
+            SkipSpaces();
+            size_t length = strlen(token);
+            if (strncmp(&m_text[m_position], token, length) != 0)
+            {
+                return false;
+            }
+            char next = m_text[m_position + length];
+            if ((length == 1 && (token[0] == '&' || token[0] == '|') && next == token[0])
+                || (length == 1 && strchr("<>!=", token[0]) != nullptr && next == '='))
+            {
+                return false;
+            }
+            m_position += static_cast<unsigned int>(length);
+            return true;
+        }
+
+        bool Expect(const char* token)
+        {
+            return Accept(token) || Fail((std::string("expected ") + token).c_str());
+        }
+
+        bool Emit(OpCode op, unsigned int slot, double constant)
+        {
+            Instruction instruction = { op, slot, constant };
+            m_trigger->code.push_back(instruction);
+            switch (op)
+            {
+            case OP_CONSTANT:
+            case OP_CURRENT:
+            case OP_PREVIOUS:
+            case OP_CHANGED:
+                m_depth++;
+                break;
+            case OP_NEGATE:
+            case OP_NOT:
+                break;
+            default:
+                m_depth--;
+                break;
+            }
+            return m_depth <= MAX_STACK || Fail("expression too complex");
+        }
+
+        /*
+         * Parses "wN" and returns the slot reading that watch.
+         */
+        bool ParseWatch(unsigned int* slot)
+        {
+            SkipSpaces();
+            if (tolower(static_cast<unsigned char>(m_text[m_position])) != 'w'
+                || !isdigit(static_cast<unsigned char>(m_text[m_position + 1])))
+            {
+                return Fail("expected a watch (w1, w2, ...)");
+            }
+            m_position++;
+            char* end = nullptr;
+            unsigned long number = strtoul(&m_text[m_position], &end, 10);
+            if (number == 0 || number > static_cast<unsigned long>(WatchCount))
+            {
+                return Fail("no such watch");
+            }
+            m_position = static_cast<unsigned int>(end - m_text);
+
+            const AddressWatcher& watch = rswatches[number - 1];
+            for (unsigned int i = 0; i < m_trigger->slots.size(); i++)
+            {
+                const WatchSlot& existing = m_trigger->slots[i];
+                if (existing.address == watch.Address && existing.size == watch.Size
+                    && existing.type == watch.Type)
+                {
+                    *slot = i;
+                    return true;
+                }
+            }
+            WatchSlot new_slot = { watch.Address, watch.Size, watch.Type, 0.0, 0.0 };
+            m_trigger->slots.push_back(new_slot);
+            *slot = static_cast<unsigned int>(m_trigger->slots.size() - 1);
+            return true;
+        }
+
+        bool ParseFunction(OpCode op)
+        {
+            unsigned int slot = 0;
+            if (!Expect("(") || !ParseWatch(&slot))
+            {
+                return false;
+            }
+            if (op == OP_CROSSES)
+            {
+                if (!Expect(",") || !Emit(OP_CURRENT, slot, 0.0) || !ParseOr())
+                {
+                    return false;
+                }
+            }
+            return Expect(")") && Emit(op, slot, 0.0);
+        }
+
+        bool AcceptWord(const char* word)
+        {
+            SkipSpaces();
+            size_t length = strlen(word);
+            if (_strnicmp(&m_text[m_position], word, length) != 0
+                || isalnum(static_cast<unsigned char>(m_text[m_position + length])))
+            {
+                return false;
+            }
+            m_position += static_cast<unsigned int>(length);
+            return true;
+        }
+
+        bool ParsePrimary()
+        {
+            SkipSpaces();
+            char c = m_text[m_position];
+            if (Accept("("))
+            {
+                return ParseOr() && Expect(")");
+            }
+            if (AcceptWord("prev"))
+            {
+                return ParseFunction(OP_PREVIOUS);
+            }
+            if (AcceptWord("changed"))
+            {
+                return ParseFunction(OP_CHANGED);
+            }
+            if (AcceptWord("crosses"))
+            {
+                return ParseFunction(OP_CROSSES);
+            }
+            if (tolower(static_cast<unsigned char>(c)) == 'w')
+            {
+                unsigned int slot = 0;
+                return ParseWatch(&slot) && Emit(OP_CURRENT, slot, 0.0);
+            }
+            if (isdigit(static_cast<unsigned char>(c)) || c == '.')
+            {
+                const char* start = &m_text[m_position];
+                char* end = nullptr;
+                double value = 0.0;
+                if (c == '0' && tolower(static_cast<unsigned char>(start[1])) == 'x')
+                {
+                    value = static_cast<double>(_strtoui64(start + 2, &end, 16));
+                }
+                else
+                {
+                    value = strtod(start, &end);
+                }
+                if (end == start || isalnum(static_cast<unsigned char>(*end)))
+                {
+                    return Fail("invalid number");
+                }
+                m_position += static_cast<unsigned int>(end - start);
+                return Emit(OP_CONSTANT, 0, value);
+            }
+            return Fail("expected a value");
+        }
+
+        bool ParseUnary()
+        {
+            if (Accept("!"))
+            {
+                return ParseUnary() && Emit(OP_NOT, 0, 0.0);
+            }
+            if (Accept("-"))
+            {
+                return ParseUnary() && Emit(OP_NEGATE, 0, 0.0);
+            }
+            return ParsePrimary();
+        }
+
+        bool ParseProduct()
+        {
+            if (!ParseUnary())
+            {
+                return false;
+            }
+            while (true)
+            {
+                OpCode op;
+                if (Accept("*"))
+                {
+                    op = OP_MULTIPLY;
+                }
+                else if (Accept("/"))
+                {
+                    op = OP_DIVIDE;
+                }
+                else if (Accept("%"))
+                {
+                    op = OP_MODULO;
+                }
+                else if (Accept("&"))
+                {
+                    op = OP_BITWISE_AND;
+                }
+                else
+                {
+                    return true;
+                }
+                if (!ParseUnary() || !Emit(op, 0, 0.0))
+                {
+                    return false;
+                }
+            }
+        }
+
+        bool ParseSum()
+        {
+            if (!ParseProduct())
+            {
+                return false;
+            }
+            while (true)
+            {
+                OpCode op;
+                if (Accept("+"))
+                {
+                    op = OP_ADD;
+                }
+                else if (Accept("-"))
+                {
+                    op = OP_SUBTRACT;
+                }
+                else
+                {
+                    return true;
+                }
+                if (!ParseProduct() || !Emit(op, 0, 0.0))
+                {
+                    return false;
+                }
+            }
+        }
+
+        bool ParseComparison()
+        {
+            if (!ParseSum())
+            {
+                return false;
+            }
+            static const struct
+            {
+                const char* token;
+                OpCode op;
+            } COMPARISONS[] =
+            {
+                { "==", OP_EQUAL },
+                { "!=", OP_NOT_EQUAL },
+                { "<=", OP_LESS_EQUAL },
+                { ">=", OP_GREATER_EQUAL },
+                { "<", OP_LESS },
+                { ">", OP_GREATER },
+            };
+            for (unsigned int i = 0; i < sizeof(COMPARISONS) / sizeof(COMPARISONS[0]); i++)
+            {
+                if (Accept(COMPARISONS[i].token))
+                {
+                    return ParseSum() && Emit(COMPARISONS[i].op, 0, 0.0);
+                }
+            }
+            return true;
+        }
+
+        bool ParseAnd()
+        {
+            if (!ParseComparison())
+            {
+                return false;
+            }
+            while (Accept("&&"))
+            {
+                if (!ParseComparison() || !Emit(OP_AND, 0, 0.0))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool ParseOr()
+        {
+            if (!ParseAnd())
+            {
+                return false;
+            }
+            while (Accept("||"))
+            {
+                if (!ParseAnd() || !Emit(OP_OR, 0, 0.0))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const char* m_text;
+        unsigned int m_position;
+        unsigned int m_depth;
+        Trigger* m_trigger;
+        std::string m_error;
+    };
+
+    double ReadSlotValue(const WatchSlot& slot)
+    {
+        unsigned int size = static_cast<unsigned int>(sizeTypeIDToSize(slot.size));
+        unsigned long long raw = 0;
+        ReadRemoteMemoryCached(slot.address, &raw, size);
+        if (slot.type == 'f')
+        {
+            if (size == sizeof(double))
+            {
+                double value;
+                memcpy(&value, &raw, sizeof(value));
+                return value;
+            }
+            float value;
+            memcpy(&value, &raw, sizeof(value));
+            return static_cast<double>(value);
+        }
+        if (slot.type == 's' && size < sizeof(raw))
+        {
+            unsigned int shift = static_cast<unsigned int>(sizeof(raw) - size) * 8;
+            return static_cast<double>(static_cast<long long>(raw << shift) >> shift);
+        }
+        if (slot.type == 's')
+        {
+            return static_cast<double>(static_cast<long long>(raw));
+        }
+        return static_cast<double>(raw);
+    }
+
+    long long ToInteger(double value)
+    {
+        return static_cast<long long>(value);
+    }
+
+    bool Evaluate(const Trigger& trigger)
+    {
+        double stack[MAX_STACK + 1];
+        unsigned int top = 0;
+        for (unsigned int i = 0; i < trigger.code.size(); i++)
+        {
+            const Instruction& instruction = trigger.code[i];
+            /* Only meaningful for the instructions that read a watch. */
+            const WatchSlot* slot = trigger.slots.empty() ? nullptr : &trigger.slots[instruction.slot];
+            switch (instruction.op)
+            {
+            case OP_CONSTANT:
+                stack[top++] = instruction.constant;
+                break;
+            case OP_CURRENT:
+                stack[top++] = slot->current;
+                break;
+            case OP_PREVIOUS:
+                stack[top++] = slot->previous;
+                break;
+            case OP_CHANGED:
+                stack[top++] = (slot->current != slot->previous) ? 1.0 : 0.0;
+                break;
+            case OP_CROSSES:
+            {
+                /* The stack holds the current value and the threshold. */
+                double threshold = stack[--top];
+                bool from_below = slot->previous < threshold && slot->current >= threshold;
+                bool from_above = slot->previous > threshold && slot->current <= threshold;
+                stack[top - 1] = (from_below || from_above) ? 1.0 : 0.0;
+                break;
+            }
+            case OP_NEGATE:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case OP_NOT:
+                stack[top - 1] = (stack[top - 1] == 0.0) ? 1.0 : 0.0;
+                break;
+            default:
+            {
+                double right = stack[--top];
+                double left = stack[top - 1];
+                double result = 0.0;
+                switch (instruction.op)
+                {
+                case OP_ADD:
+                    result = left + right;
+                    break;
+                case OP_SUBTRACT:
+                    result = left - right;
+                    break;
+                case OP_MULTIPLY:
+                    result = left * right;
+                    break;
+                case OP_DIVIDE:
+                    result = (right != 0.0) ? left / right : 0.0;
+                    break;
+                case OP_MODULO:
+                    result = (right != 0.0) ? fmod(left, right) : 0.0;
+                    break;
+                case OP_BITWISE_AND:
+                    result = static_cast<double>(ToInteger(left) & ToInteger(right));
+                    break;
+                case OP_EQUAL:
+                    result = (left == right) ? 1.0 : 0.0;
+                    break;
+                case OP_NOT_EQUAL:
+                    result = (left != right) ? 1.0 : 0.0;
+                    break;
+                case OP_LESS:
+                    result = (left < right) ? 1.0 : 0.0;
+                    break;
+                case OP_LESS_EQUAL:
+                    result = (left <= right) ? 1.0 : 0.0;
+                    break;
+                case OP_GREATER:
+                    result = (left > right) ? 1.0 : 0.0;
+                    break;
+                case OP_GREATER_EQUAL:
+                    result = (left >= right) ? 1.0 : 0.0;
+                    break;
+                case OP_AND:
+                    result = (left != 0.0 && right != 0.0) ? 1.0 : 0.0;
+                    break;
+                case OP_OR:
+                    result = (left != 0.0 || right != 0.0) ? 1.0 : 0.0;
+                    break;
+                default:
+                    break;
+                }
+                stack[top - 1] = result;
+                break;
+            }
+            }
+        }
+        return top == 1 && stack[0] != 0.0;
+    }
+
+    /*
+     * Collects the ranges of every slot, so each frame starts with one prefetch for all of them.
+     */
+    void RebuildRanges()
+    {
+        s_ranges.clear();
+        for (unsigned int i = 0; i < s_triggers.size(); i++)
+        {
+            const std::vector<WatchSlot>& slots = s_triggers[i].slots;
+            for (unsigned int j = 0; j < slots.size(); j++)
+            {
+                RemoteMemoryRange range =
+                {
+                    slots[j].address, static_cast<unsigned int>(sizeTypeIDToSize(slots[j].size))
+                };
+                s_ranges.push_back(range);
+            }
+        }
+    }
+
+    /*
+     * Updates every trigger's values for the new frame and returns whether one became true.
+     */
+    bool EvaluateTriggers()
+    {
+        AutoCritSect cs(&s_triggers_cs);
+        if (s_triggers.empty())
+        {
+            return false;
+        }
+
+        PrefetchRemoteMemory(s_ranges);
+        const Trigger* fired = nullptr;
+        for (unsigned int i = 0; i < s_triggers.size(); i++)
+        {
+            Trigger& trigger = s_triggers[i];
+            for (unsigned int j = 0; j < trigger.slots.size(); j++)
+            {
+                WatchSlot& slot = trigger.slots[j];
+                slot.previous = slot.current;
+                slot.current = ReadSlotValue(slot);
+                if (!trigger.primed)
+                {
+                    slot.previous = slot.current;
+                }
+            }
+            /*
+             * The first frame only records the values, so a condition that's already true when
+             * it's added doesn't fire until it becomes true again.
+             */
+            bool is_true = Evaluate(trigger);
+            if (trigger.primed && is_true && !trigger.was_true && fired == nullptr)
+            {
+                fired = &trigger;
+            }
+            trigger.primed = true;
+            trigger.was_true = is_true;
+        }
+
+        if (fired != nullptr)
+        {
+            s_fired_text = fired->text;
+        }
+        return fired != nullptr;
+    }
+
+    void FillTriggerList(HWND hDlg)
+    {
+        HWND list = GetDlgItem(hDlg, IDC_TRIGGER_LIST);
+        SendMessage(list, LB_RESETCONTENT, 0, 0);
+        unsigned int count = GetWatchTriggerCount();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            std::string text = GetWatchTriggerText(i);
+            SendMessage(list, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(text.c_str()));
+        }
+    }
+
+    void DoAddTrigger(HWND hDlg)
+    {
+        char condition[1024];
+        GetDlgItemText(hDlg, IDC_TRIGGER_CONDITION, condition, sizeof(condition));
+        std::string error;
+        if (!AddWatchTrigger(condition, &error))
+        {
+            SetDlgItemText(hDlg, IDC_TRIGGER_STATUS, error.c_str());
+            return;
+        }
+        SetDlgItemText(hDlg, IDC_TRIGGER_CONDITION, "");
+        SetDlgItemText(hDlg, IDC_TRIGGER_STATUS, "Armed, the game pauses when it becomes true.");
+        FillTriggerList(hDlg);
+    }
+
+    void DoRemoveTrigger(HWND hDlg)
+    {
+        LRESULT selection = SendDlgItemMessage(hDlg, IDC_TRIGGER_LIST, LB_GETCURSEL, 0, 0);
+        if (selection != LB_ERR)
+        {
+            RemoveWatchTrigger(static_cast<unsigned int>(selection));
+            FillTriggerList(hDlg);
+        }
+    }
+
+    LRESULT CALLBACK WatchTriggersProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        switch (uMsg)
+        {
+        case WM_INITDIALOG:
+            FillTriggerList(hDlg);
+            return TRUE;
+        case WM_COMMAND:
+            switch (LOWORD(wParam))
+            {
+            case IDC_TRIGGER_ADD:
+                DoAddTrigger(hDlg);
+                return TRUE;
+            case IDC_TRIGGER_REMOVE:
+                DoRemoveTrigger(hDlg);
+                return TRUE;
+            case IDCANCEL:
+                DestroyWindow(hDlg);
+                return TRUE;
+            }
+            break;
+        case WM_TRIGGER_FIRED:
+        {
+            std::string status;
+            {
+                AutoCritSect cs(&s_triggers_cs);
+                status = "Fired: " + s_fired_text;
+            }
+            SetDlgItemText(hDlg, IDC_TRIGGER_STATUS, status.c_str());
+            return TRUE;
+        }
+        case WM_CLOSE:
+            DestroyWindow(hDlg);
+            return TRUE;
+        case WM_DESTROY:
+            s_triggers_hwnd = nullptr;
+            break;
+        }
+        return FALSE;
+    }
+}
+
+void InitWatchTriggers()
+{
+    InitializeCriticalSection(&s_triggers_cs);
+}
+
+bool AddWatchTrigger(const char* condition, std::string* error)
+{
+    Trigger trigger;
+    trigger.text = condition;
+    trigger.primed = false;
+    trigger.was_true = false;
+    ConditionCompiler compiler(condition, &trigger);
+    if (!compiler.Compile(error))
+    {
+        return false;
+    }
+    AutoCritSect cs(&s_triggers_cs);
+    s_triggers.push_back(trigger);
+    RebuildRanges();
+    return true;
+}
+
+void RemoveWatchTrigger(unsigned int index)
+{
+    AutoCritSect cs(&s_triggers_cs);
+    if (index < s_triggers.size())
+    {
+        s_triggers.erase(s_triggers.begin() + index);
+        RebuildRanges();
+    }
+}
+
+unsigned int GetWatchTriggerCount()
+{
+    AutoCritSect cs(&s_triggers_cs);
+    return static_cast<unsigned int>(s_triggers.size());
+}
+
+std::string GetWatchTriggerText(unsigned int index)
+{
+    AutoCritSect cs(&s_triggers_cs);
+    return (index < s_triggers.size()) ? s_triggers[index].text : std::string();
+}
+
+bool CheckWatchTriggers()
+{
+    if (!EvaluateTriggers())
+    {
+        return false;
+    }
+    /* After leaving s_triggers_cs, and without waiting for the dialog. */
+    HWND hwnd = s_triggers_hwnd;
+    if (hwnd != nullptr)
+    {
+        PostMessage(hwnd, WM_TRIGGER_FIRED, 0, 0);
+    }
+    return true;
+}
+
+void OpenWatchTriggersWindow(HINSTANCE instance, HWND parent)
+{
+    if (s_triggers_hwnd == nullptr)
+    {
+        s_triggers_hwnd = CreateDialog(instance, MAKEINTRESOURCE(IDD_WATCHTRIGGERS), parent,
+                                       reinterpret_cast<DLGPROC>(WatchTriggersProc));
+    }
+    else
+    {
+        SetForegroundWindow(s_triggers_hwnd);
+    }
+}
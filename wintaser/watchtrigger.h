@@ -0,0 +1,27 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+
+void InitWatchTriggers();
+/*
+ * Compiles a trigger condition and adds it to the armed triggers.
+ * wN in the condition is the Nth RAM watch at the time of the call, later changes to the watch
+ * list don't affect the trigger. On failure error is set to what's wrong with the condition.
+ */
+bool AddWatchTrigger(const char* condition, std::string* error);
+void RemoveWatchTrigger(unsigned int index);
+unsigned int GetWatchTriggerCount();
+std::string GetWatchTriggerText(unsigned int index);
+/*
+ * Evaluates every trigger on the current frame's memory, must be called once per frame after the
+ * memory cache has been invalidated. A trigger fires on the frame its condition becomes true.
+ * Returns true if any trigger fired.
+ */
+bool CheckWatchTriggers();
+
+void OpenWatchTriggersWindow(HINSTANCE instance, HWND parent);
@@ -38,6 +38,8 @@
 using namespace Config;
 #include "InputCapture.h"
 #include "ramsearch.h"
+#include "watchtrace.h"
+#include "watchtrigger.h"
 #define MAX_LOADSTRING 100
 //#include <stdio.h>
 #include "logging.h"
@@ -64,6 +66,7 @@ using namespace Config;
 #include <shared/asm.h>
 #include <shared/winutil.h>
 #include "ramwatch.h"
+#include "pointerscan.h"
 
 #include "CPUinfo.h"
 #include "DirLocks.h"
@@ -1701,7 +1704,8 @@ bool CreateAVIFile()
     OPENFILENAME ofn = { sizeof(OPENFILENAME) };
     ofn.hwndOwner = hWnd;
     ofn.hInstance = hInst;
-    ofn.lpstrFilter = "AVI file\0*.avi\0All Files\0*.*\0\0";
+    // picking an image extension captures every frame to an image file instead, see ImageSequence
+    ofn.lpstrFilter = "AVI file\0*.avi\0PNG image sequence\0*.png\0BMP image sequence\0*.bmp\0TGA image sequence\0*.tga\0All Files\0*.*\0\0";
     ofn.nFilterIndex = 1;
     ofn.lpstrFile = filename;
     ofn.nMaxFile = MAX_PATH;
@@ -2198,6 +2202,33 @@ void UpdateGeneralInfoDisplay()
 }
 
 
+// the main window's own title, while the AVI queues are shown after it
+static char mainWindowTitle[256];
+static bool displayedAviQueues = false;
+// shows how full the AVI queues are in the title bar while capturing, so it's easy to see
+// whether the encoder keeps up without waiting for the log when the file is closed.
+static void UpdateAviQueueDisplay()
+{
+    if (!mainWindowTitle[0])
+        GetWindowTextA(hWnd, mainWindowTitle, sizeof(mainWindowTitle));
+    FrameRingStats video, audio;
+    GetAVIQueueStats(&video, &audio);
+    if (!localTASflags.aviMode || (!video.frames && !audio.frames))
+    {
+        if (displayedAviQueues)
+            SetWindowTextA(hWnd, mainWindowTitle);
+        displayedAviQueues = false;
+        return;
+    }
+    char str[512];
+    sprintf(str, "%s - AVI queues: video %u/%u (peak %u), %u stalls, %.1f ms; audio %u/%u (peak %u), %u stalls, %.1f ms",
+        mainWindowTitle,
+        video.occupancy, video.depth, video.peak_occupancy, video.producer_stalls, video.average_latency * 1000.0,
+        audio.occupancy, audio.depth, audio.peak_occupancy, audio.producer_stalls, audio.average_latency * 1000.0);
+    SetWindowTextA(hWnd, str);
+    displayedAviQueues = true;
+}
+
 static int displayedFrameCount = -1;
 static int displayedMaxFrameCount = -1;
 void UpdateFrameCountDisplay(int frameCount, int frequency)
@@ -2249,6 +2280,7 @@ void UpdateFrameCountDisplay(int frameCount, int frequency)
             //#ifndef _DEBUG
             UpdateGeneralInfoDisplay();
             //#endif
+            UpdateAviQueueDisplay();
         }
     }
     //#ifdef _DEBUG
@@ -2442,6 +2474,11 @@ void FrameBoundary(const char* frameInfo, int threadId)
 
         // update ram search/watch windows
         Update_RAM_Search();
+        // after the update so the trace reads this frame's memory, and before any fast-forward skip could matter
+        RecordWatchTraceFrame(frameCount);
+        // stop on the frame a watch trigger fired, unless we're on our way back to a savestate's frame
+        if (CheckWatchTriggers() && !recoveringStale)
+            paused = true;
 
         // handle skipping lag frames if that option is enabled
         temporaryUnpause = (frameCaptureInfoType == CAPTUREINFO::TYPE_PREV) && advancePastNonVideoFrames;
@@ -5571,6 +5608,14 @@ BOOL CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
                     SetForegroundWindow(RamWatchHWnd);
                 break;
 
+            case ID_POINTER_SCAN:
+                OpenPointerScanWindow(hInst, hWnd);
+                break;
+
+            case ID_WATCH_TRIGGERS:
+                OpenWatchTriggersWindow(hInst, hWnd);
+                break;
+
             case ID_TOGGLE_MOVIE_READONLY:
                 {
                     nextLoadRecords = !nextLoadRecords;
@@ -5681,6 +5726,10 @@ BOOL CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
                 localTASflags.emuMode ^= EMUMODE_VIRTUALDIRECTSOUND;
                 tasFlagsDirty = true;
                 break;
+            case ID_SOUND_HIGHQUALITYRESAMPLE:
+                localTASflags.emuMode ^= EMUMODE_HIGHQUALITYRESAMPLE;
+                tasFlagsDirty = true;
+                break;
 
             case ID_SOUND_RATE_8000:  localTASflags.audioFrequency = 8000;  tasFlagsDirty = true; break;
             case ID_SOUND_RATE_11025: localTASflags.audioFrequency = 11025; tasFlagsDirty = true; break;
@@ -5717,6 +5766,10 @@ BOOL CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
                 localTASflags.fastForwardFlags ^= FFMODE_SOUNDSKIP;
                 tasFlagsDirty = true;
                 break;
+            case ID_TIME_FF_LAZYMIX:
+                localTASflags.fastForwardFlags ^= FFMODE_LAZYMIX;
+                tasFlagsDirty = true;
+                break;
             case ID_TIME_FF_RAMSKIP:
                 localTASflags.fastForwardFlags ^= FFMODE_RAMSKIP;
                 tasFlagsDirty = true;
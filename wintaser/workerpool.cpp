@@ -0,0 +1,103 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#include <windows.h>
+
+#include <deque>
+#include <vector>
+
+#include "workerpool.h"
+
+namespace
+{
+    const unsigned int MAX_THREADS = 64;
+}
+
+WorkerPool::WorkerPool(unsigned int threads) :
+    m_task_semaphore(CreateSemaphore(nullptr, 0, LONG_MAX, nullptr)),
+    m_stopping(0)
+{
+    InitializeCriticalSection(&m_lock);
+    if (threads == 0)
+    {
+        SYSTEM_INFO system_info;
+        GetSystemInfo(&system_info);
+        threads = system_info.dwNumberOfProcessors;
+    }
+    threads = max(1u, min(threads, MAX_THREADS));
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        HANDLE thread = CreateThread(nullptr, 0, ThreadFunc, this, 0, nullptr);
+        if (thread != nullptr)
+        {
+            m_threads.push_back(thread);
+        }
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    InterlockedExchange(&m_stopping, 1);
+    ReleaseSemaphore(m_task_semaphore, static_cast<LONG>(m_threads.size()), nullptr);
+    if (!m_threads.empty())
+    {
+        WaitForMultipleObjects(static_cast<DWORD>(m_threads.size()), &m_threads[0], TRUE, INFINITE);
+    }
+    for (std::vector<HANDLE>::iterator it = m_threads.begin(); it != m_threads.end(); ++it)
+    {
+        CloseHandle(*it);
+    }
+    CloseHandle(m_task_semaphore);
+    DeleteCriticalSection(&m_lock);
+}
+
+unsigned int WorkerPool::GetThreadCount() const
+{
+    return static_cast<unsigned int>(m_threads.size());
+}
+
+void WorkerPool::Submit(Task* task)
+{
+    if (m_threads.empty())
+    {
+        /*
+         * No thread could be started, so there is no one else to run it.
+         */
+        task->Run();
+        return;
+    }
+    EnterCriticalSection(&m_lock);
+    m_tasks.push_back(task);
+    LeaveCriticalSection(&m_lock);
+    ReleaseSemaphore(m_task_semaphore, 1, nullptr);
+}
+
+DWORD WINAPI WorkerPool::ThreadFunc(LPVOID parameter)
+{
+    static_cast<WorkerPool*>(parameter)->RunTasks();
+    return 0;
+}
+
+void WorkerPool::RunTasks()
+{
+    for (;;)
+    {
+        WaitForSingleObject(m_task_semaphore, INFINITE);
+        if (m_stopping != 0)
+        {
+            return;
+        }
+        Task* task = nullptr;
+        EnterCriticalSection(&m_lock);
+        if (!m_tasks.empty())
+        {
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+        LeaveCriticalSection(&m_lock);
+        if (task != nullptr)
+        {
+            task->Run();
+        }
+    }
+}
@@ -0,0 +1,56 @@
+/*  Copyright (C) 2011 nitsuja and contributors
+    Hourglass is licensed under GPL v2. Full notice is in COPYING.txt. */
+
+#pragma once
+
+#include <windows.h>
+
+#include <deque>
+#include <vector>
+
+/*
+ * A fixed set of threads that run the tasks handed to them. Tasks are started in the order they
+ * were submitted, but can finish in any order, so anything that depends on a task being done
+ * has to wait for it itself.
+ */
+class WorkerPool
+{
+public:
+    class Task
+    {
+    public:
+        virtual ~Task() {}
+        virtual void Run() = 0;
+    };
+
+    /*
+     * With 0 threads there is one per processor.
+     */
+    explicit WorkerPool(unsigned int threads);
+    /*
+     * Waits for the tasks that are already running, the ones that haven't started yet are dropped.
+     */
+    ~WorkerPool();
+
+    unsigned int GetThreadCount() const;
+    /*
+     * The task is not copied, it has to stay alive until it has run.
+     */
+    void Submit(Task* task);
+
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    static DWORD WINAPI ThreadFunc(LPVOID parameter);
+    void RunTasks();
+
+    std::vector<HANDLE> m_threads;
+    CRITICAL_SECTION m_lock;
+    std::deque<Task*> m_tasks;
+    /*
+     * Counts the tasks waiting in m_tasks, and is raised once per thread to stop them.
+     */
+    HANDLE m_task_semaphore;
+    volatile LONG m_stopping;
+};